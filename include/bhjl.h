@@ -1,15 +1,44 @@
 #ifndef BHJL_HEADER
 #define BHJL_HEADER
 
+#include "mexp.h"
+#include "rng.h"
+
 int bhjl_encrypt(mpz_t c,const mpz_t m,
 	             const mpz_t n,const mpz_t y, const int k,
 	             const mpz_t _2k, 
 	             gmp_randstate_t gmpRandState);
 
+int bhjl_encrypt_x(mpz_t c,const mpz_t m,const mpz_t x,
+	               const mpz_t n,const mpz_t y, const int k,
+	               const mpz_t _2k);
+
+int bhjl_encrypt_x_batch(mpz_t *c,const mpz_t *m,const mpz_t *x,const int count,
+	                     const mpz_t n,const mpz_t y, const int k,
+	                     const mpz_t _2k);
+
+int bhjl_encrypt_rng(mpz_t c,const mpz_t m,
+	                 const mpz_t n,const mpz_t y, const int k,
+	                 const mpz_t _2k, 
+	                 labhe_rng *rng);
+
 int bhjl_decrypt(mpz_t m,const mpz_t c,
 	             const mpz_t p,const mpz_t D,const int k,
 	             const mpz_t _2k1,const mpz_t pm12k);
 
+int bhjl_encrypt_tab(mpz_t c,const mpz_t m,
+	                 const mpz_t n,const mexp_table *ytab, const int k,
+	                 const mpz_t _2k, 
+	                 gmp_randstate_t gmpRandState);
+
+int bhjl_decrypt_tab(mpz_t m,const mpz_t c,
+	                 const mpz_t p,const mpz_t *Dpow,const int k,
+	                 const mpz_t _2k1,const mpz_t pm12k);
+
+int bhjl_decrypt_batch(mpz_t *m,const mpz_t *c,const int count,
+	                   const mpz_t p,const mpz_t D,const mpz_t *Dpow,const int k,
+	                   const mpz_t _2k1,const mpz_t pm12k);
+
 int bhjl_homadd(mpz_t c, const mpz_t c1, const mpz_t c2, 
 	            const mpz_t n);
 
@@ -0,0 +1,60 @@
+#ifndef EVALD_HEADER
+#define EVALD_HEADER
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "mexp.h"
+
+/*
+ * labhe-evald framing (all integers big-endian):
+ *   magic[4] job[4] op[1] level[1] status[1] pad[1] count[4] compute_ns[8]
+ * followed by count items of fixed-width big-endian fields:
+ *   level-0 item: bm (ceil(k/8) bytes), c (ceil(|n|/8) bytes)
+ *   level-1 item: c (ceil(|n|/8) bytes)
+ *   HOMMUL/INNERPROD request item: two level-0 items bm1,c1,bm2,c2
+ */
+#define EVALD_MAGIC 0x4C484531 // "LHE1"
+#define EVALD_HEADER_SIZE 24
+#define EVALD_MAX_COUNT (1<<20)
+
+#define EVALD_OP_HOMMUL 1    // level-0 pairs -> level-1 vector
+#define EVALD_OP_SUM 2       // level-0/1 vector -> one level-0/1 ciphertext
+#define EVALD_OP_INNERPROD 3 // level-0 pairs -> one level-1 ciphertext
+
+#define EVALD_STATUS_OK 0
+#define EVALD_STATUS_BADREQ 1
+#define EVALD_STATUS_FAIL 2
+
+typedef struct {
+	uint32_t job;
+	int op;
+	int level;
+	int status;
+	uint32_t count;
+	uint64_t compute_ns;
+} evald_frame;
+
+typedef struct evald_server evald_server;
+
+int evald_load_params(const char *path, mpz_t n, int *k, mpz_t enc1);
+
+int evald_start(evald_server **srv, const char *path,
+	            const mpz_t n, const int k, const mpz_t enc1, const mexp_table *enc1_tab,
+	            const int workers, const int depth, FILE *log);
+
+int evald_stop(evald_server *srv);
+
+int evald_connect(const char *path);
+
+int evald_fields(const int op, const int level, const int response);
+
+int evald_write_frame(int fd, const evald_frame *f, const mpz_t *items, const int response,
+	                  const mpz_t n, const int k);
+
+int evald_read_frame(int fd, evald_frame *f, mpz_t **items, const int response,
+	                 const mpz_t n, const int k);
+
+void evald_items_clear(mpz_t *items, const uint32_t nelems);
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef KEYSTORE_HEADER
+#define KEYSTORE_HEADER
+
+#include <stddef.h>
+
+#include "mexp.h"
+
+/*
+ * Key-store files: native-endian, mmap-able layout holding key material
+ * as fixed-width limb arrays together with derived acceleration tables,
+ * protected by a Keccak digest. Loaded values are read-only views into
+ * the mapping (never modify or mpz_clear them); the mapping is shared
+ * across processes through the page cache. The PRF backend selected
+ * when the file was written is recorded with the keys; pass it to
+ * prf_select before using them. Loading also installs the tuning
+ * profile saved next to the files, if any (include/tune.h).
+ */
+typedef struct {
+	void *map;
+	size_t map_size;
+	int k;
+	int prf_backend;
+	mpz_t n, y, _2k, enc1;
+	mexp_table ytab;    // fixed-base table for y (k-bit exponents)
+	mexp_table enc1tab; // fixed-base table for enc1 (k-bit exponents)
+} keystore_pub;
+
+typedef struct {
+	void *map;
+	size_t map_size;
+	int k;
+	int prf_backend;
+	mpz_t p, D, _2k1, pm12k;
+	mpz_t *Dpow;        // Dpow[j] = D^{2^j} mod p, 0 <= j < k
+} keystore_sec;
+
+int keystore_save_public(const char *path,
+	                     const mpz_t n, const mpz_t y, const int k,
+	                     const mpz_t _2k, const mpz_t enc1, const int w);
+
+int keystore_save_secret(const char *path,
+	                     const mpz_t p, const mpz_t D, const int k,
+	                     const mpz_t _2k1, const mpz_t pm12k);
+
+int keystore_load_public(keystore_pub *ks, const char *path);
+
+int keystore_load_secret(keystore_sec *ks, const char *path);
+
+void keystore_close_public(keystore_pub *ks);
+
+void keystore_close_secret(keystore_sec *ks);
+
+#endif
@@ -1,12 +1,34 @@
 #ifndef LABHE_HEADER
 #define LABHE_HEADER
 
+#include "rng.h"
+
+/*
+ * Lazy level-1 accumulator: encodes num/den mod n
+ */
+typedef struct {
+	mpz_t num;
+	mpz_t den;
+} labhe_lev1_acc;
+
 int labhe_encrypt_offline_batch(mpz_t *b_masks, mpz_t *eb_masks, const int start_label, const int count,
 								const unsigned char *sk,
 	             				const mpz_t n,const mpz_t y, const int k,
 	             				const mpz_t _2k, 
 	             				gmp_randstate_t gmpRandState);
 
+int labhe_encrypt_offline_batch_rng(mpz_t *b_masks, mpz_t *eb_masks, const int start_label, const int count,
+								const unsigned char *sk,
+	             				const mpz_t n,const mpz_t y, const int k,
+	             				const mpz_t _2k, 
+	             				const labhe_rng *rng);
+
+int labhe_encrypt_offline_eb_set(mpz_t *eb_masks, const int *labels, const int count,
+								const unsigned char *sk,
+	             				const mpz_t n,const mpz_t y, const int k,
+	             				const mpz_t _2k, 
+	             				const labhe_rng *rng);
+
 int labhe_encrypt_online_batch(mpz_t *cs,const mpz_t *b_masks,const mpz_t *ms,const int count,
 	                                 const int k);
 
@@ -35,6 +57,10 @@ int labhe_decrypt_offline_ip_sk(mpz_t b, const unsigned char*sk1, const unsigned
 								const int start_label1, const int start_label2, const int count,
 								const int k, const mpz_t _2k1);
 
+int labhe_decrypt_offline_lincomb_sk(mpz_t b, const unsigned char* sk,
+								const int start_label, const mpz_t *w, const int count,
+								const int k);
+
 int labhe_decrypt_online1(mpz_t m, const mpz_t C,const mpz_t b,
 	             				const mpz_t p,const mpz_t D,const int k,
 	             				const mpz_t _2k1,const mpz_t pm12k);
@@ -50,6 +76,19 @@ int labhe_hommul_lev0_batch(mpz_t *c,
 	                              const mpz_t *bm1, const mpz_t *c1, const mpz_t *bm2, const mpz_t *c2,const int count,
 	                              const mpz_t n, const int k, const mpz_t enc1);
 
+int labhe_innerprod_lev0(mpz_t c,
+	                              const mpz_t *bm1, const mpz_t *c1, const mpz_t *bm2, const mpz_t *c2,const int count,
+	                              const mpz_t n, const int k, const mpz_t enc1);
+
+int labhe_lincomb_lev0(mpz_t *bmres, mpz_t *cres,
+	                              const mpz_t *bm, const mpz_t *c, const int count,
+	                              const mpz_t *w, const int rows,
+	                              const mpz_t n, const int k);
+
+int labhe_lincomb_lev1(mpz_t *cres, const mpz_t *c, const int count,
+	                              const mpz_t *w, const int rows,
+	                              const mpz_t n);
+
 int labhe_homadd_lev0_batch(mpz_t bmred, mpz_t cred,
 	                              const mpz_t *bm, const mpz_t *c, const int count,
 	                              const int k, const mpz_t n);
@@ -65,6 +104,19 @@ int labhe_homadd_lev1_batch(mpz_t cred, const mpz_t *c,const int count,
 int labhe_homsub_lev1(mpz_t csub, const mpz_t c1, const mpz_t c2, 
 								  const mpz_t n);
 
+int labhe_homsub_lev1_batch(mpz_t *csub, const mpz_t *c1, const mpz_t *c2, const int count,
+								  const mpz_t n);
+
+int labhe_lev1_acc_init(labhe_lev1_acc *acc);
+
+int labhe_lev1_acc_add(labhe_lev1_acc *acc, const mpz_t c, const mpz_t n);
+
+int labhe_lev1_acc_sub(labhe_lev1_acc *acc, const mpz_t c, const mpz_t n);
+
+int labhe_lev1_acc_final(mpz_t cres, const labhe_lev1_acc *acc, const mpz_t n);
+
+void labhe_lev1_acc_clear(labhe_lev1_acc *acc);
+
 int labhe_homsmul_lev1(mpz_t cres, const mpz_t c, const mpz_t s, 
 								  const mpz_t n) ;
 #endif
\ No newline at end of file
@@ -0,0 +1,478 @@
+#ifndef LABHE_HPP_HEADER
+#define LABHE_HPP_HEADER
+
+/*
+ * C++ layer over the evaluator side of the C API: move-only owners of
+ * level-0 vectors and level-1 ciphertexts, and expression templates for
+ * level-1 linear expressions such as
+ *
+ *     Level1Ct r = ev.eval(inner(x, y) - 3 * sum(z) + c);
+ *
+ * Building an expression does no work. Evaluation flattens it into a
+ * list of (term, scalar) pairs and computes the result in one fused
+ * pass: every inner product and every scaled ciphertext becomes bases
+ * of a multi-exponentiation (shallow views of the operands, as in
+ * labhe_innerprod_lev0), unit-weight ciphertexts are multiplied in
+ * directly, and everything with a negative weight is gathered on a
+ * divisor side that costs one inversion (as in labhe_homsub_lev1_batch).
+ * Weighted sums are multiplied out before the weight is applied.
+ * Intermediates live in the evaluator's
+ * scratch storage, which is reused across evaluations: an Evaluator
+ * must not be used by several threads at once.
+ *
+ * Expressions hold references to their operands, which must outlive
+ * the evaluation. Failures of the C layer throw std::runtime_error.
+ */
+
+#include <gmp.h>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+extern "C" {
+#include "labhe.h"
+#include "mexp.h"
+}
+
+namespace labhe {
+
+/*
+ * Owner of an array of initialized mpz_t
+ */
+class MpzArray {
+public:
+	MpzArray() : p_(nullptr), n_(0) {}
+	explicit MpzArray(const std::size_t n) : p_(nullptr), n_(0) { resize(n); }
+	MpzArray(MpzArray &&o) noexcept : p_(o.p_), n_(o.n_) { o.p_ = nullptr; o.n_ = 0; }
+	MpzArray &operator=(MpzArray &&o) noexcept { std::swap(p_, o.p_); std::swap(n_, o.n_); return *this; }
+	MpzArray(const MpzArray &) = delete;
+	MpzArray &operator=(const MpzArray &) = delete;
+	~MpzArray() { release(); }
+
+	// Grows (never shrinks) the array; existing entries are kept
+	void resize(const std::size_t n)
+	{
+		if (n <= n_) { return; }
+		mpz_t *p = static_cast<mpz_t *>(std::realloc(p_, n*sizeof(mpz_t)));
+		if (!p) { throw std::bad_alloc(); }
+		for (std::size_t i=n_;i<n;i++) { mpz_init(p[i]); }
+		p_ = p;
+		n_ = n;
+	}
+
+	std::size_t size() const { return n_; }
+	mpz_t *data() { return p_; }
+	const mpz_t *data() const { return p_; }
+	mpz_ptr operator[](const std::size_t i) { return p_[i]; }
+	mpz_srcptr operator[](const std::size_t i) const { return p_[i]; }
+
+private:
+	void release()
+	{
+		for (std::size_t i=0;i<n_;i++) { mpz_clear(p_[i]); }
+		std::free(p_);
+		p_ = nullptr;
+		n_ = 0;
+	}
+
+	mpz_t *p_;
+	std::size_t n_;
+};
+
+/*
+ * Level-0 ciphertexts (bm[i], c[i]) of consecutive labels
+ */
+class Level0Vec {
+public:
+	explicit Level0Vec(const std::size_t count) : bm_(count), c_(count), count_(count) {}
+	Level0Vec(const mpz_t *bm, const mpz_t *c, const std::size_t count) : bm_(count), c_(count), count_(count)
+	{
+		for (std::size_t i=0;i<count;i++) {
+			mpz_set(bm_[i], bm[i]);
+			mpz_set(c_[i], c[i]);
+		}
+	}
+	Level0Vec(Level0Vec &&) noexcept = default;
+	Level0Vec &operator=(Level0Vec &&) noexcept = default;
+
+	std::size_t size() const { return count_; }
+	mpz_ptr bm(const std::size_t i) { return bm_[i]; }
+	mpz_ptr c(const std::size_t i) { return c_[i]; }
+	mpz_srcptr bm(const std::size_t i) const { return bm_[i]; }
+	mpz_srcptr c(const std::size_t i) const { return c_[i]; }
+	mpz_t *bm_data() { return bm_.data(); }
+	mpz_t *c_data() { return c_.data(); }
+	const mpz_t *bm_data() const { return bm_.data(); }
+	const mpz_t *c_data() const { return c_.data(); }
+
+private:
+	MpzArray bm_, c_;
+	std::size_t count_;
+};
+
+/*
+ * Level-1 ciphertexts, e.g. element-wise products
+ */
+class Level1Vec {
+public:
+	explicit Level1Vec(const std::size_t count) : c_(count), count_(count) {}
+	Level1Vec(const mpz_t *c, const std::size_t count) : c_(count), count_(count)
+	{
+		for (std::size_t i=0;i<count;i++) { mpz_set(c_[i], c[i]); }
+	}
+	Level1Vec(Level1Vec &&) noexcept = default;
+	Level1Vec &operator=(Level1Vec &&) noexcept = default;
+
+	std::size_t size() const { return count_; }
+	mpz_ptr operator[](const std::size_t i) { return c_[i]; }
+	mpz_srcptr operator[](const std::size_t i) const { return c_[i]; }
+	mpz_t *data() { return c_.data(); }
+	const mpz_t *data() const { return c_.data(); }
+
+private:
+	MpzArray c_;
+	std::size_t count_;
+};
+
+class Level1Ct {
+public:
+	Level1Ct() { mpz_init(c_); }
+	explicit Level1Ct(const mpz_t c) { mpz_init_set(c_, c); }
+	Level1Ct(Level1Ct &&o) noexcept { mpz_init(c_); mpz_swap(c_, o.c_); }
+	Level1Ct &operator=(Level1Ct &&o) noexcept { mpz_swap(c_, o.c_); return *this; }
+	Level1Ct(const Level1Ct &) = delete;
+	Level1Ct &operator=(const Level1Ct &) = delete;
+	~Level1Ct() { mpz_clear(c_); }
+
+	mpz_ptr get() { return c_; }
+	mpz_srcptr get() const { return c_; }
+
+private:
+	mpz_t c_;
+};
+
+/*
+ * Flattened expression: bases/exps of the fused multi-exponentiations
+ * (shallow views or scratch values), unit-weight factors and divisors.
+ * Weights are kept in (-2^(k-1), 2^(k-1)]: negative ones go to the
+ * divisor side with their magnitude, so that small negative weights stay
+ * small exponents, and a single inversion ends the evaluation.
+ */
+class Plan {
+public:
+	Plan() : owned_used_(0), k_(0), n_(nullptr) { mpz_inits(e0_, s_, t_, NULL); }
+	Plan(const Plan &) = delete;
+	Plan &operator=(const Plan &) = delete;
+	~Plan() { mpz_clears(e0_, s_, t_, NULL); }
+
+	void reset(const int k, mpz_srcptr n)
+	{
+		for (int i=0;i<2;i++) {
+			bases_[i].clear();
+			exps_[i].clear();
+			units_[i].clear();
+		}
+		owned_used_ = 0;
+		k_ = k;
+		n_ = n;
+		mpz_set_ui(e0_, 0);
+		mpz_set_ui(s_, 1);
+	}
+
+	// Weight s for a sub-expression; the outer weight is saved in a
+	// scratch slot (by index: the scratch array may move)
+	std::size_t push_scale(const long s)
+	{
+		std::size_t saved = owned_used_;
+
+		mpz_set(owned(), s_);
+		mpz_mul_si(s_, s_, s);
+		mpz_fdiv_r_2exp(s_, s_, k_);
+		if (mpz_tstbit(s_, k_-1) && mpz_scan1(s_, 0) != (mp_bitcnt_t)k_-1) {
+			mpz_set_ui(t_, 0);
+			mpz_setbit(t_, k_);
+			mpz_sub(s_, s_, t_);
+		}
+		return saved;
+	}
+	void pop_scale(const std::size_t saved) { mpz_set(s_, owned_[saved]); }
+
+	void add_ct(mpz_srcptr c)
+	{
+		const int side = (mpz_sgn(s_) < 0);
+
+		if (mpz_sgn(s_) == 0) { return; }
+		if (mpz_cmpabs_ui(s_, 1) == 0) {
+			units_[side].push_back(*c);
+			return;
+		}
+		bases_[side].push_back(*c);
+		mpz_ptr e = owned();
+		mpz_abs(e, s_);
+		exps_[side].push_back(*e);
+	}
+
+	// Weighted sum of level-1 ciphertexts: multiplied first, so that the
+	// weight is applied once
+	void add_sum(const Level1Vec &z)
+	{
+		if (mpz_sgn(s_) == 0 || z.size() == 0) { return; }
+		if (mpz_cmpabs_ui(s_, 1) == 0 || z.size() == 1) {
+			for (std::size_t i=0;i<z.size();i++) { add_ct(z[i]); }
+			return;
+		}
+		mpz_ptr p = owned();
+		mpz_mul(p, z[0], z[1]);
+		mpz_mod(p, p, n_);
+		for (std::size_t i=2;i<z.size();i++) {
+			mpz_mul(p, p, z[i]);
+			mpz_mod(p, p, n_);
+		}
+		add_ct(p);
+	}
+
+	void add_inner(const Level0Vec &x, const Level0Vec &y)
+	{
+		const int side = (mpz_sgn(s_) < 0);
+		const bool unit = (mpz_cmpabs_ui(s_, 1) == 0);
+		std::size_t i;
+
+		if (x.size() != y.size()) { throw std::invalid_argument("labhe: inner product of vectors of different sizes"); }
+		if (mpz_sgn(s_) == 0) { return; }
+		mpz_set_ui(t_, 0);
+		for (i=0;i<x.size();i++) { mpz_addmul(t_, x.bm(i), y.bm(i)); }
+		mpz_addmul(e0_, t_, s_);
+		mpz_fdiv_r_2exp(e0_, e0_, k_);
+		for (i=0;i<x.size();i++) {
+			bases_[side].push_back(*x.c(i));
+			bases_[side].push_back(*y.c(i));
+			if (unit) {
+				exps_[side].push_back(*y.bm(i));
+				exps_[side].push_back(*x.bm(i));
+			} else {
+				mpz_ptr e = owned();
+				mpz_mul(e, y.bm(i), s_);
+				mpz_abs(e, e);
+				mpz_fdiv_r_2exp(e, e, k_);
+				exps_[side].push_back(*e);
+				e = owned();
+				mpz_mul(e, x.bm(i), s_);
+				mpz_abs(e, e);
+				mpz_fdiv_r_2exp(e, e, k_);
+				exps_[side].push_back(*e);
+			}
+		}
+	}
+
+	void run(mpz_t r, const mpz_t enc1)
+	{
+		mpz_t d;
+
+		if (mpz_sgn(e0_) != 0) {
+			bases_[0].push_back(*enc1);
+			exps_[0].push_back(*e0_);
+		}
+		side(r, 0);
+		if (bases_[1].empty() && units_[1].empty()) { return; }
+		mpz_init(d);
+		try {
+			side(d, 1);
+			if (mpz_invert(d, d, n_) == 0) { throw std::runtime_error("labhe: ciphertext not invertible"); }
+		} catch (...) {
+			mpz_clear(d);
+			throw;
+		}
+		mpz_mul(r, r, d);
+		mpz_mod(r, r, n_);
+		mpz_clear(d);
+	}
+
+private:
+	// Product of one side: its multi-exponentiation times its unit factors
+	void side(mpz_t r, const int i)
+	{
+		mpz_set_ui(r, 1);
+		if (!bases_[i].empty() &&
+		    mexp_powm_multi(r, reinterpret_cast<const mpz_t *>(bases_[i].data()),
+		                    reinterpret_cast<const mpz_t *>(exps_[i].data()), (int)bases_[i].size(), n_) != 0) {
+			throw std::runtime_error("labhe: multi-exponentiation failed");
+		}
+		for (const __mpz_struct &c : units_[i]) {
+			mpz_mul(r, r, &c);
+			mpz_mod(r, r, n_);
+		}
+	}
+
+	// Scratch values are kept across evaluations: no allocation once warm
+	mpz_ptr owned()
+	{
+		if (owned_used_ == owned_.size()) { owned_.resize(owned_.size()*2 + 16); }
+		return owned_[owned_used_++];
+	}
+
+	// [0]: factors, [1]: divisors
+	std::vector<__mpz_struct> bases_[2], exps_[2], units_[2];
+	MpzArray owned_;
+	std::size_t owned_used_;
+	int k_;
+	mpz_srcptr n_;
+	mpz_t e0_, s_, t_;
+};
+
+/*
+ * Expression nodes (CRTP): each one adds itself to a Plan with the
+ * current weight
+ */
+template <class E>
+struct Expr {
+	const E &self() const { return static_cast<const E &>(*this); }
+};
+
+struct InnerTerm : Expr<InnerTerm> {
+	InnerTerm(const Level0Vec &x, const Level0Vec &y) : x(x), y(y) {}
+	void collect(Plan &plan) const { plan.add_inner(x, y); }
+	const Level0Vec &x, &y;
+};
+
+struct SumTerm : Expr<SumTerm> {
+	explicit SumTerm(const Level1Vec &z) : z(z) {}
+	void collect(Plan &plan) const { plan.add_sum(z); }
+	const Level1Vec &z;
+};
+
+struct CtTerm : Expr<CtTerm> {
+	explicit CtTerm(const Level1Ct &c) : c(c) {}
+	void collect(Plan &plan) const { plan.add_ct(c.get()); }
+	const Level1Ct &c;
+};
+
+template <class A>
+struct Scaled : Expr<Scaled<A> > {
+	Scaled(const long s, const A &a) : s(s), a(a) {}
+	void collect(Plan &plan) const
+	{
+		std::size_t saved = plan.push_scale(s);
+		a.collect(plan);
+		plan.pop_scale(saved);
+	}
+	long s;
+	A a;
+};
+
+template <class A, class B>
+struct Sum2 : Expr<Sum2<A, B> > {
+	Sum2(const A &a, const B &b) : a(a), b(b) {}
+	void collect(Plan &plan) const
+	{
+		a.collect(plan);
+		b.collect(plan);
+	}
+	A a;
+	B b;
+};
+
+// Operands of the operators: expression nodes as they are, Level1Ct as a term
+template <class T, class = void>
+struct as_expr {};
+
+template <class T>
+struct as_expr<T, typename std::enable_if<std::is_base_of<Expr<T>, T>::value>::type> {
+	typedef T type;
+	static const T &get(const T &t) { return t; }
+};
+
+template <>
+struct as_expr<Level1Ct> {
+	typedef CtTerm type;
+	static CtTerm get(const Level1Ct &c) { return CtTerm(c); }
+};
+
+inline InnerTerm inner(const Level0Vec &x, const Level0Vec &y) { return InnerTerm(x, y); }
+
+inline SumTerm sum(const Level1Vec &z) { return SumTerm(z); }
+
+template <class A, class B>
+Sum2<typename as_expr<A>::type, typename as_expr<B>::type> operator+(const A &a, const B &b)
+{
+	return Sum2<typename as_expr<A>::type, typename as_expr<B>::type>(as_expr<A>::get(a), as_expr<B>::get(b));
+}
+
+template <class A, class B>
+Sum2<typename as_expr<A>::type, Scaled<typename as_expr<B>::type> > operator-(const A &a, const B &b)
+{
+	return Sum2<typename as_expr<A>::type, Scaled<typename as_expr<B>::type> >(
+	           as_expr<A>::get(a), Scaled<typename as_expr<B>::type>(-1, as_expr<B>::get(b)));
+}
+
+template <class A>
+Scaled<typename as_expr<A>::type> operator*(const long s, const A &a)
+{
+	return Scaled<typename as_expr<A>::type>(s, as_expr<A>::get(a));
+}
+
+template <class A>
+Scaled<typename as_expr<A>::type> operator-(const A &a)
+{
+	return Scaled<typename as_expr<A>::type>(-1, as_expr<A>::get(a));
+}
+
+/*
+ * Evaluation key (n, k, enc1) with its scratch storage
+ */
+class Evaluator {
+public:
+	Evaluator(const mpz_t n, const int k, const mpz_t enc1) : k_(k)
+	{
+		mpz_init_set(n_, n);
+		mpz_init_set(enc1_, enc1);
+	}
+	Evaluator(const Evaluator &) = delete;
+	Evaluator &operator=(const Evaluator &) = delete;
+	~Evaluator() { mpz_clears(n_, enc1_, NULL); }
+
+	int k() const { return k_; }
+	mpz_srcptr n() const { return n_; }
+	mpz_srcptr enc1() const { return enc1_; }
+
+	// Fused evaluation of a level-1 expression
+	template <class E>
+	void eval(Level1Ct &r, const E &e)
+	{
+		plan_.reset(k_, n_);
+		as_expr<E>::get(e).collect(plan_);
+		plan_.run(r.get(), enc1_);
+	}
+
+	template <class E>
+	Level1Ct eval(const E &e)
+	{
+		Level1Ct r;
+		eval(r, e);
+		return r;
+	}
+
+	// Element-wise products (labhe_hommul_lev0_batch)
+	Level1Vec mul(const Level0Vec &x, const Level0Vec &y) const
+	{
+		Level1Vec r(x.size());
+		if (x.size() != y.size() ||
+		    labhe_hommul_lev0_batch(r.data(), x.bm_data(), x.c_data(), y.bm_data(), y.c_data(),
+		                            (int)x.size(), n_, k_, enc1_) != 0) {
+			throw std::runtime_error("labhe: hommul failed");
+		}
+		return r;
+	}
+
+private:
+	int k_;
+	mpz_t n_, enc1_;
+	Plan plan_;
+};
+
+} // namespace labhe
+
+#endif
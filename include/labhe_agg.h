@@ -0,0 +1,32 @@
+#ifndef LABHE_AGG_HEADER
+#define LABHE_AGG_HEADER
+
+/*
+ * Cross-encryptor aggregation: many users encrypt under their own
+ * pk/sk (labhe_gen) for the same labels (e.g. time slots), the
+ * evaluator adds their ciphertexts label by label and the decryptor
+ * removes the sum of all users' masks.
+ *
+ * Per-user arrays are user-major: entry u*count + j belongs to user u
+ * and label start_label + j. Work is split by user in workers shards,
+ * run on the installed pool if any (labhe_pool_run_shards), and the
+ * partial results are merged at the end.
+ */
+
+int labhe_decrypt_offline_indep_batch(unsigned char *sks, const mpz_t *pks, const int users,
+	             				const mpz_t p,const mpz_t D,const mpz_t *Dpow,const int k,
+	             				const mpz_t _2k1,const mpz_t pm12k,
+	             				const int workers);
+
+int labhe_decrypt_offline_agg_sk(mpz_t *b, const unsigned char *sks, const int users,
+								const int start_label, const int count,
+								const int k, const int workers);
+
+int labhe_agg_lev0(mpz_t *bmres, mpz_t *cres,
+	                              const mpz_t *bm, const mpz_t *c, const int users, const int count,
+	                              const mpz_t n, const int k, const int workers);
+
+int labhe_agg_lev1(mpz_t *cres, const mpz_t *c, const int users, const int count,
+	                              const mpz_t n, const int workers);
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef LABHE_CACHE_HEADER
+#define LABHE_CACHE_HEADER
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Evaluator-side cache of fixed-base window tables for hot ciphertexts,
+ * keyed by (dataset, label). A ciphertext gets a table once it has been
+ * used hot times; tables are evicted in LRU order to keep the cache
+ * under its memory budget. The cache is thread-safe: entries in use are
+ * pinned and never evicted underneath their users.
+ *
+ * Keys are only hints: the cached base is compared with the ciphertext
+ * passed in and the entry is rebuilt if they differ.
+ */
+typedef struct labhe_cache labhe_cache;
+
+typedef struct {
+	long long hits;      // exponentiations served from a table
+	long long misses;    // exponentiations done with mpz_powm
+	long long builds;    // tables built
+	long long evictions; // entries evicted
+	size_t bytes;        // memory held by entries and tables
+	int entries;
+} labhe_cache_stats;
+
+#define LABHE_CACHE_ENC1 UINT32_MAX // reserved dataset for enc1
+
+int labhe_cache_init(labhe_cache **cache, const mpz_t n, const int k,
+	                 const size_t budget, const int hot, const int uses);
+
+int labhe_cache_powm(labhe_cache *cache, mpz_t r, const uint32_t dataset, const int label,
+	                 const mpz_t c, const mpz_t e);
+
+int labhe_cache_stats_get(labhe_cache *cache, labhe_cache_stats *stats);
+
+void labhe_cache_clear(labhe_cache *cache);
+
+int labhe_hommul_lev0_batch_cache(mpz_t *c, labhe_cache *cache,
+	                              const uint32_t dataset1, const int start_label1,
+	                              const mpz_t *bm1, const mpz_t *c1,
+	                              const uint32_t dataset2, const int start_label2,
+	                              const mpz_t *bm2, const mpz_t *c2, const int count,
+	                              const mpz_t n, const int k, const mpz_t enc1);
+
+int labhe_homsmul_lev0_cache(mpz_t bmres, mpz_t cres, labhe_cache *cache,
+	                              const uint32_t dataset, const int label,
+	                              const mpz_t bm, const mpz_t c, const mpz_t s,
+	                              const int k);
+
+#endif
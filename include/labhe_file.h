@@ -0,0 +1,73 @@
+#ifndef LABHE_FILE_HEADER
+#define LABHE_FILE_HEADER
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Ciphertext dataset files: native-endian, mmap-able header followed
+ * by fixed-width records of consecutive labels (start_label, +1, ...).
+ *   level-0 record: bm (klimbs limbs), c (nlimbs limbs)
+ *   level-1 record: c (nlimbs limbs)
+ *   linear-only level-0 record: bm (klimbs limbs)
+ * Records start LABHE_FILE_ALIGN bytes into the file. Files are written
+ * sequentially with a writer and read as read-only views into the
+ * mapping, so datasets never have to fit in memory.
+ */
+#define LABHE_FILE_ALIGN 4096
+#define LABHE_FILE_CHUNK 4096 // default records per aggregation chunk
+
+#define LABHE_FILE_LINEAR 1   // flag: level-0 records without c (no eb_mask)
+
+#define LABHE_AGG_SUM 1       // level-0/1 file -> one level-0/1 ciphertext
+#define LABHE_AGG_INNERPROD 2 // two level-0 files -> one level-1 ciphertext
+#define LABHE_AGG_SUMSQ 3     // level-0 file -> one level-1 ciphertext
+
+typedef struct {
+	void *map;
+	size_t map_size;
+	int level;
+	int flags;                // LABHE_FILE_LINEAR
+	int k;
+	int start_label;
+	long long count;
+	int nlimbs, klimbs;
+	uint64_t n_tag;           // low limb of n, checked against the evaluator key
+	const mp_limb_t *records;
+	size_t stride;            // limbs per record
+} labhe_file;
+
+typedef struct labhe_file_writer labhe_file_writer;
+
+typedef struct {
+	long long ciphertexts; // records consumed
+	long long bytes;       // record bytes read
+	long long chunks;
+	long long ns;          // wall-clock time of the job
+} labhe_file_stats;
+
+int labhe_file_create(labhe_file_writer **w, const char *path, const int level,
+	                  const int start_label, const mpz_t n, const int k);
+
+int labhe_file_create_flags(labhe_file_writer **w, const char *path, const int level,
+	                        const int start_label, const mpz_t n, const int k, const int flags);
+
+int labhe_file_append(labhe_file_writer *w, const mpz_t bm, const mpz_t c);
+
+int labhe_file_finish(labhe_file_writer *w);
+
+int labhe_file_open(labhe_file *f, const char *path);
+
+void labhe_file_close(labhe_file *f);
+
+int labhe_file_range(labhe_file *sub, const labhe_file *f, const long long first, const long long count);
+
+int labhe_file_get(const labhe_file *f, const long long i, mpz_t bm, mpz_t c);
+
+int labhe_file_aggregate(mpz_t bmres, mpz_t cres, const int op,
+	                     const labhe_file *f1, const labhe_file *f2,
+	                     const mpz_t n, const int k, const mpz_t enc1,
+	                     const int chunk, const int workers,
+	                     labhe_file_stats *stats);
+
+#endif
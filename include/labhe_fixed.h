@@ -0,0 +1,40 @@
+#ifndef LABHE_FIXED_HEADER
+#define LABHE_FIXED_HEADER
+
+#include <stdint.h>
+
+/*
+ * Fixed-point ingestion: real values v are encoded as the k-bit two's
+ * complement of round(v * 2^frac_bits), so that signed values add and
+ * multiply correctly mod 2^k. Sums keep the format of their operands;
+ * products (hommul, inner products) add the fractional bits
+ * (labhe_fixed_product). Decrypted results are mapped back with
+ * labhe_fixed_decode / labhe_fixed_decode_mpz.
+ */
+#define LABHE_FIXED_DOUBLE_BITS 51 // |round(v * 2^frac_bits)| < 2^51 for double input
+#define LABHE_FIXED_CHUNK 256      // values quantized per pass
+
+typedef struct {
+	int k;          // plaintext space 2^k
+	int frac_bits;  // fractional bits of the encoding
+} labhe_fixed;
+
+int labhe_fixed_init(labhe_fixed *fx, const int k, const int frac_bits);
+
+int labhe_fixed_product(labhe_fixed *res, const labhe_fixed *a, const labhe_fixed *b);
+
+int labhe_fixed_simd(void);
+
+int labhe_fixed_quantize(int64_t *q, const double *v, const int count, const labhe_fixed *fx);
+
+int labhe_fixed_encrypt_double(mpz_t *cs, const double *v, const mpz_t *b_masks, const int count,
+	                           const labhe_fixed *fx);
+
+int labhe_fixed_encrypt_int64(mpz_t *cs, const int64_t *v, const mpz_t *b_masks, const int count,
+	                          const labhe_fixed *fx);
+
+int labhe_fixed_decode_mpz(mpz_t r, const mpz_t m, const labhe_fixed *fx);
+
+double labhe_fixed_decode(const mpz_t m, const labhe_fixed *fx);
+
+#endif
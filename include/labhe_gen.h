@@ -1,6 +1,8 @@
 #ifndef LABHE_GEN_HEADER
 #define LABHE_GEN_HEADER
 
+#include "mexp.h"
+
 int labhe_gen_sk(unsigned char *sk,
 					  mpz_t p, mpz_t n, mpz_t y, mpz_t D, 
 	         		  const int l, const int k,
@@ -19,4 +21,15 @@ int labhe_gen(mpz_t pk,unsigned char *sk,
 	             	const mpz_t _2k, 
 	             	gmp_randstate_t gmpRandState);
 
+int labhe_gen_batch(mpz_t *pks, unsigned char *sks, const int count,
+	                const mpz_t n, const mpz_t y, const mexp_table *ytab, const int k,
+	                const mpz_t _2k, const int workers);
+
+int labhe_gen_save(const char *path, const mpz_t *pks, const unsigned char *sks, const int count,
+	               const mpz_t n, const int k);
+
+int labhe_gen_load(const char *path, mpz_t **pks, unsigned char **sks, int *count, int *k);
+
+void labhe_gen_keys_clear(mpz_t *pks, unsigned char *sks, const int count);
+
 #endif
\ No newline at end of file
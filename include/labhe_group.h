@@ -0,0 +1,77 @@
+#ifndef LABHE_GROUP_HEADER
+#define LABHE_GROUP_HEADER
+
+#include <stdint.h>
+#include <gmp.h>
+
+#include "mont.h"
+#include "prf.h"
+
+/*
+ * Group-by aggregation of a stream of (group key, level-0 ciphertext,
+ * label) records.
+ * The evaluator (LABHE_GROUP_SUMS) adds batches of (key, bm, c) on the
+ * pool installed by labhe_pool_set, if any: each worker updates its own
+ * open-addressing hash table of per-group accumulators (sum of bm mod
+ * 2^k, product of c mod n as a Montgomery chain, record count), and
+ * labhe_group_finish merges the tables and sorts the groups by key. c
+ * may be NULL for linear-only datasets (sums of bm only).
+ * The decryptor (LABHE_GROUP_MASKS) adds batches of (key, label) the
+ * same way and gets the mask of every group, the sum of its PRFs, in
+ * one pass over the labels. labhe_group_decrypt matches both by key.
+ * Memory grows with the number of groups, not of records, so the stream
+ * is fed in batches of any size. Batches of one table must not be added
+ * concurrently.
+ */
+#define LABHE_GROUP_SUMS 0
+#define LABHE_GROUP_MASKS 1
+#define LABHE_GROUP_GRAIN 1024 // records per pool chunk
+
+typedef struct {
+	uint64_t key;
+	long long records;      // 0: empty slot
+	mpz_t bm;               // sum of bm (masks: of PRFs) mod 2^k
+	mpz_t c;                // product of c mod n (sums with c)
+	mp_limb_t *acc;         // Montgomery chain of c until finished
+} labhe_group_entry;
+
+typedef struct {
+	labhe_group_entry *e;
+	size_t cap, size;       // cap is a power of two
+} labhe_group_table;
+
+typedef struct {
+	int kind;               // LABHE_GROUP_SUMS or LABHE_GROUP_MASKS
+	int k;
+	int with_c;             // sums: -1 until the first batch
+	int finished;
+	mpz_t n;
+	const mont_ctx *ctx;
+	unsigned char sk[SK_SIZE];
+	int ntables;
+	labhe_group_table *tables;   // one per worker, merged into tables[0]
+	size_t groups;
+	labhe_group_entry **sorted;  // by key, once finished
+} labhe_group;
+
+int labhe_group_init(labhe_group *g, const mpz_t n, const int k);
+
+int labhe_group_mask_init(labhe_group *g, const unsigned char *sk, const int k);
+
+int labhe_group_add(labhe_group *g, const uint64_t *keys, const mpz_t *bm, const mpz_t *c,
+	                const int count);
+
+int labhe_group_mask_add(labhe_group *g, const uint64_t *keys, const int *labels, const int count);
+
+int labhe_group_finish(labhe_group *g);
+
+int labhe_group_get(uint64_t *key, mpz_t bm, mpz_t c, long long *records,
+	                const labhe_group *g, const size_t i);
+
+long long labhe_group_find(const labhe_group *g, const uint64_t key);
+
+int labhe_group_decrypt(mpz_t *ms, const labhe_group *sums, const labhe_group *masks);
+
+void labhe_group_clear(labhe_group *g);
+
+#endif
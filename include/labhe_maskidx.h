@@ -0,0 +1,74 @@
+#ifndef LABHE_MASKIDX_HEADER
+#define LABHE_MASKIDX_HEADER
+
+#include "prf.h"
+
+/*
+ * Prefix-sum mask index of the decryptor: for labels start + i (sum0)
+ * or label pairs (start1 + i, start2 + i) (inner products), prefix[j]
+ * holds the mask of the first j*block labels, i.e. the sum mod 2^k of
+ * PRF(sk, l) or of PRF(sk1, l1)*PRF(sk2, l2). The mask of any range is
+ * then two lookups plus direct PRF calls for its partial boundary
+ * blocks (fewer than 2*block labels) and for labels outside the index.
+ *
+ * Block masks are computed on the pool installed by labhe_pool_set, if
+ * any, and the index is extended incrementally as labels are added.
+ * Installed indexes (labhe_maskidx_install) are used transparently by
+ * labhe_decrypt_offline_sum0_sk and labhe_decrypt_offline_ip_sk for
+ * matching keys, from any thread: the table of installed indexes is
+ * locked, and uninstall (or clear) waits for the lookups in progress.
+ * An index holds masks of the PRF backend selected when it was built;
+ * under another backend its queries fail and lookups skip it.
+ *
+ * Saved indexes are secret-derived: files are created with mode 0600
+ * and hold no key; the keys are given again to labhe_maskidx_load.
+ */
+#define LABHE_MASKIDX_SUM0 0
+#define LABHE_MASKIDX_IP 1
+#define LABHE_MASKIDX_SLOTS 8 // installed indexes
+
+typedef struct {
+	int kind;                   // LABHE_MASKIDX_SUM0 or LABHE_MASKIDX_IP
+	int backend;                // PRF backend of the masks
+	int k;
+	int block;                  // labels per block
+	int start1, start2;         // first indexed label(s)
+	int blocks;                 // complete blocks indexed
+	int cap;                    // allocated prefix entries
+	mpz_t *prefix;              // blocks+1 entries, prefix[0] = 0
+	unsigned char sk1[SK_SIZE], sk2[SK_SIZE];
+} labhe_maskidx;
+
+int labhe_maskidx_init_sum0(labhe_maskidx *mi, const unsigned char *sk,
+	                        const int start_label, const int block, const int k);
+
+int labhe_maskidx_init_ip(labhe_maskidx *mi, const unsigned char *sk1, const unsigned char *sk2,
+	                      const int start_label1, const int start_label2, const int block, const int k);
+
+int labhe_maskidx_extend(labhe_maskidx *mi, const int count);
+
+int labhe_maskidx_labels(const labhe_maskidx *mi);
+
+int labhe_maskidx_sum0(mpz_t b, const labhe_maskidx *mi, const int start_label, const int count);
+
+int labhe_maskidx_ip(mpz_t b, const labhe_maskidx *mi,
+	                 const int start_label1, const int start_label2, const int count);
+
+int labhe_maskidx_save(const char *path, const labhe_maskidx *mi);
+
+int labhe_maskidx_load(labhe_maskidx *mi, const char *path,
+	                   const unsigned char *sk1, const unsigned char *sk2);
+
+void labhe_maskidx_clear(labhe_maskidx *mi);
+
+int labhe_maskidx_install(const labhe_maskidx *mi);
+
+int labhe_maskidx_uninstall(const labhe_maskidx *mi);
+
+int labhe_maskidx_lookup_sum0(mpz_t b, const unsigned char *sk,
+	                          const int start_label, const int count, const int k);
+
+int labhe_maskidx_lookup_ip(mpz_t b, const unsigned char *sk1, const unsigned char *sk2,
+	                        const int start_label1, const int start_label2, const int count, const int k);
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef LABHE_PACK_HEADER
+#define LABHE_PACK_HEADER
+
+#include <stdint.h>
+
+/*
+ * Plaintext slot packing for level-0 sums: a record of up to `slots`
+ * unsigned values of slot_bits bits is encoded in one k-bit message,
+ * value j at bit j*width with width = slot_bits + headroom. The
+ * headroom bits absorb the carries of up to max_adds additions, so the
+ * sum of packed ciphertexts (labhe_homadd_lev0_batch) decrypts to the
+ * slot-wise sums. One ciphertext, one mask and one homomorphic addition
+ * then serve `slots` values.
+ *
+ * Records are record-major: value j of record r is v[r*slots + j].
+ * Only additions are supported: products of packed messages mix slots.
+ */
+typedef struct {
+	int k;
+	int slot_bits;       // bits of each input value
+	int headroom;        // ceil(log2(max_adds))
+	int width;           // slot_bits + headroom (at most 64)
+	int slots;           // values per message
+	long long max_adds;  // largest number of records in one sum
+} labhe_pack;
+
+int labhe_pack_init(labhe_pack *pk, const int k, const int slot_bits, const long long max_adds,
+	                const int slots);
+
+int labhe_pack_encode(mpz_t *ms, const uint64_t *v, const int records, const labhe_pack *pk);
+
+int labhe_pack_decode(uint64_t *sums, const mpz_t m, const labhe_pack *pk);
+
+int labhe_pack_encrypt(mpz_t *cs, const uint64_t *v, const mpz_t *b_masks, const int records,
+	                   const labhe_pack *pk);
+
+int labhe_pack_add(mpz_t bmres, mpz_t cres, const mpz_t *bm, const mpz_t *c, const int records,
+	               const mpz_t n, const labhe_pack *pk);
+
+int labhe_pack_decrypt(uint64_t *sums, const mpz_t bm, const mpz_t b, const labhe_pack *pk);
+
+#endif
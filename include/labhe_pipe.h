@@ -0,0 +1,36 @@
+#ifndef LABHE_PIPE_HEADER
+#define LABHE_PIPE_HEADER
+
+#include "rng.h"
+
+/*
+ * Pipelined LABHE encryption: offline workers fill a lock-free ring
+ * of ready masks (in label order) that the online stage consumes as
+ * plaintexts arrive. Finished level-0 ciphertexts are streamed out 
+ * through a callback (bm and c are only valid during the call).
+ */
+typedef struct labhe_pipe labhe_pipe;
+
+typedef void (*labhe_pipe_cb)(void *arg, const int label, const mpz_t bm, const mpz_t c);
+
+typedef struct {
+	long long encrypted;  // messages encrypted by the online stage
+	long long stalls;     // online calls that found no ready mask
+	long long stall_ns;   // total time the online stage waited for masks
+	long long full_waits; // times an offline worker found the ring full
+} labhe_pipe_stats;
+
+int labhe_pipe_start(labhe_pipe **pp, const int start_label, const int depth, const int workers,
+	                 const unsigned char *sk,
+	                 const mpz_t n, const mpz_t y, const int k,
+	                 const mpz_t _2k,
+	                 const labhe_rng *rng,
+	                 labhe_pipe_cb cb, void *cb_arg);
+
+int labhe_pipe_encrypt(labhe_pipe *pp, const mpz_t m);
+
+int labhe_pipe_stats_get(const labhe_pipe *pp, labhe_pipe_stats *stats);
+
+int labhe_pipe_stop(labhe_pipe *pp, labhe_pipe_stats *stats);
+
+#endif
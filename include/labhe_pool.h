@@ -0,0 +1,54 @@
+#ifndef LABHE_POOL_HEADER
+#define LABHE_POOL_HEADER
+
+/*
+ * Persistent work-stealing thread pool for parallel map stages: a job
+ * over indices 0..count-1 is split in one range per worker, each worker
+ * takes grain-sized chunks from the front of its own range and, once it
+ * is empty, steals the back half of another worker's range. Uneven
+ * chunks (e.g. exponents of varying bit-length) are thus balanced
+ * without a shared queue. The calling thread runs as worker 0.
+ *
+ * The function receives the worker index so that it can use per-worker
+ * scratch (labhe_pool_workers entries). Chunk boundaries, stolen ones
+ * included, are multiples of the grain (except count), so with a grain
+ * that is a multiple of LABHE_POOL_LINE_ITEMS workers writing
+ * consecutive mpz_t outputs never share a cache line of a 64-byte
+ * aligned array.
+ *
+ * labhe_pool_set installs a pool for the batch routines of labhe.c
+ * (labhe_hommul_lev0_batch, labhe_encrypt_offline_batch_rng,
+ * labhe_lincomb_lev1, labhe_homadd_lev1_batch), so a whole job runs on
+ * one set of workers; without one they run on the calling thread. Like
+ * tune_set, labhe_pool_set must not race with running computations.
+ * Runs issued from inside a job (nested batch routines) are executed
+ * serially by the calling worker.
+ *
+ * The routines that take a number of threads (those of labhe_agg.h,
+ * labhe_gen_batch, labhe_file_aggregate, labhe_shard_masks) split their
+ * work in that many shards and run them with labhe_pool_run_shards: on
+ * the installed pool, or without one on a pool started for the call.
+ */
+#define LABHE_POOL_LINE_ITEMS 4 // mpz_t per 64-byte cache line
+
+typedef struct labhe_pool labhe_pool;
+
+// Process indices [i0,i1) on worker `worker`; non-zero on failure
+typedef int (*labhe_pool_fn)(void *arg, const int i0, const int i1, const int worker);
+
+int labhe_pool_start(labhe_pool **pp, const int workers);
+
+int labhe_pool_workers(const labhe_pool *pp);
+
+int labhe_pool_run(labhe_pool *pp, const int count, const int grain,
+	               labhe_pool_fn fn, void *arg);
+
+int labhe_pool_run_shards(const int nshards, labhe_pool_fn fn, void *arg);
+
+int labhe_pool_stop(labhe_pool *pp);
+
+int labhe_pool_set(labhe_pool *pp);
+
+labhe_pool *labhe_pool_get(void);
+
+#endif
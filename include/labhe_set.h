@@ -0,0 +1,47 @@
+#ifndef LABHE_SET_HEADER
+#define LABHE_SET_HEADER
+
+#include <stdint.h>
+
+/*
+ * Label-set queries: the range-based routines (labhe_homadd_lev0_batch,
+ * labhe_innerprod_lev0, labhe_decrypt_offline_sum0_sk/_ip_sk) restricted
+ * to a subset of records, e.g. the rows selected by a filter.
+ *
+ * The evaluator gathers ciphertexts from the full arrays by index
+ * (shallow views, no copy): idx[] is strictly increasing and entry i of
+ * an array has label start_label + i. The decryptor computes masks of
+ * the selected labels only, from a strictly increasing label list or a
+ * bitmap (bit i of bitmap[i/64] selects label start_label + i), with
+ * batched PRF calls.
+ */
+
+int labhe_set_from_bitmap(int *idx, const uint64_t *bitmap, const int nbits);
+
+int labhe_homadd_lev0_set(mpz_t bmred, mpz_t cred,
+	                              const mpz_t *bm, const mpz_t *c, const int *idx, const int count,
+	                              const int k, const mpz_t n);
+
+int labhe_innerprod_lev0_set(mpz_t c,
+	                              const mpz_t *bm1, const mpz_t *c1, const mpz_t *bm2, const mpz_t *c2,
+	                              const int *idx, const int count,
+	                              const mpz_t n, const int k, const mpz_t enc1);
+
+int labhe_decrypt_offline_sum0_set(mpz_t b, const unsigned char *sk,
+								const int *labels, const int count,
+								const int k);
+
+int labhe_decrypt_offline_ip_set(mpz_t b, const unsigned char *sk1, const unsigned char *sk2,
+								const int *labels1, const int *labels2, const int count,
+								const int k);
+
+int labhe_decrypt_offline_sum0_bitmap(mpz_t b, const unsigned char *sk,
+								const int start_label, const uint64_t *bitmap, const int nbits,
+								const int k);
+
+int labhe_decrypt_offline_ip_bitmap(mpz_t b, const unsigned char *sk1, const unsigned char *sk2,
+								const int start_label1, const int start_label2,
+								const uint64_t *bitmap, const int nbits,
+								const int k);
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef LABHE_SHARD_HEADER
+#define LABHE_SHARD_HEADER
+
+#include <stdint.h>
+
+#include "labhe_file.h"
+
+/*
+ * Sharded evaluation: worker processes (possibly on other machines)
+ * each reduce one label range of the ciphertext dataset files to a
+ * partial result (labhe_shard_reduce). Partials carry their job and
+ * label ranges, are exchanged as small text files (labhe_shard_save,
+ * labhe_shard_load) and are merged by a coordinator pairwise in a tree
+ * (labhe_shard_merge); merged partials can be merged again. The
+ * decryptor computes the offline mask along the same boundaries
+ * (labhe_shard_mask, labhe_shard_masks).
+ */
+typedef struct {
+	int op;                  // LABHE_AGG_* job
+	int level;               // level of the result: (bm,c) for 0, c for 1
+	int k;
+	int start_label1;        // first label of the (first) operand
+	int start_label2;        // first label of the second operand (innerprod/sumsq)
+	int count;               // labels per operand
+	uint64_t n_tag;          // low limb of n, checked against the evaluator key
+	mpz_t bm, c;
+} labhe_shard;
+
+void labhe_shard_init(labhe_shard *s);
+
+void labhe_shard_clear(labhe_shard *s);
+
+int labhe_shard_reduce(labhe_shard *s, const int op,
+	                   const labhe_file *f1, const labhe_file *f2,
+	                   const long long first, const long long count,
+	                   const mpz_t n, const int k, const mpz_t enc1,
+	                   const int chunk, const int workers,
+	                   labhe_file_stats *stats);
+
+int labhe_shard_merge(labhe_shard *res, const labhe_shard *parts, const int nparts,
+	                  const mpz_t n, const int k);
+
+int labhe_shard_mask(mpz_t b, const labhe_shard *s,
+	                 const unsigned char *sk1, const unsigned char *sk2,
+	                 const int k, const mpz_t _2k1);
+
+int labhe_shard_masks(mpz_t b, const labhe_shard *parts, const int nparts,
+	                  const unsigned char *sk1, const unsigned char *sk2,
+	                  const int k, const mpz_t _2k1, const int workers);
+
+int labhe_shard_save(const char *path, const labhe_shard *s);
+
+int labhe_shard_load(labhe_shard *s, const char *path);
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef LABHE_WINDOW_HEADER
+#define LABHE_WINDOW_HEADER
+
+#include "labhe.h"
+#include "prf.h"
+
+/*
+ * Sliding-window aggregates over the last width labels of a stream.
+ * The evaluator keeps the window's ciphertexts in a ring: a push
+ * multiplies the new ciphertext into a lazy numerator/denominator
+ * accumulator and, once the window is full, moves the expired one into
+ * the denominator (homsub) and subtracts its bm mod 2^k, so a tick costs
+ * O(1) modular multiplications whatever the width; reading the result
+ * costs one inversion. The decryptor keeps the matching mask, updated
+ * with the PRF of the new and the expired labels only.
+ *   level 0: rolling sum of level-0 ciphertexts (mask: sum of b)
+ *   level 1: rolling sum of level-1 ciphertexts, e.g. the products of
+ *            two streams for a rolling inner product (mask: sum of b1*b2)
+ */
+typedef struct {
+	int level, k, width;
+	int len;                 // ciphertexts in the window (<= width)
+	int head;                // ring slot of the oldest ciphertext
+	mpz_t *ring_bm, *ring_c; // ring_bm only at level 0
+	mpz_t bm;                // level 0: sum of bm mod 2^k
+	labhe_lev1_acc acc;      // product of the ring ciphertexts
+} labhe_window;
+
+typedef struct {
+	int level, k, width;
+	int len;
+	int next_label1, next_label2; // labels of the next push
+	unsigned char sk1[SK_SIZE], sk2[SK_SIZE];
+	mpz_t b;
+} labhe_window_mask;
+
+int labhe_window_init(labhe_window *w, const int level, const int width, const int k);
+
+int labhe_window_push0(labhe_window *w, const mpz_t bm, const mpz_t c, const mpz_t n);
+
+int labhe_window_push1(labhe_window *w, const mpz_t c, const mpz_t n);
+
+int labhe_window_push_ip(labhe_window *w, const mpz_t bm1, const mpz_t c1,
+	                     const mpz_t bm2, const mpz_t c2,
+	                     const mpz_t n, const mpz_t enc1);
+
+int labhe_window_get(mpz_t bm, mpz_t c, const labhe_window *w, const mpz_t n);
+
+void labhe_window_clear(labhe_window *w);
+
+int labhe_window_mask_init(labhe_window_mask *wm, const int level, const int width,
+	                       const unsigned char *sk1, const unsigned char *sk2,
+	                       const int start_label1, const int start_label2, const int k);
+
+int labhe_window_mask_push(labhe_window_mask *wm);
+
+void labhe_window_mask_clear(labhe_window_mask *wm);
+
+#endif
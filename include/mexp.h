@@ -0,0 +1,34 @@
+#ifndef MEXP_HEADER
+#define MEXP_HEADER
+
+/*
+ * Fixed-base window table for base b:
+ * pow[j*(2^w-1)+d-1] = b^{d*2^{w*j}} mod n, for 0 <= j < nwin, 1 <= d < 2^w
+ */
+typedef struct {
+	int w;
+	int nwin;
+	mpz_t *pow;
+} mexp_table;
+
+int mexp_powm_multi(mpz_t r, const mpz_t *bases, const mpz_t *exps, const int count,
+	                const mpz_t n);
+
+int mexp_multi_cost(const int count, const int bits);
+
+int mexp_multi_window(const int count, const int bits);
+
+int mexp_table_window(const int bits, const int uses);
+
+int mexp_table_init(mexp_table *tab, const mpz_t b, const int bits, const int w,
+	                const mpz_t n);
+
+int mexp_table_powm(mpz_t r, const mexp_table *tab, const mpz_t e,
+	                const mpz_t n);
+
+int mexp_table_mulpowm(mpz_t r, const mexp_table *tab, const mpz_t e,
+	                   const mpz_t n);
+
+void mexp_table_clear(mexp_table *tab);
+
+#endif
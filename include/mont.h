@@ -0,0 +1,77 @@
+#ifndef MONT_HEADER
+#define MONT_HEADER
+
+#include <gmp.h>
+
+/*
+ * Fixed-size Montgomery arithmetic for the modulus sizes used by
+ * deployments: 1024/1536/2048 bits (p) and 2048/3072/4096 bits (n),
+ * nominal or one limb longer as generated by bhjl_gen.
+ * Each size has its own multiply/square kernels with compile-time limb
+ * counts and stack-only temporaries; values in the Montgomery domain
+ * are plain limb arrays of ctx->limbs limbs holding a*R mod m,
+ * R = 2^{GMP_NUMB_BITS*limbs}.
+ */
+#define MONT_MAX_LIMBS 65
+#define MONT_WINDOW 5
+#define MONT_MULTI_MAX 4   // bases of mont_powm_multi
+#define MONT_MULTI_WINDOW 4
+
+/*
+ * Batch exponentiation backends (mont_vec.c): several independent
+ * exponentiations modulo the same m run in the lanes of SIMD registers,
+ * one Montgomery multiplication per instruction stream for all lanes.
+ * IFMA is chosen by CPUID on first use, with the scalar kernels as the
+ * fallback; mont_backend_select overrides it and, like tune_set, must
+ * not race with running computations.
+ */
+#define MONT_BACKEND_SCALAR 0 // one exponentiation at a time (ctx->mul)
+#define MONT_BACKEND_AVX2 1   // 4 lanes, 26-bit digits (vpmuludq)
+#define MONT_BACKEND_IFMA 2   // 8 lanes, 52-bit digits (AVX-512 IFMA)
+#define MONT_LANES 8          // widest backend: callers batch by this many
+
+typedef struct mont_ctx mont_ctx;
+
+struct mont_ctx {
+	int limbs;
+	mp_limb_t m[MONT_MAX_LIMBS];
+	mp_limb_t minv;               // -m^{-1} mod 2^{GMP_NUMB_BITS}
+	mp_limb_t one[MONT_MAX_LIMBS]; // R mod m
+	mp_limb_t r2[MONT_MAX_LIMBS];  // R^2 mod m
+	void (*mul)(mp_limb_t *r, const mp_limb_t *a, const mp_limb_t *b, const mont_ctx *ctx);
+	void (*sqr)(mp_limb_t *r, const mp_limb_t *a, const mont_ctx *ctx);
+};
+
+int mont_init(mont_ctx *ctx, const mpz_t m);
+
+const mont_ctx *mont_lookup(const mpz_t m);
+
+void mont_to(mp_limb_t *r, const mpz_t a, const mont_ctx *ctx);
+
+void mont_from(mpz_t r, const mp_limb_t *a, const mont_ctx *ctx);
+
+int mont_is_one(const mp_limb_t *a, const mont_ctx *ctx);
+
+void mont_powm_limbs(mp_limb_t *r, const mp_limb_t *b, const mpz_t e, const mont_ctx *ctx);
+
+int mont_powm(mpz_t r, const mpz_t b, const mpz_t e, const mont_ctx *ctx);
+
+int mont_powm_2exp(mpz_t r, const mpz_t b, const int e, const mont_ctx *ctx);
+
+int mont_powm_multi(mpz_t r, const mpz_t *bases, const mpz_t *exps, const int count,
+	                const mont_ctx *ctx);
+
+int mont_backend(void);
+
+int mont_backend_hw(const int backend);
+
+int mont_backend_select(const int backend);
+
+int mont_powm_multi_batch(mpz_t *r, const mpz_t *bases, const mpz_t *exps, const int nbases,
+	                      const int count, const mont_ctx *ctx);
+
+int mont_mulmod(mpz_t r, const mpz_t a, const mpz_t b, const mont_ctx *ctx);
+
+int mont_prod(mpz_t r, const mpz_t *a, const int count, const mont_ctx *ctx);
+
+#endif
@@ -5,6 +5,26 @@
 #define LABEL_SIZE 16 // 128 bits
 #define NONCE_SIZE 16 // 128 bits
 
+// PRF backends (the identifier is stored with the keys)
+#define PRF_BACKEND_KECCAK 0
+#define PRF_BACKEND_AES 1
+
+#define PRF_BATCH 64 // nonces per chunk in the labhe batch routines
+
+int prf_select(const int backend);
+int prf_backend(void);
+int prf_aes_hw(void);
+
 int prf(unsigned char *nonce, const unsigned char *label, const unsigned char *key);
+int prf_batch(unsigned char *nonces, const unsigned char *labels, const int count, const unsigned char *key);
+int prf_batch_seq(unsigned char *nonces, const int start_label, const int count, const unsigned char *key);
+int prf_batch_list(unsigned char *nonces, const int *labels, const int count, const unsigned char *key);
+int prf_multi(unsigned char *nonces, const unsigned char *label, const unsigned char *keys, const int count);
+
+int prf_keccak(unsigned char *nonce, const unsigned char *label, const unsigned char *key);
+int prf_keccak_batch(unsigned char *nonces, const unsigned char *labels, const int count, const unsigned char *key);
+int prf_aes(unsigned char *nonce, const unsigned char *label, const unsigned char *key);
+int prf_aes_batch(unsigned char *nonces, const unsigned char *labels, const int count, const unsigned char *key);
+int prf_aes_multi(unsigned char *nonces, const unsigned char *label, const unsigned char *keys, const int count);
 
-#endif
\ No newline at end of file
+#endif
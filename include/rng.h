@@ -0,0 +1,34 @@
+#ifndef RNG_HEADER
+#define RNG_HEADER
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define RNG_SEED_SIZE 32 // 256 bits
+
+/*
+ * Counter-mode randomness source over the Keccak sponge: block i of
+ * stream s is Keccak(seed, s, i). Streams derived from the same seed
+ * are independent, so each thread can own one without locking.
+ */
+typedef struct {
+	unsigned char seed[RNG_SEED_SIZE];
+	uint64_t stream;
+	uint64_t counter;
+} labhe_rng;
+
+int rng_init(labhe_rng *rng);
+
+int rng_init_seed(labhe_rng *rng, const unsigned char *seed);
+
+int rng_fork(labhe_rng *child, const labhe_rng *parent, const uint64_t stream);
+
+int rng_bytes(labhe_rng *rng, unsigned char *out, const size_t len);
+
+int rng_urandomm(mpz_t x, labhe_rng *rng, const mpz_t n);
+
+int rng_urandomm_batch(mpz_t *x, const int count, labhe_rng *rng, const mpz_t n);
+
+int rng_urandomm_label(mpz_t x, const labhe_rng *rng, const int label, const mpz_t n);
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef TUNE_HEADER
+#define TUNE_HEADER
+
+#include <stddef.h>
+
+/*
+ * Tuning profiles: algorithm parameters measured on the current host for
+ * one parameter set (k and the limb counts of n and p). While a profile
+ * is active (tune_set), the batch routines use its window widths,
+ * decryption digit width, kernel choices and thread count instead of
+ * the built-in cost models. Profiles are text files stored next to the
+ * key-store files (tune_path) and installed by keystore_load_public and
+ * keystore_load_secret when they match the keys. Like prf_select,
+ * tune_set must not race with running computations.
+ */
+#define TUNE_MAX_WINDOW 8     // fixed-base table windows 1..TUNE_MAX_WINDOW
+#define TUNE_MAX_DIGIT 8      // decryption digit widths 1..TUNE_MAX_DIGIT
+#define TUNE_MULTI_CLASSES 7  // multi-exponentiation class c: 4^c < count <= 4^{c+1}
+
+#define TUNE_MONT_ENCRYPT 0   // BHJL encryption
+#define TUNE_MONT_DECRYPT 1   // BHJL decryption
+#define TUNE_MONT_HOMMUL 2    // level-0 multiplication batches
+#define TUNE_MONT_PROD 3      // addition batches (modular products)
+#define TUNE_MONT_OPS 4
+
+typedef struct {
+	int k;
+	int nlimbs, plimbs;
+	int dec_digit;                          // Pohlig-Hellman digit width of decryption
+	int multi_window[TUNE_MULTI_CLASSES];   // Pippenger window (k-bit exponents)
+	double table_build[TUNE_MAX_WINDOW+1];  // cycles to build a k-bit table of window w
+	double table_use[TUNE_MAX_WINDOW+1];    // cycles per exponentiation from it
+	int mont[TUNE_MONT_OPS];                // 1: Montgomery kernels, 0: GMP
+	int workers;                            // threads for sharded jobs
+} labhe_tune;
+
+int tune_calibrate(labhe_tune *t, const mpz_t n, const mpz_t p, const int k,
+	               const int max_workers);
+
+int tune_save(const char *path, const labhe_tune *t);
+
+int tune_load(labhe_tune *t, const char *path);
+
+int tune_path(char *buf, const size_t size, const char *keystore_path);
+
+int tune_set(const labhe_tune *t);
+
+const labhe_tune *tune_get(void);
+
+int tune_mont(const int op, const mpz_t m);
+
+int tune_dec_digit(const int k);
+
+int tune_multi_window(const int count, const int bits);
+
+int tune_table_window(const int bits, const int uses);
+
+int tune_workers(void);
+
+#endif
@@ -1,6 +1,124 @@
 #include <gmp.h>
+#include <stdlib.h>
 
+#include "mexp.h"
+#include "mont.h"
+#include "rng.h"
 #include "bhjl.h"
+#include "tune.h"
+
+/*
+ * c = y^m x^{2^k} mod n in the Montgomery domain of n, both powers
+ * sharing one chain of squarings
+ */
+static void bhjl_encrypt_mont(mpz_t c, const mpz_t m, const mpz_t x,
+	                          const mpz_t y, const mpz_t _2k, const mont_ctx *ctx)
+{
+	mpz_t bases[2], exps[2];
+
+	bases[0][0] = y[0];
+	exps[0][0] = m[0];
+	bases[1][0] = x[0];
+	exps[1][0] = _2k[0];
+	mont_powm_multi(c, (const mpz_t *)bases, (const mpz_t *)exps, 2, ctx);
+}
+
+/*
+ * Table H[x] = G^x (Montgomery domain of p) of the powers of
+ * G = D^{2^{k-w}}, of order 2^w, for bhjl_dlog_mont
+ * Outputs: newly allocated table of 2^w entries, NULL on failure
+ */
+static mp_limb_t *bhjl_dlog_table(const mpz_t D, const mpz_t *Dpow, const int k, const int w,
+	                              const mont_ctx *ctx)
+{
+	mp_limb_t *H;
+	int i, x, n = ctx->limbs;
+
+	H = (mp_limb_t *)malloc(((size_t)1<<w)*n*sizeof(mp_limb_t));
+	if (!H) { return NULL; }
+
+	if (Dpow) {
+		mont_to(H+n, Dpow[k-w], ctx);
+	} else {
+		mont_to(H+n, D, ctx);
+		for (i=0;i<k-w;i++) { ctx->sqr(H+n, H+n, ctx); }
+	}
+	mpn_copyi(H, ctx->one, n);
+	for (x=2;x<(1<<w);x++) { ctx->mul(H+(size_t)x*n, H+(size_t)(x-1)*n, H+n, ctx); }
+
+	return H;
+}
+
+/*
+ * Discrete logarithm loop of BHJL decryption in the Montgomery domain
+ * of p, w bits at a time (Pohlig-Hellman): C = c^{(p-1)/2^k} has
+ * order dividing 2^k, and C^{2^{k-j-w}} is looked up among the powers
+ * of G in H to recover bits j..j+w-1 at once, which are then cancelled
+ * by multiplying in Dpow[j+i] = D^{2^{j+i}} (or successive squares of
+ * D if Dpow is NULL)
+ * Outputs: m; C is overwritten; 1 if a digit is not found (c^{(p-1)/2^k}
+ * outside the subgroup of D, i.e. an invalid ciphertext)
+ */
+static int bhjl_dlog_mont(mpz_t m, mp_limb_t *C, const mp_limb_t *H, const mpz_t D, const mpz_t *Dpow,
+	                      const int k, const int w, const mont_ctx *ctx)
+{
+	mp_limb_t T[MONT_MAX_LIMBS], Dm[MONT_MAX_LIMBS];
+	int j, i, x, wd, step, d, n = ctx->limbs;
+
+	if (!Dpow) { mont_to(Dm, D, ctx); }
+
+	mpz_set_ui(m,0);
+	for (j=0;j<k;j+=w) {
+		// T = G^{-d 2^{w-wd}} for the next wd-bit digit d of the logarithm
+		wd = (k-j < w) ? k-j : w;
+		step = 1 << (w-wd);
+		mpn_copyi(T, C, n);
+		for (i=0;i<k-j-wd;i++) { ctx->sqr(T, T, ctx); }
+		for (x=0;x<(1<<w) && mpn_cmp(T, H+(size_t)x*n, n) != 0;x+=step);
+		if (x >= (1<<w)) { return 1; }
+		d = (((1<<w) - x) & ((1<<w)-1)) >> (w-wd);
+
+		for (i=0;i<wd;i++) {
+			if ((d >> i) & 1) {
+				mpz_setbit(m,j+i);
+				if (Dpow) { mont_to(Dm, Dpow[j+i], ctx); }
+				ctx->mul(C, C, Dm, ctx);
+			}
+			if (!Dpow) { ctx->sqr(Dm, Dm, ctx); }
+		}
+	}
+	return 0;
+}
+
+static int bhjl_dlog_digit(const int k)
+{
+	int w = tune_dec_digit(k);
+
+	return (w > k) ? k : w;
+}
+
+/*
+ * BHJL decryption in the Montgomery domain of p: c^{(p-1)/2^k}, then
+ * the discrete logarithm loop
+ * Outputs: m; 0 on success, 1 if the table cannot be allocated or the
+ * logarithm is not found
+ */
+static int bhjl_decrypt_mont(mpz_t m, const mpz_t c, const mpz_t D, const mpz_t *Dpow,
+	                         const int k, const mpz_t pm12k, const mont_ctx *ctx)
+{
+	mp_limb_t C[MONT_MAX_LIMBS], *H;
+	int rc, w = bhjl_dlog_digit(k);
+
+	H = bhjl_dlog_table(D, Dpow, k, w, ctx);
+	if (!H) { return 1; }
+
+	mont_to(C, c, ctx);
+	mont_powm_limbs(C, C, pm12k, ctx); // c^{(p-1)/2^k}
+	rc = bhjl_dlog_mont(m, C, H, D, Dpow, k, w, ctx);
+	free(H);
+
+	return rc;
+}
 
 /*
  * BHJL encryption
@@ -21,10 +139,17 @@ int bhjl_encrypt(mpz_t c,const mpz_t m,
 	             gmp_randstate_t gmpRandState) 
 {
 	mpz_t x, t1, t2, t3;
+	const mont_ctx *ctx;
 
    	mpz_init(x);
     mpz_urandomm(x,gmpRandState,n);
 
+	if (tune_mont(TUNE_MONT_ENCRYPT,n) && (ctx = mont_lookup(n)) != NULL) {
+		bhjl_encrypt_mont(c,m,x,y,_2k,ctx);
+		mpz_clear(x);
+		return 0;
+	}
+
    	mpz_init(t1);
     mpz_powm(t1,x,_2k,n);
 
@@ -41,6 +166,110 @@ int bhjl_encrypt(mpz_t c,const mpz_t m,
    	return 0;
 }
 
+/*
+ * BHJL encryption with explicit randomizer
+ * Inputs: 
+ *   - Message to encrypt: m
+ *   - Randomizer: x
+ *   - Public parameters and precomputed values: n, y, _2k
+ *   - Bit-length of messages: k
+ * Outputs: ciphertext c = y^m x^{2^k} mod n
+ * Assumptions: 
+ *   - message is within the valid range 0 <= m < 2^{k}
+ *   - randomizer is uniform in 0 <= x < n and never reused
+ *   - all I/O pointers are allocated and initialized by caller
+ */
+int bhjl_encrypt_x(mpz_t c,const mpz_t m,const mpz_t x,
+	               const mpz_t n,const mpz_t y, const int k,
+	               const mpz_t _2k) 
+{
+	mpz_t t1, t2;
+	const mont_ctx *ctx;
+
+	if (tune_mont(TUNE_MONT_ENCRYPT,n) && (ctx = mont_lookup(n)) != NULL) {
+		bhjl_encrypt_mont(c,m,x,y,_2k,ctx);
+		return 0;
+	}
+
+	mpz_inits(t1,t2,NULL);
+	mpz_powm(t1,x,_2k,n);
+	mpz_powm(t2,y,m,n);
+	mpz_mul(t1,t1,t2);
+	mpz_mod(c,t1,n);
+	mpz_clears(t1,t2,NULL);
+
+	return 0;
+}
+
+/*
+ * BHJL encryption of a batch with explicit randomizers: with a
+ * Montgomery kernel for n the joint exponentiations y^m x^{2^k} run
+ * MONT_LANES at a time on the batch backend (mont_powm_multi_batch)
+ * Inputs: 
+ *   - Messages and randomizers: m[], x[] (count of each)
+ *   - Public parameters and precomputed values: n, y, k, _2k
+ * Outputs: ciphertexts c[i] = y^{m[i]} x[i]^{2^k} mod n
+ * Assumptions: as bhjl_encrypt_x for each entry
+ */
+int bhjl_encrypt_x_batch(mpz_t *c,const mpz_t *m,const mpz_t *x,const int count,
+	                     const mpz_t n,const mpz_t y, const int k,
+	                     const mpz_t _2k) 
+{
+	mpz_t bases[2*MONT_LANES], exps[2*MONT_LANES];
+	const mont_ctx *ctx;
+	int i, j, cnt, rc = 0;
+
+	if (!tune_mont(TUNE_MONT_ENCRYPT,n) || (ctx = mont_lookup(n)) == NULL) {
+		for (i=0;i<count;i++) { rc |= bhjl_encrypt_x(c[i],m[i],x[i],n,y,k,_2k); }
+		return rc;
+	}
+
+	// Shallow copies: (y, x[i]) with exponents (m[i], 2^k)
+	for (i=0;i<count;i+=MONT_LANES) {
+		cnt = (count - i < MONT_LANES) ? count - i : MONT_LANES;
+		for (j=0;j<cnt;j++) {
+			bases[2*j][0] = y[0];
+			exps[2*j][0] = m[i+j][0];
+			bases[2*j+1][0] = x[i+j][0];
+			exps[2*j+1][0] = _2k[0];
+		}
+		rc |= mont_powm_multi_batch(c+i,(const mpz_t *)bases,(const mpz_t *)exps,2,cnt,ctx);
+	}
+
+	return rc;
+}
+
+/*
+ * BHJL encryption using the Keccak randomness source
+ * Inputs: 
+ *   - Message to encrypt: m
+ *   - Public parameters and precomputed values: n, y, _2k
+ *   - Bit-length of messages: k
+ *   - Randomness source: rng
+ * Outputs: ciphertext c
+ * Assumptions: 
+ *   - message is within the valid range 0 <= m < 2^{k}
+ *   - all I/O pointers are allocated and initialized by caller
+ *   - rng is not shared with other threads
+ */
+int bhjl_encrypt_rng(mpz_t c,const mpz_t m,
+	                 const mpz_t n,const mpz_t y, const int k,
+	                 const mpz_t _2k, 
+	                 labhe_rng *rng) 
+{
+	mpz_t x;
+
+	mpz_init(x);
+	if (rng_urandomm(x,rng,n) != 0) {
+		mpz_clear(x);
+		return 1;
+	}
+	bhjl_encrypt_x(c,m,x,n,y,k,_2k);
+	mpz_clear(x);
+
+	return 0;
+}
+
 /*
  * BHJL decryption
  * Inputs: 
@@ -48,7 +277,8 @@ int bhjl_encrypt(mpz_t c,const mpz_t m,
  *   - Secret parameters and precomputed values: p, D, _2k1, pm12k
  *   - Bit-length of messages: k
  *   - State of GMP randomness generator
- * Outputs: recovered message m
+ * Outputs: recovered message m; 1 if the logarithm is not found
+ * (c^{(p-1)/2^k} outside the subgroup of D, i.e. an invalid ciphertext)
  * Assumptions: 
  *   - all I/O pointers are allocated and initialized by caller
  *   - ciphertext is in the correct range 0 <= c < n
@@ -58,8 +288,13 @@ int bhjl_decrypt(mpz_t m,const mpz_t c,
 	             const mpz_t p,const mpz_t D,const int k,
 	             const mpz_t _2k1,const mpz_t pm12k)
 {
-	int j;
+	int j, rc;
 	mpz_t t1, t2, Bloop, Dloop, Cloop, Eloop;
+	const mont_ctx *ctx;
+
+	if (tune_mont(TUNE_MONT_DECRYPT,p) && (ctx = mont_lookup(p)) != NULL) {
+		return bhjl_decrypt_mont(m,c,D,NULL,k,pm12k,ctx);
+	}
 
 	mpz_init(t1);
 	mpz_init(t2);
@@ -89,13 +324,166 @@ int bhjl_decrypt(mpz_t m,const mpz_t c,
 	if (mpz_cmp_ui(Cloop,1)!=0) {
 		// Not equal to 1
 		mpz_add(m,m,Bloop);
+		mpz_mul(t1,Cloop,Dloop);
+		mpz_mod(Cloop,t1,p);
 	}
+	// Every bit cancelled: Cloop is 1 unless there was no logarithm
+	rc = (mpz_cmp_ui(Cloop,1)!=0);
 
   mpz_clears(t1, t2, Bloop, Dloop, Cloop, Eloop, NULL);
 
+	return rc;
+}
+
+/*
+ * BHJL encryption with a fixed-base table for y
+ * Inputs: 
+ *   - Message to encrypt: m
+ *   - Public parameters and precomputed values: n, ytab (table of y), _2k
+ *   - Bit-length of messages: k
+ *   - State of GMP randomness generator
+ * Outputs: ciphertext c
+ * Assumptions: 
+ *   - message is within the valid range 0 <= m < 2^{k}
+ *   - all I/O pointers are allocated and initialized by caller
+ *   - GMP randomness state is managed by the caller
+ */
+int bhjl_encrypt_tab(mpz_t c,const mpz_t m,
+	                 const mpz_t n,const mexp_table *ytab, const int k,
+	                 const mpz_t _2k, 
+	                 gmp_randstate_t gmpRandState) 
+{
+	mpz_t x, t1;
+	const mont_ctx *ctx;
+
+	mpz_inits(x,t1,NULL);
+	mpz_urandomm(x,gmpRandState,n);
+	if (tune_mont(TUNE_MONT_ENCRYPT,n) && (ctx = mont_lookup(n)) != NULL) {
+		mont_powm_2exp(t1,x,k,ctx);
+	} else {
+		mpz_powm(t1,x,_2k,n);
+	}
+
+	mexp_table_mulpowm(t1,ytab,m,n);
+	mpz_set(c,t1);
+
+	mpz_clears(x,t1,NULL);
+
 	return 0;
 }
 
+/*
+ * BHJL decryption with precomputed powers of D
+ * Inputs: 
+ *   - Ciphertext to decrypt: c
+ *   - Secret parameters and precomputed values: p, Dpow, _2k1, pm12k
+ *     where Dpow[j] = D^{2^j} mod p for 0 <= j < k
+ *   - Bit-length of messages: k
+ * Outputs: recovered message m; 1 if the logarithm is not found
+ * (c^{(p-1)/2^k} outside the subgroup of D, i.e. an invalid ciphertext)
+ * Assumptions: 
+ *   - all I/O pointers are allocated and initialized by caller
+ *   - ciphertext is in the correct range 0 <= c < n
+ */
+int bhjl_decrypt_tab(mpz_t m,const mpz_t c,
+	                 const mpz_t p,const mpz_t *Dpow,const int k,
+	                 const mpz_t _2k1,const mpz_t pm12k)
+{
+	int j, rc;
+	mpz_t t1, Cloop, Eloop;
+	const mont_ctx *ctx;
+
+	if (tune_mont(TUNE_MONT_DECRYPT,p) && (ctx = mont_lookup(p)) != NULL) {
+		return bhjl_decrypt_mont(m,c,NULL,Dpow,k,pm12k,ctx);
+	}
+
+	mpz_inits(t1,Cloop,NULL);
+	mpz_init_set(Eloop,_2k1);
+
+	mpz_powm(Cloop,c,pm12k,p); // c^{(p-1)/2^k}
+
+	mpz_set_ui(m,0);
+
+	for (j=0;j<k-1;j++) {
+		mpz_powm(t1,Cloop,Eloop,p);
+		if (mpz_cmp_ui(t1,1)!=0) {
+			// Not equal to 1
+			mpz_setbit(m,j);
+			mpz_mul(t1,Cloop,Dpow[j]);
+			mpz_mod(Cloop,t1,p);
+		}
+		mpz_tdiv_q_2exp(Eloop,Eloop,1);
+	}
+	if (mpz_cmp_ui(Cloop,1)!=0) {
+		// Not equal to 1
+		mpz_setbit(m,k-1);
+		mpz_mul(t1,Cloop,Dpow[k-1]);
+		mpz_mod(Cloop,t1,p);
+	}
+	// Every bit cancelled: Cloop is 1 unless there was no logarithm
+	rc = (mpz_cmp_ui(Cloop,1)!=0);
+
+	mpz_clears(t1,Cloop,Eloop,NULL);
+
+	return rc;
+}
+
+/*
+ * BHJL decryption of a batch: with a Montgomery kernel for p the
+ * exponentiations c[i]^{(p-1)/2^k} run MONT_LANES at a time on the
+ * batch backend and the discrete logarithm table is built once
+ * Inputs: 
+ *   - Ciphertexts to decrypt: c[] (count)
+ *   - Secret parameters and precomputed values: p, D, _2k1, pm12k, and
+ *     Dpow as for bhjl_decrypt_tab (NULL to use D)
+ *   - Bit-length of messages: k
+ * Outputs: recovered messages m[]; 0 on success
+ * Assumptions: 
+ *   - all I/O pointers are allocated and initialized by caller
+ *   - ciphertexts are in the correct range 0 <= c[i] < n
+ */
+int bhjl_decrypt_batch(mpz_t *m,const mpz_t *c,const int count,
+	                   const mpz_t p,const mpz_t D,const mpz_t *Dpow,const int k,
+	                   const mpz_t _2k1,const mpz_t pm12k)
+{
+	mp_limb_t C[MONT_MAX_LIMBS], *H;
+	mpz_t exps[MONT_LANES], Cs[MONT_LANES];
+	const mont_ctx *ctx;
+	int i, j, cnt, w, rc = 0;
+
+	if (!tune_mont(TUNE_MONT_DECRYPT,p) || (ctx = mont_lookup(p)) == NULL) {
+		for (i=0;i<count;i++) {
+			if (Dpow) {
+				rc |= bhjl_decrypt_tab(m[i],c[i],p,Dpow,k,_2k1,pm12k);
+			} else {
+				rc |= bhjl_decrypt(m[i],c[i],p,D,k,_2k1,pm12k);
+			}
+		}
+		return rc;
+	}
+
+	w = bhjl_dlog_digit(k);
+	H = bhjl_dlog_table(D, Dpow, k, w, ctx);
+	if (!H) { return 1; }
+
+	for (j=0;j<MONT_LANES;j++) {
+		exps[j][0] = pm12k[0];
+		mpz_init(Cs[j]);
+	}
+	for (i=0;i<count;i+=MONT_LANES) {
+		cnt = (count - i < MONT_LANES) ? count - i : MONT_LANES;
+		rc |= mont_powm_multi_batch(Cs,c+i,(const mpz_t *)exps,1,cnt,ctx);
+		for (j=0;j<cnt;j++) {
+			mont_to(C, Cs[j], ctx);
+			rc |= bhjl_dlog_mont(m[i+j], C, H, D, Dpow, k, w, ctx);
+		}
+	}
+	for (j=0;j<MONT_LANES;j++) { mpz_clear(Cs[j]); }
+	free(H);
+
+	return rc;
+}
+
 /*
  * BHJL homomorphic addition
  * Inputs: 
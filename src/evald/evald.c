@@ -0,0 +1,539 @@
+#include <gmp.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "mexp.h"
+#include "labhe.h"
+#include "evald.h"
+
+typedef struct evald_conn {
+	int fd;
+	int pending;  // jobs queued or being computed
+	int done;     // reader finished, ready to be joined
+	pthread_t reader;
+	pthread_mutex_t lock; // serializes responses and protects pending
+	pthread_cond_t idle;
+	struct evald_server *srv;
+	struct evald_conn *next;
+} evald_conn;
+
+typedef struct evald_job {
+	evald_conn *conn;
+	evald_frame f;
+	mpz_t *items;
+	uint64_t t_recv, t_queued;
+	struct evald_job *next;
+} evald_job;
+
+struct evald_server {
+	int listen_fd;
+	char path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+	mpz_t n, enc1;
+	int k;
+	mexp_table own_tab;          // built when no table is given
+	const mexp_table *enc1_tab;
+	FILE *log;
+
+	pthread_t acceptor;
+	pthread_t *workers;
+	int nworkers;
+
+	// bounded job queue: readers block when full (backpressure)
+	pthread_mutex_t qlock;
+	pthread_cond_t qnotempty, qnotfull;
+	evald_job *head, *tail;
+	int qlen, depth, stopping;
+
+	evald_conn *conns; // protected by qlock
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * Load evaluator public parameters from a text file with lines
+ * n=<hex/dec>, k=<dec>, enc1=<hex/dec> (0x prefix for hex)
+ * Inputs: file path
+ * Outputs: BHJL public parameters n, k and precomputed encryption of 1: enc1
+ * Assumptions:
+ *   - all I/O pointers are allocated and initialized by caller
+ */
+int evald_load_params(const char *path, mpz_t n, int *k, mpz_t enc1)
+{
+	FILE *fp;
+	char *line = NULL, *eq, *nl;
+	size_t cap = 0;
+	int found = 0;
+
+	fp = fopen(path, "r");
+	if (!fp) { return 1; }
+
+	while (getline(&line, &cap, fp) > 0) {
+		eq = strchr(line, '=');
+		if (!eq) { continue; }
+		*eq++ = 0;
+		nl = strchr(eq, '\n');
+		if (nl) { *nl = 0; }
+		if (strcmp(line, "n") == 0 && mpz_set_str(n, eq, 0) == 0) { found |= 1; }
+		if (strcmp(line, "k") == 0) { *k = atoi(eq); found |= 2; }
+		if (strcmp(line, "enc1") == 0 && mpz_set_str(enc1, eq, 0) == 0) { found |= 4; }
+	}
+	free(line);
+	if (fclose(fp)) { return 1; }
+
+	return (found == 7 && *k > 0) ? 0 : 1;
+}
+
+/*
+ * Check that all fields of a request are valid ciphertext components;
+ * c = 0 (a linear-only level-0 ciphertext, see LABHE_FILE_LINEAR) is
+ * only accepted by a level-0 EVALD_OP_SUM, for all items or none of them
+ */
+static int evald_check_items(const evald_server *srv, const evald_frame *f, const mpz_t *items)
+{
+	int fields, j, linear;
+	size_t i, zeros = 0;
+
+	linear = (f->op == EVALD_OP_SUM && f->level == 0);
+	fields = evald_fields(f->op,f->level,0);
+	for (i=0;i<f->count;i++) {
+		for (j=0;j<fields;j++) {
+			if (fields != 1 && (j&1) == 0) {
+				if (mpz_sizeinbase(items[i*fields+j],2) > (size_t)srv->k) { return 1; }
+			} else {
+				if (mpz_cmp(items[i*fields+j],srv->n) >= 0) { return 1; }
+				if (mpz_sgn(items[i*fields+j]) == 0) {
+					if (!linear) { return 1; }
+					zeros++;
+				}
+			}
+		}
+	}
+	return (zeros != 0 && zeros != f->count) ? 1 : 0;
+}
+
+/*
+ * Run one job
+ * Inputs: request frame f and its items
+ * Outputs:
+ *   - response frame r (count/level filled in) and newly allocated response items
+ *   - returns EVALD_STATUS_*
+ */
+static int evald_compute(evald_server *srv, const evald_frame *f, mpz_t *items,
+	                     evald_frame *r, mpz_t **res)
+{
+	uint32_t i, nres;
+	int rc = 0;
+	mpz_t *bm1, *c1, *bm2, *c2, bases[2], exps[2], e;
+
+	if (f->count == 0 || evald_check_items(srv,f,items) != 0) { return EVALD_STATUS_BADREQ; }
+
+	switch (f->op) {
+	case EVALD_OP_HOMMUL:
+		r->level = 1;
+		r->count = f->count;
+		break;
+	case EVALD_OP_INNERPROD:
+		r->level = 1;
+		r->count = 1;
+		break;
+	default:
+		r->level = f->level;
+		r->count = 1;
+	}
+	nres = r->count*evald_fields(r->op,r->level,1);
+
+	*res = (mpz_t *)malloc(nres*sizeof(mpz_t));
+	if (!*res) { return EVALD_STATUS_FAIL; }
+	for (i=0;i<nres;i++) { mpz_init((*res)[i]); }
+
+	switch (f->op) {
+	case EVALD_OP_HOMMUL:
+		// c = enc1^{bm1*bm2} c1^{bm2} c2^{bm1}, enc1 part from the warm table
+		mpz_init(e);
+		for (i=0;i<f->count;i++) {
+			bases[0][0] = items[4*i+1][0];
+			exps[0][0] = items[4*i+2][0];
+			bases[1][0] = items[4*i+3][0];
+			exps[1][0] = items[4*i][0];
+			rc |= mexp_powm_multi((*res)[i],(const mpz_t *)bases,(const mpz_t *)exps,2,srv->n);
+			mpz_mul(e,items[4*i],items[4*i+2]);
+			mpz_fdiv_r_2exp(e,e,srv->k);
+			mexp_table_mulpowm((*res)[i],srv->enc1_tab,e,srv->n);
+		}
+		mpz_clear(e);
+		break;
+	case EVALD_OP_INNERPROD:
+		bm1 = (mpz_t *)malloc(4*f->count*sizeof(mpz_t));
+		if (!bm1) { rc = 1; break; }
+		c1 = bm1 + f->count;
+		bm2 = c1 + f->count;
+		c2 = bm2 + f->count;
+		for (i=0;i<f->count;i++) {
+			bm1[i][0] = items[4*i][0];
+			c1[i][0] = items[4*i+1][0];
+			bm2[i][0] = items[4*i+2][0];
+			c2[i][0] = items[4*i+3][0];
+		}
+		rc = labhe_innerprod_lev0((*res)[0],(const mpz_t *)bm1,(const mpz_t *)c1,
+		                          (const mpz_t *)bm2,(const mpz_t *)c2,f->count,srv->n,srv->k,srv->enc1);
+		free(bm1);
+		break;
+	case EVALD_OP_SUM:
+		if (f->level == 1) {
+			rc = labhe_homadd_lev1_batch((*res)[0],(const mpz_t *)items,f->count,srv->n);
+			break;
+		}
+		bm1 = (mpz_t *)malloc(2*f->count*sizeof(mpz_t));
+		if (!bm1) { rc = 1; break; }
+		c1 = bm1 + f->count;
+		for (i=0;i<f->count;i++) {
+			bm1[i][0] = items[2*i][0];
+			c1[i][0] = items[2*i+1][0];
+		}
+		rc = labhe_homadd_lev0_batch((*res)[0],(*res)[1],(const mpz_t *)bm1,(const mpz_t *)c1,
+		                             f->count,srv->k,srv->n);
+		free(bm1);
+		break;
+	default:
+		rc = 1;
+	}
+
+	if (rc != 0) {
+		evald_items_clear(*res,nres);
+		*res = NULL;
+		return EVALD_STATUS_FAIL;
+	}
+	return EVALD_STATUS_OK;
+}
+
+static void *evald_worker(void *arg)
+{
+	evald_server *srv = (evald_server *)arg;
+	evald_job *job;
+	evald_frame r;
+	mpz_t *res;
+	uint64_t t_start, t_end;
+	int fields;
+
+	for (;;) {
+		pthread_mutex_lock(&srv->qlock);
+		while (!srv->head && !srv->stopping) {
+			pthread_cond_wait(&srv->qnotempty, &srv->qlock);
+		}
+		if (!srv->head) {
+			pthread_mutex_unlock(&srv->qlock);
+			break;
+		}
+		job = srv->head;
+		srv->head = job->next;
+		if (!srv->head) { srv->tail = NULL; }
+		srv->qlen--;
+		pthread_cond_signal(&srv->qnotfull);
+		pthread_mutex_unlock(&srv->qlock);
+
+		t_start = now_ns();
+		memset(&r, 0, sizeof(r));
+		r.job = job->f.job;
+		r.op = job->f.op;
+		res = NULL;
+		r.status = evald_compute(srv,&job->f,job->items,&r,&res);
+		if (r.status != EVALD_STATUS_OK) {
+			r.level = job->f.level;
+			r.count = 0;
+		}
+		t_end = now_ns();
+		r.compute_ns = t_end - t_start;
+
+		pthread_mutex_lock(&job->conn->lock);
+		if (evald_write_frame(job->conn->fd,&r,(const mpz_t *)res,1,srv->n,srv->k) != 0) {
+			// Drop the connection rather than leave the client waiting
+			shutdown(job->conn->fd, SHUT_RDWR);
+		}
+		job->conn->pending--;
+		pthread_cond_broadcast(&job->conn->idle);
+		pthread_mutex_unlock(&job->conn->lock);
+
+		if (srv->log) {
+			fprintf(srv->log,"job %u op %d count %u status %d: recv %.3f ms, queued %.3f ms, compute %.3f ms, send %.3f ms\n",
+			        job->f.job, job->f.op, job->f.count, r.status,
+			        job->t_recv/1e6, (t_start-job->t_queued)/1e6, r.compute_ns/1e6, (now_ns()-t_end)/1e6);
+			fflush(srv->log);
+		}
+
+		fields = evald_fields(r.op,r.level,1);
+		evald_items_clear(res,r.count*fields);
+		evald_items_clear(job->items,job->f.count*evald_fields(job->f.op,job->f.level,0));
+		free(job);
+	}
+
+	return NULL;
+}
+
+static void *evald_reader(void *arg)
+{
+	evald_conn *conn = (evald_conn *)arg;
+	evald_server *srv = conn->srv;
+	evald_job *job;
+	evald_frame r;
+	uint64_t t;
+	int rc;
+
+	for (;;) {
+		job = (evald_job *)malloc(sizeof(evald_job));
+		if (!job) { break; }
+
+		t = now_ns();
+		rc = evald_read_frame(conn->fd,&job->f,&job->items,0,srv->n,srv->k);
+		if (rc != 0) {
+			if (rc == 2) {
+				memset(&r, 0, sizeof(r));
+				r.job = job->f.job;
+				r.op = job->f.op;
+				r.status = EVALD_STATUS_BADREQ;
+				pthread_mutex_lock(&conn->lock);
+				evald_write_frame(conn->fd,&r,NULL,1,srv->n,srv->k);
+				pthread_mutex_unlock(&conn->lock);
+			}
+			free(job);
+			break;
+		}
+		job->conn = conn;
+		job->next = NULL;
+		job->t_queued = now_ns();
+		job->t_recv = job->t_queued - t;
+
+		pthread_mutex_lock(&conn->lock);
+		conn->pending++;
+		pthread_mutex_unlock(&conn->lock);
+
+		pthread_mutex_lock(&srv->qlock);
+		while (srv->qlen >= srv->depth && !srv->stopping) {
+			pthread_cond_wait(&srv->qnotfull, &srv->qlock);
+		}
+		if (srv->tail) { srv->tail->next = job; } else { srv->head = job; }
+		srv->tail = job;
+		srv->qlen++;
+		pthread_cond_signal(&srv->qnotempty);
+		pthread_mutex_unlock(&srv->qlock);
+	}
+
+	// Wait for in-flight jobs before closing the connection
+	pthread_mutex_lock(&conn->lock);
+	while (conn->pending > 0) {
+		pthread_cond_wait(&conn->idle, &conn->lock);
+	}
+	pthread_mutex_unlock(&conn->lock);
+
+	pthread_mutex_lock(&srv->qlock);
+	close(conn->fd);
+	conn->done = 1;
+	pthread_mutex_unlock(&srv->qlock);
+
+	return NULL;
+}
+
+/*
+ * Join and release connections whose reader has finished
+ * (all connections if all is set)
+ */
+static void evald_reap(evald_server *srv, const int all)
+{
+	evald_conn **pc, *c;
+	int done;
+
+	pthread_mutex_lock(&srv->qlock);
+	pc = &srv->conns;
+	while (*pc) {
+		c = *pc;
+		done = c->done;
+		if (!done && !all) {
+			pc = &c->next;
+			continue;
+		}
+		*pc = c->next;
+		if (!done) { shutdown(c->fd, SHUT_RD); }
+		pthread_mutex_unlock(&srv->qlock);
+		pthread_join(c->reader, NULL);
+		pthread_mutex_destroy(&c->lock);
+		pthread_cond_destroy(&c->idle);
+		free(c);
+		pthread_mutex_lock(&srv->qlock);
+		pc = &srv->conns;
+	}
+	pthread_mutex_unlock(&srv->qlock);
+}
+
+static void *evald_acceptor(void *arg)
+{
+	evald_server *srv = (evald_server *)arg;
+	evald_conn *conn;
+	int fd;
+
+	for (;;) {
+		fd = accept(srv->listen_fd, NULL, NULL);
+		if (fd < 0) {
+			if (errno == EINTR || errno == ECONNABORTED) { continue; }
+			break;
+		}
+
+		evald_reap(srv,0);
+
+		conn = (evald_conn *)calloc(1,sizeof(evald_conn));
+		if (!conn) {
+			close(fd);
+			continue;
+		}
+		conn->fd = fd;
+		conn->srv = srv;
+		pthread_mutex_init(&conn->lock, NULL);
+		pthread_cond_init(&conn->idle, NULL);
+
+		pthread_mutex_lock(&srv->qlock);
+		if (srv->stopping || pthread_create(&conn->reader, NULL, evald_reader, conn) != 0) {
+			pthread_mutex_unlock(&srv->qlock);
+			close(fd);
+			pthread_mutex_destroy(&conn->lock);
+			pthread_cond_destroy(&conn->idle);
+			free(conn);
+			continue;
+		}
+		conn->next = srv->conns;
+		srv->conns = conn;
+		pthread_mutex_unlock(&srv->qlock);
+	}
+
+	return NULL;
+}
+
+/*
+ * Start an evaluator listening on a Unix domain socket
+ * Inputs:
+ *   - Socket path: path (replaced if it exists)
+ *   - BHJL public parameters: n, k, and precomputed encryption of 1: enc1
+ *   - Optional fixed-base table of enc1 for k-bit exponents (see
+ *     keystore_load_public, must outlive the server), NULL to build one
+ *   - Number of worker threads: workers
+ *   - Maximum number of queued jobs before readers block: depth
+ *   - Stream for per-job timings (or NULL): log
+ * Outputs:
+ *   - Running server handle: srv (release with evald_stop)
+ * Assumptions:
+ *   - all I/O pointers are allocated and initialized by caller
+ */
+int evald_start(evald_server **srv, const char *path,
+	            const mpz_t n, const int k, const mpz_t enc1, const mexp_table *enc1_tab,
+	            const int workers, const int depth, FILE *log)
+{
+	evald_server *s;
+	struct sockaddr_un addr;
+	int i;
+
+	if (strlen(path) >= sizeof(addr.sun_path) || workers < 1 || depth < 1) { return 1; }
+
+	s = (evald_server *)calloc(1,sizeof(evald_server));
+	if (!s) { return 1; }
+
+	strcpy(s->path, path);
+	mpz_init_set(s->n, n);
+	mpz_init_set(s->enc1, enc1);
+	s->k = k;
+	s->depth = depth;
+	s->log = log;
+	pthread_mutex_init(&s->qlock, NULL);
+	pthread_cond_init(&s->qnotempty, NULL);
+	pthread_cond_init(&s->qnotfull, NULL);
+
+	// Warm fixed-base table for enc1 (exponents are reduced mod 2^k)
+	if (enc1_tab && enc1_tab->w*enc1_tab->nwin >= k) {
+		s->enc1_tab = enc1_tab;
+	} else {
+		if (mexp_table_init(&s->own_tab,enc1,k,mexp_table_window(k,1<<16),n) != 0) { goto fail; }
+		s->enc1_tab = &s->own_tab;
+	}
+
+	s->listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (s->listen_fd < 0) { goto fail_tab; }
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	unlink(path);
+	if (bind(s->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+	    listen(s->listen_fd, 64) != 0) {
+		goto fail_sock;
+	}
+
+	s->workers = (pthread_t *)malloc(workers*sizeof(pthread_t));
+	if (!s->workers) { goto fail_sock; }
+	for (i=0;i<workers;i++) {
+		if (pthread_create(&s->workers[i], NULL, evald_worker, s) != 0) { break; }
+	}
+	s->nworkers = i;
+	if (s->nworkers == 0 || pthread_create(&s->acceptor, NULL, evald_acceptor, s) != 0) {
+		pthread_mutex_lock(&s->qlock);
+		s->stopping = 1;
+		pthread_cond_broadcast(&s->qnotempty);
+		pthread_mutex_unlock(&s->qlock);
+		for (i=0;i<s->nworkers;i++) { pthread_join(s->workers[i], NULL); }
+		free(s->workers);
+		goto fail_sock;
+	}
+
+	*srv = s;
+	return 0;
+
+fail_sock:
+	close(s->listen_fd);
+	unlink(path);
+fail_tab:
+	if (s->enc1_tab == &s->own_tab) { mexp_table_clear(&s->own_tab); }
+fail:
+	mpz_clears(s->n, s->enc1, NULL);
+	free(s);
+	return 1;
+}
+
+/*
+ * Stop an evaluator: closes the listening socket and all connections,
+ * drains queued jobs and releases the server handle.
+ */
+int evald_stop(evald_server *srv)
+{
+	int i;
+
+	shutdown(srv->listen_fd, SHUT_RDWR);
+	pthread_join(srv->acceptor, NULL);
+	close(srv->listen_fd);
+
+	evald_reap(srv,1);
+
+	pthread_mutex_lock(&srv->qlock);
+	srv->stopping = 1;
+	pthread_cond_broadcast(&srv->qnotempty);
+	pthread_cond_broadcast(&srv->qnotfull);
+	pthread_mutex_unlock(&srv->qlock);
+	for (i=0;i<srv->nworkers;i++) { pthread_join(srv->workers[i], NULL); }
+
+	unlink(srv->path);
+	if (srv->enc1_tab == &srv->own_tab) { mexp_table_clear(&srv->own_tab); }
+	mpz_clears(srv->n, srv->enc1, NULL);
+	pthread_mutex_destroy(&srv->qlock);
+	pthread_cond_destroy(&srv->qnotempty);
+	pthread_cond_destroy(&srv->qnotfull);
+	free(srv->workers);
+	free(srv);
+
+	return 0;
+}
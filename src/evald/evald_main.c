@@ -0,0 +1,68 @@
+#include <stdlib.h> 
+#include <stdio.h>
+#include <signal.h>
+#include <pthread.h>
+#include <gmp.h>
+
+#include "keystore.h"
+#include "evald.h"
+#include "tune.h"
+
+/*
+ * labhe-evald: shared evaluator daemon
+ * Usage: labhe-evald <socket path> <public parameters file> [workers] [queue depth]
+ * The parameters file is a public key-store file, or a text file with 
+ * n=..., k=... and enc1=... lines. A key store stays mapped while the
+ * daemon runs, and its enc1 table is used instead of building one.
+ * Without [workers], the thread count comes from the key store's tuning
+ * profile (4 if there is none).
+ * Per-job timings are reported on stderr; stops on SIGINT/SIGTERM.
+ */
+int main(int argc, char* argv[])
+{
+	mpz_t n, enc1;
+	keystore_pub kp;
+	int k, workers, depth, sig, have_ks = 0;
+	sigset_t set;
+	evald_server *srv;
+
+	if (argc < 3) {
+		fprintf(stderr,"usage: %s <socket> <params> [workers] [depth]\n",argv[0]);
+		exit(1);
+	}
+
+	mpz_inits(n, enc1, NULL);
+	if (keystore_load_public(&kp,argv[2]) == 0) {
+		mpz_set(n,kp.n);
+		mpz_set(enc1,kp.enc1);
+		k = kp.k;
+		have_ks = 1;
+	} else if (evald_load_params(argv[2],n,&k,enc1) != 0) {
+		fprintf(stderr,"cannot load parameters from %s\n",argv[2]);
+		exit(1);
+	}
+
+	// Default thread count from the key store's tuning profile, if any
+	workers = (argc > 3) ? atoi(argv[3]) : (tune_get() ? tune_workers() : 4);
+	depth = (argc > 4) ? atoi(argv[4]) : 4*workers;
+
+	// Signals are handled synchronously by the main thread only
+	sigemptyset(&set);
+	sigaddset(&set, SIGINT);
+	sigaddset(&set, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+	if (evald_start(&srv,argv[1],n,k,enc1,have_ks ? &kp.enc1tab : NULL,workers,depth,stderr) != 0) {
+		fprintf(stderr,"cannot listen on %s\n",argv[1]);
+		exit(1);
+	}
+	fprintf(stderr,"listening on %s (%d workers, depth %d)\n",argv[1],workers,depth);
+
+	sigwait(&set, &sig);
+
+	evald_stop(srv);
+	if (have_ks) { keystore_close_public(&kp); }
+	mpz_clears(n, enc1, NULL);
+
+	exit(0);
+}
@@ -0,0 +1,248 @@
+#include <gmp.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "evald.h"
+
+static void put32(unsigned char *b, const uint32_t v)
+{
+	b[0] = v>>24; b[1] = v>>16; b[2] = v>>8; b[3] = v;
+}
+
+static uint32_t get32(const unsigned char *b)
+{
+	return ((uint32_t)b[0]<<24) | ((uint32_t)b[1]<<16) | ((uint32_t)b[2]<<8) | b[3];
+}
+
+static int write_full(int fd, const unsigned char *buf, size_t len)
+{
+	ssize_t r;
+
+	while (len > 0) {
+		r = send(fd, buf, len, MSG_NOSIGNAL);
+		if (r < 0 && errno == EINTR) { continue; }
+		if (r <= 0) { return 1; }
+		buf += r;
+		len -= r;
+	}
+	return 0;
+}
+
+static int read_full(int fd, unsigned char *buf, size_t len)
+{
+	ssize_t r;
+
+	while (len > 0) {
+		r = read(fd, buf, len);
+		if (r < 0 && errno == EINTR) { continue; }
+		if (r <= 0) { return 1; }
+		buf += r;
+		len -= r;
+	}
+	return 0;
+}
+
+/*
+ * Number of fixed-width fields per item of a frame
+ * Inputs: 
+ *   - Operation and ciphertext level of the frame: op, level
+ *   - Whether the frame is a response: response
+ * Outputs: number of fields (0 if op/level combination is invalid)
+ */
+int evald_fields(const int op, const int level, const int response)
+{
+	if (response || op == EVALD_OP_SUM) {
+		if (level == 0) { return 2; }
+		if (level == 1) { return 1; }
+		return 0;
+	}
+	if ((op == EVALD_OP_HOMMUL || op == EVALD_OP_INNERPROD) && level == 0) { 
+		return 4; 
+	}
+	return 0;
+}
+
+/*
+ * Byte width of field j of an item with the given number of fields 
+ * (level-0 fields alternate bm, c)
+ */
+static size_t field_width(const int fields, const int j, const size_t nbytes, const size_t kbytes)
+{
+	if (fields == 1) { return nbytes; }
+	return (j&1) ? nbytes : kbytes;
+}
+
+/*
+ * Connect to a labhe-evald Unix domain socket
+ * Inputs: socket path
+ * Outputs: connected file descriptor, or -1 on error
+ */
+int evald_connect(const char *path)
+{
+	int fd;
+	struct sockaddr_un addr;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) { return -1; }
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) { return -1; }
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/*
+ * Write one frame
+ * Inputs: 
+ *   - Connected socket: fd
+ *   - Frame header: f
+ *   - f->count items with evald_fields(f->op,f->level,response) fields each: items[]
+ *   - BHJL public parameters: n, k
+ * Outputs: 0 on success, 1 on I/O error or invalid frame
+ * Assumptions: 
+ *   - items are in range 0 <= bm < 2^{k}, 0 <= c < n
+ */
+int evald_write_frame(int fd, const evald_frame *f, const mpz_t *items, const int response,
+	                  const mpz_t n, const int k)
+{
+	int fields, j;
+	uint32_t i;
+	size_t nbytes, kbytes, w, len, off, cnt, sz;
+	unsigned char *buf;
+	mpz_srcptr x;
+
+	fields = evald_fields(f->op,f->level,response);
+	if (fields == 0 && f->count != 0) { return 1; }
+
+	nbytes = (mpz_sizeinbase(n,2)+7)/8;
+	kbytes = (k+7)/8;
+
+	len = EVALD_HEADER_SIZE;
+	for (j=0;j<fields;j++) { len += (size_t)f->count*field_width(fields,j,nbytes,kbytes); }
+
+	buf = (unsigned char *)calloc(len,1);
+	if (!buf) { return 1; }
+
+	put32(buf,EVALD_MAGIC);
+	put32(buf+4,f->job);
+	buf[8] = f->op;
+	buf[9] = f->level;
+	buf[10] = f->status;
+	put32(buf+12,f->count);
+	put32(buf+16,(uint32_t)(f->compute_ns>>32));
+	put32(buf+20,(uint32_t)f->compute_ns);
+
+	off = EVALD_HEADER_SIZE;
+	for (i=0;i<f->count;i++) {
+		for (j=0;j<fields;j++) {
+			w = field_width(fields,j,nbytes,kbytes);
+			x = items[(size_t)i*fields+j];
+			sz = mpz_sgn(x) ? mpz_sizeinbase(x,256) : 0;
+			if (sz > w) {
+				free(buf);
+				return 1;
+			}
+			// right-align big-endian value in its fixed-width field
+			mpz_export(buf+off+w-sz, &cnt, 1, 1, 1, 0, x);
+			off += w;
+		}
+	}
+
+	j = write_full(fd,buf,len);
+	free(buf);
+
+	return j;
+}
+
+/*
+ * Read one frame
+ * Inputs: 
+ *   - Connected socket: fd
+ *   - Whether a response frame is expected: response
+ *   - BHJL public parameters: n, k
+ * Outputs: 
+ *   - Frame header: f (zero fields that were not read, e.g. on a bad
+ *     magic, so that BADREQ replies echo no stale bytes)
+ *   - Newly allocated items (release with evald_items_clear): items
+ *   - Returns 0 on success, 1 on I/O error/EOF, 2 on malformed frame
+ */
+int evald_read_frame(int fd, evald_frame *f, mpz_t **items, const int response,
+	                 const mpz_t n, const int k)
+{
+	int fields, j;
+	uint32_t i;
+	size_t nbytes, kbytes, w, len, off, nelems;
+	unsigned char hdr[EVALD_HEADER_SIZE], *buf;
+
+	*items = NULL;
+	memset(f, 0, sizeof(evald_frame));
+	if (read_full(fd,hdr,EVALD_HEADER_SIZE) != 0) { return 1; }
+	if (get32(hdr) != EVALD_MAGIC) { return 2; }
+
+	f->job = get32(hdr+4);
+	f->op = hdr[8];
+	f->level = hdr[9];
+	f->status = hdr[10];
+	f->count = get32(hdr+12);
+	f->compute_ns = ((uint64_t)get32(hdr+16)<<32) | get32(hdr+20);
+
+	fields = evald_fields(f->op,f->level,response);
+	if (f->count == 0) { return 0; }
+	if (fields == 0 || f->count > EVALD_MAX_COUNT) { return 2; }
+
+	nbytes = (mpz_sizeinbase(n,2)+7)/8;
+	kbytes = (k+7)/8;
+
+	len = 0;
+	for (j=0;j<fields;j++) { len += (size_t)f->count*field_width(fields,j,nbytes,kbytes); }
+
+	buf = (unsigned char *)malloc(len);
+	if (!buf) { return 1; }
+	if (read_full(fd,buf,len) != 0) {
+		free(buf);
+		return 1;
+	}
+
+	nelems = (size_t)f->count*fields;
+	*items = (mpz_t *)malloc(nelems*sizeof(mpz_t));
+	if (!*items) {
+		free(buf);
+		return 1;
+	}
+
+	off = 0;
+	for (i=0;i<f->count;i++) {
+		for (j=0;j<fields;j++) {
+			w = field_width(fields,j,nbytes,kbytes);
+			mpz_init((*items)[(size_t)i*fields+j]);
+			mpz_import((*items)[(size_t)i*fields+j], w, 1, 1, 1, 0, buf+off);
+			off += w;
+		}
+	}
+	free(buf);
+
+	return 0;
+}
+
+/*
+ * Release items returned by evald_read_frame
+ */
+void evald_items_clear(mpz_t *items, const uint32_t nelems)
+{
+	uint32_t i;
+
+	if (!items) { return; }
+	for (i=0;i<nelems;i++) { mpz_clear(items[i]); }
+	free(items);
+}
@@ -0,0 +1,445 @@
+#include <gmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "KeccakPRGWidth1600.h"
+
+#include "prf.h"
+#include "keystore.h"
+#include "tune.h"
+
+#define KS_MAGIC "LABHEKS"
+#define KS_VERSION 1
+#define KS_ENDIAN 0x01020304
+#define KS_ALIGN 64
+#define KS_DIGEST_SIZE 16
+
+#define KS_KIND_PUBLIC 1
+#define KS_KIND_SECRET 2
+
+// Entry identifiers
+#define KS_N 1
+#define KS_Y 2
+#define KS_2K 3
+#define KS_ENC1 4
+#define KS_YTAB 5
+#define KS_ENC1TAB 6
+#define KS_P 16
+#define KS_D 17
+#define KS_2K1 18
+#define KS_PM12K 19
+#define KS_DPOW 20
+
+#define KS_MAX_ENTRIES 8
+
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint32_t endian;
+	uint32_t kind;
+	uint32_t k;
+	uint32_t limb_bits;
+	uint32_t nentries;
+	uint32_t prf_backend;
+	uint32_t reserved;
+	uint64_t file_size;
+	unsigned char digest[KS_DIGEST_SIZE]; // Keccak of everything after the header
+} ks_header;
+
+typedef struct {
+	uint32_t id;
+	uint32_t count;  // number of values
+	uint32_t limbs;  // limbs per value
+	uint32_t aux;    // window width for tables
+	uint64_t offset; // from start of file, KS_ALIGN aligned
+} ks_entry;
+
+typedef struct {
+	ks_entry e;
+	const mpz_t *values;
+} ks_src;
+
+static void ks_digest(unsigned char *digest, const unsigned char *data, size_t len)
+{
+	KeccakWidth1600_SpongePRG_Instance instance;
+	unsigned int chunk;
+
+	KeccakWidth1600_SpongePRG_Initialize(&instance, 254);
+	while (len > 0) {
+		chunk = (len > (1U<<30)) ? (1U<<30) : (unsigned int)len;
+		KeccakWidth1600_SpongePRG_Feed(&instance, data, chunk);
+		data += chunk;
+		len -= chunk;
+	}
+	KeccakWidth1600_SpongePRG_Fetch(&instance, digest, KS_DIGEST_SIZE);
+}
+
+static void ks_src_set(ks_src *s, const uint32_t id, const mpz_t *values, const uint32_t count, const uint32_t aux)
+{
+	uint32_t i;
+
+	s->e.id = id;
+	s->e.count = count;
+	s->e.aux = aux;
+	s->e.limbs = 1;
+	for (i=0;i<count;i++) {
+		if (mpz_size(values[i]) > s->e.limbs) { s->e.limbs = mpz_size(values[i]); }
+	}
+	s->values = values;
+}
+
+/*
+ * Write a key-store file: header, entry directory, then one limb array
+ * per entry; written to a temporary file and renamed into place
+ */
+static int ks_write(const char *path, const uint32_t kind, const int k, ks_src *src, const uint32_t nentries)
+{
+	ks_header *h;
+	ks_entry *dir;
+	unsigned char *buf;
+	mp_limb_t *limbs;
+	size_t size, off;
+	uint32_t i, j;
+	char *tmp;
+	ssize_t w = 0;
+	int fd, rc = 1;
+
+	off = sizeof(ks_header) + nentries*sizeof(ks_entry);
+	for (i=0;i<nentries;i++) {
+		off = (off + KS_ALIGN-1) & ~(size_t)(KS_ALIGN-1);
+		src[i].e.offset = off;
+		off += (size_t)src[i].e.count*src[i].e.limbs*sizeof(mp_limb_t);
+	}
+	size = off;
+
+	buf = (unsigned char *)calloc(size,1);
+	if (!buf) { return 1; }
+
+	h = (ks_header *)buf;
+	memcpy(h->magic, KS_MAGIC, sizeof(KS_MAGIC));
+	h->version = KS_VERSION;
+	h->endian = KS_ENDIAN;
+	h->kind = kind;
+	h->k = k;
+	h->limb_bits = GMP_NUMB_BITS;
+	h->nentries = nentries;
+	h->prf_backend = prf_backend();
+	h->file_size = size;
+
+	dir = (ks_entry *)(buf + sizeof(ks_header));
+	for (i=0;i<nentries;i++) {
+		dir[i] = src[i].e;
+		limbs = (mp_limb_t *)(buf + src[i].e.offset);
+		for (j=0;j<src[i].e.count;j++) {
+			memcpy(limbs + (size_t)j*src[i].e.limbs, mpz_limbs_read(src[i].values[j]),
+			       mpz_size(src[i].values[j])*sizeof(mp_limb_t));
+		}
+	}
+
+	ks_digest(h->digest, buf + sizeof(ks_header), size - sizeof(ks_header));
+
+	tmp = (char *)malloc(strlen(path)+5);
+	if (!tmp) {
+		free(buf);
+		return 1;
+	}
+	sprintf(tmp, "%s.tmp", path);
+
+	// Secret key files are only readable by their owner
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, (kind == KS_KIND_SECRET) ? 0600 : 0644);
+	if (fd >= 0) {
+		for (off=0;off<size;off+=w) {
+			w = write(fd, buf+off, size-off);
+			if (w <= 0) { break; }
+		}
+		rc = (off != size);
+		rc |= (close(fd) != 0);
+		if (rc == 0) { rc = (rename(tmp, path) != 0); }
+		if (rc != 0) { unlink(tmp); }
+	}
+
+	free(tmp);
+	free(buf);
+	return rc;
+}
+
+/*
+ * Save public key material and acceleration tables
+ * Inputs:
+ *   - Output file path: path
+ *   - BHJL public/precomputed parameters: n, y, k, _2k
+ *   - Precomputed encryption of 1: enc1
+ *   - Window width of fixed-base tables for y and enc1: w
+ * Outputs: 0 on success, 1 on error (the selected PRF backend is
+ *          recorded in the file)
+ */
+int keystore_save_public(const char *path,
+	                     const mpz_t n, const mpz_t y, const int k,
+	                     const mpz_t _2k, const mpz_t enc1, const int w)
+{
+	ks_src src[6];
+	mexp_table ytab, enc1tab;
+	int rc;
+
+	if (mexp_table_init(&ytab,y,k,w,n) != 0) { return 1; }
+	if (mexp_table_init(&enc1tab,enc1,k,w,n) != 0) {
+		mexp_table_clear(&ytab);
+		return 1;
+	}
+
+	ks_src_set(&src[0], KS_N, (const mpz_t *)n, 1, 0);
+	ks_src_set(&src[1], KS_Y, (const mpz_t *)y, 1, 0);
+	ks_src_set(&src[2], KS_2K, (const mpz_t *)_2k, 1, 0);
+	ks_src_set(&src[3], KS_ENC1, (const mpz_t *)enc1, 1, 0);
+	ks_src_set(&src[4], KS_YTAB, (const mpz_t *)ytab.pow, ytab.nwin*((1<<w)-1), w);
+	ks_src_set(&src[5], KS_ENC1TAB, (const mpz_t *)enc1tab.pow, enc1tab.nwin*((1<<w)-1), w);
+
+	rc = ks_write(path, KS_KIND_PUBLIC, k, src, 6);
+
+	mexp_table_clear(&ytab);
+	mexp_table_clear(&enc1tab);
+
+	return rc;
+}
+
+/*
+ * Save secret key material and decryption tables
+ * Inputs:
+ *   - Output file path: path
+ *   - BHJL secret/precomputed parameters: p, D, k, _2k1, pm12k
+ * Outputs: 0 on success, 1 on error (the selected PRF backend is
+ *          recorded in the file)
+ */
+int keystore_save_secret(const char *path,
+	                     const mpz_t p, const mpz_t D, const int k,
+	                     const mpz_t _2k1, const mpz_t pm12k)
+{
+	ks_src src[5];
+	mpz_t *Dpow;
+	int j, rc;
+
+	Dpow = (mpz_t *)malloc(k*sizeof(mpz_t));
+	if (!Dpow) { return 1; }
+	mpz_init_set(Dpow[0],D);
+	for (j=1;j<k;j++) {
+		mpz_init(Dpow[j]);
+		mpz_powm_ui(Dpow[j],Dpow[j-1],2,p);
+	}
+
+	ks_src_set(&src[0], KS_P, (const mpz_t *)p, 1, 0);
+	ks_src_set(&src[1], KS_D, (const mpz_t *)D, 1, 0);
+	ks_src_set(&src[2], KS_2K1, (const mpz_t *)_2k1, 1, 0);
+	ks_src_set(&src[3], KS_PM12K, (const mpz_t *)pm12k, 1, 0);
+	ks_src_set(&src[4], KS_DPOW, (const mpz_t *)Dpow, k, 0);
+
+	rc = ks_write(path, KS_KIND_SECRET, k, src, 5);
+
+	for (j=0;j<k;j++) { mpz_clear(Dpow[j]); }
+	free(Dpow);
+
+	return rc;
+}
+
+/*
+ * Map and validate a key-store file
+ * Outputs: mapping, its size and the header/directory within it
+ */
+static int ks_map(const char *path, const uint32_t kind, void **map, size_t *map_size,
+	              const ks_header **hdr, const ks_entry **dir)
+{
+	int fd;
+	struct stat st;
+	const ks_header *h;
+	const ks_entry *d;
+	unsigned char digest[KS_DIGEST_SIZE];
+	uint32_t i;
+	void *m;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) { return 1; }
+	if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(ks_header)) {
+		close(fd);
+		return 1;
+	}
+	m = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (m == MAP_FAILED) { return 1; }
+
+	h = (const ks_header *)m;
+	d = (const ks_entry *)((const unsigned char *)m + sizeof(ks_header));
+	if (memcmp(h->magic, KS_MAGIC, sizeof(KS_MAGIC)) != 0 || h->version != KS_VERSION ||
+	    h->endian != KS_ENDIAN || h->kind != kind || h->limb_bits != GMP_NUMB_BITS ||
+	    h->file_size != (uint64_t)st.st_size || h->nentries > KS_MAX_ENTRIES ||
+	    (h->prf_backend != PRF_BACKEND_KECCAK && h->prf_backend != PRF_BACKEND_AES) ||
+	    sizeof(ks_header) + h->nentries*sizeof(ks_entry) > (size_t)st.st_size) {
+		munmap(m, st.st_size);
+		return 1;
+	}
+	for (i=0;i<h->nentries;i++) {
+		if (d[i].offset % KS_ALIGN != 0 || d[i].offset > (uint64_t)st.st_size ||
+		    (uint64_t)d[i].count*d[i].limbs*sizeof(mp_limb_t) > (uint64_t)st.st_size - d[i].offset) {
+			munmap(m, st.st_size);
+			return 1;
+		}
+	}
+
+	ks_digest(digest, (const unsigned char *)m + sizeof(ks_header), st.st_size - sizeof(ks_header));
+	if (memcmp(digest, h->digest, KS_DIGEST_SIZE) != 0) {
+		munmap(m, st.st_size);
+		return 1;
+	}
+
+	*map = m;
+	*map_size = st.st_size;
+	*hdr = h;
+	*dir = d;
+	return 0;
+}
+
+static const ks_entry *ks_find(const ks_header *h, const ks_entry *dir, const uint32_t id)
+{
+	uint32_t i;
+
+	for (i=0;i<h->nentries;i++) {
+		if (dir[i].id == id) { return &dir[i]; }
+	}
+	return NULL;
+}
+
+/*
+ * Read-only view of value j of entry e
+ */
+static void ks_view(mpz_t x, const void *map, const ks_entry *e, const uint32_t j)
+{
+	mpz_roinit_n(x, (const mp_limb_t *)((const unsigned char *)map + e->offset) + (size_t)j*e->limbs, e->limbs);
+}
+
+static int ks_view_one(mpz_t x, const void *map, const ks_header *h, const ks_entry *dir, const uint32_t id)
+{
+	const ks_entry *e = ks_find(h, dir, id);
+
+	if (!e || e->count != 1) { return 1; }
+	ks_view(x, map, e, 0);
+	return 0;
+}
+
+static int ks_view_table(mexp_table *tab, const void *map, const ks_header *h, const ks_entry *dir, const uint32_t id)
+{
+	const ks_entry *e = ks_find(h, dir, id);
+	uint32_t j;
+
+	if (!e || e->aux < 1 || e->aux > 16 || e->count % ((1U<<e->aux)-1) != 0) { return 1; }
+	tab->w = e->aux;
+	tab->nwin = e->count/((1<<e->aux)-1);
+	tab->pow = (mpz_t *)malloc(e->count*sizeof(mpz_t));
+	if (!tab->pow) { return 1; }
+	for (j=0;j<e->count;j++) { ks_view(tab->pow[j], map, e, j); }
+	return 0;
+}
+
+/*
+ * Install the tuning profile stored next to a key-store file if there
+ * is one for these parameters (limbs of n, or of p for secret files)
+ */
+static void ks_tune(const char *path, const int k, const int limbs, const int secret)
+{
+	labhe_tune t;
+	char tpath[1024];
+
+	if (tune_path(tpath, sizeof(tpath), path) != 0 || tune_load(&t, tpath) != 0) { return; }
+	if (t.k != k || (secret ? t.plimbs : t.nlimbs) != limbs) { return; }
+	tune_set(&t);
+}
+
+/*
+ * Load public key material and tables
+ * Inputs: key-store file path
+ * Outputs: ks (release with keystore_close_public); 0 on success, 1 on
+ *          missing, corrupted or incompatible file. A matching tuning
+ *          profile next to the file (see tune_path) is installed.
+ */
+int keystore_load_public(keystore_pub *ks, const char *path)
+{
+	const ks_header *h;
+	const ks_entry *dir;
+
+	memset(ks, 0, sizeof(*ks));
+	if (ks_map(path, KS_KIND_PUBLIC, &ks->map, &ks->map_size, &h, &dir) != 0) { return 1; }
+	ks->k = h->k;
+	ks->prf_backend = h->prf_backend;
+
+	if (ks_view_one(ks->n, ks->map, h, dir, KS_N) != 0 ||
+	    ks_view_one(ks->y, ks->map, h, dir, KS_Y) != 0 ||
+	    ks_view_one(ks->_2k, ks->map, h, dir, KS_2K) != 0 ||
+	    ks_view_one(ks->enc1, ks->map, h, dir, KS_ENC1) != 0 ||
+	    ks_view_table(&ks->ytab, ks->map, h, dir, KS_YTAB) != 0 ||
+	    ks_view_table(&ks->enc1tab, ks->map, h, dir, KS_ENC1TAB) != 0) {
+		keystore_close_public(ks);
+		return 1;
+	}
+	ks_tune(path, ks->k, (int)mpz_size(ks->n), 0);
+	return 0;
+}
+
+/*
+ * Load secret key material and decryption tables
+ * Inputs: key-store file path
+ * Outputs: ks (release with keystore_close_secret); 0 on success, 1 on
+ *          missing, corrupted or incompatible file. A matching tuning
+ *          profile next to the file (see tune_path) is installed.
+ */
+int keystore_load_secret(keystore_sec *ks, const char *path)
+{
+	const ks_header *h;
+	const ks_entry *dir, *e;
+	uint32_t j;
+
+	memset(ks, 0, sizeof(*ks));
+	if (ks_map(path, KS_KIND_SECRET, &ks->map, &ks->map_size, &h, &dir) != 0) { return 1; }
+	ks->k = h->k;
+	ks->prf_backend = h->prf_backend;
+
+	e = ks_find(h, dir, KS_DPOW);
+	if (ks_view_one(ks->p, ks->map, h, dir, KS_P) != 0 ||
+	    ks_view_one(ks->D, ks->map, h, dir, KS_D) != 0 ||
+	    ks_view_one(ks->_2k1, ks->map, h, dir, KS_2K1) != 0 ||
+	    ks_view_one(ks->pm12k, ks->map, h, dir, KS_PM12K) != 0 ||
+	    !e || e->count != h->k) {
+		keystore_close_secret(ks);
+		return 1;
+	}
+
+	ks->Dpow = (mpz_t *)malloc(e->count*sizeof(mpz_t));
+	if (!ks->Dpow) {
+		keystore_close_secret(ks);
+		return 1;
+	}
+	for (j=0;j<e->count;j++) { ks_view(ks->Dpow[j], ks->map, e, j); }
+	ks_tune(path, ks->k, (int)mpz_size(ks->p), 1);
+
+	return 0;
+}
+
+/*
+ * Release a loaded key store (views become invalid)
+ */
+void keystore_close_public(keystore_pub *ks)
+{
+	free(ks->ytab.pow);
+	free(ks->enc1tab.pow);
+	if (ks->map) { munmap(ks->map, ks->map_size); }
+	memset(ks, 0, sizeof(*ks));
+}
+
+void keystore_close_secret(keystore_sec *ks)
+{
+	free(ks->Dpow);
+	if (ks->map) { munmap(ks->map, ks->map_size); }
+	memset(ks, 0, sizeof(*ks));
+}
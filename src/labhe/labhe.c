@@ -1,9 +1,41 @@
 #include <gmp.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "prf.h"
+#include "rng.h"
 #include "bhjl.h"
+#include "mexp.h"
+#include "mont.h"
+#include "tune.h"
 #include "labhe.h"
+#include "labhe_pool.h"
+#include "labhe_maskidx.h"
+
+#define LABHE_CACHE_LINE 64
+
+// Per-worker temporaries of the pooled batch routines
+typedef struct {
+	mpz_t t1, t2, t3;
+} __attribute__((aligned(LABHE_CACHE_LINE))) labhe_scratch;
+
+static labhe_scratch *labhe_scratch_alloc(const int nw)
+{
+	labhe_scratch *s;
+	int i;
+
+	if (posix_memalign((void **)&s, LABHE_CACHE_LINE, nw*sizeof(labhe_scratch)) != 0) { return NULL; }
+	for (i=0;i<nw;i++) { mpz_inits(s[i].t1, s[i].t2, s[i].t3, NULL); }
+	return s;
+}
+
+static void labhe_scratch_free(labhe_scratch *s, const int nw)
+{
+	int i;
+
+	for (i=0;i<nw;i++) { mpz_clears(s[i].t1, s[i].t2, s[i].t3, NULL); }
+	free(s);
+}
 
 /*
  * Batch Labelled HE encryption for #count messages using sequencial
@@ -15,7 +47,8 @@
  *   - State of GMP randomness generator
  * Outputs:
  *   - #count instances of the precomputed parameters b_masks and 
- *     eb_masks (eb_masks are part of the final ciphertext)
+ *     eb_masks (eb_masks are part of the final ciphertext); with
+ *     eb_masks NULL only b_masks are computed (linear-only datasets)
  * Assumptions: 
  *   - all I/O pointers are allocated and initialized by caller
  *   - GMP randomness state is managed by the caller
@@ -26,23 +59,157 @@ int labhe_encrypt_offline_batch(mpz_t *b_masks, mpz_t *eb_masks, const int start
 	             				const mpz_t _2k, 
 	             				gmp_randstate_t gmpRandState) 
 {
-	int i;
-	mpz_t b_mask_num;
-	unsigned char b_mask_buf[NONCE_SIZE], label[LABEL_SIZE];
+	int i, j, cnt, rc = 0;
+	mpz_t b_mask_nums[PRF_BATCH], xs[PRF_BATCH];
+	unsigned char b_mask_buf[NONCE_SIZE*PRF_BATCH];
 
-	for(i=0;i<LABEL_SIZE;i++) { label[i] = 0; }
+	for (j=0;j<PRF_BATCH;j++) { mpz_inits(b_mask_nums[j],xs[j],NULL); }
+	for (i=0;i<count;i+=cnt) {
+		cnt = count - i < PRF_BATCH ? count - i : PRF_BATCH;
+		prf_batch_seq(b_mask_buf,start_label + i,cnt,sk);
+		for (j=0;j<cnt;j++) {
+			mpz_import(b_mask_nums[j], NONCE_SIZE, 1, sizeof(b_mask_buf[0]), 0, 0, b_mask_buf + j*NONCE_SIZE);
+			mpz_sub(b_masks[i+j],_2k,b_mask_nums[j]);
+			// Randomizers in the order bhjl_encrypt would draw them
+			if (eb_masks) { mpz_urandomm(xs[j],gmpRandState,n); }
+		}
+		if (eb_masks) {
+			rc |= bhjl_encrypt_x_batch(eb_masks + i,(const mpz_t *)b_mask_nums,(const mpz_t *)xs,cnt,n,y,k,_2k);
+		}
+	}
+	for (j=0;j<PRF_BATCH;j++) { mpz_clears(b_mask_nums[j],xs[j],NULL); }
 
-	mpz_init(b_mask_num);
-	for (i=0;i<count;i++) {
-		*(int *)label = start_label + i;
-		prf(b_mask_buf,label,sk);
-		mpz_import(b_mask_num, NONCE_SIZE, 1, sizeof(b_mask_buf[0]), 0, 0, b_mask_buf);
-		bhjl_encrypt(eb_masks[i],b_mask_num,n,y,k,_2k,gmpRandState);
-		mpz_sub(b_masks[i],_2k,b_mask_num);
+	return rc;
+}
+
+typedef struct {
+	mpz_t *b_masks, *eb_masks;
+	const int *labels;   // label list, or NULL for start_label + i
+	int start_label, k;
+	const unsigned char *sk;
+	const mpz_t *n, *y, *_2k;
+	const labhe_rng *rng;
+} offline_job;
+
+static int offline_chunk(void *arg, const int i0, const int i1, const int worker)
+{
+	offline_job *job = (offline_job *)arg;
+	unsigned char b_mask_buf[NONCE_SIZE*PRF_BATCH];
+	mpz_t b_mask_nums[PRF_BATCH], xs[PRF_BATCH];
+	int i, j, cnt, label, rc = 0;
+
+	(void)worker;
+
+	for (j=0;j<PRF_BATCH;j++) { mpz_inits(b_mask_nums[j],xs[j],NULL); }
+	for (i=i0;i<i1 && rc==0;i+=cnt) {
+		cnt = i1 - i < PRF_BATCH ? i1 - i : PRF_BATCH;
+		if (job->labels) {
+			prf_batch_list(b_mask_buf,job->labels + i,cnt,job->sk);
+		} else {
+			prf_batch_seq(b_mask_buf,job->start_label + i,cnt,job->sk);
+		}
+		for (j=0;j<cnt;j++) {
+			mpz_import(b_mask_nums[j], NONCE_SIZE, 1, sizeof(b_mask_buf[0]), 0, 0, b_mask_buf + j*NONCE_SIZE);
+			if (job->b_masks) { mpz_sub(job->b_masks[i+j],*job->_2k,b_mask_nums[j]); }
+			if (job->eb_masks) {
+				label = job->labels ? job->labels[i+j] : job->start_label + i + j;
+				rc |= rng_urandomm_label(xs[j],job->rng,label,*job->n);
+			}
+		}
+		// One PRF batch of encryptions on the batch exponentiation backend
+		if (job->eb_masks && rc == 0) {
+			rc = bhjl_encrypt_x_batch(job->eb_masks + i,(const mpz_t *)b_mask_nums,(const mpz_t *)xs,cnt,
+			                          *job->n,*job->y,job->k,*job->_2k);
+		}
 	}
-  	mpz_clear(b_mask_num);
+	for (j=0;j<PRF_BATCH;j++) { mpz_clears(b_mask_nums[j],xs[j],NULL); }
 
-	return 0;
+	return rc;
+}
+
+/*
+ * Batch Labelled HE encryption for #count messages using sequencial
+ * labels starting at start_label. This is the offline stage, with 
+ * randomizers drawn from the Keccak randomness source: the randomizer
+ * of each label depends only on (seed, stream, label), so a batch can
+ * be split across threads sharing rng without locking.
+ * Inputs: 
+ *   - Batch parameters: start_label, count
+ *   - The secret key of the encryptor: sk (use labhe_gen to create on the fly)
+ *   - BHJK public/precomputed parameters: n, y, k, _2k
+ *   - Randomness source: rng (one stream per encryptor key)
+ * Outputs:
+ *   - #count instances of the precomputed parameters b_masks and 
+ *     eb_masks (eb_masks are part of the final ciphertext); with
+ *     eb_masks NULL only b_masks are computed, a PRF per label
+ *     (linear-only datasets, see labhe_encrypt_offline_eb_set)
+ * Assumptions: 
+ *   - all I/O pointers are allocated and initialized by caller
+ *   - labels are never reused with the same rng stream
+ *   - runs on the pool installed by labhe_pool_set, if any
+ */
+int labhe_encrypt_offline_batch_rng(mpz_t *b_masks, mpz_t *eb_masks, const int start_label, const int count,
+								const unsigned char *sk,
+	             				const mpz_t n,const mpz_t y, const int k,
+	             				const mpz_t _2k, 
+	             				const labhe_rng *rng) 
+{
+	labhe_pool *pool = labhe_pool_get();
+	offline_job job;
+
+	job.b_masks = b_masks;
+	job.eb_masks = eb_masks;
+	job.labels = NULL;
+	job.start_label = start_label;
+	job.k = k;
+	job.sk = sk;
+	job.n = (const mpz_t *)n;
+	job.y = (const mpz_t *)y;
+	job._2k = (const mpz_t *)_2k;
+	job.rng = rng;
+
+	// Chunks of whole PRF batches
+	return labhe_pool_run(pool,count,PRF_BATCH,offline_chunk,&job);
+}
+
+/*
+ * On-demand eb_masks of selected labels of a linear-only dataset, for
+ * the ciphertexts that enter a quadratic query (labhe_hommul_lev0_batch,
+ * labhe_innerprod_lev0). This is the part of the offline stage that
+ * labhe_encrypt_offline_batch_rng skips without eb_masks.
+ * Inputs: 
+ *   - Selected labels: labels[0..count-1]
+ *   - The secret key of the encryptor: sk
+ *   - BHJK public/precomputed parameters: n, y, k, _2k
+ *   - Randomness source: rng (the stream of the dataset)
+ * Outputs:
+ *   - #count eb_masks; (bm, eb_masks[i]) is the level-0 ciphertext of
+ *     labels[i], equal to the one a full offline batch would have given
+ * Assumptions: 
+ *   - all I/O pointers are allocated and initialized by caller
+ *   - runs on the pool installed by labhe_pool_set, if any
+ */
+int labhe_encrypt_offline_eb_set(mpz_t *eb_masks, const int *labels, const int count,
+								const unsigned char *sk,
+	             				const mpz_t n,const mpz_t y, const int k,
+	             				const mpz_t _2k, 
+	             				const labhe_rng *rng) 
+{
+	labhe_pool *pool = labhe_pool_get();
+	offline_job job;
+
+	job.b_masks = NULL;
+	job.eb_masks = eb_masks;
+	job.labels = labels;
+	job.start_label = 0;
+	job.k = k;
+	job.sk = sk;
+	job.n = (const mpz_t *)n;
+	job.y = (const mpz_t *)y;
+	job._2k = (const mpz_t *)_2k;
+	job.rng = rng;
+
+	return labhe_pool_run(pool,count,PRF_BATCH,offline_chunk,&job);
 }
 
 /*
@@ -85,23 +252,22 @@ int labhe_decrypt_offline_indep(unsigned char *sk,
 								const mpz_t pk, 
 	             				const mpz_t p,const mpz_t D,const int k,
 	             				const mpz_t _2k1,const mpz_t pm12k) {
-	int i;
 	size_t sk_size;
 	mpz_t sk_num;
-	unsigned char *sk_gmp_alloc, *aux_ptr;
 
   	mpz_init(sk_num);
 
     bhjl_decrypt(sk_num,pk,p,D,k,_2k1,pm12k);
-	sk_gmp_alloc=mpz_export(NULL, &sk_size, 1, sizeof(unsigned char), 0, 0, sk_num);
-	if (sk_size != SK_SIZE) { return 1; };
+	if (mpz_sizeinbase(sk_num,2) > 8*SK_SIZE) {
+		mpz_clear(sk_num);
+		return 1;
+	}
 
-    aux_ptr = sk_gmp_alloc;
-    for(i=SK_SIZE;i>0;i--)
-    	*sk++ = *aux_ptr++;
+	// keys with leading zero bytes export shorter than SK_SIZE
+	mpz_export(sk+SK_SIZE-(mpz_sizeinbase(sk_num,256)), &sk_size, 1, sizeof(unsigned char), 0, 0, sk_num);
+	memset(sk, 0, SK_SIZE-sk_size);
 
   	mpz_clear(sk_num);
-  	free(sk_gmp_alloc);
 
 	return 0;
 }
@@ -115,7 +281,8 @@ int labhe_decrypt_offline_indep(unsigned char *sk,
  *   - Lengths of both batches/vectors: count
  *   - Public/precomputed BHJK parameters: k, _2k1
  * Outputs:
- *   - Precomputed mask b
+ *   - Precomputed mask b (from an installed labhe_maskidx when one
+ *     covers complete blocks of the range)
  * Assumptions: 
  *   - all I/O pointers are allocated and initialized by caller
  */
@@ -125,11 +292,10 @@ int labhe_decrypt_offline_ip_sk(mpz_t b, const unsigned char*sk1, const unsigned
 {
 	int i;
 	mpz_t b_mask_num1,b_mask_num2, t1, t2,_2km1;
-	unsigned char b_mask_buf1[NONCE_SIZE], label1[LABEL_SIZE];
-	unsigned char b_mask_buf2[NONCE_SIZE], label2[LABEL_SIZE];
+	unsigned char b_mask_buf1[NONCE_SIZE*PRF_BATCH];
+	unsigned char b_mask_buf2[NONCE_SIZE*PRF_BATCH];
 
-	for(i=0;i<LABEL_SIZE;i++) { label1[i] = 0; }
-	for(i=0;i<LABEL_SIZE;i++) { label2[i] = 0; }
+	if (labhe_maskidx_lookup_ip(b,sk1,sk2,start_label1,start_label2,count,k) == 0) { return 0; }
 
 	mpz_init(t1);
 	mpz_init(_2km1);
@@ -141,12 +307,12 @@ int labhe_decrypt_offline_ip_sk(mpz_t b, const unsigned char*sk1, const unsigned
 	mpz_init(t2);
 	mpz_set_ui(b,0);
 	for (i=0;i<count;i++) {
-		*(int *)label1 = start_label1 + i;
-		prf(b_mask_buf1,label1,sk1);
-		*(int *)label2 = start_label2 + i;
-		prf(b_mask_buf2,label2,sk2);
-		mpz_import(b_mask_num1, NONCE_SIZE, 1, sizeof(b_mask_buf1[0]), 0, 0, b_mask_buf1);
-		mpz_import(b_mask_num2, NONCE_SIZE, 1, sizeof(b_mask_buf2[0]), 0, 0, b_mask_buf2);
+		if (i % PRF_BATCH == 0) {
+			prf_batch_seq(b_mask_buf1,start_label1 + i,count - i < PRF_BATCH ? count - i : PRF_BATCH,sk1);
+			prf_batch_seq(b_mask_buf2,start_label2 + i,count - i < PRF_BATCH ? count - i : PRF_BATCH,sk2);
+		}
+		mpz_import(b_mask_num1, NONCE_SIZE, 1, sizeof(b_mask_buf1[0]), 0, 0, b_mask_buf1 + (i % PRF_BATCH)*NONCE_SIZE);
+		mpz_import(b_mask_num2, NONCE_SIZE, 1, sizeof(b_mask_buf2[0]), 0, 0, b_mask_buf2 + (i % PRF_BATCH)*NONCE_SIZE);
 		mpz_mul(t1,b_mask_num1,b_mask_num2);
 		mpz_add(t2,b,t1);
 		mpz_and(b,_2km1,t2);
@@ -193,7 +359,8 @@ int labhe_decrypt_offline_ip(mpz_t b,
  *   - Length of batch/vector: count
  *   - Public BHJK parameter: k
  * Outputs:
- *   - Precomputed mask b
+ *   - Precomputed mask b (from an installed labhe_maskidx when one
+ *     covers complete blocks of the range)
  * Assumptions: 
  *   - all I/O pointers are allocated and initialized by caller
  */
@@ -203,17 +370,18 @@ int labhe_decrypt_offline_sum0_sk(mpz_t b, const unsigned char* sk,
 {
 	int i;
 	mpz_t b_mask_num, t;
-	unsigned char b_mask_buf[NONCE_SIZE], label[LABEL_SIZE];
+	unsigned char b_mask_buf[NONCE_SIZE*PRF_BATCH];
 
-	for(i=0;i<LABEL_SIZE;i++) { label[i] = 0; }
+	if (labhe_maskidx_lookup_sum0(b,sk,start_label,count,k) == 0) { return 0; }
 
 	mpz_init(t);
 	mpz_init(b_mask_num);
   	mpz_set_ui(b, 0);
 	for(i=0;i<count;i++) {
-		*(int *)label = start_label + i;
-		prf(b_mask_buf,label,sk);
-		mpz_import(b_mask_num, NONCE_SIZE, 1, sizeof(b_mask_buf[0]), 0, 0, b_mask_buf);
+		if (i % PRF_BATCH == 0) {
+			prf_batch_seq(b_mask_buf,start_label + i,count - i < PRF_BATCH ? count - i : PRF_BATCH,sk);
+		}
+		mpz_import(b_mask_num, NONCE_SIZE, 1, sizeof(b_mask_buf[0]), 0, 0, b_mask_buf + (i % PRF_BATCH)*NONCE_SIZE);
 		mpz_add(t,b,b_mask_num);
 		mpz_clrbit(t,k);
 		mpz_set(b,t);
@@ -224,6 +392,45 @@ int labhe_decrypt_offline_sum0_sk(mpz_t b, const unsigned char* sk,
 	return 0;
 }
 
+/*
+ * LABHE decryption: offline function-dependent stage for the
+ * particular case of a linear combination of a vector of 0-level 
+ * encrypted messages (one row of labhe_lincomb_lev0).
+ * Inputs: 
+ *   - Encryptor secret key: sk
+ *   - Starting label for batch of ciphertexts: start_label
+ *   - Weights of the linear combination: w[]
+ *   - Length of batch/vector: count
+ *   - Public BHJK parameter: k
+ * Outputs:
+ *   - Precomputed mask b
+ * Assumptions: 
+ *   - all I/O pointers are allocated and initialized by caller
+ */
+int labhe_decrypt_offline_lincomb_sk(mpz_t b, const unsigned char* sk,
+								const int start_label, const mpz_t *w, const int count,
+								const int k)
+{
+	int i;
+	mpz_t b_mask_num;
+	unsigned char b_mask_buf[NONCE_SIZE*PRF_BATCH];
+
+	mpz_init(b_mask_num);
+  	mpz_set_ui(b, 0);
+	for(i=0;i<count;i++) {
+		if (i % PRF_BATCH == 0) {
+			prf_batch_seq(b_mask_buf,start_label + i,count - i < PRF_BATCH ? count - i : PRF_BATCH,sk);
+		}
+		mpz_import(b_mask_num, NONCE_SIZE, 1, sizeof(b_mask_buf[0]), 0, 0, b_mask_buf + (i % PRF_BATCH)*NONCE_SIZE);
+		mpz_addmul(b,w[i],b_mask_num);
+	}	
+	mpz_fdiv_r_2exp(b,b,k);
+
+	mpz_clear(b_mask_num);
+	
+	return 0;
+}
+
 /*
  * LABHE decryption: full offline stage for the
  * particular case of of summing a vector of 0-level encrypted 
@@ -326,8 +533,60 @@ int labhe_decrypt_nooff0(mpz_t m, const mpz_t mb,const mpz_t c,
 	return 0;
 }
 
+typedef struct {
+	mpz_t *c;
+	const mpz_t *bm1, *c1, *bm2, *c2;
+	const mpz_t *n, *enc1;
+	int k;
+	const mont_ctx *ctx;
+	labhe_scratch *tmp;
+} hommul_job;
+
+static int hommul_chunk(void *arg, const int i0, const int i1, const int worker)
+{
+	hommul_job *job = (hommul_job *)arg;
+	mpz_ptr t1 = job->tmp[worker].t1, t2 = job->tmp[worker].t2, t3 = job->tmp[worker].t3;
+	mpz_t bases[3*MONT_LANES], exps[3*MONT_LANES], e[MONT_LANES];
+	int i, j, cnt, rc = 0;
+
+	if (job->ctx) {
+		// enc1^{bm1*bm2 mod 2^k} c1^{bm2} c2^{bm1} with shared squarings,
+		// MONT_LANES products at a time on the batch backend
+		for (j=0;j<MONT_LANES;j++) { mpz_init(e[j]); }
+		for (i=i0;i<i1;i+=cnt) {
+			cnt = (i1 - i < MONT_LANES) ? i1 - i : MONT_LANES;
+			for (j=0;j<cnt;j++) {
+				mpz_mul(e[j],job->bm1[i+j],job->bm2[i+j]);
+				mpz_fdiv_r_2exp(e[j],e[j],job->k);
+				bases[3*j][0] = (*job->enc1)[0];
+				exps[3*j][0] = e[j][0];
+				bases[3*j+1][0] = job->c1[i+j][0];
+				exps[3*j+1][0] = job->bm2[i+j][0];
+				bases[3*j+2][0] = job->c2[i+j][0];
+				exps[3*j+2][0] = job->bm1[i+j][0];
+			}
+			rc |= mont_powm_multi_batch(job->c+i,(const mpz_t *)bases,(const mpz_t *)exps,3,cnt,job->ctx);
+		}
+		for (j=0;j<MONT_LANES;j++) { mpz_clear(e[j]); }
+		return rc;
+	}
+
+	for(i=i0;i<i1;i++) {
+		bhjl_homsmul(t1,*job->enc1,job->bm1[i],*job->n);
+		bhjl_homsmul(t2,t1,job->bm2[i],*job->n);
+		bhjl_homsmul(t1,job->c1[i],job->bm2[i],*job->n);
+		bhjl_homadd(t3,t1,t2,*job->n);
+		bhjl_homsmul(t1,job->c2[i],job->bm1[i],*job->n);
+		bhjl_homadd(job->c[i],t1,t3,*job->n);
+	}
+
+	return 0;
+}
+
 /*
- * LABHE batch homomorphic multiplication.
+ * LABHE batch homomorphic multiplication. With a Montgomery kernel for
+ * n the three exponentiations share their squarings and the enc1
+ * exponent is reduced mod 2^{k} (same plaintext, different ciphertext).
  * Inputs: 
  *   - Size of batch: count
  *   - Many pairs of level-0 ciphertexts: bm1[], c1[], mb2[], c2[]
@@ -337,30 +596,209 @@ int labhe_decrypt_nooff0(mpz_t m, const mpz_t mb,const mpz_t c,
  * Assumptions: 
  *   - Ciphertexts are in valid range 0 <= bm1[],bm2[] < 2^{k}, 0 <= c1[],c2[] < n
  *   - All I/O pointers are allocated and initialized by caller
+ *   - Runs on the pool installed by labhe_pool_set, if any, with
+ *     per-worker temporaries
  */
 int labhe_hommul_lev0_batch(mpz_t *c,
 	                           const mpz_t *bm1, const mpz_t *c1, const mpz_t *bm2, const mpz_t *c2,const int count,
 	                           const mpz_t n, const int k, const mpz_t enc1) 
 {
-	int i;
-	mpz_t t1,t2,t3;
+	labhe_pool *pool = labhe_pool_get();
+	int rc, nw = labhe_pool_workers(pool);
+	hommul_job job;
 
-  	mpz_inits(t1,t2,t3,NULL);
+	job.tmp = labhe_scratch_alloc(nw);
+	if (!job.tmp) { return 1; }
+	job.c = c;
+	job.bm1 = bm1;
+	job.c1 = c1;
+	job.bm2 = bm2;
+	job.c2 = c2;
+	job.n = (const mpz_t *)n;
+	job.enc1 = (const mpz_t *)enc1;
+	job.k = k;
+	job.ctx = tune_mont(TUNE_MONT_HOMMUL,n) ? mont_lookup(n) : NULL;
 
-	for(i=0;i<count;i++) {
-		bhjl_homsmul(t1,enc1,bm1[i],n);
-		bhjl_homsmul(t2,t1,bm2[i],n);
-		bhjl_homsmul(t1,c1[i],bm2[i],n);
-		bhjl_homadd(t3,t1,t2,n);
-		bhjl_homsmul(t1,c2[i],bm1[i],n);
-		bhjl_homadd(c[i],t1,t3,n);
+	// Whole vectors of the batch backend per chunk where possible
+	rc = labhe_pool_run(pool,count,job.ctx ? MONT_LANES : LABHE_POOL_LINE_ITEMS,hommul_chunk,&job);
+	labhe_scratch_free(job.tmp,nw);
+
+	return rc;
+}
+
+/*
+ * LABHE fused inner product of two vectors of level-0 ciphertexts.
+ * Encrypts the same value as labhe_hommul_lev0_batch 
+ * followed by labhe_homadd_lev1_batch, as the single multi-exponentiation
+ * enc1^{sum bm1[i]*bm2[i]} * prod c1[i]^{bm2[i]} * prod c2[i]^{bm1[i]}.
+ * Inputs: 
+ *   - Size of batch: count
+ *   - Many pairs of level-0 ciphertexts: bm1[], c1[], mb2[], c2[]
+ *   - BHJK public/secret/precomputed parameters: n,k, enc1
+ * Outputs:
+ *   - One level 1 ciphertext: c
+ * Assumptions: 
+ *   - Ciphertexts are in valid range 0 <= bm1[],bm2[] < 2^{k}, 0 <= c1[],c2[] < n
+ *   - All I/O pointers are allocated and initialized by caller
+ */
+int labhe_innerprod_lev0(mpz_t c,
+	                           const mpz_t *bm1, const mpz_t *c1, const mpz_t *bm2, const mpz_t *c2,const int count,
+	                           const mpz_t n, const int k, const mpz_t enc1) 
+{
+	int i, rc;
+	mpz_t *bases, *exps, t;
+
+	bases = (mpz_t *)malloc((2*count+1)*sizeof(mpz_t));
+	exps = (mpz_t *)malloc((2*count+1)*sizeof(mpz_t));
+	if (!bases || !exps) { 
+		free(bases);
+		free(exps);
+		return 1; 
+	}
+
+	// Bases and exponents are shallow copies of the inputs
+	for (i=0;i<count;i++) {
+		bases[2*i][0] = c1[i][0];
+		exps[2*i][0] = bm2[i][0];
+		bases[2*i+1][0] = c2[i][0];
+		exps[2*i+1][0] = bm1[i][0];
 	}
 
-  	mpz_clears(t1,t2,t3,NULL);
+	// enc1 encrypts 1, so its exponent can be reduced mod 2^k
+	mpz_init(t);
+	mpz_init_set_ui(exps[2*count],0);
+	for (i=0;i<count;i++) {
+		mpz_mul(t,bm1[i],bm2[i]);
+		mpz_add(exps[2*count],exps[2*count],t);
+	}
+	mpz_fdiv_r_2exp(exps[2*count],exps[2*count],k);
+	bases[2*count][0] = enc1[0];
 
+	rc = mexp_powm_multi(c,(const mpz_t *)bases,(const mpz_t *)exps,2*count+1,n);
+
+	mpz_clears(t,exps[2*count],NULL);
+	free(bases);
+	free(exps);
+
+	return rc;
+}
+
+typedef struct {
+	mpz_t *cres;
+	const mpz_t *c, *w;
+	int count;
+	const mpz_t *n;
+} lincomb_job;
+
+// One multi-exponentiation per row
+static int lincomb_rows(void *arg, const int j0, const int j1, const int worker)
+{
+	lincomb_job *job = (lincomb_job *)arg;
+	int j;
+
+	(void)worker;
+
+	for (j=j0;j<j1;j++) {
+		if (mexp_powm_multi(job->cres[j],job->c,job->w+(size_t)j*job->count,job->count,*job->n) != 0) { return 1; }
+	}
 	return 0;
 }
 
+/*
+ * LABHE level 1 linear combinations: encrypted vector times plaintext
+ * matrix. Each input ciphertext is exponentiated by a full column of
+ * weights, so either a fixed-base table is built once per ciphertext
+ * and reused for every row, or one multi-exponentiation is done per 
+ * row, whichever has the lowest estimated cost. Rows of the latter
+ * run on the pool installed by labhe_pool_set, if any.
+ * Inputs: 
+ *   - Length of encrypted vector: count
+ *   - Level-1 ciphertexts: c[]
+ *   - Number of rows of weight matrix: rows
+ *   - Weight matrix in row-major order: w[rows*count]
+ *   - BHJK public parameter: n
+ * Outputs:
+ *   - #rows level 1 ciphertexts: cres[] 
+ * Assumptions: 
+ *   - Ciphertexts are in valid range 0 <= c[] < n
+ *   - Weights are in range 0 <= w[] < 2^{k}
+ *   - All I/O pointers are allocated and initialized by caller
+ */
+int labhe_lincomb_lev1(mpz_t *cres, const mpz_t *c, const int count,
+	                         const mpz_t *w, const int rows,
+	                         const mpz_t n)
+{
+	int i, j, bits, win, nwin;
+	double tab_cost, multi_cost;
+	mexp_table tab;
+	lincomb_job job;
+
+	bits = 1;
+	for (i=0;i<rows*count;i++) {
+		if ((int)mpz_sizeinbase(w[i],2) > bits) { bits = (int)mpz_sizeinbase(w[i],2); }
+	}
+
+	win = mexp_table_window(bits,rows);
+	nwin = (bits+win-1)/win;
+	tab_cost = (double)count * nwin * ((double)((1<<win)-1) + rows);
+	multi_cost = (double)rows * mexp_multi_cost(count,bits);
+
+	if (multi_cost <= tab_cost) {
+		job.cres = cres;
+		job.c = c;
+		job.w = w;
+		job.count = count;
+		job.n = (const mpz_t *)n;
+		return labhe_pool_run(labhe_pool_get(),rows,1,lincomb_rows,&job);
+	}
+
+	for (j=0;j<rows;j++) { mpz_set_ui(cres[j],1); }
+	for (i=0;i<count;i++) {
+		if (mexp_table_init(&tab,c[i],bits,win,n) != 0) { return 1; }
+		for (j=0;j<rows;j++) {
+			mexp_table_mulpowm(cres[j],&tab,w[(size_t)j*count+i],n);
+		}
+		mexp_table_clear(&tab);
+	}
+
+	return 0;
+}
+
+/*
+ * LABHE level 0 linear combinations: encrypted vector times plaintext
+ * matrix. The bm side is computed natively mod 2^{k} and the c side
+ * as in labhe_lincomb_lev1.
+ * Inputs: 
+ *   - Length of encrypted vector: count
+ *   - Level-0 ciphertexts: bm[], c[]
+ *   - Number of rows of weight matrix: rows
+ *   - Weight matrix in row-major order: w[rows*count]
+ *   - BHJK public parameters: n, k
+ * Outputs:
+ *   - #rows level 0 ciphertexts: bmres[], cres[] 
+ * Assumptions: 
+ *   - Ciphertexts are in valid range 0 <= bm[] < 2^{k}, 0 <= c[] < n
+ *   - Weights are in range 0 <= w[] < 2^{k}
+ *   - All I/O pointers are allocated and initialized by caller
+ */
+int labhe_lincomb_lev0(mpz_t *bmres, mpz_t *cres,
+	                         const mpz_t *bm, const mpz_t *c, const int count,
+	                         const mpz_t *w, const int rows,
+	                         const mpz_t n, const int k)
+{
+	int i, j;
+
+	for (j=0;j<rows;j++) {
+		mpz_set_ui(bmres[j],0);
+		for (i=0;i<count;i++) {
+			mpz_addmul(bmres[j],w[(size_t)j*count+i],bm[i]);
+		}
+		mpz_fdiv_r_2exp(bmres[j],bmres[j],k);
+	}
+
+	return labhe_lincomb_lev1(cres,c,count,w,rows,n);
+}
+
 /*
  * LABHE batch homomorphic level 0 addition.
  * Inputs: 
@@ -379,18 +817,16 @@ int labhe_homadd_lev0_batch(mpz_t bmred, mpz_t cred,
 {
 	int i;
 	mpz_t t;
+
 	mpz_init(t);
 	mpz_set(bmred,bm[0]);
-	mpz_set(cred,c[0]);
 	for(i=1;i<count;i++) {
 		mpz_add(t,bmred,bm[i]);
 		mpz_clrbit(t,k);
 		mpz_set(bmred,t);
-		bhjl_homadd(t,cred,c[i],n);
-		mpz_set(cred,t);
 	}
- 	mpz_clear(t);
-	return 0;
+	mpz_clear(t);
+	return labhe_homadd_lev1_batch(cred,c,count,n);
 }
 
 /*
@@ -425,6 +861,40 @@ int labhe_homadd_lev0_batch_flat(mpz_t bmred,
 	return 0;
 }
 
+#define LABHE_PROD_GRAIN 256 // ciphertexts per chunk of pooled products
+
+typedef struct {
+	const mpz_t *c;
+	const mpz_t *n;
+	const mont_ctx *ctx;
+	labhe_scratch *tmp;
+} prod_job;
+
+// r = c[i0]*...*c[i1-1] mod n
+static int prod_range(mpz_t r, const prod_job *job, const int i0, const int i1)
+{
+	int i;
+
+	if (job->ctx) { return mont_prod(r,job->c+i0,i1-i0,job->ctx); }
+	mpz_set(r,job->c[i0]);
+	for(i=i0+1;i<i1;i++) {
+		mpz_mul(r,r,job->c[i]);
+		mpz_mod(r,r,*job->n);
+	}
+	return 0;
+}
+
+static int prod_chunk(void *arg, const int i0, const int i1, const int worker)
+{
+	prod_job *job = (prod_job *)arg;
+	labhe_scratch *t = &job->tmp[worker];
+
+	if (prod_range(t->t1,job,i0,i1) != 0) { return 1; }
+	mpz_mul(t->t2,t->t2,t->t1);
+	mpz_mod(t->t2,t->t2,*job->n);
+	return 0;
+}
+
 /*
  * LABHE batch homomorphic level 1 addition 
  * Inputs: 
@@ -436,20 +906,38 @@ int labhe_homadd_lev0_batch_flat(mpz_t bmred,
  * Assumptions: 
  *   - Input ciphertext is in valid range 0 <= c < n
  *   - All I/O pointers are allocated and initialized by caller
+ *   - Large batches run on the pool installed by labhe_pool_set, if any
  */
 int labhe_homadd_lev1_batch(mpz_t cred, const mpz_t *c,const int count, 
 								  const mpz_t n) 
 {
-	int i;
-	mpz_t t;
-    mpz_init(t);
-	mpz_set(cred,c[0]);
-	for(i=1;i<count;i++) {
-		bhjl_homadd(t,cred,c[i],n);
-		mpz_set(cred,t);
+	labhe_pool *pool = labhe_pool_get();
+	int i, rc, nw = labhe_pool_workers(pool);
+	prod_job job;
+
+	if (nw == 1 || count <= LABHE_PROD_GRAIN) {
+		job.c = c;
+		job.n = (const mpz_t *)n;
+		job.ctx = tune_mont(TUNE_MONT_PROD,n) ? mont_lookup(n) : NULL;
+		return prod_range(cred,&job,0,count);
 	}
-  	mpz_clear(t);
-	return 0;
+
+	// Partial products per worker, multiplied together at the end
+	job.tmp = labhe_scratch_alloc(nw);
+	if (!job.tmp) { return 1; }
+	for (i=0;i<nw;i++) { mpz_set_ui(job.tmp[i].t2,1); }
+	job.c = c;
+	job.n = (const mpz_t *)n;
+	job.ctx = tune_mont(TUNE_MONT_PROD,n) ? mont_lookup(n) : NULL;
+	rc = labhe_pool_run(pool,count,LABHE_PROD_GRAIN,prod_chunk,&job);
+	mpz_set(cred,job.tmp[0].t2);
+	for (i=1;i<nw;i++) {
+		mpz_mul(cred,cred,job.tmp[i].t2);
+		mpz_mod(cred,cred,n);
+	}
+	labhe_scratch_free(job.tmp,nw);
+
+	return rc;
 }
 
 /*
@@ -470,6 +958,124 @@ int labhe_homsub_lev1(mpz_t csub, const mpz_t c1, const mpz_t c2,
 	return 0;
 }
 
+/*
+ * LABHE batch homomorphic level 1 subtraction, using Montgomery's
+ * simultaneous inversion trick: a single modular inversion plus 
+ * 3(count-1) modular multiplications invert all subtrahends.
+ * Inputs: 
+ *   - Size of batch: count
+ *   - Many pairs of level-1 ciphertexts: c1[], c2[]
+ *   - BHJK public/secret/precomputed parameters: n
+ * Outputs:
+ *   - Many level 1 ciphertexts: csub[] (csub[i] encodes c1[i]-c2[i])
+ * Assumptions: 
+ *   - Input ciphertexts are in valid range 0 <= c1[],c2[] < n
+ *   - All I/O pointers are allocated and initialized by caller
+ *   - csub[] may alias c1[] but not c2[]
+ */
+int labhe_homsub_lev1_batch(mpz_t *csub, const mpz_t *c1, const mpz_t *c2, const int count,
+								  const mpz_t n) 
+{
+	int i;
+	mpz_t *prefix, inv, t;
+
+	if (count <= 0) { return 0; }
+
+	prefix = (mpz_t *)malloc(count*sizeof(mpz_t));
+	if (!prefix) { return 1; }
+
+	// prefix[i] = c2[0]*...*c2[i] mod n
+	mpz_init_set(prefix[0],c2[0]);
+	for(i=1;i<count;i++) {
+		mpz_init(prefix[i]);
+		mpz_mul(prefix[i],prefix[i-1],c2[i]);
+		mpz_mod(prefix[i],prefix[i],n);
+	}
+
+	mpz_inits(inv,t,NULL);
+	if (mpz_invert(inv,prefix[count-1],n) == 0) {
+		for(i=0;i<count;i++) { mpz_clear(prefix[i]); }
+		mpz_clears(inv,t,NULL);
+		free(prefix);
+		return 1;
+	}
+
+	// inv = (c2[0]*...*c2[i])^{-1} at the start of each iteration
+	for(i=count-1;i>0;i--) {
+		mpz_mul(t,inv,prefix[i-1]);
+		mpz_mod(t,t,n); // t = c2[i]^{-1}
+		mpz_mul(inv,inv,c2[i]);
+		mpz_mod(inv,inv,n);
+		mpz_mul(t,t,c1[i]);
+		mpz_mod(csub[i],t,n);
+	}
+	mpz_mul(t,inv,c1[0]);
+	mpz_mod(csub[0],t,n);
+
+	for(i=0;i<count;i++) { mpz_clear(prefix[i]); }
+	mpz_clears(inv,t,NULL);
+	free(prefix);
+
+	return 0;
+}
+
+/*
+ * LABHE lazy level 1 accumulator: additions and subtractions are
+ * collected in a numerator/denominator pair and a single inversion
+ * is performed when the result is extracted.
+ * Inputs: 
+ *   - Accumulator: acc
+ *   - Level-1 ciphertext to add/subtract: c
+ *   - BHJK public/secret/precomputed parameters: n
+ * Outputs:
+ *   - Updated accumulator (init/add/sub) or level 1 ciphertext cres (final)
+ * Assumptions: 
+ *   - Input ciphertexts are in valid range 0 <= c < n
+ *   - All I/O pointers are allocated and initialized by caller
+ *   - Accumulator is released with labhe_lev1_acc_clear
+ */
+int labhe_lev1_acc_init(labhe_lev1_acc *acc)
+{
+	mpz_init_set_ui(acc->num,1);
+	mpz_init_set_ui(acc->den,1);
+	return 0;
+}
+
+int labhe_lev1_acc_add(labhe_lev1_acc *acc, const mpz_t c, const mpz_t n)
+{
+	mpz_mul(acc->num,acc->num,c);
+	mpz_mod(acc->num,acc->num,n);
+	return 0;
+}
+
+int labhe_lev1_acc_sub(labhe_lev1_acc *acc, const mpz_t c, const mpz_t n)
+{
+	mpz_mul(acc->den,acc->den,c);
+	mpz_mod(acc->den,acc->den,n);
+	return 0;
+}
+
+int labhe_lev1_acc_final(mpz_t cres, const labhe_lev1_acc *acc, const mpz_t n)
+{
+	mpz_t t;
+
+	mpz_init(t);
+	if (mpz_invert(t,acc->den,n) == 0) {
+		mpz_clear(t);
+		return 1;
+	}
+	mpz_mul(t,t,acc->num);
+	mpz_mod(cres,t,n);
+	mpz_clear(t);
+
+	return 0;
+}
+
+void labhe_lev1_acc_clear(labhe_lev1_acc *acc)
+{
+	mpz_clears(acc->num,acc->den,NULL);
+}
+
 /*
  * LABHE homomorphic level 1 scalar multiplication 
  * Inputs: 
@@ -0,0 +1,415 @@
+#include <gmp.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "prf.h"
+#include "bhjl.h"
+#include "mont.h"
+#include "tune.h"
+#include "labhe_pool.h"
+#include "labhe_agg.h"
+
+typedef struct agg_job agg_job;
+
+typedef struct {
+	const agg_job *job;
+	int u0, u1;   // users [u0,u1) of this shard
+	int rc;
+	mpz_t *bm;    // partial per-label results (count entries)
+	mpz_t *c;
+} agg_shard;
+
+struct agg_job {
+	void *(*fn)(void *);
+	int users, count, start_label, k;
+	const mpz_t *bm, *c, *pks, *Dpow;
+	const mpz_t *n, *p, *D, *_2k1, *pm12k;
+	const unsigned char *sks;
+	unsigned char *sks_out;
+};
+
+static int agg_shard_run(void *arg, const int i0, const int i1, const int worker)
+{
+	agg_shard *sh = (agg_shard *)arg;
+	int i, rc = 0;
+
+	(void)worker;
+	for (i=i0;i<i1;i++) {
+		sh[i].job->fn(&sh[i]);
+		rc |= sh[i].rc;
+	}
+	return rc;
+}
+
+/*
+ * Split users across shards and run job->fn on each
+ * (labhe_pool_run_shards)
+ */
+static int agg_run(const agg_job *job, agg_shard *sh, const int nshards)
+{
+	int i;
+
+	for (i=0;i<nshards;i++) {
+		sh[i].job = job;
+		sh[i].u0 = (int)((long long)job->users*i/nshards);
+		sh[i].u1 = (int)((long long)job->users*(i+1)/nshards);
+		sh[i].rc = 0;
+	}
+	return labhe_pool_run_shards(nshards, agg_shard_run, sh);
+}
+
+static int agg_shards(const int users, const int workers)
+{
+	int w = (workers < 1) ? tune_workers() : workers;
+
+	return users < w ? (users > 0 ? users : 1) : w;
+}
+
+static agg_shard *agg_alloc(const int nshards, const int count, const int with_bm)
+{
+	agg_shard *sh;
+	int i, j;
+
+	sh = (agg_shard *)calloc(nshards, sizeof(agg_shard));
+	if (!sh) { return NULL; }
+	for (i=0;i<nshards;i++) {
+		sh[i].c = (mpz_t *)malloc(count*sizeof(mpz_t));
+		sh[i].bm = with_bm ? (mpz_t *)malloc(count*sizeof(mpz_t)) : NULL;
+		for (j=0;j<count && sh[i].c;j++) { mpz_init(sh[i].c[j]); }
+		for (j=0;j<count && sh[i].bm;j++) { mpz_init(sh[i].bm[j]); }
+		if (!sh[i].c || (with_bm && !sh[i].bm)) { sh[i].rc = 1; }
+	}
+	return sh;
+}
+
+static void agg_free(agg_shard *sh, const int nshards, const int count)
+{
+	int i, j;
+
+	for (i=0;i<nshards;i++) {
+		for (j=0;j<count && sh[i].c;j++) { mpz_clear(sh[i].c[j]); }
+		for (j=0;j<count && sh[i].bm;j++) { mpz_clear(sh[i].bm[j]); }
+		free(sh[i].c);
+		free(sh[i].bm);
+	}
+	free(sh);
+}
+
+static int agg_alloc_failed(const agg_shard *sh, const int nshards)
+{
+	int i;
+
+	for (i=0;i<nshards;i++) {
+		if (sh[i].rc) { return 1; }
+	}
+	return 0;
+}
+
+static void *agg_recover(void *arg)
+{
+	agg_shard *sh = (agg_shard *)arg;
+	const agg_job *job = sh->job;
+	unsigned char buf[SK_SIZE];
+	size_t size;
+	mpz_t sk_nums[MONT_LANES];
+	int u, j, cnt;
+
+	for (j=0;j<MONT_LANES;j++) { mpz_init(sk_nums[j]); }
+	for (u=sh->u0;u<sh->u1 && !sh->rc;u+=cnt) {
+		// MONT_LANES decryptions share the batch exponentiation backend
+		cnt = (sh->u1 - u < MONT_LANES) ? sh->u1 - u : MONT_LANES;
+		if (bhjl_decrypt_batch(sk_nums,job->pks+u,cnt,*job->p,job->Dpow ? NULL : *job->D,job->Dpow,
+		                       job->k,*job->_2k1,*job->pm12k) != 0) {
+			sh->rc = 1;
+			break;
+		}
+		for (j=0;j<cnt;j++) {
+			// keys with leading zero bytes export shorter than SK_SIZE
+			if (mpz_sizeinbase(sk_nums[j],2) > 8*SK_SIZE) {
+				sh->rc = 1;
+				break;
+			}
+			mpz_export(buf, &size, 1, sizeof(unsigned char), 0, 0, sk_nums[j]);
+			memset(job->sks_out+(size_t)(u+j)*SK_SIZE, 0, SK_SIZE-size);
+			memcpy(job->sks_out+(size_t)(u+j)*SK_SIZE+SK_SIZE-size, buf, size);
+		}
+	}
+	for (j=0;j<MONT_LANES;j++) { mpz_clear(sk_nums[j]); }
+
+	return NULL;
+}
+
+/*
+ * LABHE decryption: offline, function-independent stage for many
+ * encryptors at once (parallel version of labhe_decrypt_offline_indep).
+ * Inputs:
+ *   - Encryptor public keys: pks[users]
+ *   - BHJK public/secret/precomputed parameters: p,D,k,_2k1,pm12k
+ *   - Optional decryption table Dpow[k] (Dpow[j] = D^{2^j} mod p, see
+ *     keystore_load_secret), NULL to use D
+ *   - Number of threads: workers (< 1: from the tuning profile)
+ * Outputs:
+ *   - Recovered encryptor keys: sks[users*SK_SIZE], to be cached by the
+ *     caller and reused for every round
+ * Assumptions:
+ *   - Public keys are in valid BHJK ciphertext range 0 <= pks[] < n
+ *   - all I/O pointers are allocated and initialized by caller
+ */
+int labhe_decrypt_offline_indep_batch(unsigned char *sks, const mpz_t *pks, const int users,
+	             				const mpz_t p,const mpz_t D,const mpz_t *Dpow,const int k,
+	             				const mpz_t _2k1,const mpz_t pm12k,
+	             				const int workers)
+{
+	agg_job job;
+	agg_shard *sh;
+	int nshards, rc;
+
+	memset(&job, 0, sizeof(job));
+	job.fn = agg_recover;
+	job.users = users;
+	job.k = k;
+	job.pks = pks;
+	job.Dpow = Dpow;
+	job.p = (const mpz_t *)p;
+	job.D = (const mpz_t *)D;
+	job._2k1 = (const mpz_t *)_2k1;
+	job.pm12k = (const mpz_t *)pm12k;
+	job.sks_out = sks;
+
+	nshards = agg_shards(users, workers);
+	sh = (agg_shard *)calloc(nshards, sizeof(agg_shard));
+	if (!sh) { return 1; }
+	rc = agg_run(&job, sh, nshards);
+	free(sh);
+
+	return rc;
+}
+
+static void *agg_masks(void *arg)
+{
+	agg_shard *sh = (agg_shard *)arg;
+	const agg_job *job = sh->job;
+	unsigned char nonces[NONCE_SIZE*PRF_BATCH], label[LABEL_SIZE];
+	mpz_t b_mask_num;
+	int u, i, j, c;
+
+	memset(label, 0, sizeof(label));
+	mpz_init(b_mask_num);
+	for (j=0;j<job->count;j++) {
+		*(int *)label = job->start_label + j;
+		mpz_set_ui(sh->c[j], 0);
+		// one label, PRF_BATCH keys at a time
+		for (u=sh->u0;u<sh->u1;u+=PRF_BATCH) {
+			c = sh->u1 - u < PRF_BATCH ? sh->u1 - u : PRF_BATCH;
+			prf_multi(nonces, label, job->sks+(size_t)u*SK_SIZE, c);
+			for (i=0;i<c;i++) {
+				mpz_import(b_mask_num, NONCE_SIZE, 1, sizeof(nonces[0]), 0, 0, nonces+i*NONCE_SIZE);
+				mpz_add(sh->c[j], sh->c[j], b_mask_num);
+			}
+		}
+	}
+	mpz_clear(b_mask_num);
+
+	return NULL;
+}
+
+/*
+ * LABHE decryption: offline function-dependent stage for summing the
+ * ciphertexts of many encryptors under the same labels.
+ * Inputs:
+ *   - Encryptor secret keys: sks[users*SK_SIZE] (see
+ *     labhe_decrypt_offline_indep_batch)
+ *   - Labels: start_label, ..., start_label+count-1
+ *   - Public BHJK parameter: k
+ *   - Number of threads: workers (< 1: from the tuning profile)
+ * Outputs:
+ *   - Precomputed masks b[count], b[j] = sum_u PRF(sk_u, start_label+j) mod 2^{k}
+ * Assumptions:
+ *   - all I/O pointers are allocated and initialized by caller
+ */
+int labhe_decrypt_offline_agg_sk(mpz_t *b, const unsigned char *sks, const int users,
+								const int start_label, const int count,
+								const int k, const int workers)
+{
+	agg_job job;
+	agg_shard *sh;
+	int nshards, i, j, rc;
+
+	memset(&job, 0, sizeof(job));
+	job.fn = agg_masks;
+	job.users = users;
+	job.count = count;
+	job.start_label = start_label;
+	job.sks = sks;
+
+	nshards = agg_shards(users, workers);
+	sh = agg_alloc(nshards, count, 0);
+	if (!sh) { return 1; }
+	if (agg_alloc_failed(sh, nshards)) {
+		agg_free(sh, nshards, count);
+		return 1;
+	}
+
+	rc = agg_run(&job, sh, nshards);
+	for (j=0;j<count;j++) {
+		mpz_set(b[j], sh[0].c[j]);
+		for (i=1;i<nshards;i++) { mpz_add(b[j], b[j], sh[i].c[j]); }
+		mpz_fdiv_r_2exp(b[j], b[j], k);
+	}
+	agg_free(sh, nshards, count);
+
+	return rc;
+}
+
+static void *agg_lev0(void *arg)
+{
+	agg_shard *sh = (agg_shard *)arg;
+	const agg_job *job = sh->job;
+	mpz_t t;
+	int u, j;
+
+	mpz_init(t);
+	for (j=0;j<job->count;j++) {
+		mpz_set_ui(sh->bm[j], 0);
+		mpz_set_ui(sh->c[j], 1);
+	}
+	for (u=sh->u0;u<sh->u1;u++) {
+		for (j=0;j<job->count;j++) {
+			mpz_add(sh->bm[j], sh->bm[j], job->bm[(size_t)u*job->count+j]);
+			mpz_mul(t, sh->c[j], job->c[(size_t)u*job->count+j]);
+			mpz_mod(sh->c[j], t, *job->n);
+		}
+	}
+	for (j=0;j<job->count;j++) { mpz_fdiv_r_2exp(sh->bm[j], sh->bm[j], job->k); }
+	mpz_clear(t);
+
+	return NULL;
+}
+
+static void *agg_lev1(void *arg)
+{
+	agg_shard *sh = (agg_shard *)arg;
+	const agg_job *job = sh->job;
+	mpz_t t;
+	int u, j;
+
+	mpz_init(t);
+	for (j=0;j<job->count;j++) { mpz_set_ui(sh->c[j], 1); }
+	for (u=sh->u0;u<sh->u1;u++) {
+		for (j=0;j<job->count;j++) {
+			mpz_mul(t, sh->c[j], job->c[(size_t)u*job->count+j]);
+			mpz_mod(sh->c[j], t, *job->n);
+		}
+	}
+	mpz_clear(t);
+
+	return NULL;
+}
+
+/*
+ * LABHE homomorphic level-0 addition across encryptors: for every
+ * label, add the ciphertexts of all users.
+ * Inputs:
+ *   - Level-0 ciphertexts: bm[users*count], c[users*count] (user-major)
+ *   - BHJK public parameters: n, k
+ *   - Number of threads: workers (< 1: from the tuning profile)
+ * Outputs:
+ *   - Per-label level-0 sums: bmres[count], cres[count]
+ * Assumptions:
+ *   - Ciphertexts are in valid range 0 <= bm[] < 2^{k}, 0 <= c[] < n
+ *   - all I/O pointers are allocated and initialized by caller
+ */
+int labhe_agg_lev0(mpz_t *bmres, mpz_t *cres,
+	                              const mpz_t *bm, const mpz_t *c, const int users, const int count,
+	                              const mpz_t n, const int k, const int workers)
+{
+	agg_job job;
+	agg_shard *sh;
+	int nshards, i, j, rc;
+	mpz_t t;
+
+	memset(&job, 0, sizeof(job));
+	job.fn = agg_lev0;
+	job.users = users;
+	job.count = count;
+	job.k = k;
+	job.bm = bm;
+	job.c = c;
+	job.n = (const mpz_t *)n;
+
+	nshards = agg_shards(users, workers);
+	sh = agg_alloc(nshards, count, 1);
+	if (!sh) { return 1; }
+	if (agg_alloc_failed(sh, nshards)) {
+		agg_free(sh, nshards, count);
+		return 1;
+	}
+
+	rc = agg_run(&job, sh, nshards);
+	mpz_init(t);
+	for (j=0;j<count;j++) {
+		mpz_set(bmres[j], sh[0].bm[j]);
+		mpz_set(cres[j], sh[0].c[j]);
+		for (i=1;i<nshards;i++) {
+			mpz_add(bmres[j], bmres[j], sh[i].bm[j]);
+			mpz_mul(t, cres[j], sh[i].c[j]);
+			mpz_mod(cres[j], t, n);
+		}
+		mpz_fdiv_r_2exp(bmres[j], bmres[j], k);
+	}
+	mpz_clear(t);
+	agg_free(sh, nshards, count);
+
+	return rc;
+}
+
+/*
+ * LABHE homomorphic level-1 addition across encryptors: for every
+ * label, add the level-1 ciphertexts of all users.
+ * Inputs:
+ *   - Level-1 ciphertexts: c[users*count] (user-major)
+ *   - BHJK public parameter: n
+ *   - Number of threads: workers (< 1: from the tuning profile)
+ * Outputs:
+ *   - Per-label level-1 sums: cres[count]
+ * Assumptions:
+ *   - Ciphertexts are in valid range 0 <= c[] < n
+ *   - all I/O pointers are allocated and initialized by caller
+ */
+int labhe_agg_lev1(mpz_t *cres, const mpz_t *c, const int users, const int count,
+	                              const mpz_t n, const int workers)
+{
+	agg_job job;
+	agg_shard *sh;
+	int nshards, i, j, rc;
+	mpz_t t;
+
+	memset(&job, 0, sizeof(job));
+	job.fn = agg_lev1;
+	job.users = users;
+	job.count = count;
+	job.c = c;
+	job.n = (const mpz_t *)n;
+
+	nshards = agg_shards(users, workers);
+	sh = agg_alloc(nshards, count, 0);
+	if (!sh) { return 1; }
+	if (agg_alloc_failed(sh, nshards)) {
+		agg_free(sh, nshards, count);
+		return 1;
+	}
+
+	rc = agg_run(&job, sh, nshards);
+	mpz_init(t);
+	for (j=0;j<count;j++) {
+		mpz_set(cres[j], sh[0].c[j]);
+		for (i=1;i<nshards;i++) {
+			mpz_mul(t, cres[j], sh[i].c[j]);
+			mpz_mod(cres[j], t, n);
+		}
+	}
+	mpz_clear(t);
+	agg_free(sh, nshards, count);
+
+	return rc;
+}
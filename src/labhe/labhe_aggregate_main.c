@@ -0,0 +1,169 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <gmp.h>
+
+#include "keystore.h"
+#include "evald.h"
+#include "labhe_file.h"
+#include "labhe_shard.h"
+#include "tune.h"
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,"usage: %s [-w workers] [-c chunk] [-r first:count] <sum|innerprod|sumsq> <params> <output> <input> [input2]\n"
+	               "       %s merge <params> <output> <partial>...\n",prog,prog);
+	exit(1);
+}
+
+/*
+ * labhe-aggregate: out-of-core aggregation of ciphertext dataset files
+ * Usage: labhe-aggregate [-w workers] [-c chunk] [-r first:count] <job> <params> <output> <input> [input2]
+ *        labhe-aggregate merge <params> <output> <partial>...
+ *   sum       level-0/1 input -> level-0/1 result
+ *   innerprod two level-0 inputs -> level-1 result
+ *   sumsq     level-0 input -> level-1 result (sum of squares)
+ *   merge     partial results -> partial result of their union
+ * The parameters file is a public key-store file, or a text file with
+ * n=..., k=... and enc1=... lines (as for labhe-evald). The result is
+ * written as a one-record dataset file labelled like the first input;
+ * throughput statistics are reported on stderr. Without -w the thread
+ * count comes from the key store's tuning profile (4 if there is none).
+ * With -r only records [first,first+count) are reduced, and the result
+ * is written as a partial result file (include/labhe_shard.h) for a
+ * later merge; merge outputs can themselves be merged.
+ */
+int main(int argc, char* argv[])
+{
+	mpz_t n, enc1, bm, c;
+	keystore_pub kp;
+	labhe_file f1, f2;
+	labhe_file_writer *w;
+	labhe_file_stats st;
+	labhe_shard sh, *parts;
+	long long first = 0, count = -1;
+	int k, op, opt, workers = 0, chunk = LABHE_FILE_CHUNK, level, i, nparts;
+	double secs;
+	char *colon;
+
+	while ((opt = getopt(argc, argv, "w:c:r:")) != -1) {
+		if (opt == 'w') { workers = atoi(optarg); }
+		else if (opt == 'c') { chunk = atoi(optarg); }
+		else if (opt == 'r') {
+			colon = strchr(optarg, ':');
+			if (!colon) { usage(argv[0]); }
+			first = atoll(optarg);
+			count = atoll(colon+1);
+			if (first < 0 || count < 1) { usage(argv[0]); }
+		}
+		else { usage(argv[0]); }
+	}
+	if (argc - optind < 4) { usage(argv[0]); }
+
+	if (strcmp(argv[optind],"sum") == 0) { op = LABHE_AGG_SUM; }
+	else if (strcmp(argv[optind],"innerprod") == 0) { op = LABHE_AGG_INNERPROD; }
+	else if (strcmp(argv[optind],"sumsq") == 0) { op = LABHE_AGG_SUMSQ; }
+	else if (strcmp(argv[optind],"merge") == 0) { op = 0; }
+	else { usage(argv[0]); }
+	if (op != 0 && ((op == LABHE_AGG_INNERPROD) != (argc - optind == 5) || chunk < 1)) { usage(argv[0]); }
+
+	mpz_inits(n, enc1, bm, c, NULL);
+	if (keystore_load_public(&kp,argv[optind+1]) == 0) {
+		// enc1 is raised once per chunk only, so its table is not kept
+		mpz_set(n,kp.n);
+		mpz_set(enc1,kp.enc1);
+		k = kp.k;
+		keystore_close_public(&kp);
+	} else if (evald_load_params(argv[optind+1],n,&k,enc1) != 0) {
+		fprintf(stderr,"cannot load parameters from %s\n",argv[optind+1]);
+		exit(1);
+	}
+
+	if (workers < 1) { workers = tune_get() ? tune_workers() : 4; }
+
+	// Coordinator: tree merge of partial results
+	if (op == 0) {
+		nparts = argc - optind - 3;
+		parts = (labhe_shard *)malloc(nparts*sizeof(labhe_shard));
+		if (!parts) { exit(1); }
+		labhe_shard_init(&sh);
+		for (i=0;i<nparts;i++) {
+			labhe_shard_init(&parts[i]);
+			if (labhe_shard_load(&parts[i],argv[optind+3+i]) != 0) {
+				fprintf(stderr,"cannot load %s\n",argv[optind+3+i]);
+				exit(1);
+			}
+		}
+		if (labhe_shard_merge(&sh,parts,nparts,n,k) != 0) {
+			fprintf(stderr,"merge failed (partials of different jobs or parameters, or label ranges with gaps)\n");
+			exit(1);
+		}
+		if (labhe_shard_save(argv[optind+2],&sh) != 0) {
+			fprintf(stderr,"cannot write %s\n",argv[optind+2]);
+			exit(1);
+		}
+		fprintf(stderr,"%d partials merged: labels %d..%d\n",nparts,sh.start_label1,sh.start_label1+sh.count-1);
+		for (i=0;i<nparts;i++) { labhe_shard_clear(&parts[i]); }
+		free(parts);
+		labhe_shard_clear(&sh);
+		mpz_clears(n, enc1, bm, c, NULL);
+		exit(0);
+	}
+
+	if (labhe_file_open(&f1,argv[optind+3]) != 0) {
+		fprintf(stderr,"cannot open %s\n",argv[optind+3]);
+		exit(1);
+	}
+	if (op == LABHE_AGG_INNERPROD && labhe_file_open(&f2,argv[optind+4]) != 0) {
+		fprintf(stderr,"cannot open %s\n",argv[optind+4]);
+		exit(1);
+	}
+
+	if (op != LABHE_AGG_SUM && ((f1.flags & LABHE_FILE_LINEAR) ||
+	                            (op == LABHE_AGG_INNERPROD && (f2.flags & LABHE_FILE_LINEAR)))) {
+		fprintf(stderr,"%s is a linear-only dataset: only sum is supported\n",
+		        (f1.flags & LABHE_FILE_LINEAR) ? argv[optind+3] : argv[optind+4]);
+		exit(1);
+	}
+
+	if (count > 0) {
+		// Worker: partial result of one record range
+		labhe_shard_init(&sh);
+		if (labhe_shard_reduce(&sh,op,&f1,(op == LABHE_AGG_INNERPROD) ? &f2 : NULL,first,count,
+		                       n,k,enc1,chunk,workers,&st) != 0) {
+			fprintf(stderr,"aggregation failed (inputs do not match the parameters, job or range)\n");
+			exit(1);
+		}
+		if (labhe_shard_save(argv[optind+2],&sh) != 0) {
+			fprintf(stderr,"cannot write %s\n",argv[optind+2]);
+			exit(1);
+		}
+		labhe_shard_clear(&sh);
+	} else {
+		if (labhe_file_aggregate(bm,c,op,&f1,(op == LABHE_AGG_INNERPROD) ? &f2 : NULL,
+		                         n,k,enc1,chunk,workers,&st) != 0) {
+			fprintf(stderr,"aggregation failed (inputs do not match the parameters or job)\n");
+			exit(1);
+		}
+
+		level = (op == LABHE_AGG_SUM) ? f1.level : 1;
+		if (labhe_file_create_flags(&w,argv[optind+2],level,f1.start_label,n,k,
+		                            (level == 0) ? f1.flags : 0) != 0 ||
+		    labhe_file_append(w,bm,c) != 0 || labhe_file_finish(w) != 0) {
+			fprintf(stderr,"cannot write %s\n",argv[optind+2]);
+			exit(1);
+		}
+	}
+
+	secs = st.ns/1e9;
+	fprintf(stderr,"%lld ciphertexts, %.1f MB in %.3f s (%d workers, %lld chunks): %.3f GB/s, %.0f ciphertexts/s\n",
+	        st.ciphertexts, st.bytes/1e6, secs, workers, st.chunks,
+	        secs > 0 ? st.bytes/1e9/secs : 0.0, secs > 0 ? st.ciphertexts/secs : 0.0);
+
+	labhe_file_close(&f1);
+	if (op == LABHE_AGG_INNERPROD) { labhe_file_close(&f2); }
+	mpz_clears(n, enc1, bm, c, NULL);
+
+	exit(0);
+}
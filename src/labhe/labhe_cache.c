@@ -0,0 +1,398 @@
+#include <gmp.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "mexp.h"
+#include "bhjl.h"
+#include "labhe_cache.h"
+
+typedef struct cache_entry cache_entry;
+
+struct cache_entry {
+	uint32_t dataset;
+	int label;
+	mpz_t base;
+	mexp_table tab;      // valid if has_tab
+	int has_tab;
+	int building;
+	int refs;            // pinned while > 0
+	long long uses;
+	size_t bytes;
+	cache_entry *hnext;  // hash chain
+	cache_entry *prev, *next; // LRU list, most recent first
+};
+
+struct labhe_cache {
+	pthread_mutex_t lock;
+	mpz_t n;
+	int k, hot, w;
+	size_t budget;
+	cache_entry **buckets;
+	size_t nbuckets;
+	cache_entry *head, *tail;
+	labhe_cache_stats stats;
+};
+
+static size_t cache_hash(const labhe_cache *cache, const uint32_t dataset, const int label)
+{
+	uint64_t h = ((uint64_t)dataset << 32) ^ (uint32_t)label;
+
+	h *= 0x9E3779B97F4A7C15ULL;
+	return (size_t)(h >> 32) & (cache->nbuckets-1);
+}
+
+static cache_entry *cache_find(const labhe_cache *cache, const uint32_t dataset, const int label)
+{
+	cache_entry *e;
+
+	for (e=cache->buckets[cache_hash(cache,dataset,label)];e;e=e->hnext) {
+		if (e->dataset == dataset && e->label == label) { return e; }
+	}
+	return NULL;
+}
+
+static void cache_unlink(labhe_cache *cache, cache_entry *e)
+{
+	if (e->prev) { e->prev->next = e->next; } else { cache->head = e->next; }
+	if (e->next) { e->next->prev = e->prev; } else { cache->tail = e->prev; }
+	e->prev = e->next = NULL;
+}
+
+static void cache_push(labhe_cache *cache, cache_entry *e)
+{
+	e->prev = NULL;
+	e->next = cache->head;
+	if (cache->head) { cache->head->prev = e; } else { cache->tail = e; }
+	cache->head = e;
+}
+
+static size_t cache_mpz_bytes(const mpz_t x)
+{
+	return sizeof(mpz_t) + mpz_size(x)*sizeof(mp_limb_t);
+}
+
+static size_t cache_tab_bytes(const mexp_table *tab)
+{
+	size_t j, size, bytes = 0;
+
+	size = (size_t)tab->nwin*((1<<tab->w)-1);
+	for (j=0;j<size;j++) { bytes += cache_mpz_bytes(tab->pow[j]); }
+	return bytes;
+}
+
+static void cache_drop_tab(labhe_cache *cache, cache_entry *e)
+{
+	size_t bytes;
+
+	if (!e->has_tab) { return; }
+	bytes = cache_tab_bytes(&e->tab);
+	mexp_table_clear(&e->tab);
+	e->has_tab = 0;
+	e->bytes -= bytes;
+	cache->stats.bytes -= bytes;
+}
+
+static void cache_remove(labhe_cache *cache, cache_entry *e)
+{
+	cache_entry **pp;
+
+	for (pp=&cache->buckets[cache_hash(cache,e->dataset,e->label)];*pp!=e;pp=&(*pp)->hnext);
+	*pp = e->hnext;
+	cache_unlink(cache, e);
+	cache_drop_tab(cache, e);
+	cache->stats.bytes -= e->bytes;
+	cache->stats.entries--;
+	mpz_clear(e->base);
+	free(e);
+}
+
+/*
+ * Evict least recently used entries that are not pinned until the
+ * cache fits its budget
+ */
+static void cache_evict(labhe_cache *cache)
+{
+	cache_entry *e, *prev;
+
+	for (e=cache->tail;e && cache->stats.bytes > cache->budget;e=prev) {
+		prev = e->prev;
+		if (e->refs > 0) { continue; }
+		cache_remove(cache, e);
+		cache->stats.evictions++;
+	}
+}
+
+static int cache_grow(labhe_cache *cache)
+{
+	cache_entry **buckets, **old, *e, *next;
+	size_t i, nold;
+
+	buckets = (cache_entry **)calloc(2*cache->nbuckets, sizeof(cache_entry *));
+	if (!buckets) { return 1; }
+	old = cache->buckets;
+	nold = cache->nbuckets;
+	cache->buckets = buckets;
+	cache->nbuckets *= 2;
+	for (i=0;i<nold;i++) {
+		for (e=old[i];e;e=next) {
+			next = e->hnext;
+			e->hnext = buckets[cache_hash(cache,e->dataset,e->label)];
+			buckets[cache_hash(cache,e->dataset,e->label)] = e;
+		}
+	}
+	free(old);
+	return 0;
+}
+
+/*
+ * Create an evaluator table cache
+ * Inputs:
+ *   - BHJL public parameters: n, k (tables cover k-bit exponents)
+ *   - Memory budget in bytes: budget
+ *   - Uses of a ciphertext before its table is built: hot (>= 1)
+ *   - Expected uses of a table, to choose its window width: uses
+ * Outputs: cache (release with labhe_cache_clear); 0 on success
+ */
+int labhe_cache_init(labhe_cache **cache, const mpz_t n, const int k,
+	                 const size_t budget, const int hot, const int uses)
+{
+	labhe_cache *c;
+
+	if (hot < 1 || uses < 1) { return 1; }
+
+	c = (labhe_cache *)calloc(1, sizeof(labhe_cache));
+	if (!c) { return 1; }
+	c->nbuckets = 1024;
+	c->buckets = (cache_entry **)calloc(c->nbuckets, sizeof(cache_entry *));
+	if (!c->buckets) {
+		free(c);
+		return 1;
+	}
+	if (pthread_mutex_init(&c->lock, NULL) != 0) {
+		free(c->buckets);
+		free(c);
+		return 1;
+	}
+	mpz_init_set(c->n, n);
+	c->k = k;
+	c->hot = hot;
+	c->w = mexp_table_window(k, uses);
+	c->budget = budget;
+
+	*cache = c;
+	return 0;
+}
+
+/*
+ * Cached exponentiation r = c^e mod n of the ciphertext stored under
+ * (dataset, label), building the table of c when it becomes hot
+ * Inputs:
+ *   - Cache: cache
+ *   - Key of the ciphertext: dataset, label
+ *   - Ciphertext: c
+ *   - Exponent: e (tables cover k bits, longer exponents use mpz_powm)
+ * Outputs: r
+ * Assumptions:
+ *   - ciphertext is in range 0 <= c < n, exponent is non-negative
+ *   - all I/O pointers are allocated and initialized by caller
+ */
+int labhe_cache_powm(labhe_cache *cache, mpz_t r, const uint32_t dataset, const int label,
+	                 const mpz_t c, const mpz_t e)
+{
+	cache_entry *ent;
+	mexp_table tab;
+	int build = 0;
+
+	pthread_mutex_lock(&cache->lock);
+	ent = cache_find(cache, dataset, label);
+	if (!ent) {
+		ent = (cache_entry *)calloc(1, sizeof(cache_entry));
+		if (!ent) {
+			cache->stats.misses++;
+			pthread_mutex_unlock(&cache->lock);
+			mpz_powm(r, c, e, cache->n);
+			return 0;
+		}
+		ent->dataset = dataset;
+		ent->label = label;
+		mpz_init_set(ent->base, c);
+		ent->bytes = sizeof(cache_entry) + cache_mpz_bytes(ent->base);
+		ent->hnext = cache->buckets[cache_hash(cache,dataset,label)];
+		cache->buckets[cache_hash(cache,dataset,label)] = ent;
+		cache->stats.entries++;
+		cache->stats.bytes += ent->bytes;
+		if ((size_t)cache->stats.entries > cache->nbuckets) { cache_grow(cache); }
+	} else {
+		cache_unlink(cache, ent);
+		if (mpz_cmp(ent->base, c) != 0 && ent->refs == 0) {
+			// Key reused for another ciphertext
+			cache_drop_tab(cache, ent);
+			cache->stats.bytes -= cache_mpz_bytes(ent->base);
+			mpz_set(ent->base, c);
+			cache->stats.bytes += cache_mpz_bytes(ent->base);
+			ent->bytes = sizeof(cache_entry) + cache_mpz_bytes(ent->base);
+			ent->uses = 0;
+		}
+	}
+	cache_push(cache, ent);
+	ent->uses++;
+
+	if (mpz_cmp(ent->base, c) != 0) {
+		// Pinned entry holds another ciphertext under this key
+		cache->stats.misses++;
+		pthread_mutex_unlock(&cache->lock);
+		mpz_powm(r, c, e, cache->n);
+		return 0;
+	}
+
+	if (ent->has_tab) {
+		ent->refs++;
+		cache->stats.hits++;
+		pthread_mutex_unlock(&cache->lock);
+
+		mexp_table_powm(r, &ent->tab, e, cache->n);
+
+		pthread_mutex_lock(&cache->lock);
+		ent->refs--;
+		pthread_mutex_unlock(&cache->lock);
+		return 0;
+	}
+
+	if (ent->uses >= cache->hot && !ent->building) {
+		ent->building = 1;
+		ent->refs++;
+		build = 1;
+	}
+	cache->stats.misses++;
+	cache_evict(cache);
+	pthread_mutex_unlock(&cache->lock);
+
+	if (!build) {
+		mpz_powm(r, c, e, cache->n);
+		return 0;
+	}
+
+	// Build outside the lock, the entry is pinned meanwhile
+	if (mexp_table_init(&tab, c, cache->k, cache->w, cache->n) != 0) {
+		mpz_powm(r, c, e, cache->n);
+		pthread_mutex_lock(&cache->lock);
+		ent->building = 0;
+		ent->refs--;
+		pthread_mutex_unlock(&cache->lock);
+		return 0;
+	}
+	mexp_table_powm(r, &tab, e, cache->n);
+
+	pthread_mutex_lock(&cache->lock);
+	ent->tab = tab;
+	ent->has_tab = 1;
+	ent->building = 0;
+	ent->refs--;
+	ent->bytes += cache_tab_bytes(&tab);
+	cache->stats.bytes += cache_tab_bytes(&tab);
+	cache->stats.builds++;
+	cache_evict(cache);
+	pthread_mutex_unlock(&cache->lock);
+
+	return 0;
+}
+
+/*
+ * Cache statistics so far
+ */
+int labhe_cache_stats_get(labhe_cache *cache, labhe_cache_stats *stats)
+{
+	pthread_mutex_lock(&cache->lock);
+	*stats = cache->stats;
+	pthread_mutex_unlock(&cache->lock);
+	return 0;
+}
+
+/*
+ * Release the cache and all its tables
+ * Assumptions: no exponentiation is in progress
+ */
+void labhe_cache_clear(labhe_cache *cache)
+{
+	while (cache->head) { cache_remove(cache, cache->head); }
+	pthread_mutex_destroy(&cache->lock);
+	mpz_clear(cache->n);
+	free(cache->buckets);
+	free(cache);
+}
+
+/*
+ * LABHE batch homomorphic multiplication through the table cache.
+ * Same result as labhe_hommul_lev0_batch up to the representation of
+ * the enc1 term, whose exponent is reduced mod 2^{k}.
+ * Inputs:
+ *   - Cache: cache (created for the same n and k)
+ *   - Keys of both batches: dataset1, start_label1, dataset2, start_label2
+ *     (ciphertext i of a batch is stored under start_label+i)
+ *   - Many pairs of level-0 ciphertexts: bm1[], c1[], bm2[], c2[]
+ *   - BHJK public/precomputed parameters: n, k, enc1
+ * Outputs:
+ *   - Many level 1 ciphertexts: c
+ * Assumptions:
+ *   - Ciphertexts are in valid range 0 <= bm1[],bm2[] < 2^{k}, 0 <= c1[],c2[] < n
+ *   - All I/O pointers are allocated and initialized by caller
+ */
+int labhe_hommul_lev0_batch_cache(mpz_t *c, labhe_cache *cache,
+	                              const uint32_t dataset1, const int start_label1,
+	                              const mpz_t *bm1, const mpz_t *c1,
+	                              const uint32_t dataset2, const int start_label2,
+	                              const mpz_t *bm2, const mpz_t *c2, const int count,
+	                              const mpz_t n, const int k, const mpz_t enc1)
+{
+	int i;
+	mpz_t t1,t2,t3;
+
+	mpz_inits(t1,t2,t3,NULL);
+
+	for (i=0;i<count;i++) {
+		mpz_mul(t3,bm1[i],bm2[i]);
+		mpz_fdiv_r_2exp(t3,t3,k);
+		labhe_cache_powm(cache,t2,LABHE_CACHE_ENC1,0,enc1,t3);
+		labhe_cache_powm(cache,t1,dataset1,start_label1+i,c1[i],bm2[i]);
+		bhjl_homadd(t3,t1,t2,n);
+		labhe_cache_powm(cache,t1,dataset2,start_label2+i,c2[i],bm1[i]);
+		bhjl_homadd(c[i],t1,t3,n);
+	}
+
+	mpz_clears(t1,t2,t3,NULL);
+
+	return 0;
+}
+
+/*
+ * LABHE homomorphic multiplication of a level-0 ciphertext by a
+ * scalar through the table cache
+ * Inputs:
+ *   - Cache: cache (created for the same n and k)
+ *   - Key of the ciphertext: dataset, label
+ *   - Level-0 ciphertext: bm, c
+ *   - Scalar: s (reduced mod 2^{k})
+ *   - BHJK public parameter: k (n is the cache's)
+ * Outputs:
+ *   - Level-0 ciphertext of s*m: bmres, cres
+ * Assumptions:
+ *   - Ciphertext is in valid range 0 <= bm < 2^{k}, 0 <= c < n
+ *   - All I/O pointers are allocated and initialized by caller
+ */
+int labhe_homsmul_lev0_cache(mpz_t bmres, mpz_t cres, labhe_cache *cache,
+	                              const uint32_t dataset, const int label,
+	                              const mpz_t bm, const mpz_t c, const mpz_t s,
+	                              const int k)
+{
+	mpz_t t;
+
+	mpz_init(t);
+	mpz_fdiv_r_2exp(t,s,k);
+	labhe_cache_powm(cache,cres,dataset,label,c,t);
+	mpz_mul(t,bm,t);
+	mpz_fdiv_r_2exp(bmres,t,k);
+	mpz_clear(t);
+
+	return 0;
+}
@@ -0,0 +1,519 @@
+#include <gmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "labhe.h"
+#include "tune.h"
+#include "labhe_pool.h"
+#include "labhe_file.h"
+
+#define LF_MAGIC "LABHECT"
+#define LF_VERSION 1
+#define LF_ENDIAN 0x01020304
+#define LF_WRITE_BUF (1<<20)
+
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint32_t endian;
+	uint32_t level;
+	uint32_t k;
+	uint32_t limb_bits;
+	uint32_t nlimbs;
+	uint32_t klimbs;
+	int32_t start_label;
+	uint64_t count;
+	uint64_t n_tag;
+	uint32_t flags;      // zero in files written before the flags field
+} lf_header;
+
+struct labhe_file_writer {
+	FILE *fp;
+	char *path, *tmp;
+	lf_header h;
+	mp_limb_t *rec;
+	size_t stride;
+};
+
+static long long lf_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec*1000000000LL + ts.tv_nsec;
+}
+
+/*
+ * Copy x into a zero-padded field of limbs limbs
+ */
+static int lf_put(mp_limb_t *dst, const mpz_t x, const size_t limbs)
+{
+	size_t s = mpz_size(x);
+
+	if (s > limbs || mpz_sgn(x) < 0) { return 1; }
+	if (s) { memcpy(dst, mpz_limbs_read(x), s*sizeof(mp_limb_t)); }
+	memset(dst+s, 0, (limbs-s)*sizeof(mp_limb_t));
+	return 0;
+}
+
+/*
+ * Start writing a ciphertext dataset file
+ * Inputs:
+ *   - Output file (written to path.tmp, renamed by labhe_file_finish): path
+ *   - Ciphertext level (0 or 1) and label of the first record: level, start_label
+ *   - BHJK public parameters: n,k
+ *   - Dataset flags: flags (LABHE_FILE_LINEAR: level-0 records hold bm
+ *     only, from labhe_encrypt_offline_batch_rng without eb_masks)
+ * Outputs:
+ *   - Writer to append records to: w
+ */
+int labhe_file_create_flags(labhe_file_writer **w, const char *path, const int level,
+	                        const int start_label, const mpz_t n, const int k, const int flags)
+{
+	labhe_file_writer *fw;
+	unsigned char pad[LABHE_FILE_ALIGN];
+
+	if ((level != 0 && level != 1) || k < 1 || mpz_sgn(n) <= 0) { return 1; }
+	if ((flags & ~LABHE_FILE_LINEAR) || ((flags & LABHE_FILE_LINEAR) && level != 0)) { return 1; }
+
+	fw = (labhe_file_writer *)calloc(1, sizeof(labhe_file_writer));
+	if (!fw) { return 1; }
+	memcpy(fw->h.magic, LF_MAGIC, sizeof(fw->h.magic));
+	fw->h.version = LF_VERSION;
+	fw->h.endian = LF_ENDIAN;
+	fw->h.level = level;
+	fw->h.k = k;
+	fw->h.limb_bits = GMP_NUMB_BITS;
+	fw->h.nlimbs = mpz_size(n);
+	fw->h.klimbs = (level == 0) ? (k + GMP_NUMB_BITS-1)/GMP_NUMB_BITS : 0;
+	fw->h.start_label = start_label;
+	fw->h.n_tag = mpz_getlimbn(n, 0);
+	fw->h.flags = flags;
+	fw->stride = (flags & LABHE_FILE_LINEAR) ? fw->h.klimbs : fw->h.nlimbs + fw->h.klimbs;
+
+	fw->path = strdup(path);
+	fw->tmp = (char *)malloc(strlen(path)+5);
+	fw->rec = (mp_limb_t *)malloc(fw->stride*sizeof(mp_limb_t));
+	if (!fw->path || !fw->tmp || !fw->rec) { goto err; }
+	sprintf(fw->tmp, "%s.tmp", path);
+
+	fw->fp = fopen(fw->tmp, "wb");
+	if (!fw->fp) { goto err; }
+	setvbuf(fw->fp, NULL, _IOFBF, LF_WRITE_BUF);
+
+	// Header is rewritten with the final count by labhe_file_finish
+	memset(pad, 0, sizeof(pad));
+	memcpy(pad, &fw->h, sizeof(lf_header));
+	if (fwrite(pad, sizeof(pad), 1, fw->fp) != 1) {
+		fclose(fw->fp);
+		unlink(fw->tmp);
+		goto err;
+	}
+
+	*w = fw;
+	return 0;
+
+err:
+	free(fw->path);
+	free(fw->tmp);
+	free(fw->rec);
+	free(fw);
+	return 1;
+}
+
+int labhe_file_create(labhe_file_writer **w, const char *path, const int level,
+	                  const int start_label, const mpz_t n, const int k)
+{
+	return labhe_file_create_flags(w, path, level, start_label, n, k, 0);
+}
+
+/*
+ * Append the ciphertext of the next label
+ * Inputs:
+ *   - Level-0 ciphertext (bm,c), or level-1 ciphertext c (bm ignored);
+ *     c is ignored in linear-only files
+ * Assumptions:
+ *   - 0 <= bm < 2^k and 0 <= c < n
+ */
+int labhe_file_append(labhe_file_writer *w, const mpz_t bm, const mpz_t c)
+{
+	if (w->h.level == 0 && lf_put(w->rec, bm, w->h.klimbs) != 0) { return 1; }
+	if (!(w->h.flags & LABHE_FILE_LINEAR) && lf_put(w->rec + w->h.klimbs, c, w->h.nlimbs) != 0) { return 1; }
+	if (fwrite(w->rec, w->stride*sizeof(mp_limb_t), 1, w->fp) != 1) { return 1; }
+	w->h.count++;
+	return 0;
+}
+
+/*
+ * Finalize the header, flush the file to disk and rename it into
+ * place; the writer is freed in all cases
+ */
+int labhe_file_finish(labhe_file_writer *w)
+{
+	int rc = 1;
+
+	if (fseek(w->fp, 0, SEEK_SET) == 0 &&
+	    fwrite(&w->h, sizeof(lf_header), 1, w->fp) == 1 &&
+	    fflush(w->fp) == 0 && fsync(fileno(w->fp)) == 0) {
+		rc = 0;
+	}
+	if (fclose(w->fp) != 0) { rc = 1; }
+	if (rc == 0 && rename(w->tmp, w->path) != 0) { rc = 1; }
+	if (rc != 0) { unlink(w->tmp); }
+
+	free(w->path);
+	free(w->tmp);
+	free(w->rec);
+	free(w);
+
+	return rc;
+}
+
+/*
+ * Map a ciphertext dataset file read-only for sequential access
+ * Outputs:
+ *   - Open file (close with labhe_file_close): f
+ */
+int labhe_file_open(labhe_file *f, const char *path)
+{
+	struct stat st;
+	lf_header h;
+	void *m;
+	size_t stride;
+	int fd;
+
+	memset(f, 0, sizeof(labhe_file));
+	fd = open(path, O_RDONLY);
+	if (fd < 0) { return 1; }
+	if (fstat(fd, &st) != 0 || (size_t)st.st_size < LABHE_FILE_ALIGN ||
+	    pread(fd, &h, sizeof(h), 0) != (ssize_t)sizeof(h)) {
+		close(fd);
+		return 1;
+	}
+	stride = (h.flags & LABHE_FILE_LINEAR) ? h.klimbs : (size_t)h.nlimbs + h.klimbs;
+	if (memcmp(h.magic, LF_MAGIC, sizeof(h.magic)) != 0 || h.version != LF_VERSION ||
+	    h.endian != LF_ENDIAN || h.limb_bits != GMP_NUMB_BITS || h.level > 1 ||
+	    (h.flags & ~LABHE_FILE_LINEAR) || ((h.flags & LABHE_FILE_LINEAR) && h.level != 0) ||
+	    h.nlimbs == 0 || h.k < 1 || stride == 0 ||
+	    h.klimbs != ((h.level == 0) ? (h.k + GMP_NUMB_BITS-1)/GMP_NUMB_BITS : 0) ||
+	    h.count > ((uint64_t)st.st_size - LABHE_FILE_ALIGN)/(stride*sizeof(mp_limb_t))) {
+		close(fd);
+		return 1;
+	}
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+	m = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (m == MAP_FAILED) { return 1; }
+	madvise(m, st.st_size, MADV_SEQUENTIAL);
+
+	f->map = m;
+	f->map_size = st.st_size;
+	f->level = h.level;
+	f->flags = h.flags;
+	f->k = h.k;
+	f->start_label = h.start_label;
+	f->count = h.count;
+	f->nlimbs = h.nlimbs;
+	f->klimbs = h.klimbs;
+	f->n_tag = h.n_tag;
+	f->records = (const mp_limb_t *)((const unsigned char *)m + LABHE_FILE_ALIGN);
+	f->stride = stride;
+
+	return 0;
+}
+
+void labhe_file_close(labhe_file *f)
+{
+	if (f->map) { munmap(f->map, f->map_size); }
+	memset(f, 0, sizeof(labhe_file));
+}
+
+/*
+ * View of records [first,first+count) of an open file as a file of its
+ * own (labels start_label+first, ...); it shares the mapping of f and
+ * must not be closed
+ */
+int labhe_file_range(labhe_file *sub, const labhe_file *f, const long long first, const long long count)
+{
+	if (first < 0 || count < 0 || first > f->count || count > f->count - first) { return 1; }
+	if (f->start_label + first + count - 1 > INT32_MAX) { return 1; }
+	*sub = *f;
+	sub->records = f->records + (size_t)first*f->stride;
+	sub->count = count;
+	sub->start_label = (int)(f->start_label + first);
+	return 0;
+}
+
+/*
+ * Read-only views of record i (never modify or mpz_clear them); c is
+ * 0 in linear-only files
+ */
+static void lf_view(mpz_t bm, mpz_t c, const labhe_file *f, const long long i)
+{
+	const mp_limb_t *r = f->records + (size_t)i*f->stride;
+
+	if (f->level == 0) { mpz_roinit_n(bm, r, f->klimbs); }
+	mpz_roinit_n(c, r + f->klimbs, (f->flags & LABHE_FILE_LINEAR) ? 0 : f->nlimbs);
+}
+
+/*
+ * Copy record i of an open file (bm is left untouched for level-1
+ * files, c is set to 0 for linear-only files)
+ */
+int labhe_file_get(const labhe_file *f, const long long i, mpz_t bm, mpz_t c)
+{
+	mpz_t vbm, vc;
+
+	if (i < 0 || i >= f->count) { return 1; }
+	lf_view(vbm, vc, f, i);
+	if (f->level == 0) { mpz_set(bm, vbm); }
+	mpz_set(c, vc);
+	return 0;
+}
+
+typedef struct lf_job lf_job;
+
+typedef struct {
+	const lf_job *job;
+	int rc;
+	int have;            // partial result holds at least one chunk
+	long long chunks;
+	mpz_t bm, c;         // partial result
+	mpz_t *bm1, *c1, *bm2, *c2; // record views of the current chunk
+} lf_worker;
+
+struct lf_job {
+	int op, k, chunk, workers;
+	const labhe_file *f1, *f2;
+	const mpz_t *n, *enc1;
+	long long nchunks;
+	atomic_llong next;
+};
+
+/*
+ * Hint the kernel to start reading records [i0,i1) / drop them from
+ * this mapping once consumed (pages stay in the page cache)
+ */
+static void lf_advise(const labhe_file *f, const long long i0, const long long i1, const int advice)
+{
+	uintptr_t a, b, page = (uintptr_t)sysconf(_SC_PAGESIZE);
+
+	a = (uintptr_t)(f->records + (size_t)i0*f->stride) & ~(page-1);
+	b = (uintptr_t)(f->records + (size_t)i1*f->stride);
+	b = (b + page-1) & ~(page-1);
+	if (b > (uintptr_t)f->map + f->map_size) { b = (uintptr_t)f->map + f->map_size; }
+	if (b > a) { madvise((void *)a, b-a, advice); }
+}
+
+static void lf_merge(mpz_t bm, mpz_t c, const mpz_t bmt, const mpz_t ct, const int level,
+	                 const mpz_t n, const int k)
+{
+	if (level == 0) {
+		mpz_add(bm, bm, bmt);
+		mpz_fdiv_r_2exp(bm, bm, k);
+	}
+	mpz_mul(c, c, ct);  // stays 0 for linear-only files
+	mpz_mod(c, c, n);
+}
+
+static int lf_result_level(const lf_job *job)
+{
+	return (job->op == LABHE_AGG_SUM) ? job->f1->level : 1;
+}
+
+/*
+ * Worker: claims chunks in file order, prefetching the chunk one round
+ * ahead while computing on the current one
+ */
+static void *lf_worker_run(void *arg)
+{
+	lf_worker *wk = (lf_worker *)arg;
+	const lf_job *job = wk->job;
+	const labhe_file *f2 = job->f2 ? job->f2 : job->f1;
+	long long ci, i0, i1, a0, a1, i;
+	int cnt, level = lf_result_level(job);
+	mpz_t bmt, ct;
+
+	mpz_inits(bmt, ct, NULL);
+	for (;;) {
+		ci = atomic_fetch_add_explicit((atomic_llong *)&job->next, 1, memory_order_relaxed);
+		if (ci >= job->nchunks) { break; }
+		i0 = ci*job->chunk;
+		i1 = (i0 + job->chunk < job->f1->count) ? i0 + job->chunk : job->f1->count;
+		cnt = (int)(i1 - i0);
+
+		if (ci + job->workers < job->nchunks) {
+			a0 = (ci + job->workers)*job->chunk;
+			a1 = (a0 + job->chunk < job->f1->count) ? a0 + job->chunk : job->f1->count;
+			lf_advise(job->f1, a0, a1, MADV_WILLNEED);
+			if (job->f2) { lf_advise(job->f2, a0, a1, MADV_WILLNEED); }
+		}
+
+		for (i=0;i<cnt;i++) {
+			lf_view(wk->bm1[i], wk->c1[i], job->f1, i0+i);
+			if (job->f2) { lf_view(wk->bm2[i], wk->c2[i], f2, i0+i); }
+		}
+
+		switch (job->op) {
+		case LABHE_AGG_SUM:
+			if (job->f1->flags & LABHE_FILE_LINEAR) {
+				wk->rc |= labhe_homadd_lev0_batch_flat(bmt,(const mpz_t *)wk->bm1,cnt,job->k,*job->n);
+				mpz_set_ui(ct,0);
+			} else if (job->f1->level == 0) {
+				wk->rc |= labhe_homadd_lev0_batch(bmt,ct,(const mpz_t *)wk->bm1,(const mpz_t *)wk->c1,
+				                                  cnt,job->k,*job->n);
+			} else {
+				wk->rc |= labhe_homadd_lev1_batch(ct,(const mpz_t *)wk->c1,cnt,*job->n);
+			}
+			break;
+		case LABHE_AGG_INNERPROD:
+			wk->rc |= labhe_innerprod_lev0(ct,(const mpz_t *)wk->bm1,(const mpz_t *)wk->c1,
+			                               (const mpz_t *)wk->bm2,(const mpz_t *)wk->c2,
+			                               cnt,*job->n,job->k,*job->enc1);
+			break;
+		default:
+			wk->rc |= labhe_innerprod_lev0(ct,(const mpz_t *)wk->bm1,(const mpz_t *)wk->c1,
+			                               (const mpz_t *)wk->bm1,(const mpz_t *)wk->c1,
+			                               cnt,*job->n,job->k,*job->enc1);
+			break;
+		}
+
+		if (wk->have) {
+			lf_merge(wk->bm, wk->c, bmt, ct, level, *job->n, job->k);
+		} else {
+			if (level == 0) { mpz_set(wk->bm, bmt); }
+			mpz_set(wk->c, ct);
+			wk->have = 1;
+		}
+		wk->chunks++;
+
+		lf_advise(job->f1, i0, i1, MADV_DONTNEED);
+		if (job->f2) { lf_advise(job->f2, i0, i1, MADV_DONTNEED); }
+	}
+	mpz_clears(bmt, ct, NULL);
+
+	return NULL;
+}
+
+static int lf_workers_run(void *arg, const int i0, const int i1, const int worker)
+{
+	lf_worker *wk = (lf_worker *)arg;
+	int i;
+
+	(void)worker;
+	for (i=i0;i<i1;i++) { lf_worker_run(&wk[i]); }
+	return 0;
+}
+
+/*
+ * Out-of-core LABHE aggregation over ciphertext dataset files, with
+ * memory bounded by workers*chunk records regardless of file size
+ * Inputs:
+ *   - Job: op (LABHE_AGG_SUM, LABHE_AGG_INNERPROD or LABHE_AGG_SUMSQ)
+ *   - Input files: f1, f2 (second operand of LABHE_AGG_INNERPROD, else NULL)
+ *   - BHJK public/secret/precomputed parameters: n,k,enc1
+ *   - Records per chunk and number of threads: chunk, workers
+ *     (workers < 1: from the tuning profile)
+ * Outputs:
+ *   - Level-0 result (bmres,cres) for LABHE_AGG_SUM of a level-0 file
+ *     (cres = 0 for a linear-only file, decrypted with
+ *     labhe_decrypt_online0), level-1 result cres otherwise (bmres untouched)
+ *   - Job statistics: stats (may be NULL)
+ * Assumptions:
+ *   - Files were written with the same n,k; f2 has the same count as f1
+ *   - Decryption of LABHE_AGG_INNERPROD/LABHE_AGG_SUMSQ uses
+ *     labhe_decrypt_offline_ip_sk over the labels of f1 (and f2)
+ *   - Linear-only files are refused by LABHE_AGG_INNERPROD/LABHE_AGG_SUMSQ
+ */
+int labhe_file_aggregate(mpz_t bmres, mpz_t cres, const int op,
+	                     const labhe_file *f1, const labhe_file *f2,
+	                     const mpz_t n, const int k, const mpz_t enc1,
+	                     const int chunk, const int workers,
+	                     labhe_file_stats *stats)
+{
+	lf_job job;
+	lf_worker *wk;
+	long long t0;
+	int i, nw, level, first = 1, rc = 0;
+
+	if (op != LABHE_AGG_SUM && op != LABHE_AGG_INNERPROD && op != LABHE_AGG_SUMSQ) { return 1; }
+	if ((op == LABHE_AGG_INNERPROD) != (f2 != NULL)) { return 1; }
+	if (chunk < 1 || f1->count < 1 || f1->k != k || f1->nlimbs != (int)mpz_size(n) ||
+	    f1->n_tag != mpz_getlimbn(n, 0)) { return 1; }
+	if (op != LABHE_AGG_SUM && (f1->level != 0 || (f1->flags & LABHE_FILE_LINEAR))) { return 1; }
+	if (f2 && (f2->level != 0 || (f2->flags & LABHE_FILE_LINEAR) || f2->count != f1->count || f2->k != k ||
+	           f2->nlimbs != f1->nlimbs || f2->n_tag != f1->n_tag)) { return 1; }
+
+	t0 = lf_now_ns();
+	job.op = op;
+	job.k = k;
+	job.chunk = chunk;
+	job.f1 = f1;
+	job.f2 = f2;
+	job.n = (const mpz_t *)n;
+	job.enc1 = (const mpz_t *)enc1;
+	job.nchunks = (f1->count + chunk-1)/chunk;
+	nw = (workers < 1) ? tune_workers() : workers;
+	if (nw > job.nchunks) { nw = (int)job.nchunks; }
+	job.workers = nw;
+	atomic_init(&job.next, 0);
+	level = lf_result_level(&job);
+
+	wk = (lf_worker *)calloc(nw, sizeof(lf_worker));
+	if (!wk) { return 1; }
+	for (i=0;i<nw;i++) {
+		wk[i].job = &job;
+		mpz_inits(wk[i].bm, wk[i].c, NULL);
+		wk[i].bm1 = (mpz_t *)malloc(4*(size_t)chunk*sizeof(mpz_t));
+		if (!wk[i].bm1) { rc = 1; continue; }
+		wk[i].c1 = wk[i].bm1 + chunk;
+		wk[i].bm2 = wk[i].c1 + chunk;
+		wk[i].c2 = wk[i].bm2 + chunk;
+	}
+
+	// The first round of chunks is requested up front
+	if (rc == 0) {
+		lf_advise(f1, 0, (nw*(long long)chunk < f1->count) ? nw*(long long)chunk : f1->count, MADV_WILLNEED);
+		if (f2) { lf_advise(f2, 0, (nw*(long long)chunk < f2->count) ? nw*(long long)chunk : f2->count, MADV_WILLNEED); }
+
+		labhe_pool_run_shards(nw, lf_workers_run, wk);
+	}
+
+	for (i=0;i<nw;i++) {
+		rc |= wk[i].rc;
+		if (rc == 0 && wk[i].have) {
+			if (first) {
+				if (level == 0) { mpz_set(bmres, wk[i].bm); }
+				mpz_set(cres, wk[i].c);
+				first = 0;
+			} else {
+				lf_merge(bmres, cres, wk[i].bm, wk[i].c, level, n, k);
+			}
+		}
+	}
+
+	if (stats) {
+		memset(stats, 0, sizeof(labhe_file_stats));
+		for (i=0;i<nw;i++) { stats->chunks += wk[i].chunks; }
+		stats->ciphertexts = f1->count * (f2 ? 2 : 1);
+		stats->bytes = f1->count*(long long)f1->stride*sizeof(mp_limb_t);
+		if (f2) { stats->bytes += f2->count*(long long)f2->stride*sizeof(mp_limb_t); }
+		stats->ns = lf_now_ns() - t0;
+	}
+
+	for (i=0;i<nw;i++) {
+		mpz_clears(wk[i].bm, wk[i].c, NULL);
+		free(wk[i].bm1);
+	}
+	free(wk);
+
+	return rc;
+}
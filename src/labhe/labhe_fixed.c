@@ -0,0 +1,261 @@
+#include <gmp.h>
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define FIXED_AVX2 1
+#endif
+
+#include "labhe_fixed.h"
+
+// x + 1.5*2^52 has integer ulp: its low mantissa bits hold round(x)
+// for |x| < 2^51, in the current (round-to-nearest) mode like llrint
+#define FIXED_MAGIC 6755399441055744.0
+
+/*
+ * Fixed-point format
+ * Inputs:
+ *   - Public BHJK parameter: k
+ *   - Fractional bits of the encoding: frac_bits (0 <= frac_bits < k-1)
+ * Outputs:
+ *   - Format: fx
+ */
+int labhe_fixed_init(labhe_fixed *fx, const int k, const int frac_bits)
+{
+	if (k < 2 || frac_bits < 0 || frac_bits >= k-1) { return 1; }
+	fx->k = k;
+	fx->frac_bits = frac_bits;
+	return 0;
+}
+
+/*
+ * Format of the product of two encodings (level-1 results of hommul
+ * and inner products): the fractional bits add up
+ */
+int labhe_fixed_product(labhe_fixed *res, const labhe_fixed *a, const labhe_fixed *b)
+{
+	if (a->k != b->k) { return 1; }
+	return labhe_fixed_init(res, a->k, a->frac_bits + b->frac_bits);
+}
+
+/*
+ * Largest magnitude a quantized value may round to: both the double
+ * conversion and the signed k-bit range must hold it
+ */
+static double fixed_bound(const labhe_fixed *fx)
+{
+	int bits = (fx->k - 1 < LABHE_FIXED_DOUBLE_BITS) ? fx->k - 1 : LABHE_FIXED_DOUBLE_BITS;
+
+	// |x| < 2^bits - 1/2 rounds to at most 2^bits - 1
+	return ldexp(1.0, bits) - 0.5;
+}
+
+static int fixed_quantize_scalar(int64_t *q, const double *v, const int count,
+	                             const double scale, const double bound)
+{
+	double x;
+	int i, rc = 0;
+
+	for (i=0;i<count;i++) {
+		x = v[i]*scale;
+		if (!(fabs(x) < bound)) {
+			rc = 1;
+			x = 0;
+		}
+		q[i] = llrint(x);
+	}
+	return rc;
+}
+
+#ifdef FIXED_AVX2
+
+__attribute__((target("avx2")))
+static int fixed_quantize_avx2(int64_t *q, const double *v, const int count,
+	                           const double scale, const double bound)
+{
+	const __m256d s = _mm256_set1_pd(scale), lim = _mm256_set1_pd(bound);
+	const __m256d magic = _mm256_set1_pd(FIXED_MAGIC);
+	const __m256d absmask = _mm256_castsi256_pd(_mm256_set1_epi64x(0x7fffffffffffffffLL));
+	__m256d x, in, ok = _mm256_castsi256_pd(_mm256_set1_epi64x(-1));
+	int i;
+
+	// 4 values per step: scale, range check (NaN fails), round
+	for (i=0;i+4<=count;i+=4) {
+		x = _mm256_mul_pd(_mm256_loadu_pd(v+i), s);
+		in = _mm256_cmp_pd(_mm256_and_pd(x, absmask), lim, _CMP_LT_OQ);
+		ok = _mm256_and_pd(ok, in);
+		x = _mm256_add_pd(_mm256_and_pd(x, in), magic);
+		_mm256_storeu_si256((__m256i *)(q+i),
+		                    _mm256_sub_epi64(_mm256_castpd_si256(x), _mm256_castpd_si256(magic)));
+	}
+
+	return (_mm256_movemask_pd(ok) != 0xf) | fixed_quantize_scalar(q+i, v+i, count-i, scale, bound);
+}
+
+#endif
+
+/*
+ * Non-zero if quantization runs on AVX2 on this machine
+ */
+int labhe_fixed_simd(void)
+{
+#ifdef FIXED_AVX2
+	return __builtin_cpu_supports("avx2");
+#else
+	return 0;
+#endif
+}
+
+/*
+ * Quantize real values: q[i] = round(v[i] * 2^frac_bits), ties to even
+ * Inputs:
+ *   - Values and their count: v, count
+ *   - Fixed-point format: fx
+ * Outputs:
+ *   - Signed integers: q (0 where v is out of range)
+ *   - 1 if some value is NaN, infinite or out of range: |q| must stay
+ *     below 2^min(k-1,LABHE_FIXED_DOUBLE_BITS)
+ */
+int labhe_fixed_quantize(int64_t *q, const double *v, const int count, const labhe_fixed *fx)
+{
+	double scale = ldexp(1.0, fx->frac_bits), bound = fixed_bound(fx);
+
+#ifdef FIXED_AVX2
+	if (labhe_fixed_simd()) { return fixed_quantize_avx2(q, v, count, scale, bound); }
+#endif
+	return fixed_quantize_scalar(q, v, count, scale, bound);
+}
+
+/*
+ * cs[i] = (b_masks[i] + q[i]) mod 2^k with q[i] in two's complement:
+ * on two limbs without temporaries when k <= 128 (all BHJL parameter
+ * sets in use), through mpz arithmetic otherwise
+ */
+static void fixed_mask(mpz_t *cs, const int64_t *q, const mpz_t *b_masks, const int count, const int k)
+{
+	mp_limb_t *r, lo, hi, b0, hi_mask;
+	mpz_t t;
+	int i;
+
+	if (GMP_NUMB_BITS == 64 && k > 64 && k <= 128) {
+		hi_mask = (k == 128) ? ~(mp_limb_t)0 : ((mp_limb_t)1 << (k-64)) - 1;
+		for (i=0;i<count;i++) {
+			b0 = mpz_getlimbn(b_masks[i], 0);
+			lo = b0 + (mp_limb_t)q[i];
+			hi = mpz_getlimbn(b_masks[i], 1) + (q[i] < 0 ? ~(mp_limb_t)0 : 0) + (lo < b0);
+			r = mpz_limbs_write(cs[i], 2);
+			r[0] = lo;
+			r[1] = hi & hi_mask;
+			mpz_limbs_finish(cs[i], 2);
+		}
+		return;
+	}
+
+	mpz_init(t);
+	for (i=0;i<count;i++) {
+		mpz_set_si(t, q[i]);
+		mpz_add(cs[i], b_masks[i], t);
+		mpz_fdiv_r_2exp(cs[i], cs[i], k);
+	}
+	mpz_clear(t);
+}
+
+/*
+ * LABHE online encryption of real values (fixed-point ingestion)
+ * Inputs:
+ *   - Values and their count: v, count
+ *   - Precomputed masks of their labels: b_masks (labhe_encrypt_offline_batch)
+ *   - Fixed-point format: fx
+ * Outputs:
+ *   - Masked messages cs (the bm part of the level-0 ciphertexts; the
+ *     c part is the offline eb_masks)
+ *   - 1 if some value cannot be encoded (see labhe_fixed_quantize); the
+ *     others are still encrypted and out-of-range values encode 0
+ * Assumptions:
+ *   - all I/O pointers are allocated and initialized by caller
+ */
+int labhe_fixed_encrypt_double(mpz_t *cs, const double *v, const mpz_t *b_masks, const int count,
+	                           const labhe_fixed *fx)
+{
+	int64_t q[LABHE_FIXED_CHUNK];
+	int i, c, rc = 0;
+
+	for (i=0;i<count;i+=LABHE_FIXED_CHUNK) {
+		c = (count - i < LABHE_FIXED_CHUNK) ? count - i : LABHE_FIXED_CHUNK;
+		rc |= labhe_fixed_quantize(q, v+i, c, fx);
+		fixed_mask(cs+i, q, b_masks+i, c, fx->k);
+	}
+
+	return rc;
+}
+
+/*
+ * LABHE online encryption of integer values v[i] * 2^frac_bits, as
+ * labhe_fixed_encrypt_double (raw counters or readings that are
+ * already fixed-point integers use frac_bits = 0)
+ * Outputs:
+ *   - 1 if some scaled value leaves the int64 or signed k-bit range
+ *     (it is encrypted as 0)
+ */
+int labhe_fixed_encrypt_int64(mpz_t *cs, const int64_t *v, const mpz_t *b_masks, const int count,
+	                          const labhe_fixed *fx)
+{
+	int64_t q[LABHE_FIXED_CHUNK], lim;
+	int i, j, c, bits, rc = 0;
+
+	bits = (fx->k - 1 < 63) ? fx->k - 1 : 63;
+	lim = (int64_t)((((uint64_t)1 << bits) - 1) >> fx->frac_bits);
+	if (fx->frac_bits >= 63) { lim = 0; }
+
+	for (i=0;i<count;i+=LABHE_FIXED_CHUNK) {
+		c = (count - i < LABHE_FIXED_CHUNK) ? count - i : LABHE_FIXED_CHUNK;
+		for (j=0;j<c;j++) {
+			if (v[i+j] > lim || v[i+j] < -lim) {
+				rc = 1;
+				q[j] = 0;
+			} else {
+				q[j] = (int64_t)((uint64_t)v[i+j] << fx->frac_bits);
+			}
+		}
+		fixed_mask(cs+i, q, b_masks+i, c, fx->k);
+	}
+
+	return rc;
+}
+
+/*
+ * Decrypted k-bit two's complement message -> signed integer value
+ * (the fixed-point value times 2^frac_bits)
+ */
+int labhe_fixed_decode_mpz(mpz_t r, const mpz_t m, const labhe_fixed *fx)
+{
+	mpz_t t;
+
+	mpz_fdiv_r_2exp(r, m, fx->k);
+	if (mpz_tstbit(r, fx->k-1)) {
+		mpz_init(t);
+		mpz_setbit(t, fx->k);
+		mpz_sub(r, r, t);
+		mpz_clear(t);
+	}
+	return 0;
+}
+
+/*
+ * Decrypted k-bit two's complement message -> real value (truncated to
+ * double precision)
+ */
+double labhe_fixed_decode(const mpz_t m, const labhe_fixed *fx)
+{
+	mpz_t r;
+	double d;
+
+	mpz_init(r);
+	labhe_fixed_decode_mpz(r, m, fx);
+	d = ldexp(mpz_get_d(r), -fx->frac_bits);
+	mpz_clear(r);
+
+	return d;
+}
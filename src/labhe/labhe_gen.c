@@ -1,11 +1,44 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/random.h>
 #include <gmp.h>
 
 #include "prf.h"
+#include "rng.h"
+#include "mont.h"
+#include "tune.h"
 #include "bhjl.h"
 #include "bhjl_gen.h"
+#include "labhe_pool.h"
 #include "labhe_gen.h"
 
+#define GEN_MAGIC "LABHEKY"
+#define GEN_VERSION 1
+#define GEN_HEADER_SIZE 32
+
+typedef struct gen_job gen_job;
+
+typedef struct {
+	const gen_job *job;
+	int i0, i1;   // keys [i0,i1) of this shard
+	int rc;
+} gen_shard;
+
+struct gen_job {
+	mpz_t *pks;
+	const unsigned char *sks;
+	const mpz_t *n, *_2k;
+	const mexp_table *ytab;
+	const labhe_rng *rng;
+	const mont_ctx *ctx;
+	int k;
+};
+
 /*
  * Master key generator for public-key LabHE-BHJL scheme
  * Inputs: 
@@ -109,3 +142,291 @@ int labhe_gen_sk(unsigned char *sk,
     return 0;
 }
 
+
+/*
+ * Fill buf from the kernel CSPRNG (getrandom returns at most 32MB
+ * per call, so large requests take a few)
+ */
+static int gen_random(unsigned char *buf, size_t len)
+{
+	ssize_t r;
+
+	while (len > 0) {
+		r = getrandom(buf, len, 0);
+		if (r < 0 && errno == EINTR) { continue; }
+		if (r <= 0) { return 1; }
+		buf += r;
+		len -= r;
+	}
+	return 0;
+}
+
+/*
+ * Shard of labhe_gen_batch: pk = y^{sk} x^{2^k} mod n with the table of
+ * y and randomizer x = rng_urandomm_label(i) for key i
+ */
+static void *gen_shard_run(void *arg)
+{
+	gen_shard *sh = (gen_shard *)arg;
+	const gen_job *job = sh->job;
+	mpz_t sk_num, x;
+	int i;
+
+	mpz_inits(sk_num, x, NULL);
+	for (i=sh->i0;i<sh->i1;i++) {
+		mpz_import(sk_num, SK_SIZE, 1, 1, 0, 0, job->sks + (size_t)i*SK_SIZE);
+		if (rng_urandomm_label(x, job->rng, i, *job->n) != 0) {
+			sh->rc = 1;
+			break;
+		}
+		if (job->ctx) {
+			mont_powm_2exp(job->pks[i], x, job->k, job->ctx);
+		} else {
+			mpz_powm(job->pks[i], x, *job->_2k, *job->n);
+		}
+		mexp_table_mulpowm(job->pks[i], job->ytab, sk_num, *job->n);
+	}
+	mpz_clears(sk_num, x, NULL);
+
+	return NULL;
+}
+
+static int gen_shards_run(void *arg, const int i0, const int i1, const int worker)
+{
+	gen_shard *sh = (gen_shard *)arg;
+	int i, rc = 0;
+
+	(void)worker;
+	for (i=i0;i<i1;i++) {
+		gen_shard_run(&sh[i]);
+		rc |= sh[i].rc;
+	}
+	return rc;
+}
+
+/*
+ * Bulk encryptor key generator for public-key LabHE-BHJL scheme
+ * Inputs: 
+ *   - Number of keys: count
+ *   - BHJL public/precomputed parameters: n, y, k, _2k
+ *   - Optional fixed-base table of y for k-bit exponents (see
+ *     keystore_load_public), NULL to build one for this batch
+ *   - Number of threads: workers (< 1: from the tuning profile)
+ * Outputs: 
+ *   - Sender public/secret keys: pks[count], sks[count*SK_SIZE]; all
+ *     secret keys and the randomizer seed come from one getrandom draw
+ * Assumptions: 
+ *   - all I/O pointers are allocated and initialized by caller
+ */
+int labhe_gen_batch(mpz_t *pks, unsigned char *sks, const int count,
+	                const mpz_t n, const mpz_t y, const mexp_table *ytab, const int k,
+	                const mpz_t _2k, const int workers)
+{
+	gen_job job;
+	gen_shard *sh;
+	labhe_rng rng;
+	mexp_table tab;
+	unsigned char *rnd;
+	int i, nshards, rc = 0;
+
+	if (count < 1) { return count < 0; }
+
+	rnd = (unsigned char *)malloc((size_t)count*SK_SIZE + RNG_SEED_SIZE);
+	if (!rnd) { return 1; }
+	if (gen_random(rnd, (size_t)count*SK_SIZE + RNG_SEED_SIZE) != 0 ||
+	    rng_init_seed(&rng, rnd + (size_t)count*SK_SIZE) != 0) {
+		memset(rnd, 0, (size_t)count*SK_SIZE + RNG_SEED_SIZE);
+		free(rnd);
+		return 1;
+	}
+	memcpy(sks, rnd, (size_t)count*SK_SIZE);
+	memset(rnd, 0, (size_t)count*SK_SIZE + RNG_SEED_SIZE);
+	free(rnd);
+
+	if (!ytab) {
+		if (mexp_table_init(&tab, y, k, mexp_table_window(k, count), n) != 0) { return 1; }
+	}
+
+	job.pks = pks;
+	job.sks = sks;
+	job.n = (const mpz_t *)n;
+	job._2k = (const mpz_t *)_2k;
+	job.ytab = ytab ? ytab : &tab;
+	job.rng = &rng;
+	job.ctx = tune_mont(TUNE_MONT_ENCRYPT, n) ? mont_lookup(n) : NULL;
+	job.k = k;
+
+	nshards = (workers < 1) ? tune_workers() : workers;
+	if (nshards > count) { nshards = count; }
+	sh = (gen_shard *)calloc(nshards, sizeof(gen_shard));
+	if (!sh) {
+		rc = 1;
+		goto done;
+	}
+	for (i=0;i<nshards;i++) {
+		sh[i].job = &job;
+		sh[i].i0 = (int)((long long)count*i/nshards);
+		sh[i].i1 = (int)((long long)count*(i+1)/nshards);
+	}
+	rc = labhe_pool_run_shards(nshards, gen_shards_run, sh);
+	free(sh);
+
+done:
+	memset(&rng, 0, sizeof(rng));
+	if (!ytab) { mexp_table_clear(&tab); }
+
+	return rc;
+}
+
+static void gen_put32(unsigned char *b, const uint32_t v)
+{
+	b[0] = v>>24; b[1] = v>>16; b[2] = v>>8; b[3] = v;
+}
+
+static uint32_t gen_get32(const unsigned char *b)
+{
+	return ((uint32_t)b[0]<<24) | ((uint32_t)b[1]<<16) | ((uint32_t)b[2]<<8) | b[3];
+}
+
+/*
+ * Save encryptor key pairs (big-endian, readable on any host):
+ *   magic[8] version[4] k[4] pk_bytes[4] sk_bytes[4] count[8]
+ * followed by count records pk (pk_bytes bytes), sk (SK_SIZE bytes).
+ * The file holds secret keys: it is created with mode 0600, written to
+ * path.tmp and renamed into place.
+ */
+int labhe_gen_save(const char *path, const mpz_t *pks, const unsigned char *sks, const int count,
+	               const mpz_t n, const int k)
+{
+	unsigned char hdr[GEN_HEADER_SIZE], *rec;
+	size_t pkb, len;
+	char *tmp;
+	FILE *fp;
+	int i, fd, rc = 0;
+
+	pkb = (mpz_sizeinbase(n,2) + 7)/8;
+	memset(hdr, 0, sizeof(hdr));
+	memcpy(hdr, GEN_MAGIC, 8);
+	gen_put32(hdr+8, GEN_VERSION);
+	gen_put32(hdr+12, k);
+	gen_put32(hdr+16, pkb);
+	gen_put32(hdr+20, SK_SIZE);
+	gen_put32(hdr+24, 0);
+	gen_put32(hdr+28, count);
+
+	tmp = (char *)malloc(strlen(path)+5);
+	rec = (unsigned char *)malloc(pkb + SK_SIZE);
+	if (!tmp || !rec) {
+		free(tmp);
+		free(rec);
+		return 1;
+	}
+	sprintf(tmp, "%s.tmp", path);
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	fp = (fd < 0) ? NULL : fdopen(fd, "wb");
+	if (!fp) {
+		if (fd >= 0) { close(fd); }
+		free(tmp);
+		free(rec);
+		return 1;
+	}
+
+	if (fwrite(hdr, sizeof(hdr), 1, fp) != 1) { rc = 1; }
+	for (i=0;i<count && rc==0;i++) {
+		if (mpz_sgn(pks[i]) < 0 || mpz_sizeinbase(pks[i],2) > 8*pkb) {
+			rc = 1;
+			break;
+		}
+		memset(rec, 0, pkb);
+		mpz_export(rec + pkb - (mpz_sgn(pks[i]) ? (mpz_sizeinbase(pks[i],2)+7)/8 : 0), &len, 1, 1, 1, 0, pks[i]);
+		memcpy(rec + pkb, sks + (size_t)i*SK_SIZE, SK_SIZE);
+		if (fwrite(rec, pkb + SK_SIZE, 1, fp) != 1) { rc = 1; }
+	}
+	memset(rec, 0, pkb + SK_SIZE);
+	if (fflush(fp) != 0 || fsync(fileno(fp)) != 0) { rc = 1; }
+	if (fclose(fp) != 0) { rc = 1; }
+	if (rc == 0 && rename(tmp, path) != 0) { rc = 1; }
+	if (rc != 0) { unlink(tmp); }
+
+	free(tmp);
+	free(rec);
+
+	return rc;
+}
+
+/*
+ * Load encryptor key pairs saved by labhe_gen_save
+ * Outputs: 
+ *   - pks[count], sks[count*SK_SIZE] allocated here (release with
+ *     labhe_gen_keys_clear), count and k
+ */
+int labhe_gen_load(const char *path, mpz_t **pks, unsigned char **sks, int *count, int *k)
+{
+	unsigned char hdr[GEN_HEADER_SIZE], *rec;
+	size_t pkb;
+	uint32_t cnt;
+	FILE *fp;
+	int i, rc = 0;
+
+	*pks = NULL;
+	*sks = NULL;
+	fp = fopen(path, "rb");
+	if (!fp) { return 1; }
+	if (fread(hdr, sizeof(hdr), 1, fp) != 1 || memcmp(hdr, GEN_MAGIC, 8) != 0 ||
+	    gen_get32(hdr+8) != GEN_VERSION || gen_get32(hdr+20) != SK_SIZE ||
+	    gen_get32(hdr+24) != 0 || gen_get32(hdr+28) > INT32_MAX ||
+	    gen_get32(hdr+16) == 0 || gen_get32(hdr+16) > (1U<<16)) {
+		fclose(fp);
+		return 1;
+	}
+	*k = gen_get32(hdr+12);
+	pkb = gen_get32(hdr+16);
+	cnt = gen_get32(hdr+28);
+
+	rec = (unsigned char *)malloc(pkb + SK_SIZE);
+	*pks = (mpz_t *)malloc((cnt ? cnt : 1)*sizeof(mpz_t));
+	*sks = (unsigned char *)malloc((cnt ? cnt : 1)*(size_t)SK_SIZE);
+	if (!rec || !*pks || !*sks) {
+		rc = 1;
+		cnt = 0;
+	}
+	for (i=0;i<(int)cnt;i++) { mpz_init((*pks)[i]); }
+	for (i=0;i<(int)cnt && rc==0;i++) {
+		if (fread(rec, pkb + SK_SIZE, 1, fp) != 1) {
+			rc = 1;
+			break;
+		}
+		mpz_import((*pks)[i], pkb, 1, 1, 1, 0, rec);
+		memcpy(*sks + (size_t)i*SK_SIZE, rec + pkb, SK_SIZE);
+	}
+	if (rec) { memset(rec, 0, pkb + SK_SIZE); }
+	free(rec);
+	fclose(fp);
+
+	if (rc != 0) {
+		labhe_gen_keys_clear(*pks, *sks, cnt);
+		*pks = NULL;
+		*sks = NULL;
+		return 1;
+	}
+	*count = cnt;
+
+	return 0;
+}
+
+/*
+ * Release key pairs returned by labhe_gen_load (secret keys are wiped)
+ */
+void labhe_gen_keys_clear(mpz_t *pks, unsigned char *sks, const int count)
+{
+	int i;
+
+	if (pks) {
+		for (i=0;i<count;i++) { mpz_clear(pks[i]); }
+		free(pks);
+	}
+	if (sks) {
+		memset(sks, 0, (size_t)count*SK_SIZE);
+		free(sks);
+	}
+}
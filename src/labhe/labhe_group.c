@@ -0,0 +1,452 @@
+#include <gmp.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mont.h"
+#include "prf.h"
+#include "tune.h"
+#include "labhe.h"
+#include "labhe_pool.h"
+#include "labhe_group.h"
+
+#define GROUP_MIN_CAP 64
+#define GROUP_REDUCE 0xffff // bm reduced mod 2^k every 2^16 records
+
+typedef struct {
+	labhe_group *g;
+	const uint64_t *keys;
+	const mpz_t *bm, *c;
+	const int *labels;
+} group_job;
+
+static size_t group_hash(const uint64_t key, const size_t cap)
+{
+	uint64_t h = key * 0x9e3779b97f4a7c15ULL;
+
+	return (size_t)(h ^ (h >> 32)) & (cap - 1);
+}
+
+/*
+ * Slot of key in t, the empty slot where it goes if absent (records 0);
+ * t is grown first so that it stays at most half full
+ */
+static labhe_group_entry *group_slot(labhe_group_table *t, const uint64_t key)
+{
+	labhe_group_entry *e, *old;
+	size_t i, j, cap;
+
+	if (2*(t->size + 1) > t->cap) {
+		cap = t->cap ? 2*t->cap : GROUP_MIN_CAP;
+		e = (labhe_group_entry *)calloc(cap, sizeof(labhe_group_entry));
+		if (!e) { return NULL; }
+		old = t->e;
+		for (i=0;i<t->cap;i++) {
+			if (old[i].records == 0) { continue; }
+			for (j=group_hash(old[i].key,cap);e[j].records;j=(j+1)&(cap-1));
+			e[j] = old[i];
+		}
+		free(old);
+		t->e = e;
+		t->cap = cap;
+	}
+
+	for (i=group_hash(key,t->cap);t->e[i].records && t->e[i].key != key;i=(i+1)&(t->cap-1));
+	return &t->e[i];
+}
+
+/*
+ * Accumulator of key in t, created empty if absent
+ */
+static labhe_group_entry *group_entry(labhe_group_table *t, const labhe_group *g, const uint64_t key)
+{
+	labhe_group_entry *e = group_slot(t, key);
+
+	if (!e || e->records) { return e; }
+	if (g->with_c == 1 && g->ctx) {
+		e->acc = (mp_limb_t *)malloc(g->ctx->limbs*sizeof(mp_limb_t));
+		if (!e->acc) { return NULL; }
+	}
+	e->key = key;
+	mpz_inits(e->bm, e->c, NULL);
+	t->size++;
+	return e;
+}
+
+static void group_entry_clear(labhe_group_entry *e)
+{
+	mpz_clears(e->bm, e->c, NULL);
+	free(e->acc);
+	e->acc = NULL;
+	e->records = 0;
+}
+
+/*
+ * e->acc = e->acc * c * R^{-1}: after r records the chain holds the
+ * product times R^{-(r-1)}, fixed once in labhe_group_finish
+ */
+static int group_mul(labhe_group_entry *e, const mpz_t c, const labhe_group *g)
+{
+	mp_limb_t t[MONT_MAX_LIMBS];
+	const mont_ctx *ctx = g->ctx;
+
+	if (!ctx) {
+		if (e->records == 0) {
+			mpz_mod(e->c, c, g->n);
+		} else {
+			mpz_mul(e->c, e->c, c);
+			mpz_mod(e->c, e->c, g->n);
+		}
+		return 0;
+	}
+	if ((int)mpz_size(c) > ctx->limbs) { return 1; }
+	mpn_zero(t, ctx->limbs);
+	mpn_copyi(t, mpz_limbs_read(c), mpz_size(c));
+	if (e->records == 0) {
+		mpn_copyi(e->acc, t, ctx->limbs);
+	} else {
+		ctx->mul(e->acc, e->acc, t, ctx);
+	}
+	return 0;
+}
+
+static int group_reserve(labhe_group *g, const int tables)
+{
+	labhe_group_table *t;
+
+	if (tables <= g->ntables) { return 0; }
+	t = (labhe_group_table *)realloc(g->tables, tables*sizeof(labhe_group_table));
+	if (!t) { return 1; }
+	memset(t + g->ntables, 0, (tables - g->ntables)*sizeof(labhe_group_table));
+	g->tables = t;
+	g->ntables = tables;
+	return 0;
+}
+
+static int group_common_init(labhe_group *g, const int kind, const int k)
+{
+	memset(g, 0, sizeof(labhe_group));
+	mpz_init(g->n);
+	if (k < 1) { return 1; }
+	g->kind = kind;
+	g->k = k;
+	g->with_c = (kind == LABHE_GROUP_SUMS) ? -1 : 0;
+	return group_reserve(g, 1);
+}
+
+/*
+ * Start an empty evaluator table of group sums
+ * Inputs:
+ *   - BHJK public parameters: n, k
+ * Outputs:
+ *   - Table (release with labhe_group_clear): g
+ */
+int labhe_group_init(labhe_group *g, const mpz_t n, const int k)
+{
+	if (group_common_init(g, LABHE_GROUP_SUMS, k) != 0) { return 1; }
+	mpz_set(g->n, n);
+	g->ctx = tune_mont(TUNE_MONT_PROD, n) ? mont_lookup(n) : NULL;
+	return 0;
+}
+
+/*
+ * Start an empty decryptor table of group masks
+ * Inputs:
+ *   - Secret key of the labels: sk
+ *   - BHJK public parameter: k
+ * Outputs:
+ *   - Table (release with labhe_group_clear): g
+ */
+int labhe_group_mask_init(labhe_group *g, const unsigned char *sk, const int k)
+{
+	if (group_common_init(g, LABHE_GROUP_MASKS, k) != 0) { return 1; }
+	memcpy(g->sk, sk, SK_SIZE);
+	return 0;
+}
+
+static int group_sum_chunk(void *arg, const int i0, const int i1, const int worker)
+{
+	group_job *job = (group_job *)arg;
+	labhe_group *g = job->g;
+	labhe_group_table *t = &g->tables[worker];
+	labhe_group_entry *e;
+	int i;
+
+	for (i=i0;i<i1;i++) {
+		e = group_entry(t, g, job->keys[i]);
+		if (!e) { return 1; }
+		mpz_add(e->bm, e->bm, job->bm[i]);
+		if (job->c && group_mul(e, job->c[i], g) != 0) {
+			if (e->records == 0) { group_entry_clear(e); t->size--; }
+			return 1;
+		}
+		if ((++e->records & GROUP_REDUCE) == 0) { mpz_fdiv_r_2exp(e->bm, e->bm, g->k); }
+	}
+	return 0;
+}
+
+static int group_mask_chunk(void *arg, const int i0, const int i1, const int worker)
+{
+	unsigned char buf[NONCE_SIZE*PRF_BATCH];
+	group_job *job = (group_job *)arg;
+	labhe_group *g = job->g;
+	labhe_group_table *t = &g->tables[worker];
+	labhe_group_entry *e;
+	int i, j, c, rc = 0;
+	mpz_t x;
+
+	mpz_init(x);
+	for (i=i0;i<i1 && rc==0;i+=PRF_BATCH) {
+		c = i1 - i < PRF_BATCH ? i1 - i : PRF_BATCH;
+		prf_batch_list(buf, job->labels + i, c, g->sk);
+		for (j=0;j<c;j++) {
+			e = group_entry(t, g, job->keys[i+j]);
+			if (!e) { rc = 1; break; }
+			mpz_import(x, NONCE_SIZE, 1, sizeof(buf[0]), 0, 0, buf + j*NONCE_SIZE);
+			mpz_add(e->bm, e->bm, x);
+			if ((++e->records & GROUP_REDUCE) == 0) { mpz_fdiv_r_2exp(e->bm, e->bm, g->k); }
+		}
+	}
+	mpz_clear(x);
+	return rc;
+}
+
+static int group_run(labhe_group *g, group_job *job, const int count, labhe_pool_fn fn)
+{
+	labhe_pool *pool = labhe_pool_get();
+
+	if (g->finished || count < 0) { return 1; }
+	if (group_reserve(g, labhe_pool_workers(pool)) != 0) { return 1; }
+	return labhe_pool_run(pool, count, LABHE_GROUP_GRAIN, fn, job);
+}
+
+/*
+ * Evaluator: aggregate a batch of records into their groups
+ * Inputs:
+ *   - Sums table: g
+ *   - Batch size: count
+ *   - Group keys and level-0 ciphertexts of the records: keys[], bm[], c[]
+ *     (c NULL: sums of bm only, for every batch of the table)
+ * Outputs:
+ *   - 1 on failure (then the table is unspecified) or if g is finished
+ * Assumptions:
+ *   - Input ciphertexts are in valid range 0 <= bm < 2^k, 0 <= c < n
+ *   - Large batches run on the pool installed by labhe_pool_set, if any
+ */
+int labhe_group_add(labhe_group *g, const uint64_t *keys, const mpz_t *bm, const mpz_t *c,
+	                const int count)
+{
+	group_job job;
+
+	if (g->kind != LABHE_GROUP_SUMS) { return 1; }
+	if (g->with_c < 0) { g->with_c = c ? 1 : 0; }
+	if (g->with_c != (c ? 1 : 0)) { return 1; }
+	job.g = g;
+	job.keys = keys;
+	job.bm = bm;
+	job.c = c;
+	job.labels = NULL;
+	return group_run(g, &job, count, group_sum_chunk);
+}
+
+/*
+ * Decryptor: add the PRFs of a batch of records to their group masks
+ * Inputs:
+ *   - Masks table: g
+ *   - Batch size: count
+ *   - Group keys and labels of the records: keys[], labels[]
+ * Outputs:
+ *   - 1 on failure (then the table is unspecified) or if g is finished
+ * Assumptions:
+ *   - Large batches run on the pool installed by labhe_pool_set, if any
+ */
+int labhe_group_mask_add(labhe_group *g, const uint64_t *keys, const int *labels, const int count)
+{
+	group_job job;
+
+	if (g->kind != LABHE_GROUP_MASKS) { return 1; }
+	job.g = g;
+	job.keys = keys;
+	job.bm = NULL;
+	job.c = NULL;
+	job.labels = labels;
+	return group_run(g, &job, count, group_mask_chunk);
+}
+
+static int group_cmp(const void *a, const void *b)
+{
+	uint64_t ka = (*(labhe_group_entry * const *)a)->key;
+	uint64_t kb = (*(labhe_group_entry * const *)b)->key;
+
+	return (ka > kb) - (ka < kb);
+}
+
+/*
+ * Merge the per-worker tables, fix the Montgomery chains and sort the
+ * groups by key; no batch can be added afterwards
+ * Inputs:
+ *   - Sums or masks table: g
+ * Outputs:
+ *   - 1 on allocation failure
+ */
+int labhe_group_finish(labhe_group *g)
+{
+	mp_limb_t t[MONT_MAX_LIMBS];
+	labhe_group_table *dst = &g->tables[0];
+	labhe_group_entry *e, *d;
+	const mont_ctx *ctx = g->ctx;
+	size_t i, j;
+	int w, chain;
+	mpz_t x;
+
+	if (g->finished) { return 0; }
+	chain = (g->with_c == 1 && ctx != NULL);
+
+	for (w=1;w<g->ntables;w++) {
+		for (i=0;i<g->tables[w].cap;i++) {
+			e = &g->tables[w].e[i];
+			if (e->records == 0) { continue; }
+			d = group_slot(dst, e->key);
+			if (!d) { return 1; }
+			if (d->records == 0) {
+				*d = *e;
+				dst->size++;
+				e->records = 0;
+				e->acc = NULL;
+				continue;
+			}
+			mpz_add(d->bm, d->bm, e->bm);
+			if (chain) {
+				// two chains of r1 and r2 records make one of r1+r2
+				ctx->mul(d->acc, d->acc, e->acc, ctx);
+			} else if (g->with_c == 1) {
+				mpz_mul(d->c, d->c, e->c);
+				mpz_mod(d->c, d->c, g->n);
+			}
+			d->records += e->records;
+			group_entry_clear(e);
+		}
+		free(g->tables[w].e);
+		memset(&g->tables[w], 0, sizeof(labhe_group_table));
+	}
+
+	g->sorted = (labhe_group_entry **)malloc((dst->size ? dst->size : 1)*sizeof(labhe_group_entry *));
+	if (!g->sorted) { return 1; }
+	mpz_init(x);
+	for (i=0,j=0;i<dst->cap;i++) {
+		e = &dst->e[i];
+		if (e->records == 0) { continue; }
+		mpz_fdiv_r_2exp(e->bm, e->bm, g->k);
+		if (chain) {
+			// R^{records} mod n is the Montgomery form of R^{records-1}
+			mpz_set_ui(x, e->records - 1);
+			mont_powm_limbs(t, ctx->r2, x, ctx);
+			ctx->mul(e->acc, e->acc, t, ctx);
+			mpn_copyi(mpz_limbs_write(e->c, ctx->limbs), e->acc, ctx->limbs);
+			mpz_limbs_finish(e->c, ctx->limbs);
+			free(e->acc);
+			e->acc = NULL;
+		}
+		g->sorted[j++] = e;
+	}
+	mpz_clear(x);
+	g->groups = j;
+	qsort(g->sorted, g->groups, sizeof(labhe_group_entry *), group_cmp);
+	g->finished = 1;
+
+	return 0;
+}
+
+/*
+ * Group i of a finished table, in increasing key order
+ * Inputs:
+ *   - Finished table and group index: g, i < g->groups
+ * Outputs:
+ *   - Group key: key (may be NULL)
+ *   - Sums: level-0 ciphertext of the group sum bm, c (c is 0 for sums
+ *     of bm only); masks: the group mask in bm (c may be NULL)
+ *   - Number of records of the group: records (may be NULL)
+ */
+int labhe_group_get(uint64_t *key, mpz_t bm, mpz_t c, long long *records,
+	                const labhe_group *g, const size_t i)
+{
+	const labhe_group_entry *e;
+
+	if (!g->finished || i >= g->groups) { return 1; }
+	e = g->sorted[i];
+	if (key) { *key = e->key; }
+	mpz_set(bm, e->bm);
+	if (c) { mpz_set(c, e->c); }
+	if (records) { *records = e->records; }
+	return 0;
+}
+
+/*
+ * Index of the group of key in a finished table, -1 if absent
+ */
+long long labhe_group_find(const labhe_group *g, const uint64_t key)
+{
+	size_t lo = 0, hi = g->groups, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo)/2;
+		if (g->sorted[mid]->key < key) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return (lo < g->groups && g->sorted[lo]->key == key) ? (long long)lo : -1;
+}
+
+/*
+ * Decryptor: group sums of a finished sums table with the matching
+ * finished masks table (level-0 online stage per group)
+ * Inputs:
+ *   - Finished sums and masks tables: sums, masks
+ * Outputs:
+ *   - Plaintext sum of group i of sums: ms[i], i < sums->groups
+ *   - 1 if a group has no mask or a different number of records
+ * Assumptions:
+ *   - ms has sums->groups entries, allocated and initialized by caller
+ */
+int labhe_group_decrypt(mpz_t *ms, const labhe_group *sums, const labhe_group *masks)
+{
+	const labhe_group_entry *e;
+	long long j;
+	size_t i;
+
+	if (!sums->finished || !masks->finished || sums->kind != LABHE_GROUP_SUMS ||
+	    masks->kind != LABHE_GROUP_MASKS || sums->k != masks->k) { return 1; }
+	for (i=0;i<sums->groups;i++) {
+		e = sums->sorted[i];
+		j = labhe_group_find(masks, e->key);
+		if (j < 0 || masks->sorted[j]->records != e->records) { return 1; }
+		labhe_decrypt_online0(ms[i], e->bm, masks->sorted[j]->bm, sums->k);
+	}
+	return 0;
+}
+
+/*
+ * Release a table
+ */
+void labhe_group_clear(labhe_group *g)
+{
+	size_t i;
+	int w;
+
+	for (w=0;w<g->ntables;w++) {
+		for (i=0;i<g->tables[w].cap;i++) {
+			if (g->tables[w].e[i].records) { group_entry_clear(&g->tables[w].e[i]); }
+		}
+		free(g->tables[w].e);
+	}
+	free(g->tables);
+	free(g->sorted);
+	mpz_clear(g->n);
+	memset(g->sk, 0, SK_SIZE);
+	g->tables = NULL;
+	g->sorted = NULL;
+	g->ntables = 0;
+	g->groups = 0;
+}
@@ -0,0 +1,519 @@
+#include <gmp.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "prf.h"
+#include "labhe_pool.h"
+#include "labhe_maskidx.h"
+
+#define MI_MAGIC "LABHEMI"
+#define MI_VERSION 1
+#define MI_HEADER_SIZE 40
+
+// Installed indexes; lookups hold the lock for reading until their query is done
+static const labhe_maskidx *mi_installed[LABHE_MASKIDX_SLOTS];
+static pthread_rwlock_t mi_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+// Key comparison in time independent of the contents
+static int mi_key_eq(const unsigned char *a, const unsigned char *b)
+{
+	unsigned char d = 0;
+	int i;
+
+	for (i=0;i<SK_SIZE;i++) { d |= a[i] ^ b[i]; }
+	return d == 0;
+}
+
+/*
+ * acc += mask of the labels l1 + i (and l2 + i for inner products),
+ * i < count, mod 2^k
+ */
+static void mi_direct(mpz_t acc, const labhe_maskidx *mi, const int l1, const int l2, const int count)
+{
+	unsigned char buf1[NONCE_SIZE*PRF_BATCH], buf2[NONCE_SIZE*PRF_BATCH];
+	mpz_t x1, x2;
+	int i, j, c;
+
+	mpz_inits(x1, x2, NULL);
+	for (i=0;i<count;i+=PRF_BATCH) {
+		c = count - i < PRF_BATCH ? count - i : PRF_BATCH;
+		prf_batch_seq(buf1, l1 + i, c, mi->sk1);
+		if (mi->kind == LABHE_MASKIDX_IP) { prf_batch_seq(buf2, l2 + i, c, mi->sk2); }
+		for (j=0;j<c;j++) {
+			mpz_import(x1, NONCE_SIZE, 1, sizeof(buf1[0]), 0, 0, buf1 + j*NONCE_SIZE);
+			if (mi->kind == LABHE_MASKIDX_IP) {
+				mpz_import(x2, NONCE_SIZE, 1, sizeof(buf2[0]), 0, 0, buf2 + j*NONCE_SIZE);
+				mpz_addmul(acc, x1, x2);
+			} else {
+				mpz_add(acc, acc, x1);
+			}
+		}
+		mpz_fdiv_r_2exp(acc, acc, mi->k);
+	}
+	mpz_clears(x1, x2, NULL);
+}
+
+static int mi_init(labhe_maskidx *mi, const int kind, const unsigned char *sk1, const unsigned char *sk2,
+	               const int start1, const int start2, const int block, const int k)
+{
+	if (block < 1 || k < 1) { return 1; }
+	mi->kind = kind;
+	mi->backend = prf_backend();
+	mi->k = k;
+	mi->block = block;
+	mi->start1 = start1;
+	mi->start2 = start2;
+	mi->blocks = 0;
+	mi->cap = 0;
+	mi->prefix = NULL;
+	memcpy(mi->sk1, sk1, SK_SIZE);
+	if (sk2) {
+		memcpy(mi->sk2, sk2, SK_SIZE);
+	} else {
+		memset(mi->sk2, 0, SK_SIZE);
+	}
+	return 0;
+}
+
+static int mi_reserve(labhe_maskidx *mi, const int entries)
+{
+	mpz_t *p;
+	int i;
+
+	if (entries <= mi->cap) { return 0; }
+	p = (mpz_t *)realloc(mi->prefix, entries*sizeof(mpz_t));
+	if (!p) { return 1; }
+	for (i=mi->cap;i<entries;i++) { mpz_init(p[i]); }
+	mi->prefix = p;
+	mi->cap = entries;
+	return 0;
+}
+
+/*
+ * Empty index of sum masks of the labels start_label, start_label+1, ...
+ * Inputs:
+ *   - Encryptor secret key: sk
+ *   - First label and labels per block: start_label, block
+ *   - Public BHJK parameter: k
+ * Outputs:
+ *   - Index mi (filled with labhe_maskidx_extend, released with
+ *     labhe_maskidx_clear)
+ */
+int labhe_maskidx_init_sum0(labhe_maskidx *mi, const unsigned char *sk,
+	                        const int start_label, const int block, const int k)
+{
+	if (mi_init(mi, LABHE_MASKIDX_SUM0, sk, NULL, start_label, 0, block, k) != 0) { return 1; }
+	return mi_reserve(mi, 1);
+}
+
+/*
+ * Empty index of inner product masks of the label pairs
+ * (start_label1 + i, start_label2 + i)
+ */
+int labhe_maskidx_init_ip(labhe_maskidx *mi, const unsigned char *sk1, const unsigned char *sk2,
+	                      const int start_label1, const int start_label2, const int block, const int k)
+{
+	if (mi_init(mi, LABHE_MASKIDX_IP, sk1, sk2, start_label1, start_label2, block, k) != 0) { return 1; }
+	return mi_reserve(mi, 1);
+}
+
+typedef struct {
+	labhe_maskidx *mi;
+	int first;    // first new block
+} mi_job;
+
+static int mi_blocks(void *arg, const int j0, const int j1, const int worker)
+{
+	mi_job *job = (mi_job *)arg;
+	labhe_maskidx *mi = job->mi;
+	long long o;
+	int j;
+
+	(void)worker;
+
+	for (j=j0;j<j1;j++) {
+		o = (long long)(job->first + j)*mi->block;
+		mpz_set_ui(mi->prefix[job->first + j + 1], 0);
+		mi_direct(mi->prefix[job->first + j + 1], mi, mi->start1 + (int)o, mi->start2 + (int)o, mi->block);
+	}
+	return 0;
+}
+
+/*
+ * Extend the index to the first count labels (complete blocks only):
+ * the masks of the new blocks are computed in parallel, then chained
+ * to the last prefix. Lookups only read prefixes up to mi->blocks, so
+ * an installed index is locked only to grow and to publish the blocks.
+ * Outputs: 1 on failure or if the PRF backend changed since init
+ */
+int labhe_maskidx_extend(labhe_maskidx *mi, const int count)
+{
+	mi_job job;
+	int j, rc, nb = count / mi->block;
+
+	if (mi->backend != prf_backend()) { return 1; }
+	if (nb <= mi->blocks) { return 0; }
+	if ((long long)mi->start1 + (long long)nb*mi->block > INT_MAX ||
+	    (long long)mi->start2 + (long long)nb*mi->block > INT_MAX) { return 1; }
+	pthread_rwlock_wrlock(&mi_lock);
+	rc = mi_reserve(mi, nb + 1);
+	pthread_rwlock_unlock(&mi_lock);
+	if (rc != 0) { return 1; }
+
+	job.mi = mi;
+	job.first = mi->blocks;
+	if (labhe_pool_run(labhe_pool_get(), nb - mi->blocks, 1, mi_blocks, &job) != 0) { return 1; }
+	for (j=mi->blocks;j<nb;j++) {
+		mpz_add(mi->prefix[j+1], mi->prefix[j+1], mi->prefix[j]);
+		mpz_fdiv_r_2exp(mi->prefix[j+1], mi->prefix[j+1], mi->k);
+	}
+	pthread_rwlock_wrlock(&mi_lock);
+	mi->blocks = nb;
+	pthread_rwlock_unlock(&mi_lock);
+
+	return 0;
+}
+
+/*
+ * Number of labels covered by the index
+ */
+int labhe_maskidx_labels(const labhe_maskidx *mi)
+{
+	return mi->blocks*mi->block;
+}
+
+/*
+ * Mask of count labels from offset lo of the index (pairs aligned with
+ * the index): covered complete blocks from the prefixes, the rest
+ * directly
+ */
+static void mi_query(mpz_t b, const labhe_maskidx *mi, const long long lo, const int count)
+{
+	long long hi = lo + count, end = (long long)mi->blocks*mi->block;
+	long long clo = lo > 0 ? lo : 0, chi = hi < end ? hi : end, j0, j1;
+
+	mpz_set_ui(b, 0);
+	if (clo >= chi) {
+		mi_direct(b, mi, mi->start1 + (int)lo, mi->start2 + (int)lo, count);
+		return;
+	}
+	if (lo < clo) { mi_direct(b, mi, mi->start1 + (int)lo, mi->start2 + (int)lo, (int)(clo - lo)); }
+	if (hi > chi) { mi_direct(b, mi, mi->start1 + (int)chi, mi->start2 + (int)chi, (int)(hi - chi)); }
+
+	j0 = (clo + mi->block - 1) / mi->block;
+	j1 = chi / mi->block;
+	if (j0 >= j1) {
+		mi_direct(b, mi, mi->start1 + (int)clo, mi->start2 + (int)clo, (int)(chi - clo));
+		return;
+	}
+	mi_direct(b, mi, mi->start1 + (int)clo, mi->start2 + (int)clo, (int)(j0*mi->block - clo));
+	mi_direct(b, mi, mi->start1 + (int)(j1*mi->block), mi->start2 + (int)(j1*mi->block), (int)(chi - j1*mi->block));
+	mpz_add(b, b, mi->prefix[j1]);
+	mpz_sub(b, b, mi->prefix[j0]);
+	mpz_fdiv_r_2exp(b, b, mi->k);
+}
+
+/*
+ * LABHE decryption: offline stage for the sum of the 0-level
+ * ciphertexts of labels start_label..start_label+count-1, as
+ * labhe_decrypt_offline_sum0_sk
+ * Inputs:
+ *   - Sum index: mi
+ *   - Range: start_label, count (labels outside the index are computed
+ *     directly)
+ * Outputs:
+ *   - Precomputed mask b
+ *   - 1 if mi is not a sum index or was built under another PRF backend
+ */
+int labhe_maskidx_sum0(mpz_t b, const labhe_maskidx *mi, const int start_label, const int count)
+{
+	if (mi->kind != LABHE_MASKIDX_SUM0 || mi->backend != prf_backend() || count < 0) { return 1; }
+	mi_query(b, mi, (long long)start_label - mi->start1, count);
+	return 0;
+}
+
+/*
+ * LABHE decryption: offline stage for the inner product of the label
+ * ranges start_label1.. and start_label2.., as labhe_decrypt_offline_ip_sk
+ * (pairs that are not aligned with the index are computed directly)
+ */
+int labhe_maskidx_ip(mpz_t b, const labhe_maskidx *mi,
+	                 const int start_label1, const int start_label2, const int count)
+{
+	long long lo = (long long)start_label1 - mi->start1;
+
+	if (mi->kind != LABHE_MASKIDX_IP || mi->backend != prf_backend() || count < 0) { return 1; }
+	if ((long long)start_label2 - mi->start2 != lo) {
+		mpz_set_ui(b, 0);
+		mi_direct(b, mi, start_label1, start_label2, count);
+		return 0;
+	}
+	mi_query(b, mi, lo, count);
+	return 0;
+}
+
+static void mi_put32(unsigned char *b, const uint32_t v)
+{
+	b[0] = v>>24; b[1] = v>>16; b[2] = v>>8; b[3] = v;
+}
+
+static uint32_t mi_get32(const unsigned char *b)
+{
+	return ((uint32_t)b[0]<<24) | ((uint32_t)b[1]<<16) | ((uint32_t)b[2]<<8) | b[3];
+}
+
+/*
+ * Save an index (big-endian):
+ *   magic[8] version[4] kind[4] k[4] block[4] start1[4] start2[4] blocks[4]
+ *   backend[4]
+ * followed by prefix[1..blocks], (k+7)/8 bytes each. Keys are not
+ * stored; the file is created with mode 0600, written to path.tmp and
+ * renamed into place.
+ */
+int labhe_maskidx_save(const char *path, const labhe_maskidx *mi)
+{
+	unsigned char hdr[MI_HEADER_SIZE], *rec;
+	size_t eb = (mi->k + 7)/8, len;
+	char *tmp;
+	FILE *fp;
+	int j, fd, rc = 0;
+
+	memset(hdr, 0, sizeof(hdr));
+	memcpy(hdr, MI_MAGIC, 8);
+	mi_put32(hdr+8, MI_VERSION);
+	mi_put32(hdr+12, mi->kind);
+	mi_put32(hdr+16, mi->k);
+	mi_put32(hdr+20, mi->block);
+	mi_put32(hdr+24, (uint32_t)mi->start1);
+	mi_put32(hdr+28, (uint32_t)mi->start2);
+	mi_put32(hdr+32, mi->blocks);
+	mi_put32(hdr+36, mi->backend);
+
+	tmp = (char *)malloc(strlen(path)+5);
+	rec = (unsigned char *)malloc(eb);
+	if (!tmp || !rec) {
+		free(tmp);
+		free(rec);
+		return 1;
+	}
+	sprintf(tmp, "%s.tmp", path);
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	fp = (fd < 0) ? NULL : fdopen(fd, "wb");
+	if (!fp) {
+		if (fd >= 0) { close(fd); }
+		free(tmp);
+		free(rec);
+		return 1;
+	}
+
+	if (fwrite(hdr, sizeof(hdr), 1, fp) != 1) { rc = 1; }
+	for (j=1;j<=mi->blocks && rc==0;j++) {
+		memset(rec, 0, eb);
+		mpz_export(rec + eb - (mpz_sgn(mi->prefix[j]) ? (mpz_sizeinbase(mi->prefix[j],2)+7)/8 : 0), &len, 1, 1, 1, 0,
+		           mi->prefix[j]);
+		if (fwrite(rec, eb, 1, fp) != 1) { rc = 1; }
+	}
+	memset(rec, 0, eb);
+	if (fflush(fp) != 0 || fsync(fileno(fp)) != 0) { rc = 1; }
+	if (fclose(fp) != 0) { rc = 1; }
+	if (rc == 0 && rename(tmp, path) != 0) { rc = 1; }
+	if (rc != 0) { unlink(tmp); }
+
+	free(tmp);
+	free(rec);
+
+	return rc;
+}
+
+/*
+ * Load an index saved by labhe_maskidx_save
+ * Inputs:
+ *   - Keys of the index: sk1 (and sk2 for inner products, else NULL)
+ * Outputs:
+ *   - Index mi
+ *   - 1 on I/O or format errors, if the index was saved under another
+ *     PRF backend than the selected one, or if the first block does not
+ *     match the keys
+ */
+int labhe_maskidx_load(labhe_maskidx *mi, const char *path,
+	                   const unsigned char *sk1, const unsigned char *sk2)
+{
+	unsigned char hdr[MI_HEADER_SIZE], *rec = NULL;
+	uint32_t kind, k, block, blocks;
+	struct stat st;
+	size_t eb;
+	mpz_t t;
+	FILE *fp;
+	int j, rc = 0;
+
+	mi->prefix = NULL;
+	mi->cap = 0;
+	fp = fopen(path, "rb");
+	if (!fp) { return 1; }
+	if (fread(hdr, sizeof(hdr), 1, fp) != 1 || memcmp(hdr, MI_MAGIC, 8) != 0 ||
+	    mi_get32(hdr+8) != MI_VERSION) {
+		fclose(fp);
+		return 1;
+	}
+	kind = mi_get32(hdr+12);
+	k = mi_get32(hdr+16);
+	block = mi_get32(hdr+20);
+	blocks = mi_get32(hdr+32);
+	eb = (k + 7)/8;
+	// blocks is bounded by the file size before anything is allocated
+	if ((kind != LABHE_MASKIDX_SUM0 && kind != LABHE_MASKIDX_IP) || (kind == LABHE_MASKIDX_IP && !sk2) ||
+	    k < 1 || k > 65536 || block < 1 || block > INT_MAX || blocks > INT_MAX - 1 ||
+	    mi_get32(hdr+36) != (uint32_t)prf_backend() ||
+	    fstat(fileno(fp), &st) != 0 || st.st_size < MI_HEADER_SIZE ||
+	    (uint64_t)(st.st_size - MI_HEADER_SIZE) != (uint64_t)blocks*eb ||
+	    mi_init(mi, kind, sk1, kind == LABHE_MASKIDX_IP ? sk2 : NULL,
+	            (int)mi_get32(hdr+24), (int)mi_get32(hdr+28), (int)block, (int)k) != 0 ||
+	    mi_reserve(mi, (int)blocks + 1) != 0) {
+		fclose(fp);
+		labhe_maskidx_clear(mi);
+		return 1;
+	}
+
+	rec = (unsigned char *)malloc(eb);
+	if (!rec) { rc = 1; }
+	for (j=1;j<=(int)blocks && rc==0;j++) {
+		if (fread(rec, eb, 1, fp) != 1) {
+			rc = 1;
+			break;
+		}
+		mpz_import(mi->prefix[j], eb, 1, 1, 1, 0, rec);
+		if (mpz_sizeinbase(mi->prefix[j], 2) > k) { rc = 1; }
+	}
+	if (fclose(fp) != 0) { rc = 1; }
+	free(rec);
+	mi->blocks = (int)blocks;
+
+	// The first block is recomputed to check the keys
+	if (rc == 0 && blocks > 0) {
+		mpz_init(t);
+		mi_direct(t, mi, mi->start1, mi->start2, mi->block);
+		if (mpz_cmp(t, mi->prefix[1]) != 0) { rc = 1; }
+		mpz_clear(t);
+	}
+	if (rc != 0) { labhe_maskidx_clear(mi); }
+
+	return rc;
+}
+
+void labhe_maskidx_clear(labhe_maskidx *mi)
+{
+	int i;
+
+	labhe_maskidx_uninstall(mi);
+	for (i=0;i<mi->cap;i++) { mpz_clear(mi->prefix[i]); }
+	free(mi->prefix);
+	mi->prefix = NULL;
+	mi->cap = 0;
+	mi->blocks = 0;
+	memset(mi->sk1, 0, SK_SIZE);
+	memset(mi->sk2, 0, SK_SIZE);
+}
+
+/*
+ * Make an index available to labhe_decrypt_offline_sum0_sk /
+ * labhe_decrypt_offline_ip_sk (it must stay alive until uninstalled)
+ */
+int labhe_maskidx_install(const labhe_maskidx *mi)
+{
+	int i, rc = 1;
+
+	pthread_rwlock_wrlock(&mi_lock);
+	for (i=0;i<LABHE_MASKIDX_SLOTS && rc;i++) {
+		if (mi_installed[i] == mi) { rc = 0; }
+	}
+	for (i=0;i<LABHE_MASKIDX_SLOTS && rc;i++) {
+		if (!mi_installed[i]) {
+			mi_installed[i] = mi;
+			rc = 0;
+		}
+	}
+	pthread_rwlock_unlock(&mi_lock);
+	return rc;
+}
+
+/*
+ * Remove an index from the installed ones (waits for the lookups using
+ * it to finish)
+ */
+int labhe_maskidx_uninstall(const labhe_maskidx *mi)
+{
+	int i;
+
+	pthread_rwlock_wrlock(&mi_lock);
+	for (i=0;i<LABHE_MASKIDX_SLOTS;i++) {
+		if (mi_installed[i] == mi) { mi_installed[i] = NULL; }
+	}
+	pthread_rwlock_unlock(&mi_lock);
+	return 0;
+}
+
+/*
+ * Installed index of this kind, keys and PRF backend holding a complete
+ * block of [lo, lo+count) (called with mi_lock held)
+ */
+static const labhe_maskidx *mi_find(const int kind, const unsigned char *sk1, const unsigned char *sk2,
+	                                const long long start1, const long long start2, const int count, const int k)
+{
+	const labhe_maskidx *mi;
+	long long lo, hi;
+	int i;
+
+	for (i=0;i<LABHE_MASKIDX_SLOTS;i++) {
+		mi = mi_installed[i];
+		if (!mi || mi->kind != kind || mi->k != k || mi->backend != prf_backend()) { continue; }
+		if (!mi_key_eq(mi->sk1, sk1)) { continue; }
+		if (kind == LABHE_MASKIDX_IP &&
+		    (!mi_key_eq(mi->sk2, sk2) || start2 - mi->start2 != start1 - mi->start1)) { continue; }
+		lo = start1 - mi->start1;
+		hi = lo + count;
+		lo = lo > 0 ? (lo + mi->block - 1) / mi->block : 0;
+		hi = hi < (long long)mi->blocks*mi->block ? hi / mi->block : mi->blocks;
+		if (lo < hi) { return mi; }
+	}
+	return NULL;
+}
+
+/*
+ * Range masks from an installed index (used by the range routines of
+ * labhe.c)
+ * Outputs:
+ *   - Precomputed mask b
+ *   - 1 if no installed index helps for this range: b is untouched
+ */
+int labhe_maskidx_lookup_sum0(mpz_t b, const unsigned char *sk,
+	                          const int start_label, const int count, const int k)
+{
+	const labhe_maskidx *mi;
+	int rc = 1;
+
+	pthread_rwlock_rdlock(&mi_lock);
+	mi = mi_find(LABHE_MASKIDX_SUM0, sk, NULL, start_label, 0, count, k);
+	if (mi) { rc = labhe_maskidx_sum0(b, mi, start_label, count); }
+	pthread_rwlock_unlock(&mi_lock);
+	return rc;
+}
+
+int labhe_maskidx_lookup_ip(mpz_t b, const unsigned char *sk1, const unsigned char *sk2,
+	                        const int start_label1, const int start_label2, const int count, const int k)
+{
+	const labhe_maskidx *mi;
+	int rc = 1;
+
+	pthread_rwlock_rdlock(&mi_lock);
+	mi = mi_find(LABHE_MASKIDX_IP, sk1, sk2, start_label1, start_label2, count, k);
+	if (mi) { rc = labhe_maskidx_ip(b, mi, start_label1, start_label2, count); }
+	pthread_rwlock_unlock(&mi_lock);
+	return rc;
+}
@@ -0,0 +1,149 @@
+#include <gmp.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "labhe.h"
+#include "labhe_pack.h"
+
+#define PACK_MAX_WORDS 64 // messages up to k = 4096 bits
+
+/*
+ * Packed format
+ * Inputs:
+ *   - Public BHJK parameter: k
+ *   - Bits of each value: slot_bits (1..63)
+ *   - Largest number of records added together: max_adds (>= 1)
+ *   - Values per message: slots (< 1: as many as fit)
+ * Outputs:
+ *   - Format: pk
+ *   - 1 if no slot (or fewer than slots) fits in k bits
+ */
+int labhe_pack_init(labhe_pack *pk, const int k, const int slot_bits, const long long max_adds,
+	                const int slots)
+{
+	int headroom = 0;
+
+	if (k < 1 || k > 64*PACK_MAX_WORDS || slot_bits < 1 || slot_bits > 63 || max_adds < 1) { return 1; }
+	while (headroom < 63 && (1LL << headroom) < max_adds) { headroom++; }
+	if (slot_bits + headroom > 64 || slot_bits + headroom > k) { return 1; }
+
+	pk->k = k;
+	pk->slot_bits = slot_bits;
+	pk->headroom = headroom;
+	pk->width = slot_bits + headroom;
+	pk->slots = k / pk->width;
+	pk->max_adds = max_adds;
+	if (slots > 0) {
+		if (slots > pk->slots) { return 1; }
+		pk->slots = slots;
+	}
+	return 0;
+}
+
+/*
+ * Packed messages of records: ms[r] holds values v[r*slots .. r*slots+slots-1]
+ * Outputs:
+ *   - 1 if some value has more than slot_bits bits (its slot is 0)
+ */
+int labhe_pack_encode(mpz_t *ms, const uint64_t *v, const int records, const labhe_pack *pk)
+{
+	uint64_t w[PACK_MAX_WORDS], x;
+	int r, j, o, words = (pk->k + 63) / 64, rc = 0;
+
+	for (r=0;r<records;r++) {
+		memset(w, 0, words*sizeof(w[0]));
+		for (j=0;j<pk->slots;j++) {
+			x = v[(size_t)r*pk->slots + j];
+			if (x >> pk->slot_bits) {
+				rc = 1;
+				continue;
+			}
+			o = j*pk->width;
+			w[o/64] |= x << (o%64);
+			if (o%64 && o%64 + pk->width > 64) { w[o/64+1] |= x >> (64 - o%64); }
+		}
+		mpz_import(ms[r], words, -1, sizeof(w[0]), 0, 0, w);
+	}
+	return rc;
+}
+
+/*
+ * Slot-wise sums (slots entries) of a decrypted packed message
+ */
+int labhe_pack_decode(uint64_t *sums, const mpz_t m, const labhe_pack *pk)
+{
+	uint64_t w[PACK_MAX_WORDS+1], x, mask;
+	size_t words = (pk->k + 63) / 64, used;
+	int j, o;
+
+	if (mpz_sizeinbase(m, 2) > (size_t)pk->k) { return 1; }
+	memset(w, 0, sizeof(w));
+	mpz_export(w, &used, -1, sizeof(w[0]), 0, 0, m);
+	if (used > words) { return 1; }
+
+	mask = (pk->width == 64) ? ~(uint64_t)0 : ((uint64_t)1 << pk->width) - 1;
+	for (j=0;j<pk->slots;j++) {
+		o = j*pk->width;
+		x = w[o/64] >> (o%64);
+		if (o%64 && o%64 + pk->width > 64) { x |= w[o/64+1] << (64 - o%64); }
+		sums[j] = x & mask;
+	}
+	return 0;
+}
+
+/*
+ * LABHE online encryption of packed records (labhe_encrypt_online_batch)
+ * Inputs:
+ *   - Records and their count: v, records
+ *   - Precomputed masks of their labels: b_masks (one per record)
+ *   - Packed format: pk
+ * Outputs:
+ *   - Masked messages cs (the bm part of the level-0 ciphertexts)
+ *   - 1 if some value does not fit its slot (see labhe_pack_encode)
+ * Assumptions:
+ *   - all I/O pointers are allocated and initialized by caller
+ */
+int labhe_pack_encrypt(mpz_t *cs, const uint64_t *v, const mpz_t *b_masks, const int records,
+	                   const labhe_pack *pk)
+{
+	int rc = labhe_pack_encode(cs, v, records, pk);
+
+	labhe_encrypt_online_batch(cs, b_masks, (const mpz_t *)cs, records, pk->k);
+	return rc;
+}
+
+/*
+ * Sum of packed level-0 ciphertexts (labhe_homadd_lev0_batch, or
+ * labhe_homadd_lev0_batch_flat when c is NULL)
+ * Outputs:
+ *   - 1 if more than max_adds records are added (slots would overflow)
+ */
+int labhe_pack_add(mpz_t bmres, mpz_t cres, const mpz_t *bm, const mpz_t *c, const int records,
+	               const mpz_t n, const labhe_pack *pk)
+{
+	if (records < 1 || records > pk->max_adds) { return 1; }
+	if (!c) { return labhe_homadd_lev0_batch_flat(bmres, bm, records, pk->k, n); }
+	return labhe_homadd_lev0_batch(bmres, cres, bm, c, records, pk->k, n);
+}
+
+/*
+ * LABHE online decryption of a packed sum (labhe_decrypt_online0)
+ * Inputs:
+ *   - bm part of the sum: bm
+ *   - Precomputed mask of its labels: b (e.g. labhe_decrypt_offline_sum0_sk)
+ *   - Packed format: pk
+ * Outputs:
+ *   - Slot-wise sums: sums[0..slots-1]
+ */
+int labhe_pack_decrypt(uint64_t *sums, const mpz_t bm, const mpz_t b, const labhe_pack *pk)
+{
+	mpz_t m;
+	int rc;
+
+	mpz_init(m);
+	labhe_decrypt_online0(m, bm, b, pk->k);
+	rc = labhe_pack_decode(sums, m, pk);
+	mpz_clear(m);
+
+	return rc;
+}
@@ -0,0 +1,294 @@
+#include <gmp.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "prf.h"
+#include "mont.h"
+#include "bhjl.h"
+#include "labhe.h"
+#include "labhe_pipe.h"
+
+#define PIPE_CACHE_LINE 64
+
+/*
+ * Ring slot: seq == i means the slot is free for mask index i,
+ * seq == i+1 means mask index i is ready to be consumed
+ */
+typedef struct {
+	_Atomic size_t seq;
+	mpz_t b_mask;
+	mpz_t eb_mask;
+} __attribute__((aligned(PIPE_CACHE_LINE))) pipe_slot;
+
+typedef struct {
+	labhe_pipe *pp;
+	pthread_t thread;
+} pipe_worker;
+
+struct labhe_pipe {
+	pipe_slot *ring;
+	size_t depth;
+	int start_label;
+	int batch;      // masks per offline run
+
+	_Atomic size_t next __attribute__((aligned(PIPE_CACHE_LINE))); // next mask index to produce
+	_Atomic int stop;
+	_Atomic int failed;   // an offline run failed, its slots are never published
+	_Atomic long long full_waits;
+
+	// online stage state (single consumer)
+	size_t head __attribute__((aligned(PIPE_CACHE_LINE)));
+	long long encrypted, stalls, stall_ns;
+	mpz_t cs;
+
+	unsigned char sk[SK_SIZE];
+	labhe_rng rng;
+	mpz_t n, y, _2k;
+	int k;
+	labhe_pipe_cb cb;
+	void *cb_arg;
+
+	pipe_worker *workers;
+	int nworkers;
+};
+
+static long long pipe_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec*1000000000LL + ts.tv_nsec;
+}
+
+/*
+ * Offline worker: claims runs of batch consecutive mask indices and fills
+ * them with one PRF batch and one batch encryption (batch <= depth, so
+ * the worker with the oldest run never waits on a slot of its own run).
+ * A failed run is recorded in pp->failed and stops the pipeline without
+ * publishing its slots.
+ */
+static void *pipe_offline(void *arg)
+{
+	pipe_worker *w = (pipe_worker *)arg;
+	labhe_pipe *pp = w->pp;
+	unsigned char buf[NONCE_SIZE*MONT_LANES];
+	mpz_t nums[MONT_LANES], xs[MONT_LANES], ebs[MONT_LANES];
+	pipe_slot *slot;
+	size_t i;
+	int j, label, waited, rc;
+
+	for (j=0;j<pp->batch;j++) { mpz_inits(nums[j], xs[j], ebs[j], NULL); }
+
+	while (!atomic_load_explicit(&pp->stop, memory_order_relaxed)) {
+		i = atomic_fetch_add_explicit(&pp->next, pp->batch, memory_order_relaxed);
+
+		// Wait until the consumer has released the run's slots
+		waited = 0;
+		for (j=0;j<pp->batch;j++) {
+			slot = &pp->ring[(i+j) % pp->depth];
+			while (atomic_load_explicit(&slot->seq, memory_order_acquire) != i+j) {
+				if (atomic_load_explicit(&pp->stop, memory_order_relaxed)) { goto out; }
+				if (!waited) {
+					atomic_fetch_add_explicit(&pp->full_waits, 1, memory_order_relaxed);
+					waited = 1;
+				}
+				sched_yield();
+			}
+		}
+
+		label = pp->start_label + (int)i;
+		prf_batch_seq(buf, label, pp->batch, pp->sk);
+		rc = 0;
+		for (j=0;j<pp->batch;j++) {
+			mpz_import(nums[j], NONCE_SIZE, 1, sizeof(buf[0]), 0, 0, buf + j*NONCE_SIZE);
+			mpz_sub(pp->ring[(i+j) % pp->depth].b_mask, pp->_2k, nums[j]);
+			rc |= rng_urandomm_label(xs[j], &pp->rng, label + j, pp->n);
+		}
+		if (rc == 0) {
+			rc = bhjl_encrypt_x_batch(ebs, (const mpz_t *)nums, (const mpz_t *)xs, pp->batch,
+			                          pp->n, pp->y, pp->k, pp->_2k);
+		}
+		if (rc != 0) {
+			atomic_store(&pp->failed, 1);
+			atomic_store(&pp->stop, 1);
+			break;
+		}
+
+		for (j=0;j<pp->batch;j++) {
+			slot = &pp->ring[(i+j) % pp->depth];
+			mpz_swap(slot->eb_mask, ebs[j]);
+			atomic_store_explicit(&slot->seq, i+j+1, memory_order_release);
+		}
+	}
+
+out:
+	for (j=0;j<pp->batch;j++) { mpz_clears(nums[j], xs[j], ebs[j], NULL); }
+	return NULL;
+}
+
+/*
+ * Start an encryption pipeline
+ * Inputs:
+ *   - First label to use: start_label (masks are produced for consecutive labels)
+ *   - Number of ring slots: depth
+ *   - Number of offline worker threads: workers
+ *   - The secret key of the encryptor: sk
+ *   - BHJK public/precomputed parameters: n, y, k, _2k
+ *   - Randomness source: rng (randomizers are bound to labels, so the
+ *     workers share it without locking)
+ *   - Output callback and its argument: cb, cb_arg
+ * Outputs:
+ *   - Running pipeline: pp (release with labhe_pipe_stop)
+ * Assumptions:
+ *   - all I/O pointers are allocated and initialized by caller
+ *   - labels are never reused with the same rng stream
+ *   - labhe_pipe_encrypt is called from a single thread
+ */
+int labhe_pipe_start(labhe_pipe **pp, const int start_label, const int depth, const int workers,
+	                 const unsigned char *sk,
+	                 const mpz_t n, const mpz_t y, const int k,
+	                 const mpz_t _2k,
+	                 const labhe_rng *rng,
+	                 labhe_pipe_cb cb, void *cb_arg)
+{
+	labhe_pipe *p;
+	int i;
+
+	if (depth < 1 || workers < 1 || !cb) { return 1; }
+
+	if (posix_memalign((void **)&p, PIPE_CACHE_LINE, sizeof(labhe_pipe)) != 0) { return 1; }
+	memset(p, 0, sizeof(labhe_pipe));
+
+	if (posix_memalign((void **)&p->ring, PIPE_CACHE_LINE, depth*sizeof(pipe_slot)) != 0) {
+		free(p);
+		return 1;
+	}
+	p->depth = depth;
+	for (i=0;i<depth;i++) {
+		atomic_init(&p->ring[i].seq, (size_t)i);
+		mpz_inits(p->ring[i].b_mask, p->ring[i].eb_mask, NULL);
+	}
+
+	p->start_label = start_label;
+	p->batch = (depth < MONT_LANES) ? depth : MONT_LANES;
+	atomic_init(&p->next, 0);
+	atomic_init(&p->stop, 0);
+	atomic_init(&p->failed, 0);
+	atomic_init(&p->full_waits, 0);
+	memcpy(p->sk, sk, SK_SIZE);
+	p->rng = *rng;
+	mpz_init_set(p->n, n);
+	mpz_init_set(p->y, y);
+	mpz_init_set(p->_2k, _2k);
+	mpz_init(p->cs);
+	p->k = k;
+	p->cb = cb;
+	p->cb_arg = cb_arg;
+
+	p->workers = (pipe_worker *)malloc(workers*sizeof(pipe_worker));
+	if (!p->workers) {
+		labhe_pipe_stop(p, NULL);
+		return 1;
+	}
+
+	for (i=0;i<workers;i++) {
+		p->workers[i].pp = p;
+		if (pthread_create(&p->workers[i].thread, NULL, pipe_offline, &p->workers[i]) != 0) { break; }
+		p->nworkers++;
+	}
+
+	if (p->nworkers == 0) {
+		labhe_pipe_stop(p, NULL);
+		return 1;
+	}
+
+	*pp = p;
+	return 0;
+}
+
+/*
+ * Online stage: encrypt the next message with the next ready mask
+ * (stalls if the pipeline has none ready) and pass the level-0
+ * ciphertext to the output callback.
+ * Inputs:
+ *   - Running pipeline: pp
+ *   - Message to encrypt: m
+ * Outputs: callback invoked with label, bm and c of the ciphertext;
+ * 1 if the mask was never produced because an offline run failed
+ * (the callback is not invoked and the pipeline is stopped)
+ * Assumptions:
+ *   - message is within the valid range 0 <= m < 2^{k}
+ */
+int labhe_pipe_encrypt(labhe_pipe *pp, const mpz_t m)
+{
+	pipe_slot *slot;
+	long long t;
+	size_t i = pp->head;
+
+	slot = &pp->ring[i % pp->depth];
+	if (atomic_load_explicit(&slot->seq, memory_order_acquire) != i+1) {
+		pp->stalls++;
+		t = pipe_now_ns();
+		while (atomic_load_explicit(&slot->seq, memory_order_acquire) != i+1) {
+			if (atomic_load(&pp->failed)) { return 1; }
+			sched_yield();
+		}
+		pp->stall_ns += pipe_now_ns() - t;
+	}
+
+	mpz_add(pp->cs, slot->b_mask, m);
+	mpz_clrbit(pp->cs, pp->k);
+	pp->cb(pp->cb_arg, pp->start_label + (int)i, pp->cs, slot->eb_mask);
+
+	atomic_store_explicit(&slot->seq, i + pp->depth, memory_order_release);
+	pp->head = i+1;
+	pp->encrypted++;
+
+	return 0;
+}
+
+/*
+ * Pipeline statistics so far
+ */
+int labhe_pipe_stats_get(const labhe_pipe *pp, labhe_pipe_stats *stats)
+{
+	stats->encrypted = pp->encrypted;
+	stats->stalls = pp->stalls;
+	stats->stall_ns = pp->stall_ns;
+	stats->full_waits = atomic_load((_Atomic long long *)&pp->full_waits);
+	return 0;
+}
+
+/*
+ * Stop the pipeline, join the offline workers and release it.
+ * Masks produced but not consumed are discarded (their labels are
+ * not reused by this pipeline).
+ * Outputs: final statistics in stats (if not NULL); 1 if an offline
+ * run failed
+ */
+int labhe_pipe_stop(labhe_pipe *pp, labhe_pipe_stats *stats)
+{
+	int i, rc;
+
+	atomic_store(&pp->stop, 1);
+	for (i=0;i<pp->nworkers;i++) {
+		pthread_join(pp->workers[i].thread, NULL);
+	}
+
+	if (stats) { labhe_pipe_stats_get(pp, stats); }
+	rc = atomic_load(&pp->failed);
+
+	for (i=0;i<(int)pp->depth;i++) {
+		mpz_clears(pp->ring[i].b_mask, pp->ring[i].eb_mask, NULL);
+	}
+	mpz_clears(pp->n, pp->y, pp->_2k, pp->cs, NULL);
+	free(pp->workers);
+	free(pp->ring);
+	free(pp);
+
+	return rc;
+}
@@ -0,0 +1,298 @@
+#include <gmp.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "tune.h"
+#include "labhe_pool.h"
+
+#define POOL_CACHE_LINE 64
+
+/*
+ * Per-worker range of indices [lo,hi), packed as lo | hi << 32 so that
+ * the owner (front) and thieves (back) update it with one CAS
+ */
+typedef struct {
+	_Atomic uint64_t range;
+	labhe_pool *pp;
+	pthread_t thread;
+	int id;
+	int rc;
+} __attribute__((aligned(POOL_CACHE_LINE))) pool_worker;
+
+struct labhe_pool {
+	pool_worker *w;
+	int nworkers;            // started threads + the calling thread
+
+	pthread_mutex_t run_lock; // one job at a time
+	pthread_mutex_t lock;
+	pthread_cond_t wake, done;
+	unsigned long gen;       // job generation
+	int pending;             // threads still working on the job
+	int stop;
+
+	labhe_pool_fn fn;
+	void *arg;
+	int grain;
+};
+
+static __thread int pool_in_job = 0;
+static labhe_pool *pool_current = NULL;
+
+static uint64_t pool_pack(const uint32_t lo, const uint32_t hi)
+{
+	return (uint64_t)lo | (uint64_t)hi << 32;
+}
+
+// Next chunk from the front of the worker's own range
+static int pool_take(pool_worker *w, const int grain, int *i0, int *i1)
+{
+	uint64_t r = atomic_load_explicit(&w->range, memory_order_acquire);
+	uint32_t lo, hi, c;
+
+	do {
+		lo = (uint32_t)r;
+		hi = (uint32_t)(r >> 32);
+		if (lo >= hi) { return 0; }
+		c = (hi - lo < (uint32_t)grain) ? hi - lo : (uint32_t)grain;
+	} while (!atomic_compare_exchange_weak_explicit(&w->range, &r, pool_pack(lo+c, hi),
+	                                                memory_order_acq_rel, memory_order_acquire));
+	*i0 = (int)lo;
+	*i1 = (int)(lo + c);
+	return 1;
+}
+
+// Move the back half of another worker's range to w, split at a
+// multiple of the grain (range starts always are: lo only moves by
+// whole chunks), so that only count ends a chunk off the grain
+static int pool_steal(labhe_pool *pp, pool_worker *w)
+{
+	pool_worker *v;
+	uint64_t r;
+	uint32_t lo, hi, m;
+	int j;
+
+	for (j=1;j<pp->nworkers;j++) {
+		v = &pp->w[(w->id + j) % pp->nworkers];
+		r = atomic_load_explicit(&v->range, memory_order_acquire);
+		for (;;) {
+			lo = (uint32_t)r;
+			hi = (uint32_t)(r >> 32);
+			if (lo >= hi) { break; }
+			m = lo;
+			if (hi - lo > (uint32_t)pp->grain) {
+				m += ((hi - lo)/2 + pp->grain - 1) / pp->grain * pp->grain;
+			}
+			if (atomic_compare_exchange_weak_explicit(&v->range, &r, pool_pack(lo, m),
+			                                          memory_order_acq_rel, memory_order_acquire)) {
+				atomic_store_explicit(&w->range, pool_pack(m, hi), memory_order_release);
+				return 1;
+			}
+		}
+	}
+	return 0;
+}
+
+static void pool_work(labhe_pool *pp, pool_worker *w)
+{
+	int i0, i1;
+
+	pool_in_job = 1;
+	do {
+		while (pool_take(w, pp->grain, &i0, &i1)) {
+			w->rc |= pp->fn(pp->arg, i0, i1, w->id);
+		}
+	} while (pool_steal(pp, w));
+	pool_in_job = 0;
+}
+
+static void *pool_thread(void *arg)
+{
+	pool_worker *w = (pool_worker *)arg;
+	labhe_pool *pp = w->pp;
+	unsigned long seen = 0;
+
+	pthread_mutex_lock(&pp->lock);
+	for (;;) {
+		while (pp->gen == seen && !pp->stop) { pthread_cond_wait(&pp->wake, &pp->lock); }
+		if (pp->stop) { break; }
+		seen = pp->gen;
+		pthread_mutex_unlock(&pp->lock);
+
+		pool_work(pp, w);
+
+		pthread_mutex_lock(&pp->lock);
+		if (--pp->pending == 0) { pthread_cond_signal(&pp->done); }
+	}
+	pthread_mutex_unlock(&pp->lock);
+
+	return NULL;
+}
+
+/*
+ * Start a pool
+ * Inputs:
+ *   - Number of workers including the calling thread: workers
+ *     (< 1: from the tuning profile)
+ * Outputs:
+ *   - Pool: pp (released with labhe_pool_stop)
+ */
+int labhe_pool_start(labhe_pool **pp, const int workers)
+{
+	labhe_pool *p;
+	int i, nw = (workers < 1) ? tune_workers() : workers;
+
+	if (nw < 1) { nw = 1; }
+	if (posix_memalign((void **)&p, POOL_CACHE_LINE, sizeof(labhe_pool)) != 0) { return 1; }
+	if (posix_memalign((void **)&p->w, POOL_CACHE_LINE, nw*sizeof(pool_worker)) != 0) {
+		free(p);
+		return 1;
+	}
+	pthread_mutex_init(&p->run_lock, NULL);
+	pthread_mutex_init(&p->lock, NULL);
+	pthread_cond_init(&p->wake, NULL);
+	pthread_cond_init(&p->done, NULL);
+	p->gen = 0;
+	p->pending = 0;
+	p->stop = 0;
+	p->fn = NULL;
+	p->arg = NULL;
+	p->grain = 1;
+
+	for (i=0;i<nw;i++) {
+		atomic_init(&p->w[i].range, 0);
+		p->w[i].pp = p;
+		p->w[i].id = i;
+		p->w[i].rc = 0;
+	}
+
+	// Worker 0 is the thread calling labhe_pool_run
+	p->nworkers = 1;
+	for (i=1;i<nw;i++) {
+		if (pthread_create(&p->w[i].thread, NULL, pool_thread, &p->w[i]) != 0) { break; }
+		p->nworkers++;
+	}
+
+	*pp = p;
+	return 0;
+}
+
+/*
+ * Number of workers of a pool (1 for no pool): size of per-worker
+ * scratch arrays
+ */
+int labhe_pool_workers(const labhe_pool *pp)
+{
+	return pp ? pp->nworkers : 1;
+}
+
+/*
+ * Parallel map stage: fn over indices 0..count-1 in chunks of grain
+ * Inputs:
+ *   - Pool: pp (NULL: fn(arg, 0, count, 0) on the calling thread)
+ *   - Number of indices: count
+ *   - Chunk size: grain (use multiples of LABHE_POOL_LINE_ITEMS when
+ *     the chunks write consecutive mpz_t)
+ *   - Chunk function and its argument: fn, arg
+ * Outputs:
+ *   - 1 if fn failed on some chunk (all chunks are still processed)
+ */
+int labhe_pool_run(labhe_pool *pp, const int count, const int grain,
+	               labhe_pool_fn fn, void *arg)
+{
+	int i, g = (grain < 1) ? 1 : grain, rc = 0;
+	long long b0, b1;
+
+	if (count <= 0) { return 0; }
+	if (!pp || pp->nworkers == 1 || pool_in_job || count <= g) { return fn(arg, 0, count, 0); }
+
+	pthread_mutex_lock(&pp->run_lock);
+	pp->fn = fn;
+	pp->arg = arg;
+	pp->grain = g;
+	for (i=0;i<pp->nworkers;i++) {
+		b0 = (long long)count*i/pp->nworkers/g*g;
+		b1 = (i == pp->nworkers-1) ? count : (long long)count*(i+1)/pp->nworkers/g*g;
+		atomic_store_explicit(&pp->w[i].range, pool_pack((uint32_t)b0, (uint32_t)b1), memory_order_relaxed);
+		pp->w[i].rc = 0;
+	}
+
+	pthread_mutex_lock(&pp->lock);
+	pp->pending = pp->nworkers - 1;
+	pp->gen++;
+	pthread_cond_broadcast(&pp->wake);
+	pthread_mutex_unlock(&pp->lock);
+
+	pool_work(pp, &pp->w[0]);
+
+	pthread_mutex_lock(&pp->lock);
+	while (pp->pending > 0) { pthread_cond_wait(&pp->done, &pp->lock); }
+	pthread_mutex_unlock(&pp->lock);
+
+	for (i=0;i<pp->nworkers;i++) { rc |= pp->w[i].rc; }
+	pthread_mutex_unlock(&pp->run_lock);
+
+	return rc;
+}
+
+/*
+ * Run nshards independent shards (indices 0..nshards-1, one per chunk)
+ * for the routines that take a thread count: on the pool installed by
+ * labhe_pool_set if any, else on a pool of nshards workers started for
+ * this call (on the calling thread alone if it is already in a job or
+ * no thread can be started)
+ * Outputs:
+ *   - 1 if fn failed on some shard
+ */
+int labhe_pool_run_shards(const int nshards, labhe_pool_fn fn, void *arg)
+{
+	labhe_pool *pp = pool_current, *tmp = NULL;
+	int rc;
+
+	if (!pp && !pool_in_job && nshards > 1 && labhe_pool_start(&tmp, nshards) == 0) { pp = tmp; }
+	rc = labhe_pool_run(pp, nshards, 1, fn, arg);
+	if (tmp) { labhe_pool_stop(tmp); }
+
+	return rc;
+}
+
+/*
+ * Stop the workers and release the pool (uninstalled if it was set)
+ */
+int labhe_pool_stop(labhe_pool *pp)
+{
+	int i;
+
+	if (!pp) { return 0; }
+	if (pool_current == pp) { pool_current = NULL; }
+
+	pthread_mutex_lock(&pp->lock);
+	pp->stop = 1;
+	pthread_cond_broadcast(&pp->wake);
+	pthread_mutex_unlock(&pp->lock);
+	for (i=1;i<pp->nworkers;i++) { pthread_join(pp->w[i].thread, NULL); }
+
+	pthread_mutex_destroy(&pp->run_lock);
+	pthread_mutex_destroy(&pp->lock);
+	pthread_cond_destroy(&pp->wake);
+	pthread_cond_destroy(&pp->done);
+	free(pp->w);
+	free(pp);
+
+	return 0;
+}
+
+/*
+ * Install the pool used by the batch routines (NULL: calling thread)
+ */
+int labhe_pool_set(labhe_pool *pp)
+{
+	pool_current = pp;
+	return 0;
+}
+
+labhe_pool *labhe_pool_get(void)
+{
+	return pool_current;
+}
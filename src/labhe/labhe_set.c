@@ -0,0 +1,273 @@
+#include <gmp.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "prf.h"
+#include "mexp.h"
+#include "labhe.h"
+#include "labhe_set.h"
+
+/*
+ * Selected labels, PRF_BATCH at a time: from one or two label lists,
+ * or from a bitmap with one start label per key
+ */
+typedef struct {
+	const int *labels1, *labels2;
+	const uint64_t *bitmap;
+	int start1, start2;
+	int count;   // list length or bitmap bits
+	int pos;     // next list entry or bit
+} set_cursor;
+
+static int set_next(set_cursor *s, int *l1, int *l2)
+{
+	uint64_t w;
+	int c = 0;
+
+	if (!s->bitmap) {
+		for (;c<PRF_BATCH && s->pos<s->count;c++,s->pos++) {
+			l1[c] = s->labels1[s->pos];
+			if (l2) { l2[c] = s->labels2[s->pos]; }
+		}
+		return c;
+	}
+
+	while (c < PRF_BATCH && s->pos < s->count) {
+		w = s->bitmap[s->pos/64] >> (s->pos%64);
+		if (!w) {
+			s->pos = (s->pos/64 + 1)*64;
+			continue;
+		}
+		s->pos += __builtin_ctzll(w);
+		if (s->pos >= s->count) { break; }
+		l1[c] = s->start1 + s->pos;
+		if (l2) { l2[c] = s->start2 + s->pos; }
+		c++;
+		s->pos++;
+	}
+	return c;
+}
+
+static int set_sorted(const int *v, const int count)
+{
+	int i;
+
+	for (i=1;i<count;i++) {
+		if (v[i] <= v[i-1]) { return 0; }
+	}
+	return 1;
+}
+
+// b = sum of PRF(sk, l) mod 2^k over the selected labels
+static int set_sum0(mpz_t b, const unsigned char *sk, set_cursor *s, const int k)
+{
+	unsigned char buf[NONCE_SIZE*PRF_BATCH];
+	int labels[PRF_BATCH];
+	int i, c;
+	mpz_t num;
+
+	mpz_init(num);
+	mpz_set_ui(b, 0);
+	while ((c = set_next(s, labels, NULL)) > 0) {
+		prf_batch_list(buf, labels, c, sk);
+		for (i=0;i<c;i++) {
+			mpz_import(num, NONCE_SIZE, 1, sizeof(buf[0]), 0, 0, buf + i*NONCE_SIZE);
+			mpz_add(b, b, num);
+		}
+		mpz_fdiv_r_2exp(b, b, k);
+	}
+	mpz_clear(num);
+
+	return 0;
+}
+
+// b = sum of PRF(sk1, l1)*PRF(sk2, l2) mod 2^k over the selected pairs
+static int set_ip(mpz_t b, const unsigned char *sk1, const unsigned char *sk2, set_cursor *s, const int k)
+{
+	unsigned char buf1[NONCE_SIZE*PRF_BATCH], buf2[NONCE_SIZE*PRF_BATCH];
+	int labels1[PRF_BATCH], labels2[PRF_BATCH];
+	int i, c;
+	mpz_t num1, num2;
+
+	mpz_inits(num1, num2, NULL);
+	mpz_set_ui(b, 0);
+	while ((c = set_next(s, labels1, labels2)) > 0) {
+		prf_batch_list(buf1, labels1, c, sk1);
+		prf_batch_list(buf2, labels2, c, sk2);
+		for (i=0;i<c;i++) {
+			mpz_import(num1, NONCE_SIZE, 1, sizeof(buf1[0]), 0, 0, buf1 + i*NONCE_SIZE);
+			mpz_import(num2, NONCE_SIZE, 1, sizeof(buf2[0]), 0, 0, buf2 + i*NONCE_SIZE);
+			mpz_addmul(b, num1, num2);
+		}
+		mpz_fdiv_r_2exp(b, b, k);
+	}
+	mpz_clears(num1, num2, NULL);
+
+	return 0;
+}
+
+/*
+ * Indices of the set bits of a bitmap, in increasing order
+ * Inputs:
+ *   - Bitmap of nbits bits: bitmap
+ * Outputs:
+ *   - Indices: idx (room for nbits entries)
+ *   - Number of indices written
+ */
+int labhe_set_from_bitmap(int *idx, const uint64_t *bitmap, const int nbits)
+{
+	set_cursor s = { NULL, NULL, bitmap, 0, 0, nbits, 0 };
+	int c, count = 0;
+
+	while ((c = set_next(&s, idx + count, NULL)) > 0) { count += c; }
+	return count;
+}
+
+/*
+ * LABHE homomorphic level 0 addition of the selected entries
+ * bm[idx[i]], c[idx[i]] (labhe_homadd_lev0_batch, or
+ * labhe_homadd_lev0_batch_flat when c is NULL)
+ * Inputs:
+ *   - Full arrays of level-0 ciphertexts: bm[], c[]
+ *   - Selected entries: idx[0..count-1], strictly increasing, count >= 1
+ *   - BHJK public parameters: k, n
+ * Outputs:
+ *   - One level 0 ciphertext: bmred, cred
+ *   - 1 if idx is not strictly increasing
+ */
+int labhe_homadd_lev0_set(mpz_t bmred, mpz_t cred,
+	                              const mpz_t *bm, const mpz_t *c, const int *idx, const int count,
+	                              const int k, const mpz_t n)
+{
+	mpz_t *view;
+	int i, rc;
+
+	if (count < 1 || !set_sorted(idx, count)) { return 1; }
+
+	mpz_set_ui(bmred, 0);
+	for (i=0;i<count;i++) { mpz_add(bmred, bmred, bm[idx[i]]); }
+	mpz_fdiv_r_2exp(bmred, bmred, k);
+	if (!c) { return 0; }
+
+	// Shallow views of the selected c[] for the batch product
+	view = (mpz_t *)malloc(count*sizeof(mpz_t));
+	if (!view) { return 1; }
+	for (i=0;i<count;i++) { view[i][0] = c[idx[i]][0]; }
+	rc = labhe_homadd_lev1_batch(cred, (const mpz_t *)view, count, n);
+	free(view);
+
+	return rc;
+}
+
+/*
+ * LABHE fused inner product of the selected entries of two vectors of
+ * level-0 ciphertexts (labhe_innerprod_lev0 on bm1[idx[i]], c1[idx[i]],
+ * bm2[idx[i]], c2[idx[i]])
+ * Outputs:
+ *   - One level 1 ciphertext: c
+ *   - 1 if idx is not strictly increasing
+ */
+int labhe_innerprod_lev0_set(mpz_t c,
+	                              const mpz_t *bm1, const mpz_t *c1, const mpz_t *bm2, const mpz_t *c2,
+	                              const int *idx, const int count,
+	                              const mpz_t n, const int k, const mpz_t enc1)
+{
+	mpz_t *bases, *exps;
+	int i, j, rc;
+
+	if (count < 1 || !set_sorted(idx, count)) { return 1; }
+
+	bases = (mpz_t *)malloc((2*count+1)*sizeof(mpz_t));
+	exps = (mpz_t *)malloc((2*count+1)*sizeof(mpz_t));
+	if (!bases || !exps) {
+		free(bases);
+		free(exps);
+		return 1;
+	}
+
+	// Bases and exponents are shallow copies of the selected inputs
+	mpz_init_set_ui(exps[2*count], 0);
+	for (i=0;i<count;i++) {
+		j = idx[i];
+		bases[2*i][0] = c1[j][0];
+		exps[2*i][0] = bm2[j][0];
+		bases[2*i+1][0] = c2[j][0];
+		exps[2*i+1][0] = bm1[j][0];
+		mpz_addmul(exps[2*count], bm1[j], bm2[j]);
+	}
+	mpz_fdiv_r_2exp(exps[2*count], exps[2*count], k);
+	bases[2*count][0] = enc1[0];
+
+	rc = mexp_powm_multi(c, (const mpz_t *)bases, (const mpz_t *)exps, 2*count+1, n);
+
+	mpz_clear(exps[2*count]);
+	free(bases);
+	free(exps);
+
+	return rc;
+}
+
+/*
+ * LABHE decryption: offline stage for the sum of the 0-level
+ * ciphertexts of a label set (labhe_decrypt_offline_sum0_sk)
+ * Inputs:
+ *   - Encryptor secret key: sk
+ *   - Selected labels: labels[0..count-1], strictly increasing
+ *   - Public BHJK parameter: k
+ * Outputs:
+ *   - Precomputed mask b
+ *   - 1 if labels are not strictly increasing
+ */
+int labhe_decrypt_offline_sum0_set(mpz_t b, const unsigned char *sk,
+								const int *labels, const int count,
+								const int k)
+{
+	set_cursor s = { labels, NULL, NULL, 0, 0, count, 0 };
+
+	if (!set_sorted(labels, count)) { return 1; }
+	return set_sum0(b, sk, &s, k);
+}
+
+/*
+ * LABHE decryption: offline stage for the inner product of two label
+ * sets, labels1[i] paired with labels2[i] (labhe_decrypt_offline_ip_sk)
+ * Outputs:
+ *   - Precomputed mask b
+ *   - 1 if a label list is not strictly increasing
+ */
+int labhe_decrypt_offline_ip_set(mpz_t b, const unsigned char *sk1, const unsigned char *sk2,
+								const int *labels1, const int *labels2, const int count,
+								const int k)
+{
+	set_cursor s = { labels1, labels2, NULL, 0, 0, count, 0 };
+
+	if (!set_sorted(labels1, count) || !set_sorted(labels2, count)) { return 1; }
+	return set_ip(b, sk1, sk2, &s, k);
+}
+
+/*
+ * As labhe_decrypt_offline_sum0_set, for the labels start_label + i
+ * selected by bit i of bitmap (nbits bits)
+ */
+int labhe_decrypt_offline_sum0_bitmap(mpz_t b, const unsigned char *sk,
+								const int start_label, const uint64_t *bitmap, const int nbits,
+								const int k)
+{
+	set_cursor s = { NULL, NULL, bitmap, start_label, 0, nbits, 0 };
+
+	return set_sum0(b, sk, &s, k);
+}
+
+/*
+ * As labhe_decrypt_offline_ip_set, for the label pairs
+ * (start_label1 + i, start_label2 + i) selected by bit i of bitmap
+ */
+int labhe_decrypt_offline_ip_bitmap(mpz_t b, const unsigned char *sk1, const unsigned char *sk2,
+								const int start_label1, const int start_label2,
+								const uint64_t *bitmap, const int nbits,
+								const int k)
+{
+	set_cursor s = { NULL, NULL, bitmap, start_label1, start_label2, nbits, 0 };
+
+	return set_ip(b, sk1, sk2, &s, k);
+}
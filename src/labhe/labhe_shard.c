@@ -0,0 +1,362 @@
+#include <gmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "prf.h"
+#include "labhe.h"
+#include "tune.h"
+#include "labhe_file.h"
+#include "labhe_pool.h"
+#include "labhe_shard.h"
+
+void labhe_shard_init(labhe_shard *s)
+{
+	memset(s, 0, sizeof(labhe_shard));
+	mpz_inits(s->bm, s->c, NULL);
+}
+
+void labhe_shard_clear(labhe_shard *s)
+{
+	mpz_clears(s->bm, s->c, NULL);
+}
+
+/*
+ * Worker side of sharded evaluation: reduce one record range of the
+ * dataset files to a partial result
+ * Inputs:
+ *   - Job and input files as for labhe_file_aggregate: op, f1, f2
+ *   - Record range of this shard: first, count (same range of f2)
+ *   - BHJK public/secret/precomputed parameters: n,k,enc1
+ *   - Records per chunk and number of threads: chunk, workers
+ *     (workers < 1: from the tuning profile)
+ * Outputs:
+ *   - Partial result with its job and label ranges: s
+ *   - Job statistics: stats (may be NULL)
+ */
+int labhe_shard_reduce(labhe_shard *s, const int op,
+	                   const labhe_file *f1, const labhe_file *f2,
+	                   const long long first, const long long count,
+	                   const mpz_t n, const int k, const mpz_t enc1,
+	                   const int chunk, const int workers,
+	                   labhe_file_stats *stats)
+{
+	labhe_file r1, r2;
+
+	if (count < 1 || count > INT32_MAX) { return 1; }
+	if (labhe_file_range(&r1, f1, first, count) != 0) { return 1; }
+	if (f2 && labhe_file_range(&r2, f2, first, count) != 0) { return 1; }
+	if (labhe_file_aggregate(s->bm, s->c, op, &r1, f2 ? &r2 : NULL, n, k, enc1,
+	                         chunk, workers, stats) != 0) { return 1; }
+
+	s->op = op;
+	s->level = (op == LABHE_AGG_SUM) ? f1->level : 1;
+	s->k = k;
+	s->start_label1 = r1.start_label;
+	s->start_label2 = f2 ? r2.start_label : r1.start_label;
+	s->count = (int)count;
+	s->n_tag = mpz_getlimbn(n, 0);
+	if (s->level == 1) { mpz_set_ui(s->bm, 0); }
+
+	return 0;
+}
+
+/*
+ * Order partials by label range
+ */
+static int shard_cmp(const void *a, const void *b)
+{
+	const labhe_shard *x = *(const labhe_shard * const *)a;
+	const labhe_shard *y = *(const labhe_shard * const *)b;
+
+	return (x->start_label1 > y->start_label1) - (x->start_label1 < y->start_label1);
+}
+
+/*
+ * a <- a (+) b for adjacent label ranges (b right after a)
+ */
+static int shard_merge2(labhe_shard *a, const labhe_shard *b, const mpz_t n)
+{
+	if ((long long)a->start_label1 + a->count != b->start_label1 ||
+	    (long long)a->start_label2 + a->count != b->start_label2 ||
+	    (long long)a->count + b->count > INT32_MAX) { return 1; }
+
+	if (a->level == 0) {
+		mpz_add(a->bm, a->bm, b->bm);
+		mpz_fdiv_r_2exp(a->bm, a->bm, a->k);
+	}
+	mpz_mul(a->c, a->c, b->c);
+	mpz_mod(a->c, a->c, n);
+	a->count += b->count;
+
+	return 0;
+}
+
+/*
+ * Coordinator side of sharded evaluation: merge partial results
+ * pairwise in a tree (log2(nparts) rounds of homomorphic additions)
+ * Inputs:
+ *   - Partial results of one job, in any order: parts, nparts
+ *   - BHJK public parameters: n,k
+ * Outputs:
+ *   - Partial result covering the union of the label ranges: res
+ * Assumptions:
+ *   - The label ranges tile one contiguous range per operand, with no
+ *     gaps or overlaps (otherwise the merge fails)
+ */
+int labhe_shard_merge(labhe_shard *res, const labhe_shard *parts, const int nparts,
+	                  const mpz_t n, const int k)
+{
+	const labhe_shard **order;
+	labhe_shard *tree;
+	int i, m, rc = 0;
+
+	if (nparts < 1) { return 1; }
+	for (i=0;i<nparts;i++) {
+		if (parts[i].op != parts[0].op || parts[i].level != parts[0].level || parts[i].k != k ||
+		    parts[i].n_tag != mpz_getlimbn(n, 0) || parts[i].count < 1 ||
+		    mpz_cmp(parts[i].c, n) >= 0 || mpz_sgn(parts[i].c) < 0) { return 1; }
+	}
+
+	order = (const labhe_shard **)malloc(nparts*sizeof(labhe_shard *));
+	tree = (labhe_shard *)malloc(nparts*sizeof(labhe_shard));
+	if (!order || !tree) {
+		free(order);
+		free(tree);
+		return 1;
+	}
+	for (i=0;i<nparts;i++) { order[i] = &parts[i]; }
+	qsort(order, nparts, sizeof(labhe_shard *), shard_cmp);
+
+	for (i=0;i<nparts;i++) {
+		labhe_shard_init(&tree[i]);
+		tree[i].op = order[i]->op;
+		tree[i].level = order[i]->level;
+		tree[i].k = order[i]->k;
+		tree[i].start_label1 = order[i]->start_label1;
+		tree[i].start_label2 = order[i]->start_label2;
+		tree[i].count = order[i]->count;
+		tree[i].n_tag = order[i]->n_tag;
+		mpz_set(tree[i].bm, order[i]->bm);
+		mpz_set(tree[i].c, order[i]->c);
+	}
+
+	// Round r merges neighbours 2^r apart; node i/2 of the next round
+	// holds nodes i and i+1 of this one
+	for (m=nparts;m>1 && rc==0;m=(m+1)/2) {
+		for (i=0;i<m && rc==0;i+=2) {
+			if (i+1 < m) { rc |= shard_merge2(&tree[i], &tree[i+1], n); }
+			if (i) {
+				mpz_swap(tree[i/2].bm, tree[i].bm);
+				mpz_swap(tree[i/2].c, tree[i].c);
+				tree[i/2].start_label1 = tree[i].start_label1;
+				tree[i/2].start_label2 = tree[i].start_label2;
+				tree[i/2].count = tree[i].count;
+			}
+		}
+	}
+
+	if (rc == 0) {
+		res->op = tree[0].op;
+		res->level = tree[0].level;
+		res->k = tree[0].k;
+		res->start_label1 = tree[0].start_label1;
+		res->start_label2 = tree[0].start_label2;
+		res->count = tree[0].count;
+		res->n_tag = tree[0].n_tag;
+		mpz_set(res->bm, tree[0].bm);
+		mpz_set(res->c, tree[0].c);
+	}
+
+	for (i=0;i<nparts;i++) { labhe_shard_clear(&tree[i]); }
+	free(tree);
+	free(order);
+
+	return rc;
+}
+
+/*
+ * LABHE decryption: offline mask of one partial result
+ * Inputs:
+ *   - Partial result (only its job and label ranges are used): s
+ *   - Encryptor secret keys: sk1, sk2 (operand owners; sk2 unused for
+ *     sums, and the same as sk1 for sums of squares)
+ *   - Public/precomputed BHJK parameters: k, _2k1
+ * Outputs:
+ *   - Precomputed mask b
+ * Assumptions:
+ *   - Level-1 sums have no mask from the labels alone (fails): their
+ *     records come from products whose labels the dataset does not carry
+ */
+int labhe_shard_mask(mpz_t b, const labhe_shard *s,
+	                 const unsigned char *sk1, const unsigned char *sk2,
+	                 const int k, const mpz_t _2k1)
+{
+	switch (s->op) {
+	case LABHE_AGG_SUM:
+		if (s->level != 0) { return 1; }
+		return labhe_decrypt_offline_sum0_sk(b, sk1, s->start_label1, s->count, k);
+	case LABHE_AGG_INNERPROD:
+		return labhe_decrypt_offline_ip_sk(b, sk1, sk2, s->start_label1, s->start_label2, s->count, k, _2k1);
+	case LABHE_AGG_SUMSQ:
+		return labhe_decrypt_offline_ip_sk(b, sk1, sk1, s->start_label1, s->start_label2, s->count, k, _2k1);
+	default:
+		return 1;
+	}
+}
+
+typedef struct {
+	const labhe_shard *parts;
+	int p0, p1;   // partials [p0,p1) of this thread
+	const unsigned char *sk1, *sk2;
+	int k;
+	const mpz_t *_2k1;
+	int rc;
+	mpz_t b;
+} shard_mask_job;
+
+static void *shard_mask_run(void *arg)
+{
+	shard_mask_job *job = (shard_mask_job *)arg;
+	mpz_t t;
+	int i;
+
+	mpz_init(t);
+	for (i=job->p0;i<job->p1;i++) {
+		job->rc |= labhe_shard_mask(t, &job->parts[i], job->sk1, job->sk2, job->k, *job->_2k1);
+		mpz_add(job->b, job->b, t);
+	}
+	mpz_clear(t);
+
+	return NULL;
+}
+
+static int shard_masks_run(void *arg, const int i0, const int i1, const int worker)
+{
+	shard_mask_job *jobs = (shard_mask_job *)arg;
+	int i, rc = 0;
+
+	(void)worker;
+	for (i=i0;i<i1;i++) {
+		shard_mask_run(&jobs[i]);
+		rc |= jobs[i].rc;
+	}
+	return rc;
+}
+
+/*
+ * LABHE decryption: offline mask of a sharded job, computed per
+ * partial on worker threads (masks add up like the partials)
+ * Inputs:
+ *   - Partial results of the job: parts, nparts
+ *   - Encryptor secret keys, BHJK parameters: sk1, sk2, k, _2k1 (see
+ *     labhe_shard_mask)
+ *   - Number of threads: workers (< 1: from the tuning profile)
+ * Outputs:
+ *   - Precomputed mask b of the merged result
+ */
+int labhe_shard_masks(mpz_t b, const labhe_shard *parts, const int nparts,
+	                  const unsigned char *sk1, const unsigned char *sk2,
+	                  const int k, const mpz_t _2k1, const int workers)
+{
+	shard_mask_job *jobs;
+	int i, nw, rc = 0;
+
+	if (nparts < 1) { return 1; }
+	nw = (workers < 1) ? tune_workers() : workers;
+	if (nw > nparts) { nw = nparts; }
+
+	jobs = (shard_mask_job *)calloc(nw, sizeof(shard_mask_job));
+	if (!jobs) { return 1; }
+	for (i=0;i<nw;i++) {
+		jobs[i].parts = parts;
+		jobs[i].p0 = (int)((long long)nparts*i/nw);
+		jobs[i].p1 = (int)((long long)nparts*(i+1)/nw);
+		jobs[i].sk1 = sk1;
+		jobs[i].sk2 = sk2;
+		jobs[i].k = k;
+		jobs[i]._2k1 = (const mpz_t *)_2k1;
+		mpz_init(jobs[i].b);
+	}
+	labhe_pool_run_shards(nw, shard_masks_run, jobs);
+
+	mpz_set_ui(b, 0);
+	for (i=0;i<nw;i++) {
+		rc |= jobs[i].rc;
+		mpz_add(b, b, jobs[i].b);
+		mpz_clear(jobs[i].b);
+	}
+	mpz_fdiv_r_2exp(b, b, k);
+	free(jobs);
+
+	return rc;
+}
+
+/*
+ * Write a partial result as a text file (key=value lines, hexadecimal
+ * ciphertext), through path.tmp and a rename so that a coordinator
+ * polling for it never reads a partial file
+ */
+int labhe_shard_save(const char *path, const labhe_shard *s)
+{
+	char *tmp;
+	FILE *fp;
+	int rc = 0;
+
+	tmp = (char *)malloc(strlen(path)+5);
+	if (!tmp) { return 1; }
+	sprintf(tmp, "%s.tmp", path);
+	fp = fopen(tmp, "w");
+	if (!fp) {
+		free(tmp);
+		return 1;
+	}
+	fprintf(fp, "op=%d\nlevel=%d\nk=%d\nstart_label1=%d\nstart_label2=%d\ncount=%d\nn_tag=%llx\n",
+	        s->op, s->level, s->k, s->start_label1, s->start_label2, s->count,
+	        (unsigned long long)s->n_tag);
+	gmp_fprintf(fp, "bm=0x%Zx\nc=0x%Zx\n", s->bm, s->c);
+	if (fflush(fp) != 0 || fsync(fileno(fp)) != 0) { rc = 1; }
+	if (fclose(fp) != 0) { rc = 1; }
+	if (rc == 0 && rename(tmp, path) != 0) { rc = 1; }
+	if (rc != 0) { unlink(tmp); }
+	free(tmp);
+
+	return rc;
+}
+
+/*
+ * Read a partial result written by labhe_shard_save
+ */
+int labhe_shard_load(labhe_shard *s, const char *path)
+{
+	FILE *fp;
+	char *line = NULL, *eq, *nl;
+	size_t cap = 0;
+	int found = 0;
+
+	fp = fopen(path, "r");
+	if (!fp) { return 1; }
+
+	while (getline(&line, &cap, fp) > 0) {
+		eq = strchr(line, '=');
+		if (!eq) { continue; }
+		*eq++ = 0;
+		nl = strchr(eq, '\n');
+		if (nl) { *nl = 0; }
+		if (strcmp(line, "op") == 0) { s->op = atoi(eq); found |= 1; }
+		else if (strcmp(line, "level") == 0) { s->level = atoi(eq); found |= 2; }
+		else if (strcmp(line, "k") == 0) { s->k = atoi(eq); found |= 4; }
+		else if (strcmp(line, "start_label1") == 0) { s->start_label1 = atoi(eq); found |= 8; }
+		else if (strcmp(line, "start_label2") == 0) { s->start_label2 = atoi(eq); found |= 16; }
+		else if (strcmp(line, "count") == 0) { s->count = atoi(eq); found |= 32; }
+		else if (strcmp(line, "n_tag") == 0) { s->n_tag = strtoull(eq, NULL, 16); found |= 64; }
+		else if (strcmp(line, "bm") == 0 && mpz_set_str(s->bm, eq, 0) == 0) { found |= 128; }
+		else if (strcmp(line, "c") == 0 && mpz_set_str(s->c, eq, 0) == 0) { found |= 256; }
+	}
+	free(line);
+	if (fclose(fp)) { return 1; }
+
+	return (found == 511 && (s->level == 0 || s->level == 1) && s->k > 0 && s->count > 0) ? 0 : 1;
+}
@@ -0,0 +1,234 @@
+#include <gmp.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "prf.h"
+#include "labhe.h"
+#include "labhe_window.h"
+
+/*
+ * Start an empty sliding window
+ * Inputs:
+ *   - Level of the ciphertexts (0 or 1) and window width in labels:
+ *     level, width
+ *   - Public BHJK parameter: k
+ * Outputs:
+ *   - Window (release with labhe_window_clear): w
+ */
+int labhe_window_init(labhe_window *w, const int level, const int width, const int k)
+{
+	int i;
+
+	memset(w, 0, sizeof(labhe_window));
+	if ((level != 0 && level != 1) || width < 1 || k < 1) { return 1; }
+
+	w->ring_c = (mpz_t *)malloc(width*sizeof(mpz_t));
+	w->ring_bm = (level == 0) ? (mpz_t *)malloc(width*sizeof(mpz_t)) : NULL;
+	if (!w->ring_c || (level == 0 && !w->ring_bm)) {
+		free(w->ring_c);
+		free(w->ring_bm);
+		w->ring_c = w->ring_bm = NULL;
+		return 1;
+	}
+	for (i=0;i<width;i++) {
+		mpz_init(w->ring_c[i]);
+		if (w->ring_bm) { mpz_init(w->ring_bm[i]); }
+	}
+	w->level = level;
+	w->k = k;
+	w->width = width;
+	mpz_init(w->bm);
+	labhe_lev1_acc_init(&w->acc);
+
+	return 0;
+}
+
+/*
+ * Append one ciphertext, expiring the oldest when the window is full
+ */
+static int window_push(labhe_window *w, const mpz_t bm, const mpz_t c, const mpz_t n)
+{
+	int slot;
+
+	if (w->len == w->width) {
+		// homsub of the expired ciphertext, native subtraction of its bm
+		labhe_lev1_acc_sub(&w->acc, w->ring_c[w->head], n);
+		if (w->level == 0) {
+			mpz_sub(w->bm, w->bm, w->ring_bm[w->head]);
+			mpz_fdiv_r_2exp(w->bm, w->bm, w->k);
+		}
+		slot = w->head;
+		w->head = (w->head + 1 == w->width) ? 0 : w->head + 1;
+	} else {
+		slot = (w->head + w->len) % w->width;
+		w->len++;
+	}
+
+	labhe_lev1_acc_add(&w->acc, c, n);
+	mpz_set(w->ring_c[slot], c);
+	if (w->level == 0) {
+		mpz_add(w->bm, w->bm, bm);
+		mpz_fdiv_r_2exp(w->bm, w->bm, w->k);
+		mpz_set(w->ring_bm[slot], bm);
+	}
+
+	return 0;
+}
+
+/*
+ * Slide a level-0 window by one label
+ * Inputs:
+ *   - Level-0 ciphertext of the next label: bm, c
+ *   - BHJK public parameters: n
+ * Assumptions:
+ *   - 0 <= bm < 2^k, 0 < c < n (c invertible mod n)
+ */
+int labhe_window_push0(labhe_window *w, const mpz_t bm, const mpz_t c, const mpz_t n)
+{
+	if (w->level != 0) { return 1; }
+	return window_push(w, bm, c, n);
+}
+
+/*
+ * Slide a level-1 window by one label
+ * Inputs:
+ *   - Level-1 ciphertext of the next label: c
+ *   - BHJK public parameters: n
+ * Assumptions:
+ *   - 0 < c < n (c invertible mod n)
+ */
+int labhe_window_push1(labhe_window *w, const mpz_t c, const mpz_t n)
+{
+	if (w->level != 1) { return 1; }
+	return window_push(w, NULL, c, n);
+}
+
+/*
+ * Slide a rolling inner product by one label: the product of the two
+ * level-0 ciphertexts of the next label enters a level-1 window
+ * Inputs:
+ *   - Level-0 ciphertexts of the next label of each stream: bm1, c1, bm2, c2
+ *   - BHJK public/precomputed parameters: n, enc1
+ */
+int labhe_window_push_ip(labhe_window *w, const mpz_t bm1, const mpz_t c1,
+	                     const mpz_t bm2, const mpz_t c2,
+	                     const mpz_t n, const mpz_t enc1)
+{
+	mpz_t c[1];
+	int rc;
+
+	if (w->level != 1) { return 1; }
+	mpz_init(c[0]);
+	rc = labhe_hommul_lev0_batch(c, (const mpz_t *)bm1, (const mpz_t *)c1,
+	                             (const mpz_t *)bm2, (const mpz_t *)c2, 1, n, w->k, enc1);
+	if (rc == 0) { rc = window_push(w, NULL, c[0], n); }
+	mpz_clear(c[0]);
+
+	return rc;
+}
+
+/*
+ * Current window aggregate (one inversion)
+ * Outputs:
+ *   - Level-0 ciphertext (bm,c), or level-1 ciphertext c (bm untouched)
+ */
+int labhe_window_get(mpz_t bm, mpz_t c, const labhe_window *w, const mpz_t n)
+{
+	if (w->level == 0) { mpz_set(bm, w->bm); }
+	return labhe_lev1_acc_final(c, &w->acc, n);
+}
+
+void labhe_window_clear(labhe_window *w)
+{
+	int i;
+
+	// width stays 0 until labhe_window_init succeeds
+	if (w->width == 0) { return; }
+	for (i=0;i<w->width;i++) {
+		mpz_clear(w->ring_c[i]);
+		if (w->ring_bm) { mpz_clear(w->ring_bm[i]); }
+	}
+	free(w->ring_c);
+	free(w->ring_bm);
+	mpz_clear(w->bm);
+	labhe_lev1_acc_clear(&w->acc);
+	memset(w, 0, sizeof(labhe_window));
+}
+
+/*
+ * LABHE decryption: offline mask of a sliding window, kept in step
+ * with the evaluator's labhe_window
+ * Inputs:
+ *   - Level of the window and width: level, width
+ *   - Encryptor secret keys: sk1 (level 0), sk1 and sk2 (level 1)
+ *   - Labels of the first push of each stream: start_label1, start_label2
+ *   - Public BHJK parameter: k
+ * Outputs:
+ *   - Mask of the empty window (release with labhe_window_mask_clear): wm
+ */
+int labhe_window_mask_init(labhe_window_mask *wm, const int level, const int width,
+	                       const unsigned char *sk1, const unsigned char *sk2,
+	                       const int start_label1, const int start_label2, const int k)
+{
+	memset(wm, 0, sizeof(labhe_window_mask));
+	if ((level != 0 && level != 1) || width < 1 || k < 1 || (level == 1 && !sk2)) { return 1; }
+
+	wm->level = level;
+	wm->k = k;
+	wm->width = width;
+	wm->next_label1 = start_label1;
+	wm->next_label2 = start_label2;
+	memcpy(wm->sk1, sk1, SK_SIZE);
+	if (level == 1) { memcpy(wm->sk2, sk2, SK_SIZE); }
+	mpz_init(wm->b);
+
+	return 0;
+}
+
+/*
+ * b of one label: b1 at level 0, b1*b2 at level 1
+ */
+static void window_mask_label(mpz_t b, mpz_t t, const labhe_window_mask *wm, const int label1, const int label2)
+{
+	unsigned char nonce[NONCE_SIZE];
+
+	prf_batch_seq(nonce, label1, 1, wm->sk1);
+	mpz_import(b, NONCE_SIZE, 1, 1, 0, 0, nonce);
+	if (wm->level == 1) {
+		prf_batch_seq(nonce, label2, 1, wm->sk2);
+		mpz_import(t, NONCE_SIZE, 1, 1, 0, 0, nonce);
+		mpz_mul(b, b, t);
+	}
+}
+
+/*
+ * Slide the mask by one label (at most 4 PRF calls): after each push
+ * wm->b is the mask of the evaluator's window after the same push
+ */
+int labhe_window_mask_push(labhe_window_mask *wm)
+{
+	mpz_t bl, t;
+
+	mpz_inits(bl, t, NULL);
+	window_mask_label(bl, t, wm, wm->next_label1, wm->next_label2);
+	mpz_add(wm->b, wm->b, bl);
+	if (wm->len == wm->width) {
+		window_mask_label(bl, t, wm, wm->next_label1 - wm->width, wm->next_label2 - wm->width);
+		mpz_sub(wm->b, wm->b, bl);
+	} else {
+		wm->len++;
+	}
+	mpz_fdiv_r_2exp(wm->b, wm->b, wm->k);
+	wm->next_label1++;
+	wm->next_label2++;
+	mpz_clears(bl, t, NULL);
+
+	return 0;
+}
+
+void labhe_window_mask_clear(labhe_window_mask *wm)
+{
+	if (wm->width == 0) { return; }
+	mpz_clear(wm->b);
+	memset(wm, 0, sizeof(labhe_window_mask));
+}
@@ -0,0 +1,326 @@
+#include <gmp.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mexp.h"
+#include "tune.h"
+
+#define MEXP_MAX_WINDOW 16
+
+/*
+ * Window width for Pippenger multi-exponentiation
+ * Inputs: 
+ *   - Number of bases: count
+ *   - Bit-length of the largest exponent: bits
+ * Outputs: window width c minimizing the estimated number of modular
+ *          multiplications ceil(bits/c)*(count+2^{c+1})
+ *          (estimate returned in cost if not NULL)
+ */
+static int mexp_window(const int count, const size_t bits, double *cost)
+{
+	int c, best;
+	double cc, best_cost;
+
+	best = 1;
+	best_cost = -1;
+	for (c=1;c<=MEXP_MAX_WINDOW;c++) {
+		cc = (double)((bits+c-1)/c) * ((double)count + (double)(2UL<<c));
+		if (best_cost < 0 || cc < best_cost) {
+			best = c;
+			best_cost = cc;
+		}
+	}
+	if (cost) { *cost = best_cost + (double)bits; }
+	return best;
+}
+
+/*
+ * Window width used by mexp_powm_multi: from the active tuning profile
+ * if it covers count and bits, else from the cost model
+ */
+int mexp_multi_window(const int count, const int bits)
+{
+	int c = tune_multi_window(count,bits);
+
+	return (c > 0) ? c : mexp_window(count,bits,NULL);
+}
+
+/*
+ * Estimated number of modular multiplications (squarings included)
+ * for one call to mexp_powm_multi with count bases and bits-bit exponents
+ */
+int mexp_multi_cost(const int count, const int bits)
+{
+	double cost;
+
+	mexp_window(count,bits,&cost);
+	return (int)cost;
+}
+
+/*
+ * Extract c-bit digit of exponent e starting at bit position pos
+ */
+static unsigned long mexp_digit(const mpz_t e, const size_t pos, const int c)
+{
+	int j;
+	unsigned long d = 0;
+
+	for (j=c-1;j>=0;j--) {
+		d = (d<<1) | mpz_tstbit(e,pos+j);
+	}
+	return d;
+}
+
+/*
+ * Multiply-and-reduce helper: r = r*a mod n
+ */
+static void mexp_mulm(mpz_t r, const mpz_t a, const mpz_t n, mpz_t t)
+{
+	mpz_mul(t,r,a);
+	mpz_mod(r,t,n);
+}
+
+/*
+ * Multi-exponentiation using Pippenger's bucket method
+ * Inputs: 
+ *   - Number of bases/exponents: count
+ *   - Bases: bases[]
+ *   - Exponents: exps[]
+ *   - Modulus: n
+ * Outputs: r = prod_i bases[i]^exps[i] mod n
+ * Assumptions: 
+ *   - exponents are non-negative and bases are in range 0 <= bases[] < n
+ *   - all I/O pointers are allocated and initialized by caller
+ *   - r does not alias any of the bases
+ */
+int mexp_powm_multi(mpz_t r, const mpz_t *bases, const mpz_t *exps, const int count,
+	                const mpz_t n)
+{
+	int i, j, c, w, nwin, nbuck, run_set, acc_set;
+	size_t bits, b;
+	unsigned long d;
+	mpz_t *buckets, run, acc, t;
+	char *used;
+
+	bits = 0;
+	for (i=0;i<count;i++) {
+		if (mpz_sgn(exps[i]) == 0) { continue; }
+		b = mpz_sizeinbase(exps[i],2);
+		if (b > bits) { bits = b; }
+	}
+
+	mpz_set_ui(r,1);
+	if (bits == 0) { 
+		mpz_mod(r,r,n);
+		return 0; 
+	}
+
+	c = mexp_multi_window(count,(int)bits);
+	nbuck = (1<<c) - 1;
+	nwin = (int)((bits+c-1)/c);
+
+	buckets = (mpz_t *)malloc(nbuck*sizeof(mpz_t));
+	used = (char *)malloc(nbuck);
+	if (!buckets || !used) {
+		free(buckets);
+		free(used);
+		return 1;
+	}
+	for (j=0;j<nbuck;j++) { mpz_init(buckets[j]); }
+	mpz_inits(run,acc,t,NULL);
+
+	for (w=nwin-1;w>=0;w--) {
+		if (w != nwin-1) {
+			for (j=0;j<c;j++) {
+				mpz_mul(t,r,r);
+				mpz_mod(r,t,n);
+			}
+		}
+
+		// Distribute bases into buckets according to current digit
+		memset(used,0,nbuck);
+		for (i=0;i<count;i++) {
+			d = mexp_digit(exps[i],(size_t)w*c,c);
+			if (d == 0) { continue; }
+			if (used[d-1]) {
+				mexp_mulm(buckets[d-1],bases[i],n,t);
+			} else {
+				mpz_set(buckets[d-1],bases[i]);
+				used[d-1] = 1;
+			}
+		}
+
+		// acc = prod_d bucket[d]^d via running products
+		run_set = 0;
+		acc_set = 0;
+		for (j=nbuck-1;j>=0;j--) {
+			if (used[j]) {
+				if (run_set) {
+					mexp_mulm(run,buckets[j],n,t);
+				} else {
+					mpz_set(run,buckets[j]);
+					run_set = 1;
+				}
+			}
+			if (run_set) {
+				if (acc_set) {
+					mexp_mulm(acc,run,n,t);
+				} else {
+					mpz_set(acc,run);
+					acc_set = 1;
+				}
+			}
+		}
+
+		if (acc_set) {
+			mexp_mulm(r,acc,n,t);
+		}
+	}
+
+	for (j=0;j<nbuck;j++) { mpz_clear(buckets[j]); }
+	mpz_clears(run,acc,t,NULL);
+	free(buckets);
+	free(used);
+
+	return 0;
+}
+
+/*
+ * Window width for a fixed-base table
+ * Inputs: 
+ *   - Bit-length of the exponents: bits
+ *   - Number of exponentiations that will use the table: uses
+ * Outputs: window width w minimizing the measured cost from the active
+ *          tuning profile, or else the estimated number of modular
+ *          multiplications ceil(bits/w)*(2^w-1) + uses*ceil(bits/w)
+ */
+int mexp_table_window(const int bits, const int uses)
+{
+	int w, best, nwin;
+	double cost, best_cost;
+
+	if ((w = tune_table_window(bits,uses)) > 0) { return w; }
+	best = 1;
+	best_cost = -1;
+	for (w=1;w<=MEXP_MAX_WINDOW/2;w++) {
+		nwin = (bits+w-1)/w;
+		cost = (double)nwin * ((double)((1<<w)-1) + (double)uses);
+		if (best_cost < 0 || cost < best_cost) {
+			best = w;
+			best_cost = cost;
+		}
+	}
+	return best;
+}
+
+/*
+ * Fixed-base table precomputation
+ * Inputs: 
+ *   - Base: b
+ *   - Maximum bit-length of exponents: bits
+ *   - Window width: w
+ *   - Modulus: n
+ * Outputs: table tab (to be released with mexp_table_clear)
+ * Assumptions: 
+ *   - base is in range 0 <= b < n
+ *   - all I/O pointers are allocated by caller
+ */
+int mexp_table_init(mexp_table *tab, const mpz_t b, const int bits, const int w,
+	                const mpz_t n)
+{
+	int j, d, size;
+	mpz_t t;
+
+	tab->w = w;
+	tab->nwin = (bits+w-1)/w;
+	if (tab->nwin < 1) { tab->nwin = 1; }
+	size = (1<<w)-1;
+
+	tab->pow = (mpz_t *)malloc((size_t)tab->nwin*size*sizeof(mpz_t));
+	if (!tab->pow) { return 1; }
+
+	mpz_init(t);
+	for (j=0;j<tab->nwin;j++) {
+		mpz_init(tab->pow[j*size]);
+		if (j == 0) {
+			mpz_set(tab->pow[0],b);
+		} else {
+			// b^{2^{w*j}} from the top entry of the previous window
+			mpz_mul(t,tab->pow[(j-1)*size+size-1],tab->pow[(j-1)*size]);
+			mpz_mod(tab->pow[j*size],t,n);
+		}
+		for (d=2;d<=size;d++) {
+			mpz_init(tab->pow[j*size+d-1]);
+			mpz_mul(t,tab->pow[j*size+d-2],tab->pow[j*size]);
+			mpz_mod(tab->pow[j*size+d-1],t,n);
+		}
+	}
+	mpz_clear(t);
+
+	return 0;
+}
+
+/*
+ * Fixed-base accumulation: r = r * b^e mod n using table of b
+ * Inputs: 
+ *   - Table of base b: tab
+ *   - Exponent: e
+ *   - Modulus: n
+ * Outputs: r updated in place
+ * Assumptions: 
+ *   - exponent is non-negative
+ *   - all I/O pointers are allocated and initialized by caller
+ */
+int mexp_table_mulpowm(mpz_t r, const mexp_table *tab, const mpz_t e,
+	                   const mpz_t n)
+{
+	int j, size;
+	unsigned long d;
+	mpz_t t;
+
+	mpz_init(t);
+	if (mpz_sizeinbase(e,2) > (size_t)tab->w*tab->nwin) {
+		// Exponent not covered by the table
+		mpz_powm(t,tab->pow[0],e,n);
+		mpz_mul(t,t,r);
+		mpz_mod(r,t,n);
+		mpz_clear(t);
+		return 0;
+	}
+
+	size = (1<<tab->w)-1;
+	for (j=0;j<tab->nwin;j++) {
+		d = mexp_digit(e,(size_t)j*tab->w,tab->w);
+		if (d == 0) { continue; }
+		mpz_mul(t,r,tab->pow[j*size+d-1]);
+		mpz_mod(r,t,n);
+	}
+	mpz_clear(t);
+
+	return 0;
+}
+
+/*
+ * Fixed-base exponentiation: r = b^e mod n using table of b
+ * Inputs/Assumptions: as for mexp_table_mulpowm
+ */
+int mexp_table_powm(mpz_t r, const mexp_table *tab, const mpz_t e,
+	                const mpz_t n)
+{
+	mpz_set_ui(r,1);
+	return mexp_table_mulpowm(r,tab,e,n);
+}
+
+/*
+ * Release fixed-base table
+ */
+void mexp_table_clear(mexp_table *tab)
+{
+	int j;
+
+	for (j=0;j<tab->nwin*((1<<tab->w)-1);j++) {
+		mpz_clear(tab->pow[j]);
+	}
+	free(tab->pow);
+	tab->pow = NULL;
+}
@@ -0,0 +1,354 @@
+#include <gmp.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "mont.h"
+
+#define MONT_SLOTS 8
+
+/*
+ * REDC for a fixed limb count: t[0..2N) holds a*b < m*R, result r < m.
+ * The carry of step i is kept in t[i] (already zero) and added back in
+ * one pass at the end.
+ */
+#define MONT_KERNEL(N) \
+static void mont_redc_##N(mp_limb_t *r, mp_limb_t *t, const mont_ctx *ctx) \
+{ \
+	mp_limb_t cy; \
+	int i; \
+	for (i=0;i<N;i++) { \
+		t[i] = mpn_addmul_1(t+i, ctx->m, N, t[i]*ctx->minv); \
+	} \
+	cy = mpn_add_n(r, t+N, t, N); \
+	if (cy || mpn_cmp(r, ctx->m, N) >= 0) { mpn_sub_n(r, r, ctx->m, N); } \
+} \
+static void mont_mul_##N(mp_limb_t *r, const mp_limb_t *a, const mp_limb_t *b, const mont_ctx *ctx) \
+{ \
+	mp_limb_t t[2*N]; \
+	mpn_mul_n(t, a, b, N); \
+	mont_redc_##N(r, t, ctx); \
+} \
+static void mont_sqr_##N(mp_limb_t *r, const mp_limb_t *a, const mont_ctx *ctx) \
+{ \
+	mp_limb_t t[2*N]; \
+	mpn_sqr(t, a, N); \
+	mont_redc_##N(r, t, ctx); \
+}
+
+#if GMP_NUMB_BITS == 64 && GMP_NAIL_BITS == 0
+MONT_KERNEL(16)
+MONT_KERNEL(17)
+MONT_KERNEL(24)
+MONT_KERNEL(25)
+MONT_KERNEL(32)
+MONT_KERNEL(33)
+MONT_KERNEL(48)
+MONT_KERNEL(49)
+MONT_KERNEL(64)
+MONT_KERNEL(65)
+#define MONT_SUPPORTED 1
+#endif
+
+static mont_ctx mont_slots[MONT_SLOTS];
+static _Atomic int mont_nslots;
+static pthread_mutex_t mont_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Montgomery context for modulus m
+ * Inputs: odd modulus m of 16, 24, 32, 48 or 64 limbs, or one limb more
+ *         (the sizes of p and n from bhjl_gen for l = 2048/3072/4096)
+ * Outputs: ctx; 0 on success, 1 if no kernel exists for the size of m
+ */
+int mont_init(mont_ctx *ctx, const mpz_t m)
+{
+	mpz_t t;
+	mp_limb_t inv;
+	int i, n;
+
+	n = (int)mpz_size(m);
+	memset(ctx, 0, sizeof(*ctx));
+#ifdef MONT_SUPPORTED
+	switch (n) {
+	case 16: ctx->mul = mont_mul_16; ctx->sqr = mont_sqr_16; break;
+	case 17: ctx->mul = mont_mul_17; ctx->sqr = mont_sqr_17; break;
+	case 24: ctx->mul = mont_mul_24; ctx->sqr = mont_sqr_24; break;
+	case 25: ctx->mul = mont_mul_25; ctx->sqr = mont_sqr_25; break;
+	case 32: ctx->mul = mont_mul_32; ctx->sqr = mont_sqr_32; break;
+	case 33: ctx->mul = mont_mul_33; ctx->sqr = mont_sqr_33; break;
+	case 48: ctx->mul = mont_mul_48; ctx->sqr = mont_sqr_48; break;
+	case 49: ctx->mul = mont_mul_49; ctx->sqr = mont_sqr_49; break;
+	case 64: ctx->mul = mont_mul_64; ctx->sqr = mont_sqr_64; break;
+	case 65: ctx->mul = mont_mul_65; ctx->sqr = mont_sqr_65; break;
+	default: return 1;
+	}
+#else
+	return 1;
+#endif
+	if (mpz_even_p(m)) { return 1; }
+
+	ctx->limbs = n;
+	mpn_copyi(ctx->m, mpz_limbs_read(m), n);
+
+	// Newton iteration for m^{-1} mod 2^64 (5 steps from 3 correct bits)
+	inv = ctx->m[0];
+	for (i=0;i<5;i++) { inv *= 2 - ctx->m[0]*inv; }
+	ctx->minv = -inv;
+
+	mpz_init(t);
+	mpz_setbit(t, GMP_NUMB_BITS*n);
+	mpz_mod(t, t, m);
+	mpn_zero(ctx->one, n);
+	mpn_copyi(ctx->one, mpz_limbs_read(t), mpz_size(t));
+	mpz_mul(t, t, t);
+	mpz_mod(t, t, m);
+	mpn_zero(ctx->r2, n);
+	mpn_copyi(ctx->r2, mpz_limbs_read(t), mpz_size(t));
+	mpz_clear(t);
+
+	return 0;
+}
+
+/*
+ * Process-wide Montgomery context for modulus m, created on first use
+ * Outputs: shared read-only context, or NULL if m has no kernel (callers
+ *          then use generic GMP arithmetic)
+ */
+const mont_ctx *mont_lookup(const mpz_t m)
+{
+	const mont_ctx *ctx = NULL;
+	int i, n;
+
+	n = atomic_load_explicit(&mont_nslots, memory_order_acquire);
+	for (i=0;i<n;i++) {
+		if (mont_slots[i].limbs == (int)mpz_size(m) &&
+		    mpn_cmp(mont_slots[i].m, mpz_limbs_read(m), mont_slots[i].limbs) == 0) {
+			return &mont_slots[i];
+		}
+	}
+
+	pthread_mutex_lock(&mont_lock);
+	n = atomic_load_explicit(&mont_nslots, memory_order_relaxed);
+	for (i=0;i<n && !ctx;i++) {
+		if (mont_slots[i].limbs == (int)mpz_size(m) &&
+		    mpn_cmp(mont_slots[i].m, mpz_limbs_read(m), mont_slots[i].limbs) == 0) {
+			ctx = &mont_slots[i];
+		}
+	}
+	if (!ctx && n < MONT_SLOTS && mont_init(&mont_slots[n], m) == 0) {
+		ctx = &mont_slots[n];
+		atomic_store_explicit(&mont_nslots, n+1, memory_order_release);
+	}
+	pthread_mutex_unlock(&mont_lock);
+
+	return ctx;
+}
+
+/*
+ * Plain value as ctx->limbs limbs, reduced if longer than the modulus
+ */
+static void mont_load(mp_limb_t *r, const mpz_t a, const mont_ctx *ctx)
+{
+	mpz_t t, m;
+
+	mpn_zero(r, ctx->limbs);
+	if ((int)mpz_size(a) <= ctx->limbs) {
+		mpn_copyi(r, mpz_limbs_read(a), mpz_size(a));
+		return;
+	}
+	mpz_init(t);
+	mpz_tdiv_r(t, a, mpz_roinit_n(m, ctx->m, ctx->limbs));
+	mpn_copyi(r, mpz_limbs_read(t), mpz_size(t));
+	mpz_clear(t);
+}
+
+/*
+ * Into the Montgomery domain: r = a*R mod m
+ * Assumptions: a is non-negative
+ */
+void mont_to(mp_limb_t *r, const mpz_t a, const mont_ctx *ctx)
+{
+	mp_limb_t t[MONT_MAX_LIMBS];
+
+	mont_load(t, a, ctx);
+	ctx->mul(r, t, ctx->r2, ctx);
+}
+
+/*
+ * Out of the Montgomery domain: r = a*R^{-1} mod m
+ */
+void mont_from(mpz_t r, const mp_limb_t *a, const mont_ctx *ctx)
+{
+	mp_limb_t one[MONT_MAX_LIMBS], *rp;
+
+	mpn_zero(one, ctx->limbs);
+	one[0] = 1;
+	rp = mpz_limbs_write(r, ctx->limbs);
+	ctx->mul(rp, a, one, ctx);
+	mpz_limbs_finish(r, ctx->limbs);
+}
+
+/*
+ * Non-zero if a (Montgomery domain) encodes 1
+ */
+int mont_is_one(const mp_limb_t *a, const mont_ctx *ctx)
+{
+	return mpn_cmp(a, ctx->one, ctx->limbs) == 0;
+}
+
+/*
+ * Fixed-window exponentiation in the Montgomery domain: r = b^e
+ * Inputs: base b (Montgomery domain), exponent e >= 0
+ * Outputs: r (Montgomery domain), may alias b
+ */
+void mont_powm_limbs(mp_limb_t *r, const mp_limb_t *b, const mpz_t e, const mont_ctx *ctx)
+{
+	mp_limb_t tab[1<<MONT_WINDOW][MONT_MAX_LIMBS], acc[MONT_MAX_LIMBS];
+	const mp_limb_t *ep = mpz_limbs_read(e);
+	size_t bits, i;
+	int j, n = ctx->limbs;
+	unsigned d;
+
+	bits = mpz_sgn(e) ? mpz_sizeinbase(e, 2) : 0;
+	if (bits == 0) {
+		mpn_copyi(r, ctx->one, n);
+		return;
+	}
+
+	mpn_copyi(tab[0], ctx->one, n);
+	mpn_copyi(tab[1], b, n);
+	for (j=2;j<(1<<MONT_WINDOW);j++) { ctx->mul(tab[j], tab[j-1], b, ctx); }
+
+	// Windows aligned to multiples of MONT_WINDOW from the top
+	i = ((bits + MONT_WINDOW - 1)/MONT_WINDOW)*MONT_WINDOW;
+	mpn_copyi(acc, ctx->one, n);
+	while (i > 0) {
+		i -= MONT_WINDOW;
+		for (j=0;j<MONT_WINDOW;j++) { ctx->sqr(acc, acc, ctx); }
+		d = 0;
+		for (j=MONT_WINDOW-1;j>=0;j--) {
+			if (i + j < bits) {
+				d = (d << 1) | (unsigned)((ep[(i+j)/GMP_NUMB_BITS] >> ((i+j)%GMP_NUMB_BITS)) & 1);
+			} else {
+				d <<= 1;
+			}
+		}
+		if (d) { ctx->mul(acc, acc, tab[d], ctx); }
+	}
+	mpn_copyi(r, acc, n);
+}
+
+/*
+ * Modular exponentiation r = b^e mod m
+ * Assumptions: b, e are non-negative
+ */
+int mont_powm(mpz_t r, const mpz_t b, const mpz_t e, const mont_ctx *ctx)
+{
+	mp_limb_t t[MONT_MAX_LIMBS];
+
+	mont_to(t, b, ctx);
+	mont_powm_limbs(t, t, e, ctx);
+	mont_from(r, t, ctx);
+	return 0;
+}
+
+/*
+ * Repeated squaring r = b^{2^e} mod m
+ * Assumptions: b is non-negative, e >= 0
+ */
+int mont_powm_2exp(mpz_t r, const mpz_t b, const int e, const mont_ctx *ctx)
+{
+	mp_limb_t t[MONT_MAX_LIMBS];
+	int i;
+
+	mont_to(t, b, ctx);
+	for (i=0;i<e;i++) { ctx->sqr(t, t, ctx); }
+	mont_from(r, t, ctx);
+	return 0;
+}
+
+/*
+ * Joint exponentiation r = prod bases[i]^{exps[i]} mod m sharing one
+ * chain of squarings between all bases (fixed windows, one table per
+ * base)
+ * Inputs: count <= MONT_MULTI_MAX non-negative bases and exponents
+ * Outputs: r; 0 on success, 1 if count is out of range
+ */
+int mont_powm_multi(mpz_t r, const mpz_t *bases, const mpz_t *exps, const int count,
+	                const mont_ctx *ctx)
+{
+	mp_limb_t tab[MONT_MULTI_MAX][1<<MONT_MULTI_WINDOW][MONT_MAX_LIMBS], acc[MONT_MAX_LIMBS];
+	size_t bits = 0, b, i;
+	int j, l, n = ctx->limbs;
+	unsigned d;
+
+	if (count < 1 || count > MONT_MULTI_MAX) { return 1; }
+
+	for (l=0;l<count;l++) {
+		b = mpz_sgn(exps[l]) ? mpz_sizeinbase(exps[l], 2) : 0;
+		if (b > bits) { bits = b; }
+		mont_to(tab[l][1], bases[l], ctx);
+		for (j=2;j<(1<<MONT_MULTI_WINDOW);j++) { ctx->mul(tab[l][j], tab[l][j-1], tab[l][1], ctx); }
+	}
+
+	mpn_copyi(acc, ctx->one, n);
+	i = ((bits + MONT_MULTI_WINDOW - 1)/MONT_MULTI_WINDOW)*MONT_MULTI_WINDOW;
+	while (i > 0) {
+		i -= MONT_MULTI_WINDOW;
+		for (j=0;j<MONT_MULTI_WINDOW;j++) { ctx->sqr(acc, acc, ctx); }
+		for (l=0;l<count;l++) {
+			d = 0;
+			for (j=MONT_MULTI_WINDOW-1;j>=0;j--) { d = (d << 1) | (unsigned)mpz_tstbit(exps[l], i+j); }
+			if (d) { ctx->mul(acc, acc, tab[l][d], ctx); }
+		}
+	}
+	mont_from(r, acc, ctx);
+
+	return 0;
+}
+
+/*
+ * Modular multiplication r = a*b mod m
+ * Assumptions: a, b are non-negative
+ */
+int mont_mulmod(mpz_t r, const mpz_t a, const mpz_t b, const mont_ctx *ctx)
+{
+	mp_limb_t ta[MONT_MAX_LIMBS], tb[MONT_MAX_LIMBS];
+
+	// (a*R)*b*R^{-1} = a*b, already out of the Montgomery domain
+	mont_to(ta, a, ctx);
+	mont_load(tb, b, ctx);
+	ctx->mul(ta, ta, tb, ctx);
+	mpn_copyi(mpz_limbs_write(r, ctx->limbs), ta, ctx->limbs);
+	mpz_limbs_finish(r, ctx->limbs);
+	return 0;
+}
+
+/*
+ * Modular product r = a[0]*...*a[count-1] mod m with one Montgomery
+ * multiplication per factor: the plain chain leaves a factor
+ * R^{-(count-1)} that is cancelled at the end
+ * Assumptions: count >= 1, a[] are non-negative
+ */
+int mont_prod(mpz_t r, const mpz_t *a, const int count, const mont_ctx *ctx)
+{
+	mp_limb_t acc[MONT_MAX_LIMBS], t[MONT_MAX_LIMBS];
+	mpz_t e;
+	int i;
+
+	mont_load(acc, a[0], ctx);
+	for (i=1;i<count;i++) {
+		mont_load(t, a[i], ctx);
+		ctx->mul(acc, acc, t, ctx);
+	}
+
+	// R^{count} mod m is the Montgomery form of R^{count-1}
+	mpz_init_set_ui(e, count-1);
+	mont_powm_limbs(t, ctx->r2, e, ctx);
+	mpz_clear(e);
+	ctx->mul(acc, acc, t, ctx);
+
+	mpn_copyi(mpz_limbs_write(r, ctx->limbs), acc, ctx->limbs);
+	mpz_limbs_finish(r, ctx->limbs);
+	return 0;
+}
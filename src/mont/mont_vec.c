@@ -0,0 +1,365 @@
+#include <gmp.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define MONT_VEC_X86 1
+#endif
+
+#include "mont.h"
+
+#define MV_ALIGN 64
+#define MV_MAX_DIGITS52 81  // 65 limbs + 2 bits of headroom
+#define MV_MAX_DIGITS26 161
+
+/*
+ * Lane-interleaved Montgomery arithmetic: a batch of `lanes` values is
+ * stored digit-major, v[j*lanes + lane] = digit j (bits wide) of the
+ * value in lane, so one vector instruction processes digit j of all
+ * lanes. R' = 2^{bits*digits} >= 4m, which keeps every product of
+ * values below 2m below 2m again without a final subtraction
+ * ("almost Montgomery"); values are only fully reduced on the way out.
+ */
+typedef struct mv_ctx mv_ctx;
+
+struct mv_ctx {
+	int lanes, bits, digits;
+	uint64_t mask, minv;   // 2^bits-1, -m^{-1} mod 2^bits
+	mpz_t m;
+	uint64_t *buf;         // m, R' mod m, plain 1 and the work area
+	uint64_t *md, *one, *unit;
+	void (*mul)(uint64_t *r, const uint64_t *a, const uint64_t *b, const mv_ctx *mv);
+};
+
+static _Atomic int mont_current = -1;
+
+#ifdef MONT_VEC_X86
+/*
+ * r = a*b/R' mod m, 8 lanes of 52-bit digits. T[i..i+digits] is the
+ * running sum at step i; each T entry collects at most 4 products of
+ * 52 bits per step, so 64-bit lanes cannot overflow before the final
+ * carry pass.
+ */
+__attribute__((target("avx512f,avx512ifma")))
+static void mv_mul_ifma(uint64_t *r, const uint64_t *a, const uint64_t *b, const mv_ctx *mv)
+{
+	__m512i T[2*MV_MAX_DIGITS52], bi, q, aj, mj;
+	const __m512i zero = _mm512_setzero_si512();
+	const __m512i mask = _mm512_set1_epi64((long long)mv->mask);
+	const __m512i minv = _mm512_set1_epi64((long long)mv->minv);
+	const int L = mv->digits;
+	int i, j;
+
+	for (j=0;j<2*L;j++) { T[j] = zero; }
+	for (i=0;i<L;i++) {
+		bi = _mm512_load_si512((const void *)(b + (size_t)i*8));
+		aj = _mm512_load_si512((const void *)a);
+		mj = _mm512_load_si512((const void *)mv->md);
+		T[i] = _mm512_madd52lo_epu64(T[i], aj, bi);
+		q = _mm512_madd52lo_epu64(zero, T[i], minv);
+		T[i] = _mm512_madd52lo_epu64(T[i], mj, q);
+		T[i+1] = _mm512_madd52hi_epu64(T[i+1], aj, bi);
+		T[i+1] = _mm512_madd52hi_epu64(T[i+1], mj, q);
+		for (j=1;j<L;j++) {
+			aj = _mm512_load_si512((const void *)(a + (size_t)j*8));
+			mj = _mm512_load_si512((const void *)(mv->md + (size_t)j*8));
+			T[i+j] = _mm512_madd52lo_epu64(T[i+j], aj, bi);
+			T[i+j] = _mm512_madd52lo_epu64(T[i+j], mj, q);
+			T[i+j+1] = _mm512_madd52hi_epu64(T[i+j+1], aj, bi);
+			T[i+j+1] = _mm512_madd52hi_epu64(T[i+j+1], mj, q);
+		}
+		// The low digit is now a multiple of 2^52
+		T[i+1] = _mm512_add_epi64(T[i+1], _mm512_srli_epi64(T[i], 52));
+	}
+	for (j=L;j<2*L;j++) {
+		if (j+1 < 2*L) { T[j+1] = _mm512_add_epi64(T[j+1], _mm512_srli_epi64(T[j], 52)); }
+		_mm512_store_si512((void *)(r + (size_t)(j-L)*8), _mm512_and_si512(T[j], mask));
+	}
+}
+
+/*
+ * As mv_mul_ifma, 4 lanes of 26-bit digits with 32x32->64-bit
+ * multiplies (2 products of 52 bits per T entry and step)
+ */
+__attribute__((target("avx2")))
+static void mv_mul_avx2(uint64_t *r, const uint64_t *a, const uint64_t *b, const mv_ctx *mv)
+{
+	__m256i T[2*MV_MAX_DIGITS26], bi, q;
+	const __m256i mask = _mm256_set1_epi64x((long long)mv->mask);
+	const __m256i minv = _mm256_set1_epi64x((long long)mv->minv);
+	const int L = mv->digits;
+	int i, j;
+
+	for (j=0;j<2*L;j++) { T[j] = _mm256_setzero_si256(); }
+	for (i=0;i<L;i++) {
+		bi = _mm256_load_si256((const __m256i *)(b + (size_t)i*4));
+		T[i] = _mm256_add_epi64(T[i], _mm256_mul_epu32(_mm256_load_si256((const __m256i *)a), bi));
+		q = _mm256_and_si256(_mm256_mul_epu32(T[i], minv), mask);
+		T[i] = _mm256_add_epi64(T[i], _mm256_mul_epu32(_mm256_load_si256((const __m256i *)mv->md), q));
+		for (j=1;j<L;j++) {
+			T[i+j] = _mm256_add_epi64(T[i+j],
+			         _mm256_add_epi64(_mm256_mul_epu32(_mm256_load_si256((const __m256i *)(a + (size_t)j*4)), bi),
+			                          _mm256_mul_epu32(_mm256_load_si256((const __m256i *)(mv->md + (size_t)j*4)), q)));
+		}
+		T[i+1] = _mm256_add_epi64(T[i+1], _mm256_srli_epi64(T[i], 26));
+	}
+	for (j=L;j<2*L;j++) {
+		if (j+1 < 2*L) { T[j+1] = _mm256_add_epi64(T[j+1], _mm256_srli_epi64(T[j], 26)); }
+		_mm256_store_si256((__m256i *)(r + (size_t)(j-L)*4), _mm256_and_si256(T[j], mask));
+	}
+}
+#endif
+
+/*
+ * Non-zero if backend can run on this machine
+ */
+int mont_backend_hw(const int backend)
+{
+	if (backend == MONT_BACKEND_SCALAR) { return 1; }
+#if defined(MONT_VEC_X86) && GMP_NUMB_BITS == 64
+	__builtin_cpu_init();
+	if (backend == MONT_BACKEND_AVX2) { return __builtin_cpu_supports("avx2") != 0; }
+	if (backend == MONT_BACKEND_IFMA) {
+		return __builtin_cpu_supports("avx512f") != 0 && __builtin_cpu_supports("avx512ifma") != 0;
+	}
+#endif
+	return 0;
+}
+
+/*
+ * Identifier of the batch exponentiation backend: the one selected with
+ * mont_backend_select, else IFMA if the CPU supports it. AVX2 is only
+ * used when selected: its 26-bit digits do not beat the scalar mulx
+ * kernels of GMP (mont_vec_test reports both).
+ */
+int mont_backend(void)
+{
+	int b = atomic_load_explicit(&mont_current, memory_order_relaxed);
+
+	if (b < 0) {
+		b = mont_backend_hw(MONT_BACKEND_IFMA) ? MONT_BACKEND_IFMA : MONT_BACKEND_SCALAR;
+		atomic_store_explicit(&mont_current, b, memory_order_relaxed);
+	}
+	return b;
+}
+
+/*
+ * Force a batch exponentiation backend
+ * Outputs: 0 on success, 1 if the CPU does not support it
+ */
+int mont_backend_select(const int backend)
+{
+	if (backend != MONT_BACKEND_SCALAR && backend != MONT_BACKEND_AVX2 &&
+	    backend != MONT_BACKEND_IFMA) { return 1; }
+	if (!mont_backend_hw(backend)) { return 1; }
+	atomic_store_explicit(&mont_current, backend, memory_order_relaxed);
+	return 0;
+}
+
+/*
+ * Digits of 0 <= x < R' into one lane
+ */
+static void mv_put(uint64_t *v, const int lane, const mpz_t x, const mv_ctx *mv)
+{
+	const mp_limb_t *xp = mpz_limbs_read(x);
+	size_t xs = mpz_size(x), limb;
+	uint64_t d;
+	int j, off;
+
+	for (j=0;j<mv->digits;j++) {
+		limb = (size_t)j*mv->bits/64;
+		off = (j*mv->bits)%64;
+		d = (limb < xs) ? xp[limb] >> off : 0;
+		if (off + mv->bits > 64 && limb+1 < xs) { d |= xp[limb+1] << (64-off); }
+		v[(size_t)j*mv->lanes + lane] = d & mv->mask;
+	}
+}
+
+/*
+ * Value of one lane (normalized digits)
+ */
+static void mv_get(mpz_t x, const uint64_t *v, const int lane, const mv_ctx *mv)
+{
+	int j, off, n = (mv->bits*mv->digits + 63)/64;
+	mp_limb_t *xp = mpz_limbs_write(x, n);
+	size_t limb;
+	uint64_t d;
+
+	memset(xp, 0, n*sizeof(mp_limb_t));
+	for (j=0;j<mv->digits;j++) {
+		d = v[(size_t)j*mv->lanes + lane];
+		limb = (size_t)j*mv->bits/64;
+		off = (j*mv->bits)%64;
+		xp[limb] |= d << off;
+		if (off + mv->bits > 64) { xp[limb+1] |= d >> (64-off); }
+	}
+	mpz_limbs_finish(x, n);
+}
+
+/*
+ * Lane-interleaved context for the modulus of ctx, with room for the
+ * tables of nbases bases of window w
+ */
+static int mv_init(mv_ctx *mv, const mont_ctx *ctx, const int backend, const int nbases, const int w)
+{
+	mpz_t t, mr;
+	size_t sz;
+	int lane;
+
+	memset(mv, 0, sizeof(*mv));
+#ifdef MONT_VEC_X86
+	if (backend == MONT_BACKEND_IFMA) {
+		mv->lanes = 8;
+		mv->bits = 52;
+		mv->mul = mv_mul_ifma;
+	} else if (backend == MONT_BACKEND_AVX2) {
+		mv->lanes = 4;
+		mv->bits = 26;
+		mv->mul = mv_mul_avx2;
+	}
+#endif
+	if (!mv->mul) { return 1; }
+
+	mpz_init_set(mv->m, mpz_roinit_n(mr, ctx->m, ctx->limbs));
+	mv->digits = (int)((mpz_sizeinbase(mv->m, 2) + 2 + mv->bits-1)/mv->bits);
+	mv->mask = ((uint64_t)1 << mv->bits) - 1;
+	mv->minv = ctx->minv & mv->mask;
+
+	// m, R' mod m, 1, accumulator, gathered operand, tables
+	sz = (size_t)mv->digits*mv->lanes;
+	if (posix_memalign((void **)&mv->buf, MV_ALIGN, (5 + ((size_t)nbases << w))*sz*sizeof(uint64_t)) != 0) {
+		mpz_clear(mv->m);
+		return 1;
+	}
+	mv->md = mv->buf;
+	mv->one = mv->md + sz;
+	mv->unit = mv->one + sz;
+
+	mpz_init(t);
+	mpz_setbit(t, (mp_bitcnt_t)mv->bits*mv->digits);
+	mpz_mod(t, t, mv->m);
+	for (lane=0;lane<mv->lanes;lane++) {
+		mv_put(mv->md, lane, mv->m, mv);
+		mv_put(mv->one, lane, t, mv);
+	}
+	mpz_set_ui(t, 1);
+	for (lane=0;lane<mv->lanes;lane++) { mv_put(mv->unit, lane, t, mv); }
+	mpz_clear(t);
+
+	return 0;
+}
+
+static void mv_clear(mv_ctx *mv)
+{
+	mpz_clear(mv->m);
+	free(mv->buf);
+}
+
+/*
+ * One vector of joint exponentiations: r[lane] = prod_l
+ * bases[lane*nbases+l]^{exps[lane*nbases+l]} mod m for lane < used;
+ * unused lanes compute 1 (fixed windows of w bits, one table per base
+ * and lane, tables looked up lane by lane)
+ */
+static void mv_powm_multi(mpz_t *r, const mpz_t *bases, const mpz_t *exps, const int nbases,
+	                      const int used, const int w, const mv_ctx *mv)
+{
+	size_t sz = (size_t)mv->digits*mv->lanes, bits = 0, b, i;
+	uint64_t *acc = mv->unit + sz, *op = acc + sz, *tab = op + sz, *t1;
+	unsigned d[MONT_LANES], any;
+	int j, l, lane, x;
+	mpz_t t;
+
+	mpz_init(t);
+	for (l=0;l<nbases;l++) {
+		// Table of base l: entry x at tab + ((l << w) + x)*sz
+		memcpy(tab + ((size_t)l << w)*sz, mv->one, sz*sizeof(uint64_t));
+		t1 = tab + (((size_t)l << w) + 1)*sz;
+		memcpy(t1, mv->one, sz*sizeof(uint64_t));
+		for (lane=0;lane<used;lane++) {
+			mpz_mul_2exp(t, bases[lane*nbases+l], (mp_bitcnt_t)mv->bits*mv->digits);
+			mpz_mod(t, t, mv->m);
+			mv_put(t1, lane, t, mv);
+			b = mpz_sgn(exps[lane*nbases+l]) ? mpz_sizeinbase(exps[lane*nbases+l], 2) : 0;
+			if (b > bits) { bits = b; }
+		}
+		for (x=2;x<(1<<w);x++) { mv->mul(t1 + (x-1)*sz, t1 + (x-2)*sz, t1, mv); }
+	}
+
+	memcpy(acc, mv->one, sz*sizeof(uint64_t));
+	i = ((bits + w - 1)/w)*w;
+	while (i > 0) {
+		i -= w;
+		for (j=0;j<w;j++) { mv->mul(acc, acc, acc, mv); }
+		for (l=0;l<nbases;l++) {
+			any = 0;
+			for (lane=0;lane<mv->lanes;lane++) {
+				d[lane] = 0;
+				for (j=w-1;j>=0 && lane<used;j--) {
+					d[lane] = (d[lane] << 1) | (unsigned)mpz_tstbit(exps[lane*nbases+l], i+j);
+				}
+				any |= d[lane];
+			}
+			if (!any) { continue; }
+			for (j=0;j<mv->digits;j++) {
+				for (lane=0;lane<mv->lanes;lane++) {
+					op[(size_t)j*mv->lanes + lane] =
+						tab[(((size_t)l << w) + d[lane])*sz + (size_t)j*mv->lanes + lane];
+				}
+			}
+			mv->mul(acc, acc, op, mv);
+		}
+	}
+
+	// Out of the domain: acc*1/R' <= m
+	mv->mul(acc, acc, mv->unit, mv);
+	for (lane=0;lane<used;lane++) {
+		mv_get(r[lane], acc, lane, mv);
+		if (mpz_cmp(r[lane], mv->m) >= 0) { mpz_sub(r[lane], r[lane], mv->m); }
+	}
+	mpz_clear(t);
+}
+
+/*
+ * Batch of joint exponentiations modulo the same m:
+ * r[i] = prod_{l<nbases} bases[i*nbases+l]^{exps[i*nbases+l]} mod m.
+ * On the AVX2/IFMA backends 4/8 of them run together in the vector
+ * lanes; short remainders and the scalar backend use mont_powm /
+ * mont_powm_multi one at a time.
+ * Inputs: nbases <= MONT_MULTI_MAX non-negative bases and exponents
+ *         per result, count >= 0
+ * Outputs: r[0..count-1]; 0 on success, 1 if nbases is out of range or
+ *          memory cannot be allocated
+ */
+int mont_powm_multi_batch(mpz_t *r, const mpz_t *bases, const mpz_t *exps, const int nbases,
+	                      const int count, const mont_ctx *ctx)
+{
+	int i = 0, n, w, backend = mont_backend();
+	mv_ctx mv;
+
+	if (nbases < 1 || nbases > MONT_MULTI_MAX || count < 0) { return 1; }
+
+	w = (nbases == 1) ? MONT_WINDOW : MONT_MULTI_WINDOW;
+	if (backend != MONT_BACKEND_SCALAR && count > 1 && mv_init(&mv, ctx, backend, nbases, w) == 0) {
+		for (;i<count;i+=n) {
+			n = (count - i < mv.lanes) ? count - i : mv.lanes;
+			// Less than half a vector is cheaper one at a time
+			if (2*n < mv.lanes) { break; }
+			mv_powm_multi(r+i, bases + (size_t)i*nbases, exps + (size_t)i*nbases, nbases, n, w, &mv);
+		}
+		mv_clear(&mv);
+	}
+
+	for (;i<count;i++) {
+		if (nbases == 1) {
+			mont_powm(r[i], bases[i], exps[i], ctx);
+		} else {
+			mont_powm_multi(r[i], bases + (size_t)i*nbases, exps + (size_t)i*nbases, nbases, ctx);
+		}
+	}
+
+	return 0;
+}
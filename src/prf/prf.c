@@ -1,16 +1,39 @@
 #include <stdlib.h>
+#include <string.h>
 
 #include "KeccakPRGWidth1600.h"
 
 #include "prf.h"
 
+// Backend chosen at setup; both parties must use the one stored with the keys
+static int prf_current = PRF_BACKEND_KECCAK;
+
+/*
+ * Select the PRF backend used by prf/prf_batch
+ * Inputs: backend identifier (PRF_BACKEND_KECCAK or PRF_BACKEND_AES)
+ * Outputs: 0 on success, 1 if the identifier is unknown
+ * Assumptions: called during setup, before any thread uses the PRF
+ */
+int prf_select(const int backend) {
+	if (backend != PRF_BACKEND_KECCAK && backend != PRF_BACKEND_AES) { return 1; }
+	prf_current = backend;
+	return 0;
+}
+
+/*
+ * Identifier of the selected PRF backend
+ */
+int prf_backend(void) {
+	return prf_current;
+}
+
 /*  PRF based on Keccak hash function
  *  Inputs: key[SK_SIZE],label[LABEL_SIZE])
  *  Outputs: nonce[NONCE_SIZE]
  *  Computes: nonce = Keccak(key,label)
  *  Assumptions: all I/O pointers point to correctly allocated and disjoint regions. 
  */
-int prf(unsigned char *nonce, const unsigned char *label, const unsigned char *key) {
+int prf_keccak(unsigned char *nonce, const unsigned char *label, const unsigned char *key) {
 	KeccakWidth1600_SpongePRG_Instance instance;
 
 	KeccakWidth1600_SpongePRG_Initialize(&instance, 254);
@@ -20,3 +43,100 @@ int prf(unsigned char *nonce, const unsigned char *label, const unsigned char *k
 
 	return 0;
 }
+
+/*  Batch Keccak PRF: the key is absorbed once and the sponge state
+ *  is copied for every label.
+ *  Inputs: key[SK_SIZE],labels[count*LABEL_SIZE]
+ *  Outputs: nonces[count*NONCE_SIZE]
+ *  Assumptions: all I/O pointers point to correctly allocated and disjoint regions. 
+ */
+int prf_keccak_batch(unsigned char *nonces, const unsigned char *labels, const int count, const unsigned char *key) {
+	KeccakWidth1600_SpongePRG_Instance keyed, instance;
+	int i;
+
+	KeccakWidth1600_SpongePRG_Initialize(&keyed, 254);
+	KeccakWidth1600_SpongePRG_Feed(&keyed, key, SK_SIZE);
+	for (i=0;i<count;i++) {
+		instance = keyed;
+		KeccakWidth1600_SpongePRG_Feed(&instance, labels+i*LABEL_SIZE, LABEL_SIZE);
+		KeccakWidth1600_SpongePRG_Fetch(&instance, nonces+i*NONCE_SIZE, NONCE_SIZE);
+	}
+
+	return 0;
+}
+
+/*  PRF with the selected backend
+ *  Inputs: key[SK_SIZE],label[LABEL_SIZE])
+ *  Outputs: nonce[NONCE_SIZE]
+ *  Assumptions: all I/O pointers point to correctly allocated and disjoint regions. 
+ */
+int prf(unsigned char *nonce, const unsigned char *label, const unsigned char *key) {
+	if (prf_current == PRF_BACKEND_AES) { return prf_aes(nonce, label, key); }
+	return prf_keccak(nonce, label, key);
+}
+
+/*  Batch PRF with the selected backend
+ *  Inputs: key[SK_SIZE],labels[count*LABEL_SIZE]
+ *  Outputs: nonces[count*NONCE_SIZE]
+ *  Assumptions: all I/O pointers point to correctly allocated and disjoint regions. 
+ */
+int prf_batch(unsigned char *nonces, const unsigned char *labels, const int count, const unsigned char *key) {
+	if (prf_current == PRF_BACKEND_AES) { return prf_aes_batch(nonces, labels, count, key); }
+	return prf_keccak_batch(nonces, labels, count, key);
+}
+
+/*  Batch PRF over sequential labels start_label..start_label+count-1,
+ *  encoded as in the labhe routines (int in the first bytes, rest zero)
+ *  Inputs: key[SK_SIZE], start_label, count
+ *  Outputs: nonces[count*NONCE_SIZE]
+ *  Assumptions: all I/O pointers point to correctly allocated and disjoint regions. 
+ */
+int prf_batch_seq(unsigned char *nonces, const int start_label, const int count, const unsigned char *key) {
+	unsigned char labels[PRF_BATCH*LABEL_SIZE];
+	int i, j, c;
+
+	memset(labels, 0, sizeof(labels));
+	for (i=0;i<count;i+=PRF_BATCH) {
+		c = count - i < PRF_BATCH ? count - i : PRF_BATCH;
+		for (j=0;j<c;j++) { *(int *)(labels+j*LABEL_SIZE) = start_label + i + j; }
+		prf_batch(nonces+i*NONCE_SIZE, labels, c, key);
+	}
+
+	return 0;
+}
+
+/*  Batch PRF over a list of labels (e.g. a filtered subset of records),
+ *  encoded as in prf_batch_seq
+ *  Inputs: key[SK_SIZE], labels[count]
+ *  Outputs: nonces[count*NONCE_SIZE]
+ *  Assumptions: all I/O pointers point to correctly allocated and disjoint regions. 
+ */
+int prf_batch_list(unsigned char *nonces, const int *labels, const int count, const unsigned char *key) {
+	unsigned char buf[PRF_BATCH*LABEL_SIZE];
+	int i, j, c;
+
+	memset(buf, 0, sizeof(buf));
+	for (i=0;i<count;i+=PRF_BATCH) {
+		c = count - i < PRF_BATCH ? count - i : PRF_BATCH;
+		for (j=0;j<c;j++) { *(int *)(buf+j*LABEL_SIZE) = labels[i + j]; }
+		prf_batch(nonces+i*NONCE_SIZE, buf, c, key);
+	}
+
+	return 0;
+}
+
+/*  PRF of one label under many keys with the selected backend
+ *  (e.g. the same time slot across many encryptors)
+ *  Inputs: keys[count*SK_SIZE],label[LABEL_SIZE]
+ *  Outputs: nonces[count*NONCE_SIZE], nonce_i = PRF(key_i,label)
+ *  Assumptions: all I/O pointers point to correctly allocated and disjoint regions. 
+ */
+int prf_multi(unsigned char *nonces, const unsigned char *label, const unsigned char *keys, const int count) {
+	int i;
+
+	if (prf_current == PRF_BACKEND_AES) { return prf_aes_multi(nonces, label, keys, count); }
+	for (i=0;i<count;i++) {
+		prf_keccak(nonces+i*NONCE_SIZE, label, keys+i*SK_SIZE);
+	}
+	return 0;
+}
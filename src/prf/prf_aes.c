@@ -0,0 +1,253 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <wmmintrin.h>
+#define PRF_AESNI 1
+#endif
+
+#include "prf.h"
+
+#define AES_ROUNDS 10
+#define AES_LANES 8 // blocks in flight per AES-NI round
+
+static const unsigned char aes_sbox[256] = {
+	0x63,0x7c,0x77,0x7b,0xf2,0x6b,0x6f,0xc5,0x30,0x01,0x67,0x2b,0xfe,0xd7,0xab,0x76,
+	0xca,0x82,0xc9,0x7d,0xfa,0x59,0x47,0xf0,0xad,0xd4,0xa2,0xaf,0x9c,0xa4,0x72,0xc0,
+	0xb7,0xfd,0x93,0x26,0x36,0x3f,0xf7,0xcc,0x34,0xa5,0xe5,0xf1,0x71,0xd8,0x31,0x15,
+	0x04,0xc7,0x23,0xc3,0x18,0x96,0x05,0x9a,0x07,0x12,0x80,0xe2,0xeb,0x27,0xb2,0x75,
+	0x09,0x83,0x2c,0x1a,0x1b,0x6e,0x5a,0xa0,0x52,0x3b,0xd6,0xb3,0x29,0xe3,0x2f,0x84,
+	0x53,0xd1,0x00,0xed,0x20,0xfc,0xb1,0x5b,0x6a,0xcb,0xbe,0x39,0x4a,0x4c,0x58,0xcf,
+	0xd0,0xef,0xaa,0xfb,0x43,0x4d,0x33,0x85,0x45,0xf9,0x02,0x7f,0x50,0x3c,0x9f,0xa8,
+	0x51,0xa3,0x40,0x8f,0x92,0x9d,0x38,0xf5,0xbc,0xb6,0xda,0x21,0x10,0xff,0xf3,0xd2,
+	0xcd,0x0c,0x13,0xec,0x5f,0x97,0x44,0x17,0xc4,0xa7,0x7e,0x3d,0x64,0x5d,0x19,0x73,
+	0x60,0x81,0x4f,0xdc,0x22,0x2a,0x90,0x88,0x46,0xee,0xb8,0x14,0xde,0x5e,0x0b,0xdb,
+	0xe0,0x32,0x3a,0x0a,0x49,0x06,0x24,0x5c,0xc2,0xd3,0xac,0x62,0x91,0x95,0xe4,0x79,
+	0xe7,0xc8,0x37,0x6d,0x8d,0xd5,0x4e,0xa9,0x6c,0x56,0xf4,0xea,0x65,0x7a,0xae,0x08,
+	0xba,0x78,0x25,0x2e,0x1c,0xa6,0xb4,0xc6,0xe8,0xdd,0x74,0x1f,0x4b,0xbd,0x8b,0x8a,
+	0x70,0x3e,0xb5,0x66,0x48,0x03,0xf6,0x0e,0x61,0x35,0x57,0xb9,0x86,0xc1,0x1d,0x9e,
+	0xe1,0xf8,0x98,0x11,0x69,0xd9,0x8e,0x94,0x9b,0x1e,0x87,0xe9,0xce,0x55,0x28,0xdf,
+	0x8c,0xa1,0x89,0x0d,0xbf,0xe6,0x42,0x68,0x41,0x99,0x2d,0x0f,0xb0,0x54,0xbb,0x16
+};
+
+static const unsigned char aes_rcon[AES_ROUNDS] = {
+	0x01,0x02,0x04,0x08,0x10,0x20,0x40,0x80,0x1b,0x36
+};
+
+/*
+ * AES-128 key expansion (FIPS-197, section 5.2)
+ * Outputs: rk[(AES_ROUNDS+1)*16] round keys
+ */
+static void aes_expand(unsigned char *rk, const unsigned char *key)
+{
+	unsigned char t[4], u;
+	int i;
+
+	memcpy(rk, key, 16);
+	for (i=4;i<4*(AES_ROUNDS+1);i++) {
+		memcpy(t, rk+4*(i-1), 4);
+		if (i % 4 == 0) {
+			u = t[0];
+			t[0] = aes_sbox[t[1]] ^ aes_rcon[i/4-1];
+			t[1] = aes_sbox[t[2]];
+			t[2] = aes_sbox[t[3]];
+			t[3] = aes_sbox[u];
+		}
+		rk[4*i+0] = rk[4*(i-4)+0] ^ t[0];
+		rk[4*i+1] = rk[4*(i-4)+1] ^ t[1];
+		rk[4*i+2] = rk[4*(i-4)+2] ^ t[2];
+		rk[4*i+3] = rk[4*(i-4)+3] ^ t[3];
+	}
+}
+
+static unsigned char aes_xtime(const unsigned char x)
+{
+	return (unsigned char)((x << 1) ^ ((x >> 7) * 0x1b));
+}
+
+/*
+ * Portable AES-128 block encryption, used when AES-NI is not available
+ */
+static void aes_encrypt_sw(unsigned char *out, const unsigned char *in, const unsigned char *rk)
+{
+	unsigned char s[16], t[16], a, b, c, d, e;
+	int r, i;
+
+	for (i=0;i<16;i++) { s[i] = in[i] ^ rk[i]; }
+	for (r=1;r<=AES_ROUNDS;r++) {
+		// SubBytes + ShiftRows (state is column-major)
+		for (i=0;i<16;i++) { t[i] = aes_sbox[s[(i + 4*(i % 4)) % 16]]; }
+		if (r < AES_ROUNDS) {
+			// MixColumns
+			for (i=0;i<4;i++) {
+				a = t[4*i]; b = t[4*i+1]; c = t[4*i+2]; d = t[4*i+3];
+				e = a ^ b ^ c ^ d;
+				t[4*i+0] ^= e ^ aes_xtime(a ^ b);
+				t[4*i+1] ^= e ^ aes_xtime(b ^ c);
+				t[4*i+2] ^= e ^ aes_xtime(c ^ d);
+				t[4*i+3] ^= e ^ aes_xtime(d ^ a);
+			}
+		}
+		for (i=0;i<16;i++) { s[i] = t[i] ^ rk[16*r+i]; }
+	}
+	memcpy(out, s, 16);
+}
+
+#ifdef PRF_AESNI
+
+#define AES_NI_EXPAND(rk, r, rcon) do { \
+		__m128i t_ = _mm_aeskeygenassist_si128(rk[r-1], rcon); \
+		__m128i k_ = rk[r-1]; \
+		t_ = _mm_shuffle_epi32(t_, 0xff); \
+		k_ = _mm_xor_si128(k_, _mm_slli_si128(k_, 4)); \
+		k_ = _mm_xor_si128(k_, _mm_slli_si128(k_, 4)); \
+		k_ = _mm_xor_si128(k_, _mm_slli_si128(k_, 4)); \
+		rk[r] = _mm_xor_si128(k_, t_); \
+	} while (0)
+
+__attribute__((target("aes,sse2")))
+static void aes_expand_ni(__m128i *rk, const unsigned char *key)
+{
+	rk[0] = _mm_loadu_si128((const __m128i *)key);
+	AES_NI_EXPAND(rk, 1, 0x01);
+	AES_NI_EXPAND(rk, 2, 0x02);
+	AES_NI_EXPAND(rk, 3, 0x04);
+	AES_NI_EXPAND(rk, 4, 0x08);
+	AES_NI_EXPAND(rk, 5, 0x10);
+	AES_NI_EXPAND(rk, 6, 0x20);
+	AES_NI_EXPAND(rk, 7, 0x40);
+	AES_NI_EXPAND(rk, 8, 0x80);
+	AES_NI_EXPAND(rk, 9, 0x1b);
+	AES_NI_EXPAND(rk, 10, 0x36);
+}
+
+__attribute__((target("aes,sse2")))
+static void aes_batch_ni(unsigned char *out, const unsigned char *in, const int count, const unsigned char *key)
+{
+	__m128i rk[AES_ROUNDS+1], b[AES_LANES];
+	int i, j, r;
+
+	aes_expand_ni(rk, key);
+
+	// 8 independent blocks per round hide the aesenc latency
+	for (i=0;i+AES_LANES<=count;i+=AES_LANES) {
+		for (j=0;j<AES_LANES;j++) {
+			b[j] = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(in+16*(i+j))), rk[0]);
+		}
+		for (r=1;r<AES_ROUNDS;r++) {
+			for (j=0;j<AES_LANES;j++) { b[j] = _mm_aesenc_si128(b[j], rk[r]); }
+		}
+		for (j=0;j<AES_LANES;j++) {
+			b[j] = _mm_aesenclast_si128(b[j], rk[AES_ROUNDS]);
+			_mm_storeu_si128((__m128i *)(out+16*(i+j)), b[j]);
+		}
+	}
+
+	for (;i<count;i++) {
+		b[0] = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(in+16*i)), rk[0]);
+		for (r=1;r<AES_ROUNDS;r++) { b[0] = _mm_aesenc_si128(b[0], rk[r]); }
+		b[0] = _mm_aesenclast_si128(b[0], rk[AES_ROUNDS]);
+		_mm_storeu_si128((__m128i *)(out+16*i), b[0]);
+	}
+}
+
+__attribute__((target("aes,sse2")))
+static void aes_multi_ni(unsigned char *out, const unsigned char *in, const unsigned char *keys, const int count)
+{
+	__m128i rk[AES_LANES][AES_ROUNDS+1], b[AES_LANES], x;
+	int i, j, r, c;
+
+	x = _mm_loadu_si128((const __m128i *)in);
+
+	// 8 keys per group: expansions and encryptions are independent
+	for (i=0;i<count;i+=AES_LANES) {
+		c = count - i < AES_LANES ? count - i : AES_LANES;
+		for (j=0;j<c;j++) {
+			aes_expand_ni(rk[j], keys+SK_SIZE*(i+j));
+			b[j] = _mm_xor_si128(x, rk[j][0]);
+		}
+		for (r=1;r<AES_ROUNDS;r++) {
+			for (j=0;j<c;j++) { b[j] = _mm_aesenc_si128(b[j], rk[j][r]); }
+		}
+		for (j=0;j<c;j++) {
+			b[j] = _mm_aesenclast_si128(b[j], rk[j][AES_ROUNDS]);
+			_mm_storeu_si128((__m128i *)(out+16*(i+j)), b[j]);
+		}
+	}
+}
+
+#endif
+
+/*
+ * Non-zero if the AES backend runs on AES-NI on this machine
+ */
+int prf_aes_hw(void)
+{
+#ifdef PRF_AESNI
+	return __builtin_cpu_supports("aes");
+#else
+	return 0;
+#endif
+}
+
+/*  Batch PRF based on AES-128 keyed with the encryptor secret key
+ *  Inputs: key[SK_SIZE],labels[count*LABEL_SIZE]
+ *  Outputs: nonces[count*NONCE_SIZE]
+ *  Computes: nonce_i = AES_key(label_i)
+ *  Assumptions: all I/O pointers point to correctly allocated and disjoint regions.
+ */
+int prf_aes_batch(unsigned char *nonces, const unsigned char *labels, const int count, const unsigned char *key) {
+	unsigned char rk[16*(AES_ROUNDS+1)];
+	int i;
+
+	// The key schedule is amortized over the batch; on AES-NI it is built
+	// with aeskeygenassist, without the secret-indexed S-box lookups
+#ifdef PRF_AESNI
+	if (prf_aes_hw()) {
+		aes_batch_ni(nonces, labels, count, key);
+		return 0;
+	}
+#endif
+
+	aes_expand(rk, key);
+	for (i=0;i<count;i++) {
+		aes_encrypt_sw(nonces+i*NONCE_SIZE, labels+i*LABEL_SIZE, rk);
+	}
+
+	return 0;
+}
+
+/*  PRF based on AES-128 keyed with the encryptor secret key
+ *  Inputs: key[SK_SIZE],label[LABEL_SIZE])
+ *  Outputs: nonce[NONCE_SIZE]
+ *  Computes: nonce = AES_key(label)
+ *  Assumptions: all I/O pointers point to correctly allocated and disjoint regions.
+ */
+int prf_aes(unsigned char *nonce, const unsigned char *label, const unsigned char *key) {
+	return prf_aes_batch(nonce, label, 1, key);
+}
+
+/*  AES-128 PRF of one label under many keys
+ *  Inputs: keys[count*SK_SIZE],label[LABEL_SIZE]
+ *  Outputs: nonces[count*NONCE_SIZE], nonce_i = AES_{key_i}(label)
+ *  Assumptions: all I/O pointers point to correctly allocated and disjoint regions.
+ */
+int prf_aes_multi(unsigned char *nonces, const unsigned char *label, const unsigned char *keys, const int count) {
+	unsigned char rk[16*(AES_ROUNDS+1)];
+	int i;
+
+#ifdef PRF_AESNI
+	if (prf_aes_hw()) {
+		aes_multi_ni(nonces, label, keys, count);
+		return 0;
+	}
+#endif
+
+	for (i=0;i<count;i++) {
+		aes_expand(rk, keys+i*SK_SIZE);
+		aes_encrypt_sw(nonces+i*NONCE_SIZE, label, rk);
+	}
+
+	return 0;
+}
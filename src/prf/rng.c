@@ -0,0 +1,175 @@
+#include <gmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "KeccakPRGWidth1600.h"
+
+#include "rng.h"
+
+#define RNG_DOMAIN_COUNTER 1
+#define RNG_DOMAIN_LABEL 2
+
+// Extra bytes drawn so that reduction mod n is statistically uniform
+#define RNG_SLACK 16
+
+static void rng_put64(unsigned char *b, uint64_t v)
+{
+	int i;
+
+	for (i=7;i>=0;i--) {
+		b[i] = v & 0xff;
+		v >>= 8;
+	}
+}
+
+/*
+ * Start a sponge absorbing (seed, domain, stream, index)
+ */
+static void rng_sponge(KeccakWidth1600_SpongePRG_Instance *instance, const labhe_rng *rng,
+	                   const unsigned char domain, const uint64_t index)
+{
+	unsigned char buf[17];
+
+	buf[0] = domain;
+	rng_put64(buf+1, rng->stream);
+	rng_put64(buf+9, index);
+
+	KeccakWidth1600_SpongePRG_Initialize(instance, 254);
+	KeccakWidth1600_SpongePRG_Feed(instance, rng->seed, RNG_SEED_SIZE);
+	KeccakWidth1600_SpongePRG_Feed(instance, buf, sizeof(buf));
+}
+
+static void rng_fetch(KeccakWidth1600_SpongePRG_Instance *instance, unsigned char *out, size_t len)
+{
+	unsigned int chunk;
+
+	while (len > 0) {
+		chunk = (len > (1U<<30)) ? (1U<<30) : (unsigned int)len;
+		KeccakWidth1600_SpongePRG_Fetch(instance, out, chunk);
+		out += chunk;
+		len -= chunk;
+	}
+}
+
+/*
+ * Randomness source seeded from /dev/urandom
+ * Outputs: rng on stream 0
+ */
+int rng_init(labhe_rng *rng)
+{
+	FILE *fp;
+	unsigned char seed[RNG_SEED_SIZE];
+
+	fp = fopen("/dev/urandom", "r");
+	if (!fp) { return 1; }
+
+	if (fread(seed, RNG_SEED_SIZE, 1, fp) != 1)  { 
+		fclose(fp);
+		return 1; 
+	}
+	if (fclose(fp)) { return 1; }
+
+	return rng_init_seed(rng, seed);
+}
+
+/*
+ * Randomness source from a caller-supplied seed[RNG_SEED_SIZE]
+ * Outputs: rng on stream 0
+ */
+int rng_init_seed(labhe_rng *rng, const unsigned char *seed)
+{
+	memcpy(rng->seed, seed, RNG_SEED_SIZE);
+	rng->stream = 0;
+	rng->counter = 0;
+	return 0;
+}
+
+/*
+ * Independent stream sharing the parent's seed (e.g. one per thread)
+ * Assumptions: each stream identifier is used by a single owner
+ */
+int rng_fork(labhe_rng *child, const labhe_rng *parent, const uint64_t stream)
+{
+	memcpy(child->seed, parent->seed, RNG_SEED_SIZE);
+	child->stream = stream;
+	child->counter = 0;
+	return 0;
+}
+
+/*
+ * Next len pseudorandom bytes of the stream (one counter block)
+ */
+int rng_bytes(labhe_rng *rng, unsigned char *out, const size_t len)
+{
+	KeccakWidth1600_SpongePRG_Instance instance;
+
+	rng_sponge(&instance, rng, RNG_DOMAIN_COUNTER, rng->counter++);
+	rng_fetch(&instance, out, len);
+	return 0;
+}
+
+/*
+ * Uniform random integer 0 <= x < n from the next counter block
+ * Assumptions: all I/O pointers are allocated and initialized by caller
+ */
+int rng_urandomm(mpz_t x, labhe_rng *rng, const mpz_t n)
+{
+	return rng_urandomm_batch((mpz_t *)x, 1, rng, n);
+}
+
+/*
+ * #count uniform random integers 0 <= x[] < n squeezed from a single
+ * counter block (one sponge for the whole batch)
+ * Assumptions: all I/O pointers are allocated and initialized by caller
+ */
+int rng_urandomm_batch(mpz_t *x, const int count, labhe_rng *rng, const mpz_t n)
+{
+	KeccakWidth1600_SpongePRG_Instance instance;
+	unsigned char *buf;
+	size_t len;
+	int i;
+
+	len = (mpz_sizeinbase(n,2)+7)/8 + RNG_SLACK;
+	buf = (unsigned char *)malloc(len);
+	if (!buf) { return 1; }
+
+	rng_sponge(&instance, rng, RNG_DOMAIN_COUNTER, rng->counter++);
+	for (i=0;i<count;i++) {
+		rng_fetch(&instance, buf, len);
+		mpz_import(x[i], len, 1, 1, 0, 0, buf);
+		mpz_mod(x[i], x[i], n);
+	}
+
+	memset(buf, 0, len);
+	free(buf);
+	return 0;
+}
+
+/*
+ * Uniform random integer 0 <= x < n bound to a label of the stream;
+ * does not modify rng, so threads can share it when they use disjoint
+ * labels.
+ * Assumptions: 
+ *   - each (stream, label) pair is used for a single encryption
+ *   - all I/O pointers are allocated and initialized by caller
+ */
+int rng_urandomm_label(mpz_t x, const labhe_rng *rng, const int label, const mpz_t n)
+{
+	KeccakWidth1600_SpongePRG_Instance instance;
+	unsigned char *buf;
+	size_t len;
+
+	len = (mpz_sizeinbase(n,2)+7)/8 + RNG_SLACK;
+	buf = (unsigned char *)malloc(len);
+	if (!buf) { return 1; }
+
+	rng_sponge(&instance, rng, RNG_DOMAIN_LABEL, (uint64_t)(uint32_t)label);
+	rng_fetch(&instance, buf, len);
+	mpz_import(x, len, 1, 1, 0, 0, buf);
+	mpz_mod(x, x, n);
+
+	memset(buf, 0, len);
+	free(buf);
+	return 0;
+}
@@ -0,0 +1,475 @@
+#include <gmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "bench.h"
+#include "mexp.h"
+#include "mont.h"
+#include "bhjl.h"
+#include "labhe.h"
+#include "tune.h"
+
+#define TUNE_TRIALS 3         // best of, for every measurement
+#define TUNE_ENC_OPS 8
+#define TUNE_DEC_OPS 2
+#define TUNE_HOMMUL_COUNT 8
+#define TUNE_PROD_COUNT 256
+#define TUNE_MULTI_COUNT 2048 // largest multi-exponentiation timed
+#define TUNE_TABLE_USES 8
+#define TUNE_WORKER_OPS 16    // exponentiations per thread in the scaling test
+#define TUNE_WORKER_GAIN 1.25 // minimum throughput gain to add threads
+
+static labhe_tune tune_profile;
+static int tune_active = 0;
+
+/*
+ * Install a tuning profile for the batch routines
+ * Inputs: profile t, or NULL to go back to the built-in cost models
+ * Outputs: 0 on success, 1 if the profile is malformed
+ */
+int tune_set(const labhe_tune *t)
+{
+	int i;
+
+	if (!t) {
+		tune_active = 0;
+		return 0;
+	}
+	if (t->k < 1 || t->nlimbs < 1 || t->plimbs < 1 || t->workers < 1 ||
+	    t->dec_digit < 1 || t->dec_digit > TUNE_MAX_DIGIT) { return 1; }
+	for (i=0;i<TUNE_MULTI_CLASSES;i++) {
+		if (t->multi_window[i] < 0 || t->multi_window[i] > 16) { return 1; }
+	}
+	tune_profile = *t;
+	tune_active = 1;
+	return 0;
+}
+
+/*
+ * Active tuning profile, NULL if none
+ */
+const labhe_tune *tune_get(void)
+{
+	return tune_active ? &tune_profile : NULL;
+}
+
+/*
+ * Whether operation op on modulus m should use the Montgomery kernels
+ * (always, unless the active profile measured GMP to be faster for a
+ * modulus of this size)
+ */
+int tune_mont(const int op, const mpz_t m)
+{
+	int limbs;
+
+	if (!tune_active || op < 0 || op >= TUNE_MONT_OPS) { return 1; }
+	limbs = (op == TUNE_MONT_DECRYPT) ? tune_profile.plimbs : tune_profile.nlimbs;
+	if ((int)mpz_size(m) != limbs) { return 1; }
+	return tune_profile.mont[op];
+}
+
+/*
+ * Digit width of the discrete logarithm in BHJL decryption: from the
+ * active profile, else the width minimizing the estimated number of
+ * multiplications k(k-w)/(2w) squarings + 2^w table entries + k/w
+ * table scans (counted as 2^w/8)
+ */
+int tune_dec_digit(const int k)
+{
+	int w, best = 1;
+	double cost, best_cost = -1;
+
+	if (tune_active && tune_profile.k == k) { return tune_profile.dec_digit; }
+	for (w=1;w<=TUNE_MAX_DIGIT && w<=k;w++) {
+		cost = (double)k*(k-w)/(2.0*w) + (double)(1<<w) + (double)((k+w-1)/w)*(1<<w)/8.0;
+		if (best_cost < 0 || cost < best_cost) {
+			best = w;
+			best_cost = cost;
+		}
+	}
+	return best;
+}
+
+static int tune_class(const int count)
+{
+	int c;
+	long long lim = 4;
+
+	for (c=0;c<TUNE_MULTI_CLASSES;c++, lim*=4) {
+		if (count <= lim) { return c; }
+	}
+	return -1;
+}
+
+/*
+ * Pippenger window for count exponents of bits bits from the active
+ * profile (calibrated with k-bit exponents, used for k/2..2k bits)
+ * Outputs: window width, 0 to use the cost model
+ */
+int tune_multi_window(const int count, const int bits)
+{
+	int c;
+
+	if (!tune_active || 2*bits < tune_profile.k || bits > 2*tune_profile.k) { return 0; }
+	c = tune_class(count);
+	return (c < 0) ? 0 : tune_profile.multi_window[c];
+}
+
+/*
+ * Fixed-base table window for bits-bit exponents and uses
+ * exponentiations, minimizing the measured build + uses*use cycles
+ * Outputs: window width, 0 to use the cost model
+ */
+int tune_table_window(const int bits, const int uses)
+{
+	int w, best = 0;
+	double cost, best_cost = -1;
+
+	if (!tune_active || bits != tune_profile.k) { return 0; }
+	for (w=1;w<=TUNE_MAX_WINDOW;w++) {
+		if (tune_profile.table_use[w] <= 0) { return 0; }
+		cost = tune_profile.table_build[w] + (double)uses*tune_profile.table_use[w];
+		if (best_cost < 0 || cost < best_cost) {
+			best = w;
+			best_cost = cost;
+		}
+	}
+	return best;
+}
+
+/*
+ * Threads for sharded jobs: from the active profile, 1 without one
+ */
+int tune_workers(void)
+{
+	return tune_active ? tune_profile.workers : 1;
+}
+
+/*
+ * Profile file next to a key-store file: <prefix>.tune for
+ * <prefix>.pub/<prefix>.sec, else <path>.tune
+ * Outputs: 0 on success, 1 if buf is too small
+ */
+int tune_path(char *buf, const size_t size, const char *keystore_path)
+{
+	size_t len = strlen(keystore_path);
+
+	if (len >= 4 && (strcmp(keystore_path+len-4, ".pub") == 0 ||
+	                 strcmp(keystore_path+len-4, ".sec") == 0)) {
+		len -= 4;
+	}
+	if (len + 6 > size) { return 1; }
+	memcpy(buf, keystore_path, len);
+	strcpy(buf+len, ".tune");
+	return 0;
+}
+
+/*
+ * Save a profile as key=value text lines
+ */
+int tune_save(const char *path, const labhe_tune *t)
+{
+	FILE *fp;
+	int i;
+
+	fp = fopen(path, "w");
+	if (!fp) { return 1; }
+	fprintf(fp, "k=%d\nnlimbs=%d\nplimbs=%d\ndec_digit=%d\n", t->k, t->nlimbs, t->plimbs, t->dec_digit);
+	fprintf(fp, "multi_window=");
+	for (i=0;i<TUNE_MULTI_CLASSES;i++) { fprintf(fp, "%s%d", i ? "," : "", t->multi_window[i]); }
+	fprintf(fp, "\ntable_build=");
+	for (i=1;i<=TUNE_MAX_WINDOW;i++) { fprintf(fp, "%s%.0f", i>1 ? "," : "", t->table_build[i]); }
+	fprintf(fp, "\ntable_use=");
+	for (i=1;i<=TUNE_MAX_WINDOW;i++) { fprintf(fp, "%s%.0f", i>1 ? "," : "", t->table_use[i]); }
+	fprintf(fp, "\nmont=");
+	for (i=0;i<TUNE_MONT_OPS;i++) { fprintf(fp, "%s%d", i ? "," : "", t->mont[i]); }
+	fprintf(fp, "\nworkers=%d\n", t->workers);
+
+	return fclose(fp) ? 1 : 0;
+}
+
+/*
+ * Comma-separated list of count numbers
+ */
+static int tune_list(const char *s, double *v, const int count)
+{
+	char *end;
+	int i;
+
+	for (i=0;i<count;i++) {
+		v[i] = strtod(s, &end);
+		if (end == s) { return 1; }
+		s = end;
+		if (i < count-1) {
+			if (*s != ',') { return 1; }
+			s++;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Load a profile saved by tune_save (does not install it)
+ */
+int tune_load(labhe_tune *t, const char *path)
+{
+	FILE *fp;
+	char *line = NULL, *eq, *nl;
+	size_t cap = 0;
+	double v[TUNE_MAX_WINDOW+TUNE_MULTI_CLASSES];
+	int i, found = 0, bad = 0;
+
+	fp = fopen(path, "r");
+	if (!fp) { return 1; }
+
+	memset(t, 0, sizeof(labhe_tune));
+	while (getline(&line, &cap, fp) > 0) {
+		eq = strchr(line, '=');
+		if (!eq) { continue; }
+		*eq++ = 0;
+		nl = strchr(eq, '\n');
+		if (nl) { *nl = 0; }
+		if (strcmp(line, "k") == 0) { t->k = atoi(eq); found |= 1; }
+		else if (strcmp(line, "nlimbs") == 0) { t->nlimbs = atoi(eq); found |= 2; }
+		else if (strcmp(line, "plimbs") == 0) { t->plimbs = atoi(eq); found |= 4; }
+		else if (strcmp(line, "dec_digit") == 0) { t->dec_digit = atoi(eq); found |= 8; }
+		else if (strcmp(line, "workers") == 0) { t->workers = atoi(eq); found |= 16; }
+		else if (strcmp(line, "multi_window") == 0) {
+			bad |= tune_list(eq, v, TUNE_MULTI_CLASSES);
+			for (i=0;i<TUNE_MULTI_CLASSES;i++) { t->multi_window[i] = (int)v[i]; }
+			found |= 32;
+		} else if (strcmp(line, "table_build") == 0) {
+			bad |= tune_list(eq, t->table_build+1, TUNE_MAX_WINDOW);
+			found |= 64;
+		} else if (strcmp(line, "table_use") == 0) {
+			bad |= tune_list(eq, t->table_use+1, TUNE_MAX_WINDOW);
+			found |= 128;
+		} else if (strcmp(line, "mont") == 0) {
+			bad |= tune_list(eq, v, TUNE_MONT_OPS);
+			for (i=0;i<TUNE_MONT_OPS;i++) { t->mont[i] = (v[i] != 0); }
+			found |= 256;
+		}
+	}
+	free(line);
+	if (fclose(fp)) { return 1; }
+
+	return (found == 511 && !bad) ? 0 : 1;
+}
+
+typedef struct {
+	pthread_t thread;
+	const mpz_t *n;
+	int k;
+} tune_thread;
+
+static void *tune_worker(void *arg)
+{
+	tune_thread *th = (tune_thread *)arg;
+	mpz_t b, e;
+	int i;
+
+	mpz_init_set(b, *th->n);
+	mpz_sub_ui(b, b, 3);
+	mpz_init(e);
+	mpz_setbit(e, th->k);
+	mpz_sub_ui(e, e, 1);
+	for (i=0;i<TUNE_WORKER_OPS;i++) { mpz_powm(b, b, e, *th->n); }
+	mpz_clears(b, e, NULL);
+	return NULL;
+}
+
+/*
+ * Wall-clock seconds for w threads each running the same job
+ */
+static double tune_threads(const int w, const mpz_t n, const int k)
+{
+	tune_thread *th;
+	struct timespec t0, t1;
+	int i, started;
+
+	th = (tune_thread *)calloc(w, sizeof(tune_thread));
+	if (!th) { return -1; }
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (started=0;started<w;started++) {
+		th[started].n = (const mpz_t *)n;
+		th[started].k = k;
+		if (pthread_create(&th[started].thread, NULL, tune_worker, &th[started]) != 0) { break; }
+	}
+	for (i=0;i<started;i++) { pthread_join(th[i].thread, NULL); }
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	free(th);
+	if (started < w) { return -1; }
+
+	return (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec)/1e9;
+}
+
+/*
+ * Calibrate a tuning profile on the current host by timing every
+ * candidate strategy through the library entry points
+ * Inputs:
+ *   - BHJK parameters: n, p (NULL to time decryption with a random odd
+ *     modulus of the size of p), k
+ *   - Largest thread count to try: max_workers (< 1 for all online CPUs)
+ * Outputs:
+ *   - Profile: t (not installed; the active profile is left unchanged)
+ */
+int tune_calibrate(labhe_tune *t, const mpz_t n, const mpz_t p, const int k,
+	               const int max_workers)
+{
+	labhe_tune work, saved;
+	const labhe_tune *prev;
+	mpz_t pp, D, _2k, e1, e2, r, *bm, *c, out[TUNE_HOMMUL_COUNT];
+	mexp_table tab;
+	gmp_randstate_t st;
+	long long before, after, best, cyc[2], enc[2], mul[2], prod[2];
+	double secs, rate, best_rate;
+	int i, j, w, trial, op, model, best_w, count, maxw, rc = 0;
+
+	if (k < 1 || mpz_sgn(n) <= 0) { return 1; }
+	bm = (mpz_t *)malloc(TUNE_MULTI_COUNT*sizeof(mpz_t));
+	c = (mpz_t *)malloc(TUNE_MULTI_COUNT*sizeof(mpz_t));
+	if (!bm || !c) {
+		free(bm);
+		free(c);
+		return 1;
+	}
+	prev = tune_get();
+	if (prev) { saved = *prev; }
+
+	mpz_inits(pp, D, _2k, e1, e2, r, NULL);
+	for (i=0;i<TUNE_MULTI_COUNT;i++) { mpz_inits(bm[i], c[i], NULL); }
+	for (i=0;i<TUNE_HOMMUL_COUNT;i++) { mpz_init(out[i]); }
+
+	// Benchmark inputs need not be secret
+	gmp_randinit_default(st);
+	gmp_randseed_ui(st, 0x4c414248);
+	if (p) {
+		mpz_set(pp, p);
+	} else {
+		mpz_urandomb(pp, st, (mpz_sizeinbase(n,2)+1)/2);
+		mpz_setbit(pp, (mpz_sizeinbase(n,2)+1)/2 - 1);
+		mpz_setbit(pp, 0);
+	}
+	mpz_urandomm(D, st, pp);
+	for (i=0;i<TUNE_MULTI_COUNT;i++) {
+		mpz_urandomb(bm[i], st, k);
+		mpz_urandomm(c[i], st, n);
+	}
+	mpz_setbit(_2k, k);
+	mpz_setbit(e1, k-1);     // 2^{k-1}
+	mpz_tdiv_q_2exp(e2, pp, k); // of the size of (p-1)/2^k
+
+	memset(&work, 0, sizeof(work));
+	work.k = k;
+	work.nlimbs = mpz_size(n);
+	work.plimbs = mpz_size(pp);
+	work.dec_digit = tune_dec_digit(k);
+	for (op=0;op<TUNE_MONT_OPS;op++) { work.mont[op] = 1; }
+	work.workers = 1;
+	if (tune_set(&work) != 0) {
+		rc = 1;
+		goto done;
+	}
+
+#define TUNE_TIME(res, body) \
+	for (res=-1,trial=0;trial<TUNE_TRIALS;trial++) { \
+		before = cpucycles(); \
+		body; \
+		after = cpucycles(); \
+		if (res < 0 || after-before < res) { res = after-before; } \
+	}
+
+	// Montgomery kernels against GMP (kept unless GMP is faster)
+	for (j=0;j<2;j++) {
+		work.mont[TUNE_MONT_ENCRYPT] = work.mont[TUNE_MONT_HOMMUL] = work.mont[TUNE_MONT_PROD] = j;
+		tune_set(&work);
+		TUNE_TIME(enc[j], for (i=0;i<TUNE_ENC_OPS;i++) { bhjl_encrypt_x(r,bm[i],c[i],n,c[TUNE_ENC_OPS],k,_2k); });
+		TUNE_TIME(mul[j], labhe_hommul_lev0_batch(out,(const mpz_t *)bm,(const mpz_t *)c,
+		                                          (const mpz_t *)bm+TUNE_HOMMUL_COUNT,(const mpz_t *)c+TUNE_HOMMUL_COUNT,
+		                                          TUNE_HOMMUL_COUNT,n,k,c[2*TUNE_HOMMUL_COUNT]));
+		TUNE_TIME(prod[j], labhe_homadd_lev1_batch(r,(const mpz_t *)c,TUNE_PROD_COUNT,n));
+	}
+	work.mont[TUNE_MONT_ENCRYPT] = (enc[1] <= enc[0]);
+	work.mont[TUNE_MONT_HOMMUL] = (mul[1] <= mul[0]);
+	work.mont[TUNE_MONT_PROD] = (prod[1] <= prod[0]);
+
+	// Decryption: GMP, or Montgomery kernels with each digit width
+	work.mont[TUNE_MONT_DECRYPT] = 0;
+	tune_set(&work);
+	TUNE_TIME(best, for (i=0;i<TUNE_DEC_OPS;i++) { bhjl_decrypt(r,c[i],pp,D,k,e1,e2); });
+	best_w = 0;
+	work.mont[TUNE_MONT_DECRYPT] = 1;
+	for (w=1;w<=TUNE_MAX_DIGIT && w<=k;w++) {
+		work.dec_digit = w;
+		tune_set(&work);
+		TUNE_TIME(cyc[0], for (i=0;i<TUNE_DEC_OPS;i++) { bhjl_decrypt(r,c[i],pp,D,k,e1,e2); });
+		if (cyc[0] < best) {
+			best = cyc[0];
+			best_w = w;
+		}
+	}
+	work.mont[TUNE_MONT_DECRYPT] = (best_w > 0);
+	work.dec_digit = best_w ? best_w : tune_dec_digit(k);
+
+	// Fixed-base tables: build and per-use cost of each window width
+	for (w=1;w<=TUNE_MAX_WINDOW;w++) {
+		TUNE_TIME(cyc[0], rc |= mexp_table_init(&tab,c[0],k,w,n); if (trial < TUNE_TRIALS-1) { mexp_table_clear(&tab); });
+		TUNE_TIME(cyc[1], for (i=0;i<TUNE_TABLE_USES;i++) { mexp_table_powm(r,&tab,bm[i],n); });
+		mexp_table_clear(&tab);
+		work.table_build[w] = (double)cyc[0];
+		work.table_use[w] = (double)(cyc[1]/TUNE_TABLE_USES);
+	}
+
+	// Pippenger windows around the cost model, one count per class
+	// (larger classes keep the model)
+	for (j=0;j<TUNE_MULTI_CLASSES && (2<<(2*j)) <= TUNE_MULTI_COUNT;j++) {
+		count = 2 << (2*j);
+		tune_set(&work);
+		model = mexp_multi_window(count, k);
+		best = -1;
+		best_w = model;
+		for (w=(model > 2 ? model-2 : 1);w<=model+2;w++) {
+			work.multi_window[j] = w;
+			tune_set(&work);
+			TUNE_TIME(cyc[0], mexp_powm_multi(r,(const mpz_t *)c,(const mpz_t *)bm,count,n));
+			if (best < 0 || cyc[0] < best) {
+				best = cyc[0];
+				best_w = w;
+			}
+		}
+		work.multi_window[j] = best_w;
+	}
+#undef TUNE_TIME
+
+	// Threads: double while the throughput keeps improving
+	maxw = (max_workers > 0) ? max_workers : (int)sysconf(_SC_NPROCESSORS_ONLN);
+	if (maxw < 1) { maxw = 1; }
+	best_rate = -1;
+	for (w=1;;w=(2*w > maxw) ? maxw : 2*w) {
+		secs = tune_threads(w, n, k);
+		if (secs <= 0) { break; }
+		rate = w/secs;
+		if (best_rate < 0 || rate > best_rate*TUNE_WORKER_GAIN) {
+			best_rate = rate;
+			work.workers = w;
+		}
+		if (w >= maxw) { break; }
+	}
+
+	*t = work;
+
+done:
+	tune_set(prev ? &saved : NULL);
+	gmp_randclear(st);
+	for (i=0;i<TUNE_MULTI_COUNT;i++) { mpz_clears(bm[i], c[i], NULL); }
+	for (i=0;i<TUNE_HOMMUL_COUNT;i++) { mpz_clear(out[i]); }
+	mpz_clears(pp, D, _2k, e1, e2, r, NULL);
+	free(bm);
+	free(c);
+
+	return rc;
+}
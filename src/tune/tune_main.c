@@ -0,0 +1,61 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <gmp.h>
+
+#include "keystore.h"
+#include "tune.h"
+
+/*
+ * labhe-tune: calibrate the tuning profile of a key store
+ * Usage: labhe-tune <public key-store file> [secret key-store file] [max workers]
+ * Times the candidate algorithms for the stored parameters on this host
+ * and saves the profile next to the key-store files (see tune_path),
+ * where keystore_load_public/keystore_load_secret pick it up. Without
+ * the secret file, decryption is timed with a modulus of the size of p.
+ */
+int main(int argc, char* argv[])
+{
+	keystore_pub kp;
+	keystore_sec ks;
+	labhe_tune t;
+	char path[1024];
+	int i, have_sec = 0, max_workers;
+
+	if (argc < 2) {
+		fprintf(stderr,"usage: %s <public key store> [secret key store] [max workers]\n",argv[0]);
+		exit(1);
+	}
+	if (keystore_load_public(&kp,argv[1]) != 0) {
+		fprintf(stderr,"cannot load %s\n",argv[1]);
+		exit(1);
+	}
+	if (argc > 2) {
+		if (keystore_load_secret(&ks,argv[2]) != 0 || ks.k != kp.k) {
+			fprintf(stderr,"cannot load %s\n",argv[2]);
+			exit(1);
+		}
+		have_sec = 1;
+	}
+	max_workers = (argc > 3) ? atoi(argv[3]) : 0;
+	if (tune_path(path,sizeof(path),argv[1]) != 0) { exit(1); }
+
+	// Calibrate from the built-in defaults, not a previous profile
+	tune_set(NULL);
+	if (tune_calibrate(&t,kp.n,have_sec ? ks.p : NULL,kp.k,max_workers) != 0 ||
+	    tune_save(path,&t) != 0) {
+		fprintf(stderr,"calibration failed\n");
+		exit(1);
+	}
+
+	fprintf(stdout,"%s: k=%d, decryption digit %d, %d workers\n",path,t.k,t.dec_digit,t.workers);
+	fprintf(stdout,"Montgomery kernels (encrypt, decrypt, hommul, products): %d %d %d %d\n",
+	        t.mont[TUNE_MONT_ENCRYPT],t.mont[TUNE_MONT_DECRYPT],t.mont[TUNE_MONT_HOMMUL],t.mont[TUNE_MONT_PROD]);
+	fprintf(stdout,"multi-exponentiation windows:");
+	for (i=0;i<TUNE_MULTI_CLASSES;i++) { fprintf(stdout," %d",t.multi_window[i]); }
+	fprintf(stdout,"\n");
+
+	keystore_close_public(&kp);
+	if (have_sec) { keystore_close_secret(&ks); }
+
+	exit(0);
+}
@@ -1,20 +1,28 @@
 #include <stdlib.h> 
 #include <stdio.h>
+#include <string.h>
 #include <gmp.h>
 
 #include "bhjl.h"
 #include "bhjl_gen.h"
+#include "tune.h"
 #include "bench.h"
 
+#define BATCH 13
+
 int main(int argc, char* argv[])
 {
 	mpz_t p, n, y, D,msg1, cph1, msg2, cph2, msgp, cpha, msga, aux, seed, _2k,_2k1,pm12k;
 	long long before, after;
-	int l, k;
+	mpz_t ms[BATCH], xs[BATCH], cs[BATCH], ds[BATCH];
+	mpz_t *Dpow;
+	labhe_tune t;
+	int l, k, i, j;
 	FILE *fp;
 	unsigned char rand_buff[16];
 
 	mpz_inits(p, n, y, D,msg1, cph1, msg2, cph2, msgp, cpha, msga, aux, seed, _2k,_2k1,pm12k,NULL);
+	for (i=0;i<BATCH;i++) { mpz_inits(ms[i],xs[i],cs[i],ds[i],NULL); }
 
 
 	fp = fopen("/dev/urandom", "r");
@@ -132,6 +140,70 @@ int main(int argc, char* argv[])
 		printf("OK!\n");
 	}
 
+	// Batches on the batch exponentiation backend, against single calls
+	for (i=0;i<BATCH;i++) {
+		mpz_urandomb(ms[i],gmpRandState,k);
+		mpz_urandomm(xs[i],gmpRandState,n);
+	}
+	before=cpucycles();
+	bhjl_encrypt_x_batch(cs,(const mpz_t *)ms,(const mpz_t *)xs,BATCH,n,y,k,_2k);
+	after=cpucycles();
+	fprintf(stdout,"\n\nBatch encrypt cycles/op=%lld\n",(after-before)/BATCH);
+	before=cpucycles();
+	i = bhjl_decrypt_batch(ds,(const mpz_t *)cs,BATCH,p,D,NULL,k,_2k1,pm12k);
+	after=cpucycles();
+	if (i != 0) {
+		printf("Error.\n");
+		exit(1);
+	}
+	fprintf(stdout,"Batch decrypt cycles/op=%lld\n\n",(after-before)/BATCH);
+	for (i=0;i<BATCH;i++) {
+		bhjl_encrypt_x(cph1,ms[i],xs[i],n,y,k,_2k);
+		if (mpz_cmp(cph1,cs[i])!=0 || mpz_cmp(ds[i],ms[i])!=0) {
+			printf("Error.\n");
+			exit(1);
+		}
+	}
+
+	// A ciphertext outside the group (0 mod p) has no logarithm, on the
+	// Montgomery kernels and on the GMP path (profile t)
+	Dpow = (mpz_t *)malloc(k*sizeof(mpz_t));
+	if (!Dpow) { exit(1); }
+	mpz_init_set(Dpow[0],D);
+	for (i=1;i<k;i++) {
+		mpz_init(Dpow[i]);
+		mpz_powm_ui(Dpow[i],Dpow[i-1],2,p);
+	}
+	memset(&t,0,sizeof(t));
+	t.k = k;
+	t.nlimbs = (int)mpz_size(n);
+	t.plimbs = (int)mpz_size(p);
+	t.dec_digit = 1;
+	t.workers = 1;
+	for (i=0;i<TUNE_MONT_OPS;i++) { t.mont[i] = 1; }
+	t.mont[TUNE_MONT_DECRYPT] = 0;
+	mpz_set(cs[3],p);
+	for (j=0;j<2;j++) {
+		if (j == 1 && tune_set(&t) != 0) { exit(1); }
+		if (bhjl_decrypt_batch(ds,(const mpz_t *)cs,BATCH,p,D,NULL,k,_2k1,pm12k) == 0 ||
+		    bhjl_decrypt_batch(ds,(const mpz_t *)cs,BATCH,p,D,(const mpz_t *)Dpow,k,_2k1,pm12k) == 0 ||
+		    bhjl_decrypt(msgp,cs[3],p,D,k,_2k1,pm12k) == 0 ||
+		    bhjl_decrypt_tab(msgp,cs[3],p,(const mpz_t *)Dpow,k,_2k1,pm12k) == 0) {
+			printf("Error.\n");
+			exit(1);
+		}
+		if (bhjl_decrypt(msgp,cs[0],p,D,k,_2k1,pm12k) != 0 || mpz_cmp(msgp,ms[0]) != 0 ||
+		    bhjl_decrypt_tab(msgp,cs[1],p,(const mpz_t *)Dpow,k,_2k1,pm12k) != 0 || mpz_cmp(msgp,ms[1]) != 0) {
+			printf("Error.\n");
+			exit(1);
+		}
+	}
+	tune_set(NULL);
+	for (i=0;i<k;i++) { mpz_clear(Dpow[i]); }
+	free(Dpow);
+	printf("OK!\n");
+
+	for (i=0;i<BATCH;i++) { mpz_clears(ms[i],xs[i],cs[i],ds[i],NULL); }
     mpz_clears(p, n, y, D,msg1, cph1, msg2, cph2, msgp, cpha, msga, aux, seed, _2k,_2k1,pm12k,NULL);
     gmp_randclear(gmpRandState);
 
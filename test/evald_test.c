@@ -0,0 +1,196 @@
+#include <stdlib.h> 
+#include <stdio.h>
+#include <unistd.h>
+#include <gmp.h>
+
+#include "prf.h"
+#include "bench.h"
+#include "labhe.h"
+#include "labhe_gen.h"
+#include "evald.h"
+
+#define COUNT 64
+#define CLIENTS 2
+
+static void check(int cond)
+{
+	if (!cond) {
+		printf("Error.\n");
+		exit(1);
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	mpz_t p, n, y, D,seed,pk1,pk2,_2k,_2k1,pm12k, enc1, n2, enc12, t1, mp, b, m;
+	long long before, after;
+	int l, k, k2, i, j, fd[CLIENTS], status, level;
+	uint32_t job, cnt;
+	uint64_t compute_ns;
+	FILE *fp;
+	unsigned char rand_buff[16];
+	unsigned char sk1[SK_SIZE];
+	unsigned char sk2[SK_SIZE];
+	char path[64], params[64];
+	mpz_t b_masks1[COUNT], eb_masks1[COUNT], cs1[COUNT], ms1[COUNT];
+	mpz_t b_masks2[COUNT], eb_masks2[COUNT], cs2[COUNT], ms2[COUNT];
+	mpz_t req[4*COUNT], sreq[2*COUNT], *res;
+	evald_frame f;
+	evald_server *srv;
+
+	mpz_inits(p, n, y, D,seed,pk1,pk2,_2k,_2k1,pm12k, enc1, n2, enc12, t1, mp, b, m, NULL);
+	for (i=0;i<COUNT;i++) {
+		mpz_inits(b_masks1[i],eb_masks1[i],cs1[i],ms1[i],b_masks2[i],eb_masks2[i],cs2[i],ms2[i],NULL);
+	}
+	for (i=0;i<4*COUNT;i++) { mpz_init(req[i]); }
+	for (i=0;i<2*COUNT;i++) { mpz_init(sreq[i]); }
+
+	fp = fopen("/dev/urandom", "r");
+	if (!fp) { exit(1); }
+
+	if (fread(rand_buff, sizeof(rand_buff), 1, fp) != 1)  { exit(1); }
+	if (fclose(fp)) { exit(1); }
+
+	mpz_import(seed, sizeof(rand_buff), 1, sizeof(rand_buff[0]), 0, 0, rand_buff);
+
+	gmp_randstate_t gmpRandState;
+	gmp_randinit_default(gmpRandState);
+	gmp_randseed(gmpRandState, seed);
+
+	l = 2048;
+	k = 128;
+
+	if (labhe_setup(p,n,y,D,l,k,_2k1,_2k,pm12k,enc1,gmpRandState)!=0) { exit(1); } 
+	if (labhe_gen(pk1,sk1,n,y,k,_2k,gmpRandState)!=0) { exit(1); } 
+	if (labhe_gen(pk2,sk2,n,y,k,_2k,gmpRandState)!=0) { exit(1); } 
+
+	for (i=0;i<COUNT;i++) {
+		mpz_urandomb(ms1[i],gmpRandState,k);
+		mpz_urandomb(ms2[i],gmpRandState,k);
+	}
+
+	labhe_encrypt_offline_batch(b_masks1,eb_masks1,0 /* start label */,COUNT,sk1,n,y,k,_2k,gmpRandState);
+	labhe_encrypt_offline_batch(b_masks2,eb_masks2,COUNT /* start label */,COUNT,sk2,n,y,k,_2k,gmpRandState);
+	labhe_encrypt_online_batch(cs1,b_masks1,ms1,COUNT,k);
+	labhe_encrypt_online_batch(cs2,b_masks2,ms2,COUNT,k);
+
+	// Public parameters as loaded by labhe-evald
+	snprintf(params,sizeof(params),"/tmp/labhe-evald-test-%d.params",(int)getpid());
+	fp = fopen(params, "w");
+	if (!fp) { exit(1); }
+	gmp_fprintf(fp,"n=0x%Zx\nk=%d\nenc1=0x%Zx\n",n,k,enc1);
+	if (fclose(fp)) { exit(1); }
+	check(evald_load_params(params,n2,&k2,enc12)==0);
+	unlink(params);
+	check(mpz_cmp(n,n2)==0 && k==k2 && mpz_cmp(enc1,enc12)==0);
+
+	snprintf(path,sizeof(path),"/tmp/labhe-evald-test-%d.sock",(int)getpid());
+	check(evald_start(&srv,path,n2,k2,enc12,NULL,2 /* workers */,2 /* depth */,stdout)==0);
+
+	for (j=0;j<CLIENTS;j++) {
+		fd[j] = evald_connect(path);
+		check(fd[j] >= 0);
+	}
+
+	for (i=0;i<COUNT;i++) {
+		mpz_set(req[4*i],cs1[i]);
+		mpz_set(req[4*i+1],eb_masks1[i]);
+		mpz_set(req[4*i+2],cs2[i]);
+		mpz_set(req[4*i+3],eb_masks2[i]);
+		mpz_set(sreq[2*i],cs1[i]);
+		mpz_set(sreq[2*i+1],eb_masks1[i]);
+	}
+
+	before=cpucycles();
+
+	// Pipeline several jobs on each connection before reading responses
+	for (j=0;j<CLIENTS;j++) {
+		f.op = EVALD_OP_INNERPROD; f.level = 0; f.status = 0; f.count = COUNT; f.compute_ns = 0;
+		f.job = 3*j;
+		check(evald_write_frame(fd[j],&f,(const mpz_t *)req,0,n,k)==0);
+		f.op = EVALD_OP_HOMMUL;
+		f.job = 3*j+1;
+		check(evald_write_frame(fd[j],&f,(const mpz_t *)req,0,n,k)==0);
+		// Sum of the first level-0 vector, as (bm,c) pairs
+		f.op = EVALD_OP_SUM;
+		f.job = 3*j+2;
+		check(evald_write_frame(fd[j],&f,(const mpz_t *)sreq,0,n,k)==0);
+	}
+
+	labhe_decrypt_offline_ip_sk(b,sk1,sk2,0,COUNT,COUNT,k,_2k1);
+	mpz_set_ui(mp,0);
+	for (i=0;i<COUNT;i++) {
+		mpz_addmul(mp,ms1[i],ms2[i]);
+	}
+	mpz_mod(mp,mp,_2k);
+
+	for (j=0;j<CLIENTS;j++) {
+		for (i=0;i<3;i++) {
+			check(evald_read_frame(fd[j],&f,&res,1,n,k)==0);
+			check(f.status == EVALD_STATUS_OK);
+			job = f.job; status = f.status; level = f.level; cnt = f.count; compute_ns = f.compute_ns;
+			fprintf(stdout,"job %u: status %d level %d count %u compute %llu ns\n",
+			        job,status,level,cnt,(unsigned long long)compute_ns);
+			switch (job%3) {
+			case 0:
+				check(level == 1 && cnt == 1);
+				labhe_decrypt_online1(m,res[0],b,p,D,k,_2k1,pm12k);
+				check(mpz_cmp(m,mp)==0);
+				break;
+			case 1:
+				check(level == 1 && cnt == COUNT);
+				labhe_homadd_lev1_batch(t1,(const mpz_t *)res,COUNT,n);
+				labhe_decrypt_online1(m,t1,b,p,D,k,_2k1,pm12k);
+				check(mpz_cmp(m,mp)==0);
+				break;
+			case 2:
+				check(level == 0 && cnt == 1);
+				labhe_decrypt_nooff0(m,res[0],res[1],p,D,k,_2k1,pm12k);
+				mpz_set_ui(t1,0);
+				for (l=0;l<COUNT;l++) { mpz_add(t1,t1,ms1[l]); }
+				mpz_mod(t1,t1,_2k);
+				check(mpz_cmp(m,t1)==0);
+				break;
+			}
+			evald_items_clear(res,cnt*evald_fields(f.op,level,1));
+		}
+	}
+
+	after=cpucycles();
+
+	fprintf(stdout,"\n\nEvaluator round trip cycles=%lld\n\n",after-before);
+
+	// Malformed request is rejected
+	f.op = EVALD_OP_HOMMUL; f.level = 1; f.job = 99; f.count = 0;
+	check(evald_write_frame(fd[0],&f,NULL,0,n,k)==0);
+	check(evald_read_frame(fd[0],&f,&res,1,n,k)==0);
+	check(f.job == 99 && f.status == EVALD_STATUS_BADREQ);
+
+	// Level-0 sums take linear (c = 0) or full ciphertexts, not a mix
+	mpz_set_ui(sreq[1],0);
+	f.op = EVALD_OP_SUM; f.level = 0; f.job = 100; f.count = COUNT;
+	check(evald_write_frame(fd[0],&f,(const mpz_t *)sreq,0,n,k)==0);
+	check(evald_read_frame(fd[0],&f,&res,1,n,k)==0);
+	check(f.job == 100 && f.status == EVALD_STATUS_BADREQ);
+	for (i=0;i<COUNT;i++) { mpz_set_ui(sreq[2*i+1],0); }
+	f.op = EVALD_OP_SUM; f.level = 0; f.job = 101; f.count = COUNT;
+	check(evald_write_frame(fd[0],&f,(const mpz_t *)sreq,0,n,k)==0);
+	check(evald_read_frame(fd[0],&f,&res,1,n,k)==0);
+	check(f.job == 101 && f.status == EVALD_STATUS_OK && f.level == 0 && f.count == 1);
+	evald_items_clear(res,evald_fields(f.op,0,1));
+
+	for (j=0;j<CLIENTS;j++) { close(fd[j]); }
+	evald_stop(srv);
+
+	printf("OK!\n");
+
+	mpz_clears(p, n, y, D,seed,pk1,pk2,_2k,_2k1,pm12k, enc1, n2, enc12, t1, mp, b, m, NULL);
+	for (i=0;i<COUNT;i++) {
+		mpz_clears(b_masks1[i],eb_masks1[i],cs1[i],ms1[i],b_masks2[i],eb_masks2[i],cs2[i],ms2[i],NULL);
+	}
+	for (i=0;i<4*COUNT;i++) { mpz_clear(req[i]); }
+	for (i=0;i<2*COUNT;i++) { mpz_clear(sreq[i]); }
+	gmp_randclear(gmpRandState);
+
+	exit(0);
+}
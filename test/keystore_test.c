@@ -0,0 +1,118 @@
+#include <stdlib.h> 
+#include <stdio.h>
+#include <unistd.h>
+#include <gmp.h>
+
+#include "bench.h"
+#include "bhjl.h"
+#include "labhe_gen.h"
+#include "prf.h"
+#include "keystore.h"
+
+static void check(int cond)
+{
+	if (!cond) {
+		printf("Error.\n");
+		exit(1);
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	mpz_t p, n, y, D, seed, _2k, _2k1, pm12k, enc1, msg, cph, msgp, t1, t2;
+	long long before, after;
+	int l, k, i;
+	FILE *fp;
+	unsigned char rand_buff[16];
+	char pub[64], sec[64];
+	keystore_pub kp;
+	keystore_sec ks;
+
+	mpz_inits(p, n, y, D, seed, _2k, _2k1, pm12k, enc1, msg, cph, msgp, t1, t2, NULL);
+
+	fp = fopen("/dev/urandom", "r");
+	if (!fp) { exit(1); }
+
+	if (fread(rand_buff, sizeof(rand_buff), 1, fp) != 1)  { exit(1); }
+	if (fclose(fp)) { exit(1); }
+
+	mpz_import(seed, sizeof(rand_buff), 1, sizeof(rand_buff[0]), 0, 0, rand_buff);
+
+	gmp_randstate_t gmpRandState;
+	gmp_randinit_default(gmpRandState);
+	gmp_randseed(gmpRandState, seed);
+
+	l = 2048;
+	k = 128;
+
+	before=cpucycles();
+	if (labhe_setup(p,n,y,D,l,k,_2k1,_2k,pm12k,enc1,gmpRandState)!=0) { exit(1); } 
+	after=cpucycles();
+
+	fprintf(stdout,"\n\nSetup cycles=%lld\n\n",after-before);
+
+	snprintf(pub,sizeof(pub),"/tmp/labhe-ks-test-%d.pub",(int)getpid());
+	snprintf(sec,sizeof(sec),"/tmp/labhe-ks-test-%d.sec",(int)getpid());
+
+	check(prf_select(PRF_BACKEND_AES)==0);
+
+	before=cpucycles();
+	check(keystore_save_public(pub,n,y,k,_2k,enc1,6)==0);
+	check(keystore_save_secret(sec,p,D,k,_2k1,pm12k)==0);
+	after=cpucycles();
+
+	fprintf(stdout,"\n\nKey store save cycles=%lld\n\n",after-before);
+
+	before=cpucycles();
+	check(keystore_load_public(&kp,pub)==0);
+	check(keystore_load_secret(&ks,sec)==0);
+	after=cpucycles();
+
+	fprintf(stdout,"\n\nKey store load cycles=%lld\n\n",after-before);
+
+	check(kp.k == k && ks.k == k);
+	check(kp.prf_backend == PRF_BACKEND_AES && ks.prf_backend == PRF_BACKEND_AES);
+	check(mpz_cmp(kp.n,n)==0 && mpz_cmp(kp.y,y)==0 && mpz_cmp(kp._2k,_2k)==0 && mpz_cmp(kp.enc1,enc1)==0);
+	check(mpz_cmp(ks.p,p)==0 && mpz_cmp(ks.D,D)==0 && mpz_cmp(ks._2k1,_2k1)==0 && mpz_cmp(ks.pm12k,pm12k)==0);
+
+	for (i=0;i<10;i++) {
+		mpz_urandomb(msg,gmpRandState,k);
+
+		mexp_table_powm(t1,&kp.enc1tab,msg,kp.n);
+		mpz_powm(t2,enc1,msg,n);
+		check(mpz_cmp(t1,t2)==0);
+
+		bhjl_encrypt_tab(cph,msg,kp.n,&kp.ytab,kp.k,kp._2k,gmpRandState);
+		bhjl_decrypt(msgp,cph,p,D,k,_2k1,pm12k);
+		check(mpz_cmp(msg,msgp)==0);
+
+		bhjl_encrypt(cph,msg,n,y,k,_2k,gmpRandState);
+		bhjl_decrypt_tab(msgp,cph,ks.p,(const mpz_t *)ks.Dpow,ks.k,ks._2k1,ks.pm12k);
+		check(mpz_cmp(msg,msgp)==0);
+	}
+
+	keystore_close_public(&kp);
+	keystore_close_secret(&ks);
+
+	// Wrong kind and corrupted files are rejected
+	check(keystore_load_secret(&ks,pub)!=0);
+
+	fp = fopen(pub, "r+b");
+	if (!fp) { exit(1); }
+	fseek(fp, 512, SEEK_SET);
+	i = fgetc(fp);
+	fseek(fp, 512, SEEK_SET);
+	fputc(i^1, fp);
+	if (fclose(fp)) { exit(1); }
+	check(keystore_load_public(&kp,pub)!=0);
+
+	unlink(pub);
+	unlink(sec);
+
+	printf("OK!\n");
+
+	mpz_clears(p, n, y, D, seed, _2k, _2k1, pm12k, enc1, msg, cph, msgp, t1, t2, NULL);
+	gmp_randclear(gmpRandState);
+
+	exit(0);
+}
@@ -0,0 +1,168 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <gmp.h>
+
+#include "labhe.h"
+#include "labhe_gen.h"
+#include "labhe_file.h"
+#include "prf.h"
+#include "test_common.h"
+
+#define COUNT 1000
+#define CHUNK 64
+#define WORKERS 4
+#define START1 0
+#define START2 COUNT
+
+static void report(const char *job, const labhe_file_stats *st)
+{
+	double secs = st->ns/1e9;
+
+	fprintf(stdout,"%s: %lld ciphertexts, %lld chunks, %.3f GB/s, %.0f ciphertexts/s\n",
+	        job,st->ciphertexts,st->chunks,st->bytes/1e9/secs,st->ciphertexts/secs);
+}
+
+int main(int argc, char* argv[])
+{
+	mpz_t p, n, y, D, seed, pk1, pk2, _2k, _2k1, pm12k, enc1, b, m, mp, bm, c, t;
+	mpz_t *b_masks1, *eb_masks1, *cs1, *ms1, *b_masks2, *eb_masks2, *cs2, *ms2, *cl1;
+	unsigned char sk1[SK_SIZE], sk2[SK_SIZE];
+	unsigned char rand_buff[16];
+	char path1[64], path2[64], path3[64], pathr[64];
+	labhe_file_writer *w1, *w2, *w3;
+	labhe_file f1, f2, f3, fr;
+	labhe_file_stats st;
+	int k, i;
+	FILE *fp;
+
+	mpz_inits(p, n, y, D, seed, pk1, pk2, _2k, _2k1, pm12k, enc1, b, m, mp, bm, c, t, NULL);
+
+	b_masks1=(mpz_t*)malloc(COUNT*sizeof(mpz_t));
+	eb_masks1=(mpz_t*)malloc(COUNT*sizeof(mpz_t));
+	cs1=(mpz_t*)malloc(COUNT*sizeof(mpz_t));
+	ms1=(mpz_t*)malloc(COUNT*sizeof(mpz_t));
+	b_masks2=(mpz_t*)malloc(COUNT*sizeof(mpz_t));
+	eb_masks2=(mpz_t*)malloc(COUNT*sizeof(mpz_t));
+	cs2=(mpz_t*)malloc(COUNT*sizeof(mpz_t));
+	ms2=(mpz_t*)malloc(COUNT*sizeof(mpz_t));
+	cl1=(mpz_t*)malloc(COUNT*sizeof(mpz_t));
+	for (i=0;i<COUNT;i++) {
+		mpz_inits(b_masks1[i],eb_masks1[i],cs1[i],ms1[i],b_masks2[i],eb_masks2[i],cs2[i],ms2[i],cl1[i],NULL);
+	}
+
+	fp = fopen("/dev/urandom", "r");
+	if (!fp) { exit(1); }
+	if (fread(rand_buff, sizeof(rand_buff), 1, fp) != 1)  { exit(1); }
+	if (fclose(fp)) { exit(1); }
+
+	mpz_import(seed, sizeof(rand_buff), 1, sizeof(rand_buff[0]), 0, 0, rand_buff);
+
+	gmp_randstate_t gmpRandState;
+	gmp_randinit_default(gmpRandState);
+	gmp_randseed(gmpRandState, seed);
+
+	k = TEST_K;
+
+	test_labhe_setup(p,n,y,D,_2k1,_2k,pm12k,enc1,pk1,sk1,pk2,sk2,gmpRandState);
+
+	for (i=0;i<COUNT;i++) {
+		mpz_urandomb(ms1[i],gmpRandState,k);
+		mpz_urandomb(ms2[i],gmpRandState,k);
+	}
+	labhe_encrypt_offline_batch(b_masks1,eb_masks1,START1,COUNT,sk1,n,y,k,_2k,gmpRandState);
+	labhe_encrypt_offline_batch(b_masks2,eb_masks2,START2,COUNT,sk2,n,y,k,_2k,gmpRandState);
+	labhe_encrypt_online_batch(cs1,b_masks1,ms1,COUNT,k);
+	labhe_encrypt_online_batch(cs2,b_masks2,ms2,COUNT,k);
+	labhe_hommul_lev0_batch(cl1,cs1,eb_masks1,cs2,eb_masks2,COUNT,n,k,enc1);
+
+	// Datasets are streamed to disk record by record
+	snprintf(path1,sizeof(path1),"/tmp/labhe-file-test-%d.1",(int)getpid());
+	snprintf(path2,sizeof(path2),"/tmp/labhe-file-test-%d.2",(int)getpid());
+	snprintf(path3,sizeof(path3),"/tmp/labhe-file-test-%d.3",(int)getpid());
+	snprintf(pathr,sizeof(pathr),"/tmp/labhe-file-test-%d.r",(int)getpid());
+	check(labhe_file_create(&w1,path1,0,START1,n,k)==0);
+	check(labhe_file_create(&w2,path2,0,START2,n,k)==0);
+	check(labhe_file_create(&w3,path3,1,START1,n,k)==0);
+	for (i=0;i<COUNT;i++) {
+		check(labhe_file_append(w1,cs1[i],eb_masks1[i])==0);
+		check(labhe_file_append(w2,cs2[i],eb_masks2[i])==0);
+		check(labhe_file_append(w3,NULL,cl1[i])==0);
+	}
+	check(labhe_file_finish(w1)==0 && labhe_file_finish(w2)==0 && labhe_file_finish(w3)==0);
+
+	check(labhe_file_open(&f1,path1)==0 && labhe_file_open(&f2,path2)==0 && labhe_file_open(&f3,path3)==0);
+	check(f1.count==COUNT && f1.level==0 && f1.k==k && f2.start_label==START2 && f3.level==1);
+	check(labhe_file_get(&f1,COUNT-1,bm,c)==0 && mpz_cmp(bm,cs1[COUNT-1])==0 && mpz_cmp(c,eb_masks1[COUNT-1])==0);
+	check(labhe_file_get(&f3,7,bm,c)==0 && mpz_cmp(c,cl1[7])==0);
+	check(labhe_file_get(&f1,COUNT,bm,c)!=0);
+
+	// Sum of a level-0 file
+	check(labhe_file_aggregate(bm,c,LABHE_AGG_SUM,&f1,NULL,n,k,enc1,CHUNK,WORKERS,&st)==0);
+	report("sum",&st);
+	check(st.ciphertexts==COUNT && st.chunks==(COUNT+CHUNK-1)/CHUNK);
+	labhe_decrypt_offline_sum0_sk(b,sk1,START1,COUNT,k);
+	labhe_decrypt_online0(m,bm,b,k);
+	mpz_set_ui(mp,0);
+	for (i=0;i<COUNT;i++) { mpz_add(mp,mp,ms1[i]); }
+	mpz_mod(mp,mp,_2k);
+	check(mpz_cmp(m,mp)==0);
+	labhe_decrypt_nooff0(m,bm,c,p,D,k,_2k1,pm12k);
+	check(mpz_cmp(m,mp)==0);
+
+	// Inner product of two files, also through a result file
+	check(labhe_file_aggregate(bm,c,LABHE_AGG_INNERPROD,&f1,&f2,n,k,enc1,CHUNK,WORKERS,&st)==0);
+	report("innerprod",&st);
+	check(labhe_file_create(&w1,pathr,1,START1,n,k)==0 && labhe_file_append(w1,NULL,c)==0 && labhe_file_finish(w1)==0);
+	check(labhe_file_open(&fr,pathr)==0 && fr.count==1 && labhe_file_get(&fr,0,NULL,t)==0);
+	labhe_file_close(&fr);
+	labhe_decrypt_offline_ip_sk(b,sk1,sk2,START1,START2,COUNT,k,_2k1);
+	labhe_decrypt_online1(m,t,b,p,D,k,_2k1,pm12k);
+	mpz_set_ui(mp,0);
+	for (i=0;i<COUNT;i++) { mpz_addmul(mp,ms1[i],ms2[i]); }
+	mpz_mod(mp,mp,_2k);
+	check(mpz_cmp(m,mp)==0);
+
+	// Sum of a level-1 file holds the same inner product (one worker)
+	check(labhe_file_aggregate(bm,c,LABHE_AGG_SUM,&f3,NULL,n,k,enc1,CHUNK,1,&st)==0);
+	report("sum (level 1)",&st);
+	labhe_decrypt_online1(m,c,b,p,D,k,_2k1,pm12k);
+	check(mpz_cmp(m,mp)==0);
+
+	// Sum of squares, with chunks that do not divide the count
+	check(labhe_file_aggregate(bm,c,LABHE_AGG_SUMSQ,&f1,NULL,n,k,enc1,CHUNK+7,WORKERS,&st)==0);
+	report("sumsq",&st);
+	labhe_decrypt_offline_ip_sk(b,sk1,sk1,START1,START1,COUNT,k,_2k1);
+	labhe_decrypt_online1(m,c,b,p,D,k,_2k1,pm12k);
+	mpz_set_ui(mp,0);
+	for (i=0;i<COUNT;i++) { mpz_addmul(mp,ms1[i],ms1[i]); }
+	mpz_mod(mp,mp,_2k);
+	check(mpz_cmp(m,mp)==0);
+
+	// Mismatched jobs and parameters are rejected
+	check(labhe_file_aggregate(bm,c,LABHE_AGG_INNERPROD,&f1,NULL,n,k,enc1,CHUNK,WORKERS,NULL)!=0);
+	check(labhe_file_aggregate(bm,c,LABHE_AGG_SUMSQ,&f3,NULL,n,k,enc1,CHUNK,WORKERS,NULL)!=0);
+	check(labhe_file_aggregate(bm,c,LABHE_AGG_SUM,&f1,NULL,n,k+1,enc1,CHUNK,WORKERS,NULL)!=0);
+	mpz_add_ui(t,n,2);
+	check(labhe_file_aggregate(bm,c,LABHE_AGG_SUM,&f1,NULL,t,k,enc1,CHUNK,WORKERS,NULL)!=0);
+
+	labhe_file_close(&f1);
+	labhe_file_close(&f2);
+	labhe_file_close(&f3);
+	unlink(path1);
+	unlink(path2);
+	unlink(path3);
+	unlink(pathr);
+
+	printf("OK!\n");
+
+	for (i=0;i<COUNT;i++) {
+		mpz_clears(b_masks1[i],eb_masks1[i],cs1[i],ms1[i],b_masks2[i],eb_masks2[i],cs2[i],ms2[i],cl1[i],NULL);
+	}
+	free(b_masks1); free(eb_masks1); free(cs1); free(ms1);
+	free(b_masks2); free(eb_masks2); free(cs2); free(ms2); free(cl1);
+	mpz_clears(p, n, y, D, seed, pk1, pk2, _2k, _2k1, pm12k, enc1, b, m, mp, bm, c, t, NULL);
+	gmp_randclear(gmpRandState);
+
+	return 0;
+}
@@ -0,0 +1,165 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include <gmp.h>
+
+#include "bench.h"
+#include "labhe.h"
+#include "labhe_gen.h"
+#include "labhe_fixed.h"
+#include "prf.h"
+#include "test_common.h"
+
+#define COUNT 1000
+#define START1 0
+#define START2 COUNT
+#define FRAC 16
+
+int main(int argc, char* argv[])
+{
+	mpz_t p, n, y, D, seed, pk1, pk2, _2k, _2k1, pm12k, enc1, b, m, mp, bmres, cres, t;
+	mpz_t *b_masks1, *eb_masks1, *cs1, *ms1, *b_masks2, *eb_masks2, *cs2, *cs3;
+	unsigned char sk1[SK_SIZE], sk2[SK_SIZE];
+	unsigned char rand_buff[16];
+	double v1[COUNT], v2[COUNT], bad[5];
+	int64_t q1[COUNT], q2[COUNT], iv[COUNT];
+	long long before, after;
+	labhe_fixed fx, fx2, fx64;
+	double sum;
+	int k, i;
+	FILE *fp;
+
+	mpz_inits(p, n, y, D, seed, pk1, pk2, _2k, _2k1, pm12k, enc1, b, m, mp, bmres, cres, t, NULL);
+
+	b_masks1=(mpz_t*)malloc(COUNT*sizeof(mpz_t));
+	eb_masks1=(mpz_t*)malloc(COUNT*sizeof(mpz_t));
+	cs1=(mpz_t*)malloc(COUNT*sizeof(mpz_t));
+	ms1=(mpz_t*)malloc(COUNT*sizeof(mpz_t));
+	b_masks2=(mpz_t*)malloc(COUNT*sizeof(mpz_t));
+	eb_masks2=(mpz_t*)malloc(COUNT*sizeof(mpz_t));
+	cs2=(mpz_t*)malloc(COUNT*sizeof(mpz_t));
+	cs3=(mpz_t*)malloc(COUNT*sizeof(mpz_t));
+	for (i=0;i<COUNT;i++) {
+		mpz_inits(b_masks1[i],eb_masks1[i],cs1[i],ms1[i],b_masks2[i],eb_masks2[i],cs2[i],cs3[i],NULL);
+	}
+
+	fp = fopen("/dev/urandom", "r");
+	if (!fp) { exit(1); }
+	if (fread(rand_buff, sizeof(rand_buff), 1, fp) != 1)  { exit(1); }
+	if (fclose(fp)) { exit(1); }
+
+	mpz_import(seed, sizeof(rand_buff), 1, sizeof(rand_buff[0]), 0, 0, rand_buff);
+
+	gmp_randstate_t gmpRandState;
+	gmp_randinit_default(gmpRandState);
+	gmp_randseed(gmpRandState, seed);
+
+	k = TEST_K;
+
+	test_labhe_setup(p,n,y,D,_2k1,_2k,pm12k,enc1,pk1,sk1,pk2,sk2,gmpRandState);
+
+	labhe_encrypt_offline_batch(b_masks1,eb_masks1,START1,COUNT,sk1,n,y,k,_2k,gmpRandState);
+	labhe_encrypt_offline_batch(b_masks2,eb_masks2,START2,COUNT,sk2,n,y,k,_2k,gmpRandState);
+
+	// Signed sensor-like readings, including exact ties
+	srand((unsigned)mpz_get_ui(seed));
+	for (i=0;i<COUNT;i++) {
+		v1[i] = (rand() - RAND_MAX/2) / 1000.0;
+		v2[i] = (rand() % 2000 - 1000) / 7.0;
+		iv[i] = (int64_t)rand() - RAND_MAX/2;
+	}
+	v1[0] = 2.5/65536; v1[1] = -2.5/65536; v1[2] = 0.0; v1[3] = -0.0;
+
+	check(labhe_fixed_init(&fx,k,FRAC)==0);
+	check(labhe_fixed_init(&fx64,k,0)==0);
+	check(labhe_fixed_init(&fx2,k,k-1)!=0);
+	fprintf(stdout,"AVX2 quantization: %s\n",labhe_fixed_simd() ? "yes" : "no");
+
+	// Quantization matches llrint, ties to even
+	check(labhe_fixed_quantize(q1,v1,COUNT,&fx)==0);
+	check(labhe_fixed_quantize(q2,v2,COUNT,&fx)==0);
+	for (i=0;i<COUNT;i++) {
+		check(q1[i]==llrint(ldexp(v1[i],FRAC)) && q2[i]==llrint(ldexp(v2[i],FRAC)));
+	}
+	check(q1[0]==2 && q1[1]==-2 && q1[2]==0 && q1[3]==0);
+
+	// Ingestion against the by-hand conversion
+	before=cpucycles();
+	for (i=0;i<COUNT;i++) {
+		mpz_set_d(ms1[i],nearbyint(ldexp(v1[i],FRAC)));
+		mpz_mod(ms1[i],ms1[i],_2k);
+	}
+	labhe_encrypt_online_batch(cs3,(const mpz_t *)b_masks1,(const mpz_t *)ms1,COUNT,k);
+	after=cpucycles();
+	fprintf(stdout,"By-hand conversion + online encryption (%d values) cycles=%lld\n",COUNT,after-before);
+	before=cpucycles();
+	check(labhe_fixed_encrypt_double(cs1,v1,(const mpz_t *)b_masks1,COUNT,&fx)==0);
+	after=cpucycles();
+	fprintf(stdout,"Fixed-point ingestion (%d values) cycles=%lld\n",COUNT,after-before);
+	for (i=0;i<COUNT;i++) { check(mpz_cmp(cs1[i],cs3[i])==0); }
+	check(labhe_fixed_encrypt_double(cs2,v2,(const mpz_t *)b_masks2,COUNT,&fx)==0);
+
+	// Sum decodes to the sum of the quantized values
+	labhe_homadd_lev0_batch(bmres,cres,(const mpz_t *)cs1,(const mpz_t *)eb_masks1,COUNT,k,n);
+	labhe_decrypt_nooff0(m,bmres,cres,p,D,k,_2k1,pm12k);
+	mpz_set_ui(mp,0);
+	for (i=0;i<COUNT;i++) {
+		mpz_set_si(t,q1[i]);
+		mpz_add(mp,mp,t);
+	}
+	labhe_fixed_decode_mpz(b,m,&fx);
+	check(mpz_cmp(b,mp)==0);
+	sum = 0;
+	for (i=0;i<COUNT;i++) { sum += ldexp((double)q1[i],-FRAC); }
+	check(fabs(labhe_fixed_decode(m,&fx) - sum) < 1e-6);
+
+	// Inner product carries 2*FRAC fractional bits
+	check(labhe_fixed_product(&fx2,&fx,&fx)==0 && fx2.frac_bits==2*FRAC);
+	labhe_innerprod_lev0(cres,(const mpz_t *)cs1,(const mpz_t *)eb_masks1,(const mpz_t *)cs2,(const mpz_t *)eb_masks2,
+	                     COUNT,n,k,enc1);
+	labhe_decrypt_offline_ip_sk(b,sk1,sk2,START1,START2,COUNT,k,_2k1);
+	labhe_decrypt_online1(m,cres,b,p,D,k,_2k1,pm12k);
+	mpz_set_ui(mp,0);
+	sum = 0;
+	for (i=0;i<COUNT;i++) {
+		mpz_set_si(t,q1[i]);
+		mpz_mul_si(t,t,q2[i]);
+		mpz_add(mp,mp,t);
+		sum += ldexp((double)q1[i],-FRAC)*ldexp((double)q2[i],-FRAC);
+	}
+	labhe_fixed_decode_mpz(b,m,&fx2);
+	check(mpz_cmp(b,mp)==0);
+	check(fabs(labhe_fixed_decode(m,&fx2) - sum) < 1e-3);
+
+	// Integer input
+	check(labhe_fixed_encrypt_int64(cs2,iv,(const mpz_t *)b_masks2,COUNT,&fx64)==0);
+	labhe_homadd_lev0_batch(bmres,cres,(const mpz_t *)cs2,(const mpz_t *)eb_masks2,COUNT,k,n);
+	labhe_decrypt_nooff0(m,bmres,cres,p,D,k,_2k1,pm12k);
+	mpz_set_ui(mp,0);
+	for (i=0;i<COUNT;i++) {
+		mpz_set_si(t,iv[i]);
+		mpz_add(mp,mp,t);
+	}
+	labhe_fixed_decode_mpz(b,m,&fx64);
+	check(mpz_cmp(b,mp)==0);
+
+	// Values that cannot be encoded are reported and encrypted as 0
+	bad[0] = NAN; bad[1] = INFINITY; bad[2] = ldexp(1.0,60); bad[3] = 1.0; bad[4] = -ldexp(1.0,LABHE_FIXED_DOUBLE_BITS-FRAC);
+	check(labhe_fixed_quantize(q1,bad,5,&fx)!=0);
+	check(q1[0]==0 && q1[1]==0 && q1[2]==0 && q1[3]==65536 && q1[4]==0);
+	check(labhe_fixed_quantize(q1,bad+3,1,&fx)==0);
+	iv[0] = INT64_MAX;
+	check(labhe_fixed_encrypt_int64(cs2,iv,(const mpz_t *)b_masks2,1,&fx)!=0 && mpz_cmp(cs2[0],b_masks2[0])==0);
+
+	printf("OK!\n");
+
+	for (i=0;i<COUNT;i++) {
+		mpz_clears(b_masks1[i],eb_masks1[i],cs1[i],ms1[i],b_masks2[i],eb_masks2[i],cs2[i],cs3[i],NULL);
+	}
+	free(b_masks1); free(eb_masks1); free(cs1); free(ms1);
+	free(b_masks2); free(eb_masks2); free(cs2); free(cs3);
+	mpz_clears(p, n, y, D, seed, pk1, pk2, _2k, _2k1, pm12k, enc1, b, m, mp, bmres, cres, t, NULL);
+	gmp_randclear(gmpRandState);
+
+	return 0;
+}
@@ -0,0 +1,201 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <gmp.h>
+
+#include "bench.h"
+#include "labhe.h"
+#include "labhe_gen.h"
+#include "labhe_group.h"
+#include "labhe_pool.h"
+#include "prf.h"
+#include "rng.h"
+#include "test_common.h"
+
+#define COUNT 3000
+#define GROUPS 200
+#define START 700
+#define FLAT_COUNT 200000
+#define FLAT_GROUPS 2000
+#define FLAT_BATCH 50000
+
+// Skewed key: half the records fall in the first tenth of the groups
+static uint64_t key_of(const int groups)
+{
+	int g = (rand() % 2) ? rand() % (groups/10) : rand() % groups;
+
+	return (uint64_t)g * 0x100000001ULL + 17;
+}
+
+int main(int argc, char* argv[])
+{
+	mpz_t p, n, y, D, seed, pk1, _2k, _2k1, pm12k, enc1, bm, c, t;
+	mpz_t *b_masks, *eb_masks, *cs, *ms, *sums, *prods, *res, *flat_b, *flat_bm;
+	unsigned char sk[SK_SIZE];
+	unsigned char rand_buff[16];
+	uint64_t *keys, key, prev;
+	int *labels, *counts;
+	long long before, after, records, cycles;
+	labhe_group gs, gm;
+	labhe_pool *pool;
+	labhe_rng rng;
+	int k, i, s;
+	long long j;
+	FILE *fp;
+
+	mpz_inits(p, n, y, D, seed, pk1, _2k, _2k1, pm12k, enc1, bm, c, t, NULL);
+
+	b_masks=(mpz_t*)malloc(COUNT*sizeof(mpz_t));
+	eb_masks=(mpz_t*)malloc(COUNT*sizeof(mpz_t));
+	cs=(mpz_t*)malloc(COUNT*sizeof(mpz_t));
+	ms=(mpz_t*)malloc(COUNT*sizeof(mpz_t));
+	sums=(mpz_t*)malloc(FLAT_GROUPS*sizeof(mpz_t));
+	prods=(mpz_t*)malloc(FLAT_GROUPS*sizeof(mpz_t));
+	res=(mpz_t*)malloc(FLAT_GROUPS*sizeof(mpz_t));
+	flat_b=(mpz_t*)malloc(FLAT_BATCH*sizeof(mpz_t));
+	flat_bm=(mpz_t*)malloc(FLAT_BATCH*sizeof(mpz_t));
+	keys=(uint64_t*)malloc(FLAT_COUNT*sizeof(uint64_t));
+	labels=(int*)malloc(FLAT_COUNT*sizeof(int));
+	counts=(int*)calloc(FLAT_GROUPS,sizeof(int));
+	for (i=0;i<COUNT;i++) { mpz_inits(b_masks[i],eb_masks[i],cs[i],ms[i],NULL); }
+	for (i=0;i<FLAT_GROUPS;i++) { mpz_inits(sums[i],prods[i],res[i],NULL); }
+	for (i=0;i<FLAT_BATCH;i++) { mpz_inits(flat_b[i],flat_bm[i],NULL); }
+
+	fp = fopen("/dev/urandom", "r");
+	if (!fp) { exit(1); }
+	if (fread(rand_buff, sizeof(rand_buff), 1, fp) != 1)  { exit(1); }
+	if (fclose(fp)) { exit(1); }
+
+	mpz_import(seed, sizeof(rand_buff), 1, sizeof(rand_buff[0]), 0, 0, rand_buff);
+	srand((unsigned)rand_buff[0] | (unsigned)rand_buff[1] << 8);
+
+	gmp_randstate_t gmpRandState;
+	gmp_randinit_default(gmpRandState);
+	gmp_randseed(gmpRandState, seed);
+
+	k = TEST_K;
+
+	test_labhe_setup(p,n,y,D,_2k1,_2k,pm12k,enc1,pk1,sk,NULL,NULL,gmpRandState);
+	if (rng_init(&rng)!=0) { exit(1); }
+	check(labhe_pool_start(&pool,2)==0);
+	labhe_pool_set(pool);
+
+	// Level-0 records with labels START + i, keys in GROUPS groups
+	check(labhe_encrypt_offline_batch_rng(b_masks,eb_masks,START,COUNT,sk,n,y,k,_2k,&rng)==0);
+	for (i=0;i<COUNT;i++) {
+		mpz_urandomb(ms[i],gmpRandState,k);
+		keys[i] = key_of(GROUPS);
+		labels[i] = START + i;
+	}
+	labhe_encrypt_online_batch(cs,(const mpz_t *)b_masks,(const mpz_t *)ms,COUNT,k);
+
+	// Evaluator: three uneven batches, per-worker tables merged at the end
+	check(labhe_group_init(&gs,n,k)==0);
+	check(labhe_group_add(&gs,keys,(const mpz_t *)cs,(const mpz_t *)eb_masks,1000)==0);
+	check(labhe_group_add(&gs,keys+1000,(const mpz_t *)cs+1000,NULL,10)!=0);
+	check(labhe_group_add(&gs,keys+1000,(const mpz_t *)cs+1000,(const mpz_t *)eb_masks+1000,1)==0);
+	check(labhe_group_add(&gs,keys+1001,(const mpz_t *)cs+1001,(const mpz_t *)eb_masks+1001,COUNT-1001)==0);
+	check(labhe_group_finish(&gs)==0);
+	check(labhe_group_add(&gs,keys,(const mpz_t *)cs,(const mpz_t *)eb_masks,1)!=0);
+
+	// Each group holds the homomorphic sum of its records, in key order
+	check(gs.groups>0 && gs.groups<=GROUPS);
+	prev = 0;
+	for (s=0;s<(int)gs.groups;s++) {
+		check(labhe_group_get(&key,bm,c,&records,&gs,s)==0);
+		check(s==0 || key>prev);
+		prev = key;
+		check(labhe_group_find(&gs,key)==s);
+		mpz_set_ui(sums[s],0);
+		mpz_set_ui(prods[s],1);
+		j = 0;
+		for (i=0;i<COUNT;i++) {
+			if (keys[i] != key) { continue; }
+			mpz_add(sums[s],sums[s],cs[i]);
+			mpz_mul(prods[s],prods[s],eb_masks[i]);
+			mpz_mod(prods[s],prods[s],n);
+			j++;
+		}
+		mpz_mod(sums[s],sums[s],_2k);
+		check(j==records && mpz_cmp(bm,sums[s])==0 && mpz_cmp(c,prods[s])==0);
+	}
+	check(labhe_group_find(&gs,3)==-1);
+
+	// Decryptor: all group masks in one pass over the labels
+	check(labhe_group_mask_init(&gm,sk,k)==0);
+	check(labhe_group_mask_add(&gm,keys,labels,COUNT)==0);
+	check(labhe_group_finish(&gm)==0);
+	check(gm.groups==gs.groups);
+	check(labhe_group_decrypt(res,&gs,&gm)==0);
+	for (s=0;s<(int)gs.groups;s++) {
+		labhe_group_get(&key,bm,NULL,NULL,&gs,s);
+		mpz_set_ui(t,0);
+		for (i=0;i<COUNT;i++) {
+			if (keys[i] == key) { mpz_add(t,t,ms[i]); }
+		}
+		mpz_mod(t,t,_2k);
+		check(mpz_cmp(res[s],t)==0);
+	}
+	labhe_group_clear(&gm);
+
+	// A record missing from the masks is detected
+	check(labhe_group_mask_init(&gm,sk,k)==0);
+	check(labhe_group_mask_add(&gm,keys,labels,COUNT-1)==0);
+	check(labhe_group_finish(&gm)==0);
+	check(labhe_group_decrypt(res,&gs,&gm)!=0);
+	labhe_group_clear(&gm);
+	labhe_group_clear(&gs);
+
+	// Linear-only stream of FLAT_COUNT records in FLAT_GROUPS groups
+	check(labhe_group_init(&gs,n,k)==0);
+	check(labhe_group_mask_init(&gm,sk,k)==0);
+	for (i=0;i<FLAT_GROUPS;i++) { mpz_set_ui(sums[i],0); }
+	for (i=0;i<FLAT_COUNT;i++) {
+		keys[i] = key_of(FLAT_GROUPS);
+		labels[i] = START + i;
+		counts[(keys[i] - 17)/0x100000001ULL]++;
+	}
+	cycles = 0;
+	for (s=0;s<FLAT_COUNT;s+=FLAT_BATCH) {
+		check(labhe_encrypt_offline_batch_rng(flat_b,NULL,START+s,FLAT_BATCH,sk,n,y,k,_2k,&rng)==0);
+		for (i=0;i<FLAT_BATCH;i++) {
+			mpz_urandomb(t,gmpRandState,32);
+			mpz_add(sums[(keys[s+i] - 17)/0x100000001ULL],sums[(keys[s+i] - 17)/0x100000001ULL],t);
+			mpz_add(flat_bm[i],t,flat_b[i]);
+			mpz_mod(flat_bm[i],flat_bm[i],_2k);
+		}
+		before=cpucycles();
+		check(labhe_group_add(&gs,keys+s,(const mpz_t *)flat_bm,NULL,FLAT_BATCH)==0);
+		after=cpucycles();
+		cycles += after-before;
+	}
+	check(labhe_group_finish(&gs)==0);
+	fprintf(stdout,"Group-by of %d records: evaluator cycles/record=%lld\n",FLAT_COUNT,cycles/FLAT_COUNT);
+	before=cpucycles();
+	check(labhe_group_mask_add(&gm,keys,labels,FLAT_COUNT)==0);
+	check(labhe_group_finish(&gm)==0);
+	after=cpucycles();
+	fprintf(stdout,"Group-by of %d records: decryptor masks cycles/record=%lld\n",FLAT_COUNT,(after-before)/FLAT_COUNT);
+	check(labhe_group_decrypt(res,&gs,&gm)==0);
+	for (s=0;s<(int)gs.groups;s++) {
+		labhe_group_get(&key,bm,c,&records,&gs,s);
+		i = (int)((key - 17)/0x100000001ULL);
+		mpz_mod(t,sums[i],_2k);
+		check(records==counts[i] && mpz_cmp(res[s],t)==0 && mpz_sgn(c)==0);
+	}
+	labhe_group_clear(&gm);
+	labhe_group_clear(&gs);
+
+	printf("OK!\n");
+
+	labhe_pool_stop(pool);
+	for (i=0;i<COUNT;i++) { mpz_clears(b_masks[i],eb_masks[i],cs[i],ms[i],NULL); }
+	for (i=0;i<FLAT_GROUPS;i++) { mpz_clears(sums[i],prods[i],res[i],NULL); }
+	for (i=0;i<FLAT_BATCH;i++) { mpz_clears(flat_b[i],flat_bm[i],NULL); }
+	free(b_masks); free(eb_masks); free(cs); free(ms); free(sums); free(prods); free(res);
+	free(flat_b); free(flat_bm); free(keys); free(labels); free(counts);
+	mpz_clears(p, n, y, D, seed, pk1, _2k, _2k1, pm12k, enc1, bm, c, t, NULL);
+	gmp_randclear(gmpRandState);
+
+	return 0;
+}
@@ -0,0 +1,153 @@
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+#include <utility>
+#include <gmp.h>
+
+#include "labhe.hpp"
+
+extern "C" {
+#include "bench.h"
+#include "bhjl.h"
+#include "labhe_gen.h"
+#include "prf.h"
+}
+
+#define COUNT 200
+#define START1 0
+#define START2 COUNT
+
+using namespace labhe;
+
+static void check(const bool ok)
+{
+	if (!ok) {
+		printf("Error.\n");
+		exit(1);
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	mpz_t p, n, y, D, seed, pk1, pk2, _2k, _2k1, pm12k, enc1, b, m, mp, t, s3;
+	mpz_t b_masks1[COUNT], b_masks2[COUNT], ms1[COUNT], ms2[COUNT];
+	unsigned char sk1[SK_SIZE], sk2[SK_SIZE];
+	unsigned char rand_buff[16];
+	long long before, after;
+	int l, k, i;
+	FILE *fp;
+
+	mpz_inits(p, n, y, D, seed, pk1, pk2, _2k, _2k1, pm12k, enc1, b, m, mp, t, s3, NULL);
+	for (i=0;i<COUNT;i++) { mpz_inits(b_masks1[i],b_masks2[i],ms1[i],ms2[i],NULL); }
+
+	fp = fopen("/dev/urandom", "r");
+	if (!fp) { exit(1); }
+	if (fread(rand_buff, sizeof(rand_buff), 1, fp) != 1)  { exit(1); }
+	if (fclose(fp)) { exit(1); }
+
+	mpz_import(seed, sizeof(rand_buff), 1, sizeof(rand_buff[0]), 0, 0, rand_buff);
+
+	gmp_randstate_t gmpRandState;
+	gmp_randinit_default(gmpRandState);
+	gmp_randseed(gmpRandState, seed);
+
+	l = 2048;
+	k = 128;
+
+	if (labhe_setup(p,n,y,D,l,k,_2k1,_2k,pm12k,enc1,gmpRandState)!=0) { exit(1); }
+	if (labhe_gen(pk1,sk1,n,y,k,_2k,gmpRandState)!=0) { exit(1); }
+	if (labhe_gen(pk2,sk2,n,y,k,_2k,gmpRandState)!=0) { exit(1); }
+
+	Evaluator ev(n,k,enc1);
+	Level0Vec x(COUNT), v(COUNT);
+	for (i=0;i<COUNT;i++) {
+		mpz_urandomb(ms1[i],gmpRandState,k);
+		mpz_urandomb(ms2[i],gmpRandState,k);
+	}
+	labhe_encrypt_offline_batch(b_masks1,x.c_data(),START1,COUNT,sk1,n,y,k,_2k,gmpRandState);
+	labhe_encrypt_offline_batch(b_masks2,v.c_data(),START2,COUNT,sk2,n,y,k,_2k,gmpRandState);
+	labhe_encrypt_online_batch(x.bm_data(),b_masks1,ms1,COUNT,k);
+	labhe_encrypt_online_batch(v.bm_data(),b_masks2,ms2,COUNT,k);
+
+	// Move-only owners
+	Level0Vec x2(std::move(x));
+	x = std::move(x2);
+	check(x.size()==COUNT);
+
+	Level1Vec z = ev.mul(x,v);
+	Level1Ct c(z[0]), w(z[1]);
+
+	// Fused inner product decrypts like the C routine
+	Level1Ct r = ev.eval(inner(x,v));
+	labhe_decrypt_offline_ip_sk(b,sk1,sk2,START1,START2,COUNT,k,_2k1);
+	labhe_decrypt_online1(m,r.get(),b,p,D,k,_2k1,pm12k);
+	mpz_set_ui(mp,0);
+	for (i=0;i<COUNT;i++) { mpz_addmul(mp,ms1[i],ms2[i]); }
+	mpz_mod(mp,mp,_2k);
+	check(mpz_cmp(m,mp)==0);
+
+	// inner(x,v) - 3*sum(z) + c - w against the C calls one by one
+	before=cpucycles();
+	ev.eval(r,inner(x,v) - 3*sum(z) + c - w);
+	after=cpucycles();
+	fprintf(stdout,"Fused expression (%d labels) cycles=%lld\n",COUNT,after-before);
+
+	before=cpucycles();
+	{
+		mpz_t cip, csum, ct;
+		mpz_inits(cip,csum,ct,NULL);
+		labhe_innerprod_lev0(cip,x.bm_data(),x.c_data(),v.bm_data(),v.c_data(),COUNT,n,k,enc1);
+		labhe_homadd_lev1_batch(csum,z.data(),COUNT,n);
+		mpz_set_ui(s3,3);
+		labhe_homsmul_lev1(csum,csum,s3,n);
+		labhe_homsub_lev1(ct,cip,csum,n);
+		bhjl_homadd(ct,ct,c.get(),n);
+		labhe_homsub_lev1(ct,ct,w.get(),n);
+		after=cpucycles();
+		fprintf(stdout,"Separate C calls cycles=%lld\n",after-before);
+
+		bhjl_decrypt(m,r.get(),p,D,k,_2k1,pm12k);
+		bhjl_decrypt(mp,ct,p,D,k,_2k1,pm12k);
+		check(mpz_cmp(m,mp)==0);
+		mpz_clears(cip,csum,ct,NULL);
+	}
+
+	// End to end: masks combine with the same weights (1 - 3), and the
+	// decrypted c - w is cancelled out of the mask
+	mpz_mul_si(t,b,-2);
+	bhjl_decrypt(m,c.get(),p,D,k,_2k1,pm12k);
+	mpz_sub(t,t,m);
+	bhjl_decrypt(m,w.get(),p,D,k,_2k1,pm12k);
+	mpz_add(t,t,m);
+	mpz_mod(t,t,_2k);
+	labhe_decrypt_online1(m,r.get(),t,p,D,k,_2k1,pm12k);
+	mpz_set_ui(mp,0);
+	for (i=0;i<COUNT;i++) { mpz_addmul(mp,ms1[i],ms2[i]); }
+	mpz_mul_si(mp,mp,-2);
+	mpz_mod(mp,mp,_2k);
+	check(mpz_cmp(m,mp)==0);
+
+	// Weights that cancel, nested scaling and negation
+	ev.eval(r,2*(sum(z) - c) - 2*sum(z) + 2*c);
+	bhjl_decrypt(m,r.get(),p,D,k,_2k1,pm12k);
+	check(mpz_sgn(m)==0);
+	ev.eval(r,-(-1*inner(x,v)));
+	Level1Ct r2 = ev.eval(inner(x,v));
+	check(mpz_cmp(r.get(),r2.get())==0);
+
+	// Mismatched operands throw
+	Level0Vec small(3);
+	try {
+		ev.eval(r,inner(x,small));
+		check(false);
+	} catch (const std::invalid_argument &) {
+	}
+
+	printf("OK!\n");
+
+	for (i=0;i<COUNT;i++) { mpz_clears(b_masks1[i],b_masks2[i],ms1[i],ms2[i],NULL); }
+	mpz_clears(p, n, y, D, seed, pk1, pk2, _2k, _2k1, pm12k, enc1, b, m, mp, t, s3, NULL);
+	gmp_randclear(gmpRandState);
+
+	return 0;
+}
@@ -0,0 +1,138 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <gmp.h>
+
+#include "bench.h"
+#include "labhe.h"
+#include "labhe_gen.h"
+#include "labhe_file.h"
+#include "labhe_set.h"
+#include "prf.h"
+#include "rng.h"
+#include "test_common.h"
+
+#define COUNT 2000
+#define START 500
+#define STEP 7
+
+int main(int argc, char* argv[])
+{
+	mpz_t p, n, y, D, seed, pk1, _2k, _2k1, pm12k, enc1, b, m, mp, bm, c, bmres, cres;
+	mpz_t *b_masks, *eb_masks, *b_lin, *cs, *ms, *eb_sel, *cs_sel;
+	unsigned char sk[SK_SIZE];
+	unsigned char rand_buff[16];
+	int labels[COUNT];
+	char path[64];
+	long long before, after, full, linear;
+	labhe_file_writer *w;
+	labhe_file f;
+	labhe_rng rng;
+	int k, i, sel;
+	FILE *fp;
+
+	mpz_inits(p, n, y, D, seed, pk1, _2k, _2k1, pm12k, enc1, b, m, mp, bm, c, bmres, cres, NULL);
+
+	b_masks=(mpz_t*)malloc(COUNT*sizeof(mpz_t));
+	eb_masks=(mpz_t*)malloc(COUNT*sizeof(mpz_t));
+	b_lin=(mpz_t*)malloc(COUNT*sizeof(mpz_t));
+	cs=(mpz_t*)malloc(COUNT*sizeof(mpz_t));
+	ms=(mpz_t*)malloc(COUNT*sizeof(mpz_t));
+	eb_sel=(mpz_t*)malloc(COUNT*sizeof(mpz_t));
+	cs_sel=(mpz_t*)malloc(COUNT*sizeof(mpz_t));
+	for (i=0;i<COUNT;i++) { mpz_inits(b_masks[i],eb_masks[i],b_lin[i],cs[i],ms[i],eb_sel[i],cs_sel[i],NULL); }
+
+	fp = fopen("/dev/urandom", "r");
+	if (!fp) { exit(1); }
+	if (fread(rand_buff, sizeof(rand_buff), 1, fp) != 1)  { exit(1); }
+	if (fclose(fp)) { exit(1); }
+
+	mpz_import(seed, sizeof(rand_buff), 1, sizeof(rand_buff[0]), 0, 0, rand_buff);
+
+	gmp_randstate_t gmpRandState;
+	gmp_randinit_default(gmpRandState);
+	gmp_randseed(gmpRandState, seed);
+
+	k = TEST_K;
+
+	test_labhe_setup(p,n,y,D,_2k1,_2k,pm12k,enc1,pk1,sk,NULL,NULL,gmpRandState);
+	if (rng_init(&rng)!=0) { exit(1); }
+
+	for (i=0;i<COUNT;i++) { mpz_urandomb(ms[i],gmpRandState,k); }
+
+	// Full and linear-only offline stages give the same b_masks
+	before=cpucycles();
+	check(labhe_encrypt_offline_batch_rng(b_masks,eb_masks,START,COUNT,sk,n,y,k,_2k,&rng)==0);
+	after=cpucycles();
+	full = after-before;
+	before=cpucycles();
+	check(labhe_encrypt_offline_batch_rng(b_lin,NULL,START,COUNT,sk,n,y,k,_2k,&rng)==0);
+	after=cpucycles();
+	linear = after-before;
+	fprintf(stdout,"Offline stage of %d labels: full cycles=%lld, linear-only cycles=%lld (%.0fx)\n",
+	        COUNT,full,linear,(double)full/linear);
+	for (i=0;i<COUNT;i++) { check(mpz_cmp(b_masks[i],b_lin[i])==0); }
+	labhe_encrypt_online_batch(cs,(const mpz_t *)b_lin,(const mpz_t *)ms,COUNT,k);
+
+	// Linear-only dataset file: bm records, flag in the header
+	sprintf(path,"/tmp/labhe_linear_test_%d.ct",(int)getpid());
+	check(labhe_file_create_flags(&w,path,1,START,n,k,LABHE_FILE_LINEAR)!=0);
+	check(labhe_file_create_flags(&w,path,0,START,n,k,LABHE_FILE_LINEAR)==0);
+	for (i=0;i<COUNT;i++) { check(labhe_file_append(w,cs[i],c)==0); }
+	check(labhe_file_finish(w)==0);
+	check(labhe_file_open(&f,path)==0);
+	check(f.flags==LABHE_FILE_LINEAR && f.level==0 && f.count==COUNT && f.stride==(size_t)f.klimbs);
+	check(labhe_file_get(&f,3,bm,c)==0 && mpz_cmp(bm,cs[3])==0 && mpz_sgn(c)==0);
+
+	// Sums decrypt with the level-0 online stage; quadratic jobs are refused
+	check(labhe_file_aggregate(bmres,cres,LABHE_AGG_SUM,&f,NULL,n,k,enc1,300,2,NULL)==0);
+	labhe_decrypt_offline_sum0_sk(b,sk,START,COUNT,k);
+	labhe_decrypt_online0(m,bmres,b,k);
+	mpz_set_ui(mp,0);
+	for (i=0;i<COUNT;i++) { mpz_add(mp,mp,ms[i]); }
+	mpz_mod(mp,mp,_2k);
+	check(mpz_cmp(m,mp)==0 && mpz_sgn(cres)==0);
+	check(labhe_file_aggregate(bmres,cres,LABHE_AGG_SUMSQ,&f,NULL,n,k,enc1,300,1,NULL)!=0);
+	check(labhe_file_aggregate(bmres,cres,LABHE_AGG_INNERPROD,&f,&f,n,k,enc1,300,1,NULL)!=0);
+	labhe_file_close(&f);
+
+	// A malformed header with k = 0 (no bm limbs, zero stride) is refused
+	fp = fopen(path, "r+b");
+	check(fp!=NULL);
+	i = 0;
+	check(fseek(fp,20,SEEK_SET)==0 && fwrite(&i,4,1,fp)==1);   // k
+	check(fseek(fp,32,SEEK_SET)==0 && fwrite(&i,4,1,fp)==1);   // klimbs
+	check(fclose(fp)==0);
+	check(labhe_file_open(&f,path)!=0);
+	unlink(path);
+
+	// Quadratic query on a selection: eb on demand matches the full batch
+	sel = 0;
+	for (i=0;i<COUNT;i+=STEP) {
+		labels[sel] = START + i;
+		mpz_set(cs_sel[sel],cs[i]);
+		sel++;
+	}
+	before=cpucycles();
+	check(labhe_encrypt_offline_eb_set(eb_sel,labels,sel,sk,n,y,k,_2k,&rng)==0);
+	after=cpucycles();
+	fprintf(stdout,"On-demand eb_masks of %d labels cycles=%lld\n",sel,after-before);
+	for (i=0;i<sel;i++) { check(mpz_cmp(eb_sel[i],eb_masks[(size_t)i*STEP])==0); }
+	check(labhe_innerprod_lev0(cres,(const mpz_t *)cs_sel,(const mpz_t *)eb_sel,
+	                           (const mpz_t *)cs_sel,(const mpz_t *)eb_sel,sel,n,k,enc1)==0);
+	check(labhe_decrypt_offline_ip_set(b,sk,sk,labels,labels,sel,k)==0);
+	labhe_decrypt_online1(m,cres,b,p,D,k,_2k1,pm12k);
+	mpz_set_ui(mp,0);
+	for (i=0;i<COUNT;i+=STEP) { mpz_addmul(mp,ms[i],ms[i]); }
+	mpz_mod(mp,mp,_2k);
+	check(mpz_cmp(m,mp)==0);
+
+	printf("OK!\n");
+
+	for (i=0;i<COUNT;i++) { mpz_clears(b_masks[i],eb_masks[i],b_lin[i],cs[i],ms[i],eb_sel[i],cs_sel[i],NULL); }
+	free(b_masks); free(eb_masks); free(b_lin); free(cs); free(ms); free(eb_sel); free(cs_sel);
+	mpz_clears(p, n, y, D, seed, pk1, _2k, _2k1, pm12k, enc1, b, m, mp, bm, c, bmres, cres, NULL);
+	gmp_randclear(gmpRandState);
+
+	return 0;
+}
@@ -0,0 +1,215 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <gmp.h>
+
+#include "bench.h"
+#include "labhe.h"
+#include "labhe_maskidx.h"
+#include "labhe_pool.h"
+#include "prf.h"
+#include "test_common.h"
+
+#define START 100
+#define BLOCK 256
+#define LABELS1 20000
+#define LABELS2 50000
+#define IP_START2 1000000
+#define IP_LABELS 8000
+#define QUERIES 40
+#define LOOKUPS 64
+
+typedef struct {
+	const labhe_maskidx *mi;
+	const unsigned char *sk;
+	int k;
+	mpz_t expect;
+	_Atomic int stop;
+} lookup_job;
+
+// Range masks from pool workers, installed index or not
+static int lookup_chunk(void *arg, const int i0, const int i1, const int worker)
+{
+	lookup_job *job = (lookup_job *)arg;
+	mpz_t t;
+	int i, rc = 0;
+
+	(void)worker;
+	mpz_init(t);
+	for (i=i0;i<i1 && rc==0;i++) {
+		labhe_decrypt_offline_sum0_sk(t,job->sk,START+37,4*BLOCK,job->k);
+		if (mpz_cmp(t,job->expect)!=0) { rc = 1; }
+	}
+	mpz_clear(t);
+	return rc;
+}
+
+static void *lookup_toggle(void *arg)
+{
+	lookup_job *job = (lookup_job *)arg;
+
+	while (!atomic_load(&job->stop)) {
+		labhe_maskidx_install(job->mi);
+		labhe_maskidx_uninstall(job->mi);
+	}
+	return NULL;
+}
+
+int main(int argc, char* argv[])
+{
+	mpz_t b, b2, _2k1;
+	unsigned char sk1[SK_SIZE], sk2[SK_SIZE], sk3[SK_SIZE];
+	char path[64];
+	long long before, after;
+	unsigned char hdr[40];
+	labhe_maskidx mi, mip, mi2;
+	labhe_pool *pool;
+	lookup_job job;
+	pthread_t th;
+	int k, q, s, c;
+	FILE *fp;
+
+	mpz_inits(b, b2, _2k1, NULL);
+
+	fp = fopen("/dev/urandom", "r");
+	if (!fp) { exit(1); }
+	if (fread(sk1, sizeof(sk1), 1, fp) != 1)  { exit(1); }
+	if (fread(sk2, sizeof(sk2), 1, fp) != 1)  { exit(1); }
+	if (fread(sk3, sizeof(sk3), 1, fp) != 1)  { exit(1); }
+	if (fread(&s, sizeof(s), 1, fp) != 1)  { exit(1); }
+	if (fclose(fp)) { exit(1); }
+	srand((unsigned)s);
+
+	k = 128;
+	mpz_setbit(_2k1, k-1);
+
+	// Built on a pool, then extended as labels are added
+	check(labhe_pool_start(&pool,2)==0);
+	labhe_pool_set(pool);
+	check(labhe_maskidx_init_sum0(&mi,sk1,START,BLOCK,k)==0);
+	before=cpucycles();
+	check(labhe_maskidx_extend(&mi,LABELS1)==0);
+	after=cpucycles();
+	fprintf(stdout,"Index of %d labels (block %d) cycles=%lld\n",LABELS1,BLOCK,after-before);
+	check(labhe_maskidx_labels(&mi)==LABELS1/BLOCK*BLOCK);
+	check(labhe_maskidx_extend(&mi,LABELS2)==0);
+	check(labhe_maskidx_labels(&mi)==LABELS2/BLOCK*BLOCK);
+	check(labhe_maskidx_extend(&mi,LABELS1)==0 && labhe_maskidx_labels(&mi)==LABELS2/BLOCK*BLOCK);
+
+	// Any range, inside, across or outside the index, matches the range routine
+	for (q=0;q<QUERIES;q++) {
+		s = START - 500 + rand() % (LABELS2 + 1000);
+		c = (q < QUERIES/4) ? rand() % (2*BLOCK) : rand() % (LABELS2 + 1000 - (s - START + 500));
+		labhe_decrypt_offline_sum0_sk(b2,sk1,s,c,k);
+		check(labhe_maskidx_sum0(b,&mi,s,c)==0);
+		check(mpz_cmp(b,b2)==0);
+	}
+	check(labhe_maskidx_sum0(b,&mi,START,0)==0 && mpz_sgn(b)==0);
+
+	// Cost of a long range: direct PRFs against lookups plus boundary blocks
+	before=cpucycles();
+	labhe_decrypt_offline_sum0_sk(b2,sk1,START+37,LABELS2-100,k);
+	after=cpucycles();
+	fprintf(stdout,"Direct mask of %d labels cycles=%lld\n",LABELS2-100,after-before);
+	before=cpucycles();
+	check(labhe_maskidx_sum0(b,&mi,START+37,LABELS2-100)==0);
+	after=cpucycles();
+	fprintf(stdout,"Indexed mask of %d labels cycles=%lld\n",LABELS2-100,after-before);
+	check(mpz_cmp(b,b2)==0);
+
+	// Installed: the range routine uses the index for matching keys
+	check(labhe_maskidx_install(&mi)==0);
+	mpz_set_ui(b,0);
+	labhe_decrypt_offline_sum0_sk(b,sk1,START+37,LABELS2-100,k);
+	check(mpz_cmp(b,b2)==0);
+	labhe_decrypt_offline_sum0_sk(b,sk2,START,BLOCK,k);
+	check(labhe_maskidx_uninstall(&mi)==0);
+	labhe_decrypt_offline_sum0_sk(b2,sk2,START,BLOCK,k);
+	check(mpz_cmp(b,b2)==0);
+
+	// Lookups from the pool workers while another thread installs and
+	// uninstalls the index
+	job.mi = &mi;
+	job.sk = sk1;
+	job.k = k;
+	atomic_init(&job.stop, 0);
+	mpz_init(job.expect);
+	labhe_decrypt_offline_sum0_sk(job.expect,sk1,START+37,4*BLOCK,k);
+	check(pthread_create(&th,NULL,lookup_toggle,&job)==0);
+	s = labhe_pool_run(pool,LOOKUPS,1,lookup_chunk,&job);
+	atomic_store(&job.stop, 1);
+	pthread_join(th,NULL);
+	check(s==0);
+	mpz_clear(job.expect);
+
+	// Masks of another PRF backend: the index is skipped and refuses queries
+	check(labhe_maskidx_install(&mi)==0);
+	check(prf_select(PRF_BACKEND_AES)==0);
+	labhe_decrypt_offline_sum0_sk(b,sk1,START+37,LABELS2-100,k);
+	check(labhe_maskidx_sum0(b2,&mi,START+37,LABELS2-100)!=0);
+	check(labhe_maskidx_extend(&mi,LABELS2+BLOCK)!=0);
+	check(labhe_maskidx_uninstall(&mi)==0);
+	labhe_decrypt_offline_sum0_sk(b2,sk1,START+37,LABELS2-100,k);
+	check(mpz_cmp(b,b2)==0);
+	check(prf_select(PRF_BACKEND_KECCAK)==0);
+
+	// Inner product index, aligned and misaligned pairs
+	check(labhe_maskidx_init_ip(&mip,sk1,sk2,START,IP_START2,BLOCK,k)==0);
+	check(labhe_maskidx_extend(&mip,IP_LABELS)==0);
+	for (q=0;q<QUERIES/4;q++) {
+		s = rand() % IP_LABELS;
+		c = rand() % (IP_LABELS + 300 - s);
+		labhe_decrypt_offline_ip_sk(b2,sk1,sk2,START+s,IP_START2+s,c,k,_2k1);
+		check(labhe_maskidx_ip(b,&mip,START+s,IP_START2+s,c)==0);
+		check(mpz_cmp(b,b2)==0);
+	}
+	labhe_decrypt_offline_ip_sk(b2,sk1,sk2,START+5,IP_START2+9,3*BLOCK,k,_2k1);
+	check(labhe_maskidx_ip(b,&mip,START+5,IP_START2+9,3*BLOCK)==0);
+	check(mpz_cmp(b,b2)==0);
+	check(labhe_maskidx_install(&mip)==0);
+	labhe_decrypt_offline_ip_sk(b,sk1,sk2,START+5,IP_START2+5,3*BLOCK,k,_2k1);
+	check(labhe_maskidx_ip(b2,&mip,START+5,IP_START2+5,3*BLOCK)==0);
+	check(mpz_cmp(b,b2)==0);
+	check(labhe_maskidx_sum0(b,&mip,START,BLOCK)!=0);
+
+	// Persisted and reloaded with the keys; wrong keys are detected
+	sprintf(path,"/tmp/labhe_maskidx_test_%d.idx",(int)getpid());
+	check(labhe_maskidx_save(path,&mi)==0);
+	check(labhe_maskidx_load(&mi2,path,sk1,NULL)==0);
+	check(mi2.blocks==mi.blocks && mi2.block==BLOCK && mi2.start1==START);
+	check(labhe_maskidx_sum0(b,&mi2,START+37,LABELS2-100)==0);
+	labhe_maskidx_sum0(b2,&mi,START+37,LABELS2-100);
+	check(mpz_cmp(b,b2)==0);
+	labhe_maskidx_clear(&mi2);
+	check(labhe_maskidx_load(&mi2,path,sk3,NULL)!=0);
+	check(prf_select(PRF_BACKEND_AES)==0);
+	check(labhe_maskidx_load(&mi2,path,sk1,NULL)!=0);
+	check(prf_select(PRF_BACKEND_KECCAK)==0);
+
+	// A block count larger than the file is rejected before allocating
+	fp = fopen(path,"r+b");
+	check(fp!=NULL && fread(hdr,sizeof(hdr),1,fp)==1);
+	memset(hdr+32,0x7f,1);
+	check(fseek(fp,0,SEEK_SET)==0 && fwrite(hdr,sizeof(hdr),1,fp)==1 && fclose(fp)==0);
+	check(labhe_maskidx_load(&mi2,path,sk1,NULL)!=0);
+	check(labhe_maskidx_save(path,&mip)==0);
+	check(labhe_maskidx_load(&mi2,path,sk1,NULL)!=0);
+	check(labhe_maskidx_load(&mi2,path,sk1,sk2)==0);
+	labhe_maskidx_ip(b,&mi2,START+3,IP_START2+3,IP_LABELS);
+	labhe_maskidx_ip(b2,&mip,START+3,IP_START2+3,IP_LABELS);
+	check(mpz_cmp(b,b2)==0);
+	unlink(path);
+
+	printf("OK!\n");
+
+	labhe_maskidx_clear(&mi);
+	labhe_maskidx_clear(&mip);
+	labhe_maskidx_clear(&mi2);
+	labhe_pool_stop(pool);
+	mpz_clears(b, b2, _2k1, NULL);
+
+	return 0;
+}
@@ -0,0 +1,127 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <gmp.h>
+
+#include "bench.h"
+#include "labhe.h"
+#include "labhe_gen.h"
+#include "labhe_pack.h"
+#include "prf.h"
+#include "test_common.h"
+
+#define RECORDS 1000
+#define START 0
+#define BITS 24
+#define MAX_SLOTS 8
+
+int main(int argc, char* argv[])
+{
+	mpz_t p, n, y, D, seed, pk1, _2k, _2k1, pm12k, enc1, b, m, bmres, cres;
+	mpz_t *b_masks, *eb_masks, *cs, *ms;
+	unsigned char sk[SK_SIZE];
+	unsigned char rand_buff[16];
+	uint64_t *v, sums[MAX_SLOTS], expect[MAX_SLOTS];
+	long long before, after, plain, packed;
+	labhe_pack pk, pk2;
+	int k, i, j, r;
+	FILE *fp;
+
+	mpz_inits(p, n, y, D, seed, pk1, _2k, _2k1, pm12k, enc1, b, m, bmres, cres, NULL);
+
+	b_masks=(mpz_t*)malloc(MAX_SLOTS*RECORDS*sizeof(mpz_t));
+	eb_masks=(mpz_t*)malloc(MAX_SLOTS*RECORDS*sizeof(mpz_t));
+	cs=(mpz_t*)malloc(MAX_SLOTS*RECORDS*sizeof(mpz_t));
+	ms=(mpz_t*)malloc(MAX_SLOTS*RECORDS*sizeof(mpz_t));
+	v=(uint64_t*)malloc(MAX_SLOTS*RECORDS*sizeof(uint64_t));
+	for (i=0;i<MAX_SLOTS*RECORDS;i++) { mpz_inits(b_masks[i],eb_masks[i],cs[i],ms[i],NULL); }
+
+	fp = fopen("/dev/urandom", "r");
+	if (!fp) { exit(1); }
+	if (fread(rand_buff, sizeof(rand_buff), 1, fp) != 1)  { exit(1); }
+	if (fclose(fp)) { exit(1); }
+
+	mpz_import(seed, sizeof(rand_buff), 1, sizeof(rand_buff[0]), 0, 0, rand_buff);
+
+	gmp_randstate_t gmpRandState;
+	gmp_randinit_default(gmpRandState);
+	gmp_randseed(gmpRandState, seed);
+
+	k = TEST_K;
+
+	// Formats: 24-bit counters summed 1000 times need 10 headroom bits
+	check(labhe_pack_init(&pk,k,BITS,RECORDS,0)==0);
+	check(pk.headroom==10 && pk.width==34 && pk.slots==3);
+	check(labhe_pack_init(&pk2,k,16,1,0)==0 && pk2.slots==8 && pk2.headroom==0);
+	check(labhe_pack_init(&pk2,k,32,1LL<<40,0)!=0);
+	check(labhe_pack_init(&pk2,k,BITS,RECORDS,4)!=0);
+	fprintf(stdout,"%d-bit values, %d additions: %d slots of %d bits\n",BITS,RECORDS,pk.slots,pk.width);
+
+	test_labhe_setup(p,n,y,D,_2k1,_2k,pm12k,enc1,pk1,sk,NULL,NULL,gmpRandState);
+
+	// Largest values: every slot carries into its headroom
+	srand((unsigned)mpz_get_ui(seed));
+	for (i=0;i<pk.slots*RECORDS;i++) { v[i] = (uint64_t)rand() & ((1u<<BITS)-1); }
+	for (i=0;i<pk.slots;i++) { v[i] = (1u<<BITS)-1; }
+	for (j=0;j<pk.slots;j++) {
+		expect[j] = 0;
+		for (r=0;r<RECORDS;r++) { expect[j] += v[(size_t)r*pk.slots+j]; }
+	}
+
+	// Encode/decode round trip
+	check(labhe_pack_encode(ms,v,1,&pk)==0);
+	check(labhe_pack_decode(sums,ms[0],&pk)==0);
+	for (j=0;j<pk.slots;j++) { check(sums[j]==v[j]); }
+
+	// Packed: one ciphertext per record
+	labhe_encrypt_offline_batch(b_masks,eb_masks,START,RECORDS,sk,n,y,k,_2k,gmpRandState);
+	check(labhe_pack_encrypt(cs,v,(const mpz_t *)b_masks,RECORDS,&pk)==0);
+	before=cpucycles();
+	check(labhe_pack_add(bmres,cres,(const mpz_t *)cs,(const mpz_t *)eb_masks,RECORDS,n,&pk)==0);
+	labhe_decrypt_offline_sum0_sk(b,sk,START,RECORDS,k);
+	check(labhe_pack_decrypt(sums,bmres,b,&pk)==0);
+	after=cpucycles();
+	packed = after-before;
+	for (j=0;j<pk.slots;j++) { check(sums[j]==expect[j]); }
+
+	// Flat sums (no c part) decrypt the same
+	check(labhe_pack_add(bmres,NULL,(const mpz_t *)cs,NULL,RECORDS,n,&pk)==0);
+	check(labhe_pack_decrypt(sums,bmres,b,&pk)==0);
+	for (j=0;j<pk.slots;j++) { check(sums[j]==expect[j]); }
+
+	// Unpacked: one ciphertext per value, labels START+RECORDS.. per column
+	labhe_encrypt_offline_batch(b_masks,eb_masks,START+RECORDS,pk.slots*RECORDS,sk,n,y,k,_2k,gmpRandState);
+	for (i=0;i<pk.slots*RECORDS;i++) {
+		j = i / RECORDS;
+		r = i % RECORDS;
+		mpz_set_ui(ms[i],v[(size_t)r*pk.slots+j]);
+	}
+	labhe_encrypt_online_batch(cs,(const mpz_t *)b_masks,(const mpz_t *)ms,pk.slots*RECORDS,k);
+	before=cpucycles();
+	for (j=0;j<pk.slots;j++) {
+		labhe_homadd_lev0_batch(bmres,cres,(const mpz_t *)cs+(size_t)j*RECORDS,(const mpz_t *)eb_masks+(size_t)j*RECORDS,
+		                        RECORDS,k,n);
+		labhe_decrypt_offline_sum0_sk(b,sk,START+RECORDS+j*RECORDS,RECORDS,k);
+		labhe_decrypt_online0(m,bmres,b,k);
+		check(mpz_get_ui(m)==expect[j]);
+	}
+	after=cpucycles();
+	plain = after-before;
+	fprintf(stdout,"Slot-wise sums of %d records x %d values: unpacked cycles=%lld, packed cycles=%lld (%.1fx)\n",
+	        RECORDS,pk.slots,plain,packed,(double)plain/packed);
+
+	// Too many additions or too wide values are refused
+	check(labhe_pack_add(bmres,cres,(const mpz_t *)cs,(const mpz_t *)eb_masks,RECORDS+1,n,&pk)!=0);
+	v[0] = 1u<<BITS;
+	check(labhe_pack_encode(ms,v,1,&pk)!=0);
+	check(labhe_pack_decode(sums,ms[0],&pk)==0 && sums[0]==0 && sums[1]==v[1]);
+
+	printf("OK!\n");
+
+	for (i=0;i<MAX_SLOTS*RECORDS;i++) { mpz_clears(b_masks[i],eb_masks[i],cs[i],ms[i],NULL); }
+	free(b_masks); free(eb_masks); free(cs); free(ms); free(v);
+	mpz_clears(p, n, y, D, seed, pk1, _2k, _2k1, pm12k, enc1, b, m, bmres, cres, NULL);
+	gmp_randclear(gmpRandState);
+
+	return 0;
+}
@@ -0,0 +1,171 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdatomic.h>
+#include <gmp.h>
+
+#include "bench.h"
+#include "labhe.h"
+#include "labhe_gen.h"
+#include "labhe_pool.h"
+#include "prf.h"
+#include "test_common.h"
+
+#define COUNT 400
+#define START1 0
+#define START2 COUNT
+#define WORKERS 4
+#define MAP_COUNT 100000  // not a multiple of MAP_GRAIN
+#define MAP_GRAIN 64
+#define ROWS 6
+
+static _Atomic int visits[MAP_COUNT];
+static _Atomic int nested_calls;
+static _Atomic int misaligned;
+
+// Uneven work: the cost of index i grows with i
+static int map_chunk(void *arg, const int i0, const int i1, const int worker)
+{
+	volatile unsigned long x = 0;
+	int i, j;
+
+	if (i0 % MAP_GRAIN || (i1 % MAP_GRAIN && i1 != MAP_COUNT)) { atomic_fetch_add(&misaligned, 1); }
+	for (i=i0;i<i1;i++) {
+		for (j=0;j<i/1000;j++) { x += j; }
+		atomic_fetch_add(&visits[i], 1);
+	}
+	return (arg && i0 <= 777 && 777 < i1) ? 1 : 0;
+}
+
+static int nested_inner(void *arg, const int i0, const int i1, const int worker)
+{
+	atomic_fetch_add(&nested_calls, 1);
+	return worker != 0 || i0 != 0 || i1 != 10;
+}
+
+static int nested_chunk(void *arg, const int i0, const int i1, const int worker)
+{
+	return labhe_pool_run((labhe_pool *)arg, 10, 1, nested_inner, NULL);
+}
+
+int main(int argc, char* argv[])
+{
+	mpz_t p, n, y, D, seed, pk1, pk2, _2k, _2k1, pm12k, enc1, r1, r2;
+	mpz_t *b_masks1, *eb_masks1, *cs1, *b_masks2, *eb_masks2, *cs2, *c, *c2, *w, *rows1, *rows2;
+	unsigned char sk1[SK_SIZE], sk2[SK_SIZE];
+	unsigned char rand_buff[16];
+	long long before, after;
+	labhe_pool *pool;
+	labhe_rng rng;
+	int k, i;
+	FILE *fp;
+
+	mpz_inits(p, n, y, D, seed, pk1, pk2, _2k, _2k1, pm12k, enc1, r1, r2, NULL);
+
+	b_masks1=(mpz_t*)malloc(COUNT*sizeof(mpz_t));
+	eb_masks1=(mpz_t*)malloc(COUNT*sizeof(mpz_t));
+	cs1=(mpz_t*)malloc(COUNT*sizeof(mpz_t));
+	b_masks2=(mpz_t*)malloc(COUNT*sizeof(mpz_t));
+	eb_masks2=(mpz_t*)malloc(COUNT*sizeof(mpz_t));
+	cs2=(mpz_t*)malloc(COUNT*sizeof(mpz_t));
+	c=(mpz_t*)malloc(COUNT*sizeof(mpz_t));
+	c2=(mpz_t*)malloc(COUNT*sizeof(mpz_t));
+	w=(mpz_t*)malloc(ROWS*COUNT*sizeof(mpz_t));
+	rows1=(mpz_t*)malloc(ROWS*sizeof(mpz_t));
+	rows2=(mpz_t*)malloc(ROWS*sizeof(mpz_t));
+	for (i=0;i<COUNT;i++) {
+		mpz_inits(b_masks1[i],eb_masks1[i],cs1[i],b_masks2[i],eb_masks2[i],cs2[i],c[i],c2[i],NULL);
+	}
+	for (i=0;i<ROWS*COUNT;i++) { mpz_init(w[i]); }
+	for (i=0;i<ROWS;i++) { mpz_inits(rows1[i],rows2[i],NULL); }
+
+	fp = fopen("/dev/urandom", "r");
+	if (!fp) { exit(1); }
+	if (fread(rand_buff, sizeof(rand_buff), 1, fp) != 1)  { exit(1); }
+	if (fclose(fp)) { exit(1); }
+
+	mpz_import(seed, sizeof(rand_buff), 1, sizeof(rand_buff[0]), 0, 0, rand_buff);
+
+	gmp_randstate_t gmpRandState;
+	gmp_randinit_default(gmpRandState);
+	gmp_randseed(gmpRandState, seed);
+
+	check(labhe_pool_start(&pool,WORKERS)==0);
+	fprintf(stdout,"Pool workers: %d\n",labhe_pool_workers(pool));
+
+	// Every index is processed exactly once despite uneven chunk costs,
+	// in chunks aligned to the grain, stolen ones included
+	check(labhe_pool_run(pool,MAP_COUNT,MAP_GRAIN,map_chunk,NULL)==0);
+	for (i=0;i<MAP_COUNT;i++) { check(atomic_load(&visits[i])==1); }
+	check(atomic_load(&misaligned)==0);
+
+	// Failures are reported, the other chunks still run
+	check(labhe_pool_run(pool,MAP_COUNT,MAP_GRAIN,map_chunk,pool)!=0);
+	for (i=0;i<MAP_COUNT;i++) { check(atomic_load(&visits[i])==2); }
+
+	// Runs issued from a job execute serially on the calling worker
+	check(labhe_pool_run(pool,64,4,nested_chunk,pool)==0);
+	check(atomic_load(&nested_calls)==16);
+
+	k = TEST_K;
+
+	test_labhe_setup(p,n,y,D,_2k1,_2k,pm12k,enc1,pk1,sk1,pk2,sk2,gmpRandState);
+	if (rng_init(&rng)!=0) { exit(1); }
+
+	// Offline encryption: same masks and ciphertexts with and without the pool
+	check(labhe_encrypt_offline_batch_rng(b_masks1,eb_masks1,START1,COUNT,sk1,n,y,k,_2k,&rng)==0);
+	labhe_pool_set(pool);
+	check(labhe_pool_get()==pool);
+	check(labhe_encrypt_offline_batch_rng(b_masks2,eb_masks2,START1,COUNT,sk1,n,y,k,_2k,&rng)==0);
+	labhe_pool_set(NULL);
+	for (i=0;i<COUNT;i++) {
+		check(mpz_cmp(b_masks1[i],b_masks2[i])==0 && mpz_cmp(eb_masks1[i],eb_masks2[i])==0);
+	}
+	check(labhe_encrypt_offline_batch_rng(b_masks2,eb_masks2,START2,COUNT,sk2,n,y,k,_2k,&rng)==0);
+	for (i=0;i<COUNT;i++) {
+		mpz_urandomb(cs1[i],gmpRandState,k);
+		mpz_urandomb(cs2[i],gmpRandState,k);
+	}
+
+	// Multiplication batch
+	before=cpucycles();
+	check(labhe_hommul_lev0_batch(c,(const mpz_t *)cs1,(const mpz_t *)eb_masks1,(const mpz_t *)cs2,(const mpz_t *)eb_masks2,
+	                              COUNT,n,k,enc1)==0);
+	after=cpucycles();
+	fprintf(stdout,"Hommul batch, calling thread (%d ciphertexts) cycles=%lld\n",COUNT,after-before);
+	labhe_pool_set(pool);
+	before=cpucycles();
+	check(labhe_hommul_lev0_batch(c2,(const mpz_t *)cs1,(const mpz_t *)eb_masks1,(const mpz_t *)cs2,(const mpz_t *)eb_masks2,
+	                              COUNT,n,k,enc1)==0);
+	after=cpucycles();
+	fprintf(stdout,"Hommul batch, %d workers (%d ciphertexts) cycles=%lld\n",labhe_pool_workers(pool),COUNT,after-before);
+	labhe_pool_set(NULL);
+	for (i=0;i<COUNT;i++) { check(mpz_cmp(c[i],c2[i])==0); }
+
+	// Products and linear combinations
+	check(labhe_homadd_lev1_batch(r1,(const mpz_t *)c,COUNT,n)==0);
+	for (i=0;i<ROWS*COUNT;i++) { mpz_urandomb(w[i],gmpRandState,k); }
+	check(labhe_lincomb_lev1(rows1,(const mpz_t *)c,COUNT,(const mpz_t *)w,ROWS,n)==0);
+	labhe_pool_set(pool);
+	check(labhe_homadd_lev1_batch(r2,(const mpz_t *)c,COUNT,n)==0);
+	check(mpz_cmp(r1,r2)==0);
+	check(labhe_lincomb_lev1(rows2,(const mpz_t *)c,COUNT,(const mpz_t *)w,ROWS,n)==0);
+	for (i=0;i<ROWS;i++) { check(mpz_cmp(rows1[i],rows2[i])==0); }
+
+	// Stopping the installed pool uninstalls it
+	check(labhe_pool_stop(pool)==0);
+	check(labhe_pool_get()==NULL);
+
+	printf("OK!\n");
+
+	for (i=0;i<COUNT;i++) {
+		mpz_clears(b_masks1[i],eb_masks1[i],cs1[i],b_masks2[i],eb_masks2[i],cs2[i],c[i],c2[i],NULL);
+	}
+	for (i=0;i<ROWS*COUNT;i++) { mpz_clear(w[i]); }
+	for (i=0;i<ROWS;i++) { mpz_clears(rows1[i],rows2[i],NULL); }
+	free(b_masks1); free(eb_masks1); free(cs1); free(b_masks2); free(eb_masks2); free(cs2);
+	free(c); free(c2); free(w); free(rows1); free(rows2);
+	mpz_clears(p, n, y, D, seed, pk1, pk2, _2k, _2k1, pm12k, enc1, r1, r2, NULL);
+	gmp_randclear(gmpRandState);
+
+	return 0;
+}
@@ -0,0 +1,154 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <gmp.h>
+
+#include "bench.h"
+#include "labhe.h"
+#include "labhe_gen.h"
+#include "labhe_set.h"
+#include "prf.h"
+#include "test_common.h"
+
+#define COUNT 1000
+#define START1 0
+#define START2 COUNT
+
+int main(int argc, char* argv[])
+{
+	mpz_t p, n, y, D, seed, pk1, pk2, _2k, _2k1, pm12k, enc1, b, b2, m, mp, bmres, cres, t;
+	mpz_t *b_masks1, *eb_masks1, *cs1, *ms1, *b_masks2, *eb_masks2, *cs2, *ms2;
+	unsigned char sk1[SK_SIZE], sk2[SK_SIZE];
+	unsigned char rand_buff[16];
+	uint64_t bitmap[(COUNT+63)/64];
+	int idx[COUNT], idx2[COUNT], labels1[COUNT], labels2[COUNT];
+	long long before, after;
+	int k, i, j, sel, runs;
+	FILE *fp;
+
+	mpz_inits(p, n, y, D, seed, pk1, pk2, _2k, _2k1, pm12k, enc1, b, b2, m, mp, bmres, cres, t, NULL);
+
+	b_masks1=(mpz_t*)malloc(COUNT*sizeof(mpz_t));
+	eb_masks1=(mpz_t*)malloc(COUNT*sizeof(mpz_t));
+	cs1=(mpz_t*)malloc(COUNT*sizeof(mpz_t));
+	ms1=(mpz_t*)malloc(COUNT*sizeof(mpz_t));
+	b_masks2=(mpz_t*)malloc(COUNT*sizeof(mpz_t));
+	eb_masks2=(mpz_t*)malloc(COUNT*sizeof(mpz_t));
+	cs2=(mpz_t*)malloc(COUNT*sizeof(mpz_t));
+	ms2=(mpz_t*)malloc(COUNT*sizeof(mpz_t));
+	for (i=0;i<COUNT;i++) {
+		mpz_inits(b_masks1[i],eb_masks1[i],cs1[i],ms1[i],b_masks2[i],eb_masks2[i],cs2[i],ms2[i],NULL);
+	}
+
+	fp = fopen("/dev/urandom", "r");
+	if (!fp) { exit(1); }
+	if (fread(rand_buff, sizeof(rand_buff), 1, fp) != 1)  { exit(1); }
+	if (fclose(fp)) { exit(1); }
+
+	mpz_import(seed, sizeof(rand_buff), 1, sizeof(rand_buff[0]), 0, 0, rand_buff);
+
+	gmp_randstate_t gmpRandState;
+	gmp_randinit_default(gmpRandState);
+	gmp_randseed(gmpRandState, seed);
+
+	k = TEST_K;
+
+	test_labhe_setup(p,n,y,D,_2k1,_2k,pm12k,enc1,pk1,sk1,pk2,sk2,gmpRandState);
+
+	for (i=0;i<COUNT;i++) {
+		mpz_urandomb(ms1[i],gmpRandState,k);
+		mpz_urandomb(ms2[i],gmpRandState,k);
+	}
+	labhe_encrypt_offline_batch(b_masks1,eb_masks1,START1,COUNT,sk1,n,y,k,_2k,gmpRandState);
+	labhe_encrypt_offline_batch(b_masks2,eb_masks2,START2,COUNT,sk2,n,y,k,_2k,gmpRandState);
+	labhe_encrypt_online_batch(cs1,(const mpz_t *)b_masks1,(const mpz_t *)ms1,COUNT,k);
+	labhe_encrypt_online_batch(cs2,(const mpz_t *)b_masks2,(const mpz_t *)ms2,COUNT,k);
+
+	// Filter selecting about a third of the records, first and last included
+	for (i=0;i<(COUNT+63)/64;i++) { bitmap[i] = 0; }
+	sel = 0;
+	for (i=0;i<COUNT;i++) {
+		if (i == 0 || i == COUNT-1 || mpz_fdiv_ui(ms1[i],3) == 0) {
+			bitmap[i/64] |= (uint64_t)1 << (i%64);
+			idx[sel] = i;
+			labels1[sel] = START1 + i;
+			labels2[sel] = START2 + i;
+			sel++;
+		}
+	}
+	check(labhe_set_from_bitmap(idx2,bitmap,COUNT)==sel);
+	for (i=0;i<sel;i++) { check(idx2[i]==idx[i]); }
+	fprintf(stdout,"%d of %d records selected\n",sel,COUNT);
+
+	// Sum of the selection
+	check(labhe_homadd_lev0_set(bmres,cres,(const mpz_t *)cs1,(const mpz_t *)eb_masks1,idx,sel,k,n)==0);
+	before=cpucycles();
+	check(labhe_decrypt_offline_sum0_set(b,sk1,labels1,sel,k)==0);
+	after=cpucycles();
+	fprintf(stdout,"Label-set sum mask cycles=%lld\n",after-before);
+	labhe_decrypt_online0(m,bmres,b,k);
+	mpz_set_ui(mp,0);
+	for (i=0;i<sel;i++) { mpz_add(mp,mp,ms1[idx[i]]); }
+	mpz_mod(mp,mp,_2k);
+	check(mpz_cmp(m,mp)==0);
+	labhe_decrypt_nooff0(m,bmres,cres,p,D,k,_2k1,pm12k);
+	check(mpz_cmp(m,mp)==0);
+	check(labhe_decrypt_offline_sum0_bitmap(b2,sk1,START1,bitmap,COUNT,k)==0);
+	check(mpz_cmp(b,b2)==0);
+
+	// Against one range call per run of consecutive labels
+	before=cpucycles();
+	mpz_set_ui(b2,0);
+	runs = 0;
+	for (i=0;i<sel;i=j) {
+		for (j=i+1;j<sel && idx[j]==idx[j-1]+1;j++) {}
+		labhe_decrypt_offline_sum0_sk(t,sk1,START1+idx[i],j-i,k);
+		mpz_add(b2,b2,t);
+		runs++;
+	}
+	mpz_mod(b2,b2,_2k);
+	after=cpucycles();
+	fprintf(stdout,"Per-run range masks (%d runs) cycles=%lld\n",runs,after-before);
+	check(mpz_cmp(b,b2)==0);
+
+	// Flat sum
+	check(labhe_homadd_lev0_set(bmres,NULL,(const mpz_t *)cs1,NULL,idx,sel,k,n)==0);
+	labhe_decrypt_online0(m,bmres,b,k);
+	check(mpz_cmp(m,mp)==0);
+
+	// Inner product of the selection
+	check(labhe_innerprod_lev0_set(cres,(const mpz_t *)cs1,(const mpz_t *)eb_masks1,(const mpz_t *)cs2,(const mpz_t *)eb_masks2,
+	                               idx,sel,n,k,enc1)==0);
+	check(labhe_decrypt_offline_ip_set(b,sk1,sk2,labels1,labels2,sel,k)==0);
+	labhe_decrypt_online1(m,cres,b,p,D,k,_2k1,pm12k);
+	mpz_set_ui(mp,0);
+	for (i=0;i<sel;i++) { mpz_addmul(mp,ms1[idx[i]],ms2[idx[i]]); }
+	mpz_mod(mp,mp,_2k);
+	check(mpz_cmp(m,mp)==0);
+	check(labhe_decrypt_offline_ip_bitmap(b2,sk1,sk2,START1,START2,bitmap,COUNT,k)==0);
+	check(mpz_cmp(b,b2)==0);
+
+	// A dense selection matches the range routines
+	for (i=0;i<COUNT;i++) { labels1[i] = START1 + i; }
+	check(labhe_decrypt_offline_sum0_set(b,sk1,labels1,COUNT,k)==0);
+	labhe_decrypt_offline_sum0_sk(b2,sk1,START1,COUNT,k);
+	check(mpz_cmp(b,b2)==0);
+
+	// Unsorted or repeated selections are refused
+	idx[1] = idx[0];
+	check(labhe_homadd_lev0_set(bmres,cres,(const mpz_t *)cs1,(const mpz_t *)eb_masks1,idx,sel,k,n)!=0);
+	labels1[1] = labels1[0];
+	check(labhe_decrypt_offline_sum0_set(b,sk1,labels1,COUNT,k)!=0);
+
+	printf("OK!\n");
+
+	for (i=0;i<COUNT;i++) {
+		mpz_clears(b_masks1[i],eb_masks1[i],cs1[i],ms1[i],b_masks2[i],eb_masks2[i],cs2[i],ms2[i],NULL);
+	}
+	free(b_masks1); free(eb_masks1); free(cs1); free(ms1);
+	free(b_masks2); free(eb_masks2); free(cs2); free(ms2);
+	mpz_clears(p, n, y, D, seed, pk1, pk2, _2k, _2k1, pm12k, enc1, b, b2, m, mp, bmres, cres, t, NULL);
+	gmp_randclear(gmpRandState);
+
+	return 0;
+}
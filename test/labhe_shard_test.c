@@ -0,0 +1,210 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <gmp.h>
+
+#include "labhe.h"
+#include "labhe_gen.h"
+#include "labhe_file.h"
+#include "labhe_shard.h"
+#include "prf.h"
+#include "test_common.h"
+
+#define COUNT 600
+#define CHUNK 32
+#define MAX_PROCS 4
+#define START1 100
+#define START2 5000
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+/*
+ * Reduce the dataset with procs worker processes (one label range each,
+ * partials exchanged through files), then tree-merge the partials
+ */
+static double run_sharded(labhe_shard *res, const int op, const int procs,
+	                      const labhe_file *f1, const labhe_file *f2,
+	                      const mpz_t n, const int k, const mpz_t enc1)
+{
+	labhe_shard parts[MAX_PROCS], sh;
+	char path[64];
+	long long first, cnt;
+	pid_t pid[MAX_PROCS];
+	double t0, t1;
+	int i, status;
+
+	t0 = now();
+	for (i=0;i<procs;i++) {
+		first = (long long)COUNT*i/procs;
+		cnt = (long long)COUNT*(i+1)/procs - first;
+		snprintf(path,sizeof(path),"/tmp/labhe-shard-test-%d.%d",(int)getpid(),i);
+		pid[i] = fork();
+		check(pid[i] >= 0);
+		if (pid[i] == 0) {
+			labhe_shard_init(&sh);
+			if (labhe_shard_reduce(&sh,op,f1,f2,first,cnt,n,k,enc1,CHUNK,1,NULL) != 0 ||
+			    labhe_shard_save(path,&sh) != 0) { _exit(1); }
+			_exit(0);
+		}
+	}
+	for (i=0;i<procs;i++) {
+		check(waitpid(pid[i],&status,0) == pid[i] && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+	}
+	// Partials are loaded in reverse order: the merge sorts them by label
+	for (i=0;i<procs;i++) {
+		snprintf(path,sizeof(path),"/tmp/labhe-shard-test-%d.%d",(int)getpid(),procs-1-i);
+		labhe_shard_init(&parts[i]);
+		check(labhe_shard_load(&parts[i],path) == 0);
+		unlink(path);
+	}
+	check(labhe_shard_merge(res,parts,procs,n,k) == 0);
+	t1 = now();
+
+	for (i=0;i<procs;i++) { labhe_shard_clear(&parts[i]); }
+
+	return t1 - t0;
+}
+
+int main(int argc, char* argv[])
+{
+	mpz_t p, n, y, D, seed, pk1, pk2, _2k, _2k1, pm12k, enc1, b, b2, m, mp;
+	mpz_t *b_masks1, *eb_masks1, *cs1, *ms1, *b_masks2, *eb_masks2, *cs2, *ms2;
+	unsigned char sk1[SK_SIZE], sk2[SK_SIZE];
+	unsigned char rand_buff[16];
+	char path1[64], path2[64];
+	labhe_file_writer *w1, *w2;
+	labhe_file f1, f2;
+	labhe_shard res, parts[3];
+	double secs;
+	int k, i, procs;
+	FILE *fp;
+
+	mpz_inits(p, n, y, D, seed, pk1, pk2, _2k, _2k1, pm12k, enc1, b, b2, m, mp, NULL);
+
+	b_masks1=(mpz_t*)malloc(COUNT*sizeof(mpz_t));
+	eb_masks1=(mpz_t*)malloc(COUNT*sizeof(mpz_t));
+	cs1=(mpz_t*)malloc(COUNT*sizeof(mpz_t));
+	ms1=(mpz_t*)malloc(COUNT*sizeof(mpz_t));
+	b_masks2=(mpz_t*)malloc(COUNT*sizeof(mpz_t));
+	eb_masks2=(mpz_t*)malloc(COUNT*sizeof(mpz_t));
+	cs2=(mpz_t*)malloc(COUNT*sizeof(mpz_t));
+	ms2=(mpz_t*)malloc(COUNT*sizeof(mpz_t));
+	for (i=0;i<COUNT;i++) {
+		mpz_inits(b_masks1[i],eb_masks1[i],cs1[i],ms1[i],b_masks2[i],eb_masks2[i],cs2[i],ms2[i],NULL);
+	}
+
+	fp = fopen("/dev/urandom", "r");
+	if (!fp) { exit(1); }
+	if (fread(rand_buff, sizeof(rand_buff), 1, fp) != 1)  { exit(1); }
+	if (fclose(fp)) { exit(1); }
+
+	mpz_import(seed, sizeof(rand_buff), 1, sizeof(rand_buff[0]), 0, 0, rand_buff);
+
+	gmp_randstate_t gmpRandState;
+	gmp_randinit_default(gmpRandState);
+	gmp_randseed(gmpRandState, seed);
+
+	k = TEST_K;
+
+	test_labhe_setup(p,n,y,D,_2k1,_2k,pm12k,enc1,pk1,sk1,pk2,sk2,gmpRandState);
+
+	for (i=0;i<COUNT;i++) {
+		mpz_urandomb(ms1[i],gmpRandState,k);
+		mpz_urandomb(ms2[i],gmpRandState,k);
+	}
+	labhe_encrypt_offline_batch(b_masks1,eb_masks1,START1,COUNT,sk1,n,y,k,_2k,gmpRandState);
+	labhe_encrypt_offline_batch(b_masks2,eb_masks2,START2,COUNT,sk2,n,y,k,_2k,gmpRandState);
+	labhe_encrypt_online_batch(cs1,b_masks1,ms1,COUNT,k);
+	labhe_encrypt_online_batch(cs2,b_masks2,ms2,COUNT,k);
+
+	snprintf(path1,sizeof(path1),"/tmp/labhe-shard-test-%d.a",(int)getpid());
+	snprintf(path2,sizeof(path2),"/tmp/labhe-shard-test-%d.b",(int)getpid());
+	check(labhe_file_create(&w1,path1,0,START1,n,k)==0);
+	check(labhe_file_create(&w2,path2,0,START2,n,k)==0);
+	for (i=0;i<COUNT;i++) {
+		check(labhe_file_append(w1,cs1[i],eb_masks1[i])==0);
+		check(labhe_file_append(w2,cs2[i],eb_masks2[i])==0);
+	}
+	check(labhe_file_finish(w1)==0 && labhe_file_finish(w2)==0);
+	check(labhe_file_open(&f1,path1)==0 && labhe_file_open(&f2,path2)==0);
+
+	labhe_shard_init(&res);
+	for (i=0;i<3;i++) { labhe_shard_init(&parts[i]); }
+
+	// Inner product over 1..MAX_PROCS worker processes
+	mpz_set_ui(mp,0);
+	for (i=0;i<COUNT;i++) { mpz_addmul(mp,ms1[i],ms2[i]); }
+	mpz_mod(mp,mp,_2k);
+	for (procs=1;procs<=MAX_PROCS;procs*=2) {
+		secs = run_sharded(&res,LABHE_AGG_INNERPROD,procs,&f1,&f2,n,k,enc1);
+		fprintf(stdout,"innerprod, %d processes: %.3f s, %.0f ciphertexts/s\n",procs,secs,2*COUNT/secs);
+		check(res.op==LABHE_AGG_INNERPROD && res.level==1 && res.count==COUNT);
+		check(res.start_label1==START1 && res.start_label2==START2);
+		check(labhe_shard_mask(b,&res,sk1,sk2,k,_2k1)==0);
+		labhe_decrypt_offline_ip_sk(b2,sk1,sk2,START1,START2,COUNT,k,_2k1);
+		check(mpz_cmp(b,b2)==0);
+		labhe_decrypt_online1(m,res.c,b,p,D,k,_2k1,pm12k);
+		check(mpz_cmp(m,mp)==0);
+	}
+
+	// Sum with three uneven shards; masks split along the same ranges
+	check(labhe_shard_reduce(&parts[0],LABHE_AGG_SUM,&f1,NULL,0,100,n,k,enc1,CHUNK,1,NULL)==0);
+	check(labhe_shard_reduce(&parts[1],LABHE_AGG_SUM,&f1,NULL,100,7,n,k,enc1,CHUNK,2,NULL)==0);
+	check(labhe_shard_reduce(&parts[2],LABHE_AGG_SUM,&f1,NULL,107,COUNT-107,n,k,enc1,CHUNK,2,NULL)==0);
+	check(parts[1].start_label1==START1+100 && parts[1].count==7 && parts[1].level==0);
+	check(labhe_shard_merge(&res,parts,3,n,k)==0);
+	check(labhe_shard_masks(b,parts,3,sk1,NULL,k,_2k1,2)==0);
+	mpz_set_ui(mp,0);
+	for (i=0;i<COUNT;i++) { mpz_add(mp,mp,ms1[i]); }
+	mpz_mod(mp,mp,_2k);
+	labhe_decrypt_online0(m,res.bm,b,k);
+	check(mpz_cmp(m,mp)==0);
+	labhe_decrypt_nooff0(m,res.bm,res.c,p,D,k,_2k1,pm12k);
+	check(mpz_cmp(m,mp)==0);
+
+	// Merged partials merge again (two-level coordinators)
+	check(labhe_shard_merge(&res,parts+1,2,n,k)==0 && res.count==COUNT-100);
+	mpz_swap(parts[1].bm,res.bm); mpz_swap(parts[1].c,res.c);
+	parts[1].count = res.count;
+	check(labhe_shard_merge(&res,parts,2,n,k)==0 && res.count==COUNT);
+	labhe_decrypt_online0(m,res.bm,b,k);
+	check(mpz_cmp(m,mp)==0);
+
+	// Gaps, overlaps and mixed jobs are rejected
+	check(labhe_shard_merge(&res,parts,1,n,k)==0);
+	parts[1].start_label1 += 1;
+	check(labhe_shard_merge(&res,parts,2,n,k)!=0);
+	parts[1].start_label1 -= 1;
+	parts[1].op = LABHE_AGG_SUMSQ;
+	check(labhe_shard_merge(&res,parts,2,n,k)!=0);
+	parts[1].op = LABHE_AGG_SUM;
+	check(labhe_shard_merge(&res,parts,2,n,k+1)!=0);
+	check(labhe_shard_reduce(&res,LABHE_AGG_SUM,&f1,NULL,COUNT-1,2,n,k,enc1,CHUNK,1,NULL)!=0);
+
+	labhe_file_close(&f1);
+	labhe_file_close(&f2);
+	unlink(path1);
+	unlink(path2);
+
+	printf("OK!\n");
+
+	labhe_shard_clear(&res);
+	for (i=0;i<3;i++) { labhe_shard_clear(&parts[i]); }
+	for (i=0;i<COUNT;i++) {
+		mpz_clears(b_masks1[i],eb_masks1[i],cs1[i],ms1[i],b_masks2[i],eb_masks2[i],cs2[i],ms2[i],NULL);
+	}
+	free(b_masks1); free(eb_masks1); free(cs1); free(ms1);
+	free(b_masks2); free(eb_masks2); free(cs2); free(ms2);
+	mpz_clears(p, n, y, D, seed, pk1, pk2, _2k, _2k1, pm12k, enc1, b, b2, m, mp, NULL);
+	gmp_randclear(gmpRandState);
+
+	return 0;
+}
@@ -1,28 +1,68 @@
 #include <stdlib.h> 
 #include <stdio.h>
+#include <string.h>
+#include <unistd.h>
 #include <gmp.h>
 
 #include "prf.h"
 #include "bench.h"
 #include "labhe.h"
 #include "labhe_gen.h"
+#include "labhe_pipe.h"
+#include "labhe_agg.h"
+#include "labhe_cache.h"
+#include "keystore.h"
 
 #define COUNT 1000
+#define LC_COUNT 100
+#define LC_ROWS 8
+#define LC_TAB_COUNT 2   // few ciphertexts, LC_ROWS rows: fixed-base tables
+#define PIPE_COUNT 200
+#define PIPE_START 5000
+#define AGG_USERS 32
+#define AGG_LABELS 4
+#define AGG_START 7000
+#define CACHE_COUNT 50
+
+static void pipe_output(void *arg, const int label, const mpz_t bm, const mpz_t c)
+{
+	mpz_t *out = (mpz_t *)arg;
+
+	mpz_set(out[2*(label-PIPE_START)],bm);
+	mpz_set(out[2*(label-PIPE_START)+1],c);
+}
 
 int main(int argc, char* argv[])
 {
-	mpz_t p, n, y, D,seed,pk1,pk2,_2k,_2k1,pm12k, enc1, t1, t2, mp,cred,b,m;
+	mpz_t p, n, y, D,seed,pk1,pk2,_2k,_2k1,pm12k, enc1, t1, t2, mp,cred,cip,b,m;
 	long long before, after;
-	int l, k,i;
+	int l, k,i,j;
 	FILE *fp;
 	unsigned char rand_buff[16];
 	unsigned char sk1[SK_SIZE];
 	unsigned char sk2[SK_SIZE];
 	mpz_t *b_masks1, *eb_masks1, *cs1, *ms1;
 	mpz_t *b_masks2, *eb_masks2, *cs2, *ms2;
-	mpz_t *c;
-
-	mpz_inits(p, n, y, D,seed,pk1,pk2,_2k,_2k1,pm12k, enc1, t1, t2, mp,cred,b,m,NULL);
+	mpz_t *c, *csub;
+	mpz_t *w, *bmlc, *clc;
+	labhe_lev1_acc acc;
+	labhe_pipe *lp;
+	labhe_pipe_stats pstats;
+	labhe_rng rng;
+	mpz_t pout[2*PIPE_COUNT];
+	mpz_t pks[AGG_USERS];
+	unsigned char sks[AGG_USERS*SK_SIZE], sks_rec[AGG_USERS*SK_SIZE];
+	labhe_cache *cache;
+	labhe_cache_stats cstats;
+	size_t budget;
+	char *ks_prefix, ks_pub[256], ks_sec[256], gen_path[64];
+	mpz_t *pks_ld;
+	unsigned char *sks_ld;
+	int count_ld, k_ld, have_ks = 0;
+	keystore_pub kp;
+	keystore_sec ks;
+
+	mpz_inits(p, n, y, D,seed,pk1,pk2,_2k,_2k1,pm12k, enc1, t1, t2, mp,cred,cip,b,m,NULL);
 	
 	b_masks1=(mpz_t*)malloc(COUNT*sizeof(mpz_t));
 	eb_masks1=(mpz_t*)malloc(COUNT*sizeof(mpz_t));
@@ -33,10 +73,17 @@ int main(int argc, char* argv[])
 	cs2=(mpz_t*)malloc(COUNT*sizeof(mpz_t));
 	ms2=(mpz_t*)malloc(COUNT*sizeof(mpz_t));
 	c=(mpz_t*)malloc(COUNT*sizeof(mpz_t));
+	csub=(mpz_t*)malloc(COUNT/2*sizeof(mpz_t));
+	w=(mpz_t*)malloc(LC_ROWS*LC_COUNT*sizeof(mpz_t));
+	bmlc=(mpz_t*)malloc(LC_ROWS*sizeof(mpz_t));
+	clc=(mpz_t*)malloc(LC_ROWS*sizeof(mpz_t));
 
 	for (i=0;i<COUNT;i++) {
 		mpz_inits(c[i],cs1[i],ms1[i],b_masks1[i],eb_masks1[i],cs2[i],ms2[i],b_masks2[i],eb_masks2[i],NULL);
 	}
+	for (i=0;i<COUNT/2;i++) { mpz_init(csub[i]); }
+	for (i=0;i<LC_ROWS*LC_COUNT;i++) { mpz_init(w[i]); }
+	for (i=0;i<LC_ROWS;i++) { mpz_inits(bmlc[i],clc[i],NULL); }
 
 	fp = fopen("/dev/urandom", "r");
 	if (!fp) { exit(1); }
@@ -52,8 +99,30 @@ int main(int argc, char* argv[])
 	l = 2048;
 	k = 128;
 
-	// setup
-	if (labhe_setup(p,n,y,D,l,k,_2k1,_2k,pm12k,enc1,gmpRandState)!=0) { exit(1); } 
+	// PRF backend (LABHE_PRF=aes selects AES-128, default Keccak)
+	if (getenv("LABHE_PRF") && strcmp(getenv("LABHE_PRF"),"aes")==0) {
+		if (prf_select(PRF_BACKEND_AES)!=0) { exit(1); }
+	}
+
+	// setup (reused from key-store files LABHE_KEYSTORE.pub/.sec if given)
+	ks_prefix = getenv("LABHE_KEYSTORE");
+	if (ks_prefix) {
+		snprintf(ks_pub,sizeof(ks_pub),"%s.pub",ks_prefix);
+		snprintf(ks_sec,sizeof(ks_sec),"%s.sec",ks_prefix);
+	}
+	if (ks_prefix && keystore_load_public(&kp,ks_pub)==0 && kp.k==k) {
+		if (keystore_load_secret(&ks,ks_sec)!=0) { exit(1); }
+		if (prf_select(kp.prf_backend)!=0) { exit(1); }
+		mpz_set(n,kp.n); mpz_set(y,kp.y); mpz_set(_2k,kp._2k); mpz_set(enc1,kp.enc1);
+		mpz_set(p,ks.p); mpz_set(D,ks.D); mpz_set(_2k1,ks._2k1); mpz_set(pm12k,ks.pm12k);
+		have_ks = 1;
+	} else {
+		if (labhe_setup(p,n,y,D,l,k,_2k1,_2k,pm12k,enc1,gmpRandState)!=0) { exit(1); } 
+		if (ks_prefix) {
+			if (keystore_save_public(ks_pub,n,y,k,_2k,enc1,6)!=0) { exit(1); }
+			if (keystore_save_secret(ks_sec,p,D,k,_2k1,pm12k)!=0) { exit(1); }
+		}
+	}
 
 	if (labhe_gen(pk1,sk1,n,y,k,_2k,gmpRandState)!=0) { exit(1); } 
 	if (labhe_gen(pk2,sk2,n,y,k,_2k,gmpRandState)!=0) { exit(1); } 
@@ -107,6 +176,63 @@ int main(int argc, char* argv[])
 
 	fprintf(stdout,"\n\nReduce cycles=%lld\n\n",after-before);
 
+	before=cpucycles();
+	labhe_innerprod_lev0(cip,cs1,eb_masks1,cs2,eb_masks2,COUNT,n,k,enc1);
+	after=cpucycles();
+
+	fprintf(stdout,"\n\nFused inner product cycles=%lld\n\n",after-before);
+
+	labhe_decrypt_online1(m,cip,b,p,D,k,_2k1,pm12k);
+	labhe_decrypt_online1(mp,cred,b,p,D,k,_2k1,pm12k);
+
+	if (mpz_cmp(m,mp)!=0) {
+		printf("Error.\n");
+		exit(1);
+	}
+
+	// Repeated queries over the same columns through the table cache
+	// (pass 1 cold, pass 2 builds tables, pass 3 hits; then two passes
+	// with a budget that forces evictions)
+	mpz_set_ui(mp,0);
+	for (i=0;i<CACHE_COUNT;i++) {
+		mpz_addmul(mp,ms1[i],ms2[i]);
+	}
+	mpz_mod(mp,mp,_2k);
+	labhe_decrypt_offline_ip_sk(t1,sk1,sk2,0,COUNT,CACHE_COUNT,k,_2k1);
+
+	for (budget=(size_t)1<<30,j=0;j<5;j++) {
+		if (j==0 || j==3) {
+			if (j==3) { labhe_cache_clear(cache); budget = (size_t)1<<20; }
+			if (labhe_cache_init(&cache,n,k,budget,2,8)!=0) { exit(1); }
+		}
+		before=cpucycles();
+		labhe_hommul_lev0_batch_cache(c,cache,1,0,cs1,eb_masks1,2,COUNT,cs2,eb_masks2,CACHE_COUNT,n,k,enc1);
+		after=cpucycles();
+
+		fprintf(stdout,"\n\nCached map (pass %d) cycles=%lld\n\n",j+1,after-before);
+
+		labhe_homadd_lev1_batch(t2,c,CACHE_COUNT,n);
+		labhe_decrypt_online1(m,t2,t1,p,D,k,_2k1,pm12k);
+		if (mpz_cmp(m,mp)!=0) {
+			printf("Error.\n");
+			exit(1);
+		}
+	}
+	labhe_cache_stats_get(cache,&cstats);
+	if (cstats.evictions == 0 || cstats.bytes > budget) {
+		printf("Error.\n");
+		exit(1);
+	}
+	labhe_homsmul_lev0_cache(t2,cip,cache,1,0,cs1[0],eb_masks1[0],ms2[0],k);
+	labhe_decrypt_nooff0(m,t2,cip,p,D,k,_2k1,pm12k);
+	mpz_mul(t2,ms1[0],ms2[0]);
+	mpz_mod(t2,t2,_2k);
+	if (mpz_cmp(m,t2)!=0) {
+		printf("Error.\n");
+		exit(1);
+	}
+	labhe_cache_clear(cache);
+
 	before=cpucycles();
 	labhe_decrypt_online1(m,cred,b,p,D,k,_2k1,pm12k);
 	after=cpucycles();
@@ -134,9 +260,241 @@ int main(int argc, char* argv[])
 		printf("OK!\n");
 	}
 
+	// Batch and lazy level-1 subtraction
+
+	before=cpucycles();
+	labhe_homsub_lev1_batch(csub,c,c+COUNT/2,COUNT/2,n);
+	after=cpucycles();
+
+	fprintf(stdout,"\n\nBatch subtraction (%d) cycles=%lld\n\n",COUNT/2,after-before);
+
+	for (i=0;i<COUNT/2;i++) {
+		labhe_homsub_lev1(t1,c[i],c[COUNT/2+i],n);
+		if (mpz_cmp(t1,csub[i])!=0) {
+			printf("Error.\n");
+			exit(1);
+		}
+	}
+
+	labhe_lev1_acc_init(&acc);
+	for (i=0;i<COUNT;i++) {
+		labhe_lev1_acc_add(&acc,c[i],n);
+		if (i < 10) { labhe_lev1_acc_sub(&acc,c[i],n); }
+	}
+	labhe_lev1_acc_final(t1,&acc,n);
+	labhe_lev1_acc_clear(&acc);
+	labhe_homadd_lev1_batch(t2,c+10,COUNT-10,n);
+
+	if (mpz_cmp(t1,t2)!=0) {
+		printf("Error.\n");
+		exit(1);
+	}
+
+	printf("OK!\n");
+
+	// Pipelined offline/online encryption
+
+	for (i=0;i<2*PIPE_COUNT;i++) { mpz_init(pout[i]); }
+
+	if (rng_init(&rng)!=0) { exit(1); }
+	if (labhe_pipe_start(&lp,PIPE_START,16 /* depth */,2 /* workers */,sk1,n,y,k,_2k,&rng,pipe_output,pout)!=0) { exit(1); }
+
+	before=cpucycles();
+	for (i=0;i<PIPE_COUNT;i++) {
+		if (labhe_pipe_encrypt(lp,ms1[i])!=0) { printf("Error.\n"); exit(1); }
+	}
+	after=cpucycles();
+
+	if (labhe_pipe_stop(lp,&pstats)!=0) { printf("Error.\n"); exit(1); }
+
+	fprintf(stdout,"\n\nPipelined Encrypt cycles=%lld (stalls %lld, stalled %lld ns, full waits %lld)\n\n",
+	        after-before,pstats.stalls,pstats.stall_ns,pstats.full_waits);
+
+	mpz_set_ui(mp,0);
+	mpz_set_ui(t2,0);
+	for (i=0;i<PIPE_COUNT;i++) {
+		mpz_add(mp,mp,ms1[i]);
+		mpz_add(t2,t2,pout[2*i]);
+	}
+	mpz_mod(mp,mp,_2k);
+	mpz_mod(t2,t2,_2k);
+
+	labhe_decrypt_offline_sum0_sk(b,sk1,PIPE_START,PIPE_COUNT,k);
+	labhe_decrypt_online0(m,t2,b,k);
+	if (pstats.encrypted != PIPE_COUNT || mpz_cmp(m,mp)!=0) {
+		printf("Error.\n");
+		exit(1);
+	}
+
+	labhe_decrypt_nooff0(m,pout[0],pout[1],p,D,k,_2k1,pm12k);
+	if (mpz_cmp(m,ms1[0])!=0) {
+		printf("Error.\n");
+		exit(1);
+	}
+
+	for (i=0;i<2*PIPE_COUNT;i++) { mpz_clear(pout[i]); }
+
+	printf("OK!\n");
+
+	// Linear combinations of level-0 ciphertexts with a weight matrix
+
+	for (i=0;i<LC_ROWS*LC_COUNT;i++) {
+		mpz_urandomb(w[i],gmpRandState,k);
+	}
+
+	before=cpucycles();
+	labhe_lincomb_lev0(bmlc,clc,cs1,eb_masks1,LC_COUNT,w,LC_ROWS,n,k);
+	after=cpucycles();
+
+	fprintf(stdout,"\n\nLinear combination (%d x %d) cycles=%lld\n\n",LC_ROWS,LC_COUNT,after-before);
+
+	// A single row recomputes row 0 (8 x 100 and 1 x 100 both take the
+	// multi-exponentiation path)
+	labhe_lincomb_lev0(bmlc,clc,cs1,eb_masks1,LC_COUNT,w,1,n,k);
+
+	for (j=0;j<LC_ROWS;j++) {
+		mpz_set_ui(mp,0);
+		for (i=0;i<LC_COUNT;i++) {
+			mpz_addmul(mp,w[j*LC_COUNT+i],ms1[i]);
+		}
+		mpz_mod(mp,mp,_2k);
+
+		labhe_decrypt_offline_lincomb_sk(b,sk1,0 /* start label */,w+j*LC_COUNT,LC_COUNT,k);
+		labhe_decrypt_online0(m,bmlc[j],b,k);
+		if (mpz_cmp(m,mp)!=0) {
+			printf("Error.\n");
+			exit(1);
+		}
+
+		labhe_decrypt_nooff0(m,bmlc[j],clc[j],p,D,k,_2k1,pm12k);
+		if (mpz_cmp(m,mp)!=0) {
+			printf("Error.\n");
+			exit(1);
+		}
+	}
+
+	printf("OK!\n");
+
+	// Many rows over few ciphertexts go through the fixed-base table path,
+	// checked against naive exponentiations
+	labhe_lincomb_lev1(clc,eb_masks1,LC_TAB_COUNT,w,LC_ROWS,n);
+	for (j=0;j<LC_ROWS;j++) {
+		mpz_set_ui(t1,1);
+		for (i=0;i<LC_TAB_COUNT;i++) {
+			mpz_powm(t2,eb_masks1[i],w[j*LC_TAB_COUNT+i],n);
+			mpz_mul(t1,t1,t2);
+			mpz_mod(t1,t1,n);
+		}
+		if (mpz_cmp(clc[j],t1)!=0) {
+			printf("Error.\n");
+			exit(1);
+		}
+	}
+
+	printf("OK!\n");
+
+	// Same labels summed across many encryptors (user-major arrays)
+
+	// Encryptor keys issued in bulk, one at a time for comparison
+	for (i=0;i<AGG_USERS;i++) { mpz_init(pks[i]); }
+	before=cpucycles();
+	for (i=0;i<AGG_USERS;i++) {
+		if (labhe_gen(pks[i],sks+i*SK_SIZE,n,y,k,_2k,gmpRandState)!=0) { exit(1); }
+	}
+	after=cpucycles();
+	fprintf(stdout,"\n\nKey issuance (%d users, labhe_gen) cycles=%lld\n",AGG_USERS,after-before);
+	before=cpucycles();
+	if (labhe_gen_batch(pks,sks,AGG_USERS,n,y,have_ks ? &kp.ytab : NULL,k,_2k,4)!=0) { exit(1); }
+	after=cpucycles();
+	fprintf(stdout,"Key issuance (%d users, labhe_gen_batch) cycles=%lld\n\n",AGG_USERS,after-before);
+
+	snprintf(gen_path,sizeof(gen_path),"/tmp/labhe-gen-test-%d",(int)getpid());
+	if (labhe_gen_save(gen_path,(const mpz_t *)pks,sks,AGG_USERS,n,k)!=0) { exit(1); }
+	if (labhe_gen_load(gen_path,&pks_ld,&sks_ld,&count_ld,&k_ld)!=0) { exit(1); }
+	unlink(gen_path);
+	if (count_ld!=AGG_USERS || k_ld!=k || memcmp(sks,sks_ld,sizeof(sks))!=0) {
+		printf("Error.\n");
+		exit(1);
+	}
+	for (i=0;i<AGG_USERS;i++) {
+		if (mpz_cmp(pks[i],pks_ld[i])!=0) {
+			printf("Error.\n");
+			exit(1);
+		}
+	}
+	labhe_gen_keys_clear(pks_ld,sks_ld,count_ld);
+
+	for (i=0;i<AGG_USERS;i++) {
+		labhe_encrypt_offline_batch(b_masks2+i*AGG_LABELS,eb_masks2+i*AGG_LABELS,AGG_START,AGG_LABELS,
+		                            sks+i*SK_SIZE,n,y,k,_2k,gmpRandState);
+		for (j=0;j<AGG_LABELS;j++) { mpz_urandomb(ms2[i*AGG_LABELS+j],gmpRandState,32); }
+		labhe_encrypt_online_batch(cs2+i*AGG_LABELS,b_masks2+i*AGG_LABELS,ms2+i*AGG_LABELS,AGG_LABELS,k);
+	}
+
+	before=cpucycles();
+	if (labhe_decrypt_offline_indep_batch(sks_rec,(const mpz_t *)pks,AGG_USERS,p,D,have_ks ? (const mpz_t *)ks.Dpow : NULL,k,_2k1,pm12k,4)!=0) { exit(1); }
+	after=cpucycles();
+
+	fprintf(stdout,"\n\nKey recovery (%d users) cycles=%lld\n\n",AGG_USERS,after-before);
+
+	// A failed discrete logarithm (public key 0 mod p) fails the batch
+	mpz_swap(t1,pks[1]);
+	mpz_set(pks[1],p);
+	if (labhe_decrypt_offline_indep_batch(sks_rec,(const mpz_t *)pks,AGG_USERS,p,D,NULL,k,_2k1,pm12k,4)==0) {
+		printf("Error.\n");
+		exit(1);
+	}
+	mpz_swap(t1,pks[1]);
+	if (labhe_decrypt_offline_indep_batch(sks_rec,(const mpz_t *)pks,AGG_USERS,p,D,NULL,k,_2k1,pm12k,4)!=0) { exit(1); }
+
+	if (memcmp(sks,sks_rec,sizeof(sks))!=0) {
+		printf("Error.\n");
+		exit(1);
+	}
+
+	before=cpucycles();
+	labhe_agg_lev0(bmlc,clc,cs2,eb_masks2,AGG_USERS,AGG_LABELS,n,k,4);
+	labhe_decrypt_offline_agg_sk(c,sks_rec,AGG_USERS,AGG_START,AGG_LABELS,k,4);
+	after=cpucycles();
+
+	fprintf(stdout,"\n\nAggregation (%d users x %d labels) cycles=%lld\n\n",AGG_USERS,AGG_LABELS,after-before);
+
+	for (j=0;j<AGG_LABELS;j++) {
+		mpz_set_ui(mp,0);
+		for (i=0;i<AGG_USERS;i++) { mpz_add(mp,mp,ms2[i*AGG_LABELS+j]); }
+		mpz_mod(mp,mp,_2k);
+
+		labhe_decrypt_online0(m,bmlc[j],c[j],k);
+		if (mpz_cmp(m,mp)!=0) {
+			printf("Error.\n");
+			exit(1);
+		}
+		labhe_decrypt_nooff0(m,bmlc[j],clc[j],p,D,k,_2k1,pm12k);
+		if (mpz_cmp(m,mp)!=0) {
+			printf("Error.\n");
+			exit(1);
+		}
+	}
+
+	// Level-1 aggregation matches the level-0 ciphertext products
+	labhe_agg_lev1(c,(const mpz_t *)eb_masks2,AGG_USERS,AGG_LABELS,n,3);
+	for (j=0;j<AGG_LABELS;j++) {
+		if (mpz_cmp(c[j],clc[j])!=0) {
+			printf("Error.\n");
+			exit(1);
+		}
+	}
+	for (i=0;i<AGG_USERS;i++) { mpz_clear(pks[i]); }
+
+	printf("OK!\n");
+
 	if (fclose(fp)) { exit(1); }
+	if (have_ks) {
+		keystore_close_public(&kp);
+		keystore_close_secret(&ks);
+	}
 
-    mpz_clears(p, n, y, D,seed,pk1,pk2,_2k,_2k1,pm12k, enc1, t1, t2, mp,cred,b,m,NULL);
+    mpz_clears(p, n, y, D,seed,pk1,pk2,_2k,_2k1,pm12k, enc1, t1, t2, mp,cred,cip,b,m,NULL);
     for (i=0;i<COUNT;i++) {
        mpz_clears(c[i],cs1[i],ms1[i],b_masks1[i],eb_masks1[i],cs2[i],ms2[i],b_masks2[i],eb_masks2[i], NULL);
     }
@@ -151,6 +509,13 @@ int main(int argc, char* argv[])
 	free(cs2);
 	free(ms2);
 	free(c);
+	for (i=0;i<COUNT/2;i++) { mpz_clear(csub[i]); }
+	free(csub);
+	for (i=0;i<LC_ROWS*LC_COUNT;i++) { mpz_clear(w[i]); }
+	for (i=0;i<LC_ROWS;i++) { mpz_clears(bmlc[i],clc[i],NULL); }
+	free(w);
+	free(bmlc);
+	free(clc);
 
 	exit(0);
 }
@@ -0,0 +1,144 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <gmp.h>
+
+#include "bench.h"
+#include "labhe.h"
+#include "labhe_gen.h"
+#include "labhe_window.h"
+#include "prf.h"
+#include "test_common.h"
+
+#define COUNT 200
+#define WIDTH 37
+#define START1 10
+#define START2 9000
+#define CHECK1 20   // level-1 windows are decrypted every CHECK1 ticks
+
+/*
+ * Cycles of one tick (push + mask update) of a full window of the given width
+ */
+static long long tick_cycles(const int width, const mpz_t *bm, const mpz_t *c, const unsigned char *sk,
+	                         const mpz_t n, const int k)
+{
+	labhe_window w;
+	labhe_window_mask wm;
+	long long before, after, best = -1;
+	int i;
+
+	check(labhe_window_init(&w,0,width,k)==0);
+	check(labhe_window_mask_init(&wm,0,width,sk,NULL,START1,START2,k)==0);
+	for (i=0;i<width+COUNT;i++) {
+		before=cpucycles();
+		labhe_window_push0(&w,bm[i%COUNT],c[i%COUNT],n);
+		labhe_window_mask_push(&wm);
+		after=cpucycles();
+		if (i >= width && (best < 0 || after-before < best)) { best = after-before; }
+	}
+	labhe_window_clear(&w);
+	labhe_window_mask_clear(&wm);
+
+	return best;
+}
+
+int main(int argc, char* argv[])
+{
+	mpz_t p, n, y, D, seed, pk1, pk2, _2k, _2k1, pm12k, enc1, b, m, mp, bm, c, t;
+	mpz_t b_masks1[COUNT], eb_masks1[COUNT], cs1[COUNT], ms1[COUNT];
+	mpz_t b_masks2[COUNT], eb_masks2[COUNT], cs2[COUNT], ms2[COUNT];
+	unsigned char sk1[SK_SIZE], sk2[SK_SIZE];
+	unsigned char rand_buff[16];
+	labhe_window w0, w1;
+	labhe_window_mask wm0, wm1;
+	int k, i, j, lo;
+	FILE *fp;
+
+	mpz_inits(p, n, y, D, seed, pk1, pk2, _2k, _2k1, pm12k, enc1, b, m, mp, bm, c, t, NULL);
+	for (i=0;i<COUNT;i++) {
+		mpz_inits(b_masks1[i],eb_masks1[i],cs1[i],ms1[i],b_masks2[i],eb_masks2[i],cs2[i],ms2[i],NULL);
+	}
+
+	fp = fopen("/dev/urandom", "r");
+	if (!fp) { exit(1); }
+	if (fread(rand_buff, sizeof(rand_buff), 1, fp) != 1)  { exit(1); }
+	if (fclose(fp)) { exit(1); }
+
+	mpz_import(seed, sizeof(rand_buff), 1, sizeof(rand_buff[0]), 0, 0, rand_buff);
+
+	gmp_randstate_t gmpRandState;
+	gmp_randinit_default(gmpRandState);
+	gmp_randseed(gmpRandState, seed);
+
+	k = TEST_K;
+
+	test_labhe_setup(p,n,y,D,_2k1,_2k,pm12k,enc1,pk1,sk1,pk2,sk2,gmpRandState);
+
+	for (i=0;i<COUNT;i++) {
+		mpz_urandomb(ms1[i],gmpRandState,k);
+		mpz_urandomb(ms2[i],gmpRandState,k);
+	}
+	labhe_encrypt_offline_batch(b_masks1,eb_masks1,START1,COUNT,sk1,n,y,k,_2k,gmpRandState);
+	labhe_encrypt_offline_batch(b_masks2,eb_masks2,START2,COUNT,sk2,n,y,k,_2k,gmpRandState);
+	labhe_encrypt_online_batch(cs1,b_masks1,ms1,COUNT,k);
+	labhe_encrypt_online_batch(cs2,b_masks2,ms2,COUNT,k);
+
+	// Failed starts can be released like started windows
+	check(labhe_window_init(&w0,2,WIDTH,k)!=0);
+	labhe_window_clear(&w0);
+	check(labhe_window_mask_init(&wm0,1,WIDTH,sk1,NULL,START1,START2,k)!=0);
+	labhe_window_mask_clear(&wm0);
+
+	// Rolling sum and rolling inner product, checked at every tick
+	check(labhe_window_init(&w0,0,WIDTH,k)==0);
+	check(labhe_window_init(&w1,1,WIDTH,k)==0);
+	check(labhe_window_mask_init(&wm0,0,WIDTH,sk1,NULL,START1,START2,k)==0);
+	check(labhe_window_mask_init(&wm1,1,WIDTH,sk1,sk2,START1,START2,k)==0);
+	check(labhe_window_push1(&w0,eb_masks1[0],n)!=0 && labhe_window_push0(&w1,cs1[0],eb_masks1[0],n)!=0);
+	for (i=0;i<COUNT;i++) {
+		check(labhe_window_push0(&w0,cs1[i],eb_masks1[i],n)==0);
+		check(labhe_window_push_ip(&w1,cs1[i],eb_masks1[i],cs2[i],eb_masks2[i],n,enc1)==0);
+		check(labhe_window_mask_push(&wm0)==0 && labhe_window_mask_push(&wm1)==0);
+		lo = (i+1 > WIDTH) ? i+1-WIDTH : 0;
+
+		check(labhe_window_get(bm,c,&w0,n)==0);
+		labhe_decrypt_offline_sum0_sk(b,sk1,START1+lo,i+1-lo,k);
+		check(mpz_cmp(b,wm0.b)==0);
+		mpz_set_ui(mp,0);
+		for (j=lo;j<=i;j++) { mpz_add(mp,mp,ms1[j]); }
+		mpz_mod(mp,mp,_2k);
+		labhe_decrypt_online0(m,bm,wm0.b,k);
+		check(mpz_cmp(m,mp)==0);
+
+		labhe_decrypt_offline_ip_sk(b,sk1,sk2,START1+lo,START2+lo,i+1-lo,k,_2k1);
+		check(mpz_cmp(b,wm1.b)==0);
+		if (i % CHECK1 == 0 || i == COUNT-1) {
+			labhe_decrypt_nooff0(m,bm,c,p,D,k,_2k1,pm12k);
+			check(mpz_cmp(m,mp)==0);
+			check(labhe_window_get(NULL,c,&w1,n)==0);
+			mpz_set_ui(mp,0);
+			for (j=lo;j<=i;j++) { mpz_addmul(mp,ms1[j],ms2[j]); }
+			mpz_mod(mp,mp,_2k);
+			labhe_decrypt_online1(m,c,wm1.b,p,D,k,_2k1,pm12k);
+			check(mpz_cmp(m,mp)==0);
+		}
+	}
+	labhe_window_clear(&w0);
+	labhe_window_clear(&w1);
+	labhe_window_mask_clear(&wm0);
+	labhe_window_mask_clear(&wm1);
+
+	// Tick cost does not depend on the width
+	for (i=16;i<=4096;i*=16) {
+		fprintf(stdout,"width %d: tick cycles=%lld\n",i,tick_cycles(i,(const mpz_t *)cs1,(const mpz_t *)eb_masks1,sk1,n,k));
+	}
+
+	printf("OK!\n");
+
+	for (i=0;i<COUNT;i++) {
+		mpz_clears(b_masks1[i],eb_masks1[i],cs1[i],ms1[i],b_masks2[i],eb_masks2[i],cs2[i],ms2[i],NULL);
+	}
+	mpz_clears(p, n, y, D, seed, pk1, pk2, _2k, _2k1, pm12k, enc1, b, m, mp, bm, c, t, NULL);
+	gmp_randclear(gmpRandState);
+
+	return 0;
+}
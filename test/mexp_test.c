@@ -0,0 +1,99 @@
+#include <stdlib.h> 
+#include <stdio.h>
+#include <gmp.h>
+
+#include "bench.h"
+#include "mexp.h"
+
+#define MAX_COUNT 300
+
+int main(int argc, char* argv[])
+{
+	mpz_t n, r, rp, t, seed, bases[MAX_COUNT], exps[MAX_COUNT];
+	long long before, after;
+	int i, j, l;
+	FILE *fp;
+	unsigned char rand_buff[16];
+	const int counts[] = { 1, 2, 17, MAX_COUNT };
+	const int ebits[] = { 1, 64, 128, 300 };
+
+	mpz_inits(n, r, rp, t, seed, NULL);
+	for (i=0;i<MAX_COUNT;i++) { mpz_inits(bases[i],exps[i],NULL); }
+
+	fp = fopen("/dev/urandom", "r");
+	if (!fp) { exit(1); }
+
+	if (fread(rand_buff, sizeof(rand_buff), 1, fp) != 1)  { exit(1); }
+	if (fclose(fp)) { exit(1); }
+
+	mpz_import(seed, sizeof(rand_buff), 1, sizeof(rand_buff[0]), 0, 0, rand_buff);
+
+	gmp_randstate_t gmpRandState;
+	gmp_randinit_default(gmpRandState);
+	gmp_randseed(gmpRandState, seed);
+
+	l = 2048;
+
+	mpz_urandomb(n,gmpRandState,l);
+	mpz_setbit(n,l-1);
+	mpz_setbit(n,0);
+
+	for (i=0;i<MAX_COUNT;i++) {
+		mpz_urandomm(bases[i],gmpRandState,n);
+	}
+
+	for (j=0;j<(int)(sizeof(counts)/sizeof(counts[0]));j++) {
+		for (i=0;i<counts[j];i++) {
+			mpz_urandomb(exps[i],gmpRandState,ebits[j]);
+		}
+		// Zero exponents must be handled
+		mpz_set_ui(exps[0],0);
+
+		before=cpucycles();
+		mexp_powm_multi(r,(const mpz_t *)bases,(const mpz_t *)exps,counts[j],n);
+		after=cpucycles();
+
+		fprintf(stdout,"Multi-exponentiation (%d bases, %d bits) cycles=%lld\n",counts[j],ebits[j],after-before);
+
+		before=cpucycles();
+		mpz_set_ui(rp,1);
+		for (i=0;i<counts[j];i++) {
+			mpz_powm(t,bases[i],exps[i],n);
+			mpz_mul(rp,rp,t);
+			mpz_mod(rp,rp,n);
+		}
+		after=cpucycles();
+
+		fprintf(stdout,"Naive product (%d bases, %d bits) cycles=%lld\n\n",counts[j],ebits[j],after-before);
+
+		if (mpz_cmp(r,rp)!=0) {
+			printf("Error.\n");
+			exit(1);
+		}
+	}
+
+	// Fixed-base tables, including exponents longer than the table
+	for (j=1;j<=6;j++) {
+		mexp_table tab;
+
+		mexp_table_init(&tab,bases[j],128,j,n);
+		for (i=0;i<4;i++) {
+			mpz_urandomb(exps[i],gmpRandState,(i==3)?200:128);
+			mexp_table_powm(r,&tab,exps[i],n);
+			mpz_powm(rp,bases[j],exps[i],n);
+			if (mpz_cmp(r,rp)!=0) {
+				printf("Error.\n");
+				exit(1);
+			}
+		}
+		mexp_table_clear(&tab);
+	}
+
+	printf("OK!\n");
+
+	mpz_clears(n, r, rp, t, seed, NULL);
+	for (i=0;i<MAX_COUNT;i++) { mpz_clears(bases[i],exps[i],NULL); }
+	gmp_randclear(gmpRandState);
+
+	exit(0);
+}
@@ -0,0 +1,158 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <gmp.h>
+
+#include "mont.h"
+#include "bench.h"
+
+#define TEST_OPS 200
+#define TEST_PROD 1000
+
+static void check(const int ok)
+{
+	if (!ok) {
+		printf("Error.\n");
+		exit(1);
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	static const int sizes[] = { 1024, 1025, 1536, 2048, 2050, 3072, 4096 };
+	mpz_t m, a, b, e, r1, r2, seed, xs[TEST_PROD];
+	long long before, after;
+	mont_ctx ctx;
+	const mont_ctx *shared;
+	int i, s;
+	FILE *fp;
+	unsigned char rand_buff[16];
+
+	mpz_inits(m, a, b, e, r1, r2, seed, NULL);
+	for (i=0;i<TEST_PROD;i++) { mpz_init(xs[i]); }
+
+	fp = fopen("/dev/urandom", "r");
+	if (!fp) { exit(1); }
+	if (fread(rand_buff, sizeof(rand_buff), 1, fp) != 1)  { exit(1); }
+	if (fclose(fp)) { exit(1); }
+
+	mpz_import(seed, sizeof(rand_buff), 1, sizeof(rand_buff[0]), 0, 0, rand_buff);
+
+	gmp_randstate_t gmpRandState;
+	gmp_randinit_default(gmpRandState);
+	gmp_randseed(gmpRandState, seed);
+
+	// Unsupported sizes and even moduli are rejected
+	mpz_urandomb(m,gmpRandState,900);
+	mpz_setbit(m,899); mpz_setbit(m,0);
+	check(mont_init(&ctx,m)!=0 && mont_lookup(m)==NULL);
+	mpz_urandomb(m,gmpRandState,2048);
+	mpz_setbit(m,2047); mpz_clrbit(m,0);
+	check(mont_init(&ctx,m)!=0);
+
+	for (s=0;s<(int)(sizeof(sizes)/sizeof(sizes[0]));s++) {
+		mpz_urandomb(m,gmpRandState,sizes[s]);
+		mpz_setbit(m,sizes[s]-1); mpz_setbit(m,0);
+		check(mont_init(&ctx,m)==0);
+		shared = mont_lookup(m);
+		check(shared!=NULL && shared==mont_lookup(m));
+
+		for (i=0;i<20;i++) {
+			mpz_urandomm(a,gmpRandState,m);
+			mpz_urandomm(b,gmpRandState,m);
+			mpz_urandomb(e,gmpRandState,i*40);
+
+			mont_mulmod(r1,a,b,&ctx);
+			mpz_mul(r2,a,b); mpz_mod(r2,r2,m);
+			check(mpz_cmp(r1,r2)==0);
+
+			mont_powm(r1,a,e,&ctx);
+			mpz_powm(r2,a,e,m);
+			check(mpz_cmp(r1,r2)==0);
+
+			mont_powm_2exp(r1,a,i,&ctx);
+			mpz_set_ui(e,0); mpz_setbit(e,i);
+			mpz_powm(r2,a,e,m);
+			check(mpz_cmp(r1,r2)==0);
+
+			// inputs longer than the modulus are reduced first
+			mpz_mul(b,b,m); mpz_add(b,b,a);
+			mont_powm(r1,b,e,&ctx);
+			check(mpz_cmp(r1,r2)==0);
+		}
+
+		for (i=0;i<TEST_PROD;i++) { mpz_urandomm(xs[i],gmpRandState,m); }
+
+		// Joint exponentiation of 3 bases (exponents in xs[3..5])
+		for (i=3;i<6;i++) { mpz_urandomb(xs[i],gmpRandState,128+i); }
+		check(mont_powm_multi(r1,(const mpz_t *)xs,(const mpz_t *)xs+3,3,&ctx)==0);
+		mpz_set_ui(r2,1);
+		for (i=0;i<3;i++) { mpz_powm(a,xs[i],xs[i+3],m); mpz_mul(r2,r2,a); mpz_mod(r2,r2,m); }
+		check(mpz_cmp(r1,r2)==0);
+		check(mont_powm_multi(r1,(const mpz_t *)xs,(const mpz_t *)xs+3,MONT_MULTI_MAX+1,&ctx)!=0);
+
+		before=cpucycles();
+		for (i=0;i<TEST_OPS/20;i++) { mont_powm_multi(r1,(const mpz_t *)xs,(const mpz_t *)xs+3,3,&ctx); }
+		after=cpucycles();
+		fprintf(stdout,"\n%d bits: Montgomery 3-base joint powm cycles=%lld\n",sizes[s],(after-before)/(TEST_OPS/20));
+
+		before=cpucycles();
+		for (i=0;i<TEST_OPS/20;i++) {
+			mpz_powm(r2,xs[0],xs[3],m);
+			mpz_powm(a,xs[1],xs[4],m); mpz_mul(r2,r2,a); mpz_mod(r2,r2,m);
+			mpz_powm(a,xs[2],xs[5],m); mpz_mul(r2,r2,a); mpz_mod(r2,r2,m);
+		}
+		after=cpucycles();
+		fprintf(stdout,"%d bits: GMP 3 x powm cycles=%lld\n",sizes[s],(after-before)/(TEST_OPS/20));
+		check(mpz_cmp(r1,r2)==0);
+
+		for (i=0;i<TEST_PROD;i++) { mpz_urandomm(xs[i],gmpRandState,m); }
+		mont_prod(r1,(const mpz_t *)xs,TEST_PROD,&ctx);
+		mpz_set(r2,xs[0]);
+		for (i=1;i<TEST_PROD;i++) { mpz_mul(r2,r2,xs[i]); mpz_mod(r2,r2,m); }
+		check(mpz_cmp(r1,r2)==0);
+		mont_prod(r1,(const mpz_t *)xs,1,&ctx);
+		check(mpz_cmp(r1,xs[0])==0);
+
+		// Kernels against generic GMP
+		mpz_urandomb(e,gmpRandState,sizes[s]);
+
+		before=cpucycles();
+		for (i=0;i<TEST_OPS;i++) { mpz_mul(r2,xs[i],xs[i+1]); mpz_mod(r2,r2,m); }
+		after=cpucycles();
+		fprintf(stdout,"\n%d bits: GMP mulmod cycles=%lld\n",sizes[s],(after-before)/TEST_OPS);
+
+		before=cpucycles();
+		for (i=0;i<TEST_OPS;i++) { mont_mulmod(r1,xs[i],xs[i+1],&ctx); }
+		after=cpucycles();
+		fprintf(stdout,"%d bits: Montgomery mulmod cycles=%lld\n",sizes[s],(after-before)/TEST_OPS);
+
+		before=cpucycles();
+		for (i=1;i<TEST_PROD;i++) { mpz_mul(r2,r2,xs[i]); mpz_mod(r2,r2,m); }
+		after=cpucycles();
+		fprintf(stdout,"%d bits: GMP product cycles/factor=%lld\n",sizes[s],(after-before)/TEST_PROD);
+
+		before=cpucycles();
+		mont_prod(r1,(const mpz_t *)xs,TEST_PROD,&ctx);
+		after=cpucycles();
+		fprintf(stdout,"%d bits: Montgomery product cycles/factor=%lld\n",sizes[s],(after-before)/TEST_PROD);
+
+		before=cpucycles();
+		for (i=0;i<TEST_OPS/20;i++) { mpz_powm(r2,xs[i],e,m); }
+		after=cpucycles();
+		fprintf(stdout,"%d bits: GMP powm cycles=%lld\n",sizes[s],(after-before)/(TEST_OPS/20));
+
+		before=cpucycles();
+		for (i=0;i<TEST_OPS/20;i++) { mont_powm(r1,xs[i],e,&ctx); }
+		after=cpucycles();
+		fprintf(stdout,"%d bits: Montgomery powm cycles=%lld\n",sizes[s],(after-before)/(TEST_OPS/20));
+		check(mpz_cmp(r1,r2)==0);
+	}
+
+	printf("OK!\n");
+
+	for (i=0;i<TEST_PROD;i++) { mpz_clear(xs[i]); }
+	mpz_clears(m, a, b, e, r1, r2, seed, NULL);
+	gmp_randclear(gmpRandState);
+
+	return 0;
+}
@@ -0,0 +1,116 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <gmp.h>
+
+#include "mont.h"
+#include "bench.h"
+
+#define BATCH 19   // two full vectors and a remainder of either width
+#define BENCH 16
+
+static void check(const int ok)
+{
+	if (!ok) {
+		printf("Error.\n");
+		exit(1);
+	}
+}
+
+static const char *backend_name(const int b)
+{
+	return (b == MONT_BACKEND_IFMA) ? "IFMA" : (b == MONT_BACKEND_AVX2) ? "AVX2" : "scalar";
+}
+
+int main(int argc, char* argv[])
+{
+	static const int sizes[] = { 1024, 1025, 2048, 2050, 3072, 4096 };
+	static const int backends[] = { MONT_BACKEND_SCALAR, MONT_BACKEND_AVX2, MONT_BACKEND_IFMA };
+	mpz_t m, t, a, seed, bases[3*BATCH], exps[3*BATCH], r[BATCH];
+	long long before, after;
+	const mont_ctx *ctx;
+	int i, j, l, s, bi, nb, def;
+	FILE *fp;
+	unsigned char rand_buff[16];
+
+	mpz_inits(m, t, a, seed, NULL);
+	for (i=0;i<3*BATCH;i++) { mpz_inits(bases[i], exps[i], NULL); }
+	for (i=0;i<BATCH;i++) { mpz_init(r[i]); }
+
+	fp = fopen("/dev/urandom", "r");
+	if (!fp) { exit(1); }
+	if (fread(rand_buff, sizeof(rand_buff), 1, fp) != 1)  { exit(1); }
+	if (fclose(fp)) { exit(1); }
+
+	mpz_import(seed, sizeof(rand_buff), 1, sizeof(rand_buff[0]), 0, 0, rand_buff);
+
+	gmp_randstate_t gmpRandState;
+	gmp_randinit_default(gmpRandState);
+	gmp_randseed(gmpRandState, seed);
+
+	def = mont_backend();
+	fprintf(stdout,"Default batch backend: %s\n",backend_name(def));
+	check(mont_backend_hw(def) && mont_backend_hw(MONT_BACKEND_SCALAR));
+	check(mont_backend_select(7)!=0);
+
+	for (s=0;s<(int)(sizeof(sizes)/sizeof(sizes[0]));s++) {
+		mpz_urandomb(m,gmpRandState,sizes[s]);
+		mpz_setbit(m,sizes[s]-1); mpz_setbit(m,0);
+		ctx = mont_lookup(m);
+		check(ctx!=NULL);
+
+		for (bi=0;bi<3;bi++) {
+			if (mont_backend_select(backends[bi]) != 0) {
+				check(!mont_backend_hw(backends[bi]));
+				continue;
+			}
+
+			// 1 to 3 bases, exponents of mixed lengths, zero and base 0/1 edge cases
+			for (nb=1;nb<=3;nb++) {
+				for (i=0;i<nb*BATCH;i++) {
+					mpz_urandomm(bases[i],gmpRandState,m);
+					mpz_urandomb(exps[i],gmpRandState,(i % 5 == 0) ? 64 : 130+i);
+				}
+				mpz_set_ui(exps[nb],0);
+				mpz_set_ui(bases[2*nb],1);
+				mpz_set_ui(bases[3*nb],0);
+				mpz_add(bases[4*nb],bases[4*nb],m);   // reduced first
+				mpz_sub_ui(bases[5*nb],m,1);
+				check(mont_powm_multi_batch(r,(const mpz_t *)bases,(const mpz_t *)exps,nb,BATCH,ctx)==0);
+				for (i=0;i<BATCH;i++) {
+					mpz_set_ui(t,1);
+					for (l=0;l<nb;l++) {
+						mpz_powm(a,bases[i*nb+l],exps[i*nb+l],m);
+						mpz_mul(t,t,a);
+						mpz_mod(t,t,m);
+					}
+					check(mpz_cmp(r[i],t)==0);
+				}
+			}
+			check(mont_powm_multi_batch(r,(const mpz_t *)bases,(const mpz_t *)exps,MONT_MULTI_MAX+1,BATCH,ctx)!=0);
+
+			// Full-size exponents (as in decryption), per exponentiation
+			for (i=0;i<BENCH;i++) {
+				mpz_urandomm(bases[i],gmpRandState,m);
+				mpz_urandomb(exps[i],gmpRandState,sizes[s]);
+			}
+			before=cpucycles();
+			check(mont_powm_multi_batch(r,(const mpz_t *)bases,(const mpz_t *)exps,1,BENCH,ctx)==0);
+			after=cpucycles();
+			for (j=0;j<BENCH;j++) {
+				mpz_powm(t,bases[j],exps[j],m);
+				check(mpz_cmp(r[j],t)==0);
+			}
+			fprintf(stdout,"%d bits: %s batch powm cycles=%lld\n",sizes[s],backend_name(backends[bi]),(after-before)/BENCH);
+		}
+	}
+	check(mont_backend_select(def)==0);
+
+	printf("OK!\n");
+
+	for (i=0;i<3*BATCH;i++) { mpz_clears(bases[i], exps[i], NULL); }
+	for (i=0;i<BATCH;i++) { mpz_clear(r[i]); }
+	mpz_clears(m, t, a, seed, NULL);
+	gmp_randclear(gmpRandState);
+
+	return 0;
+}
@@ -1,19 +1,55 @@
 #include <stdlib.h> 
 #include <stdio.h>
+#include <string.h>
+#include <gmp.h>
 
 #include "bench.h"
 #include "prf.h"
+#include "rng.h"
 
 #define TEST_NONCES 10
+#define BATCH_NONCES 4096
+
+// FIPS-197 Appendix B and C.1 known answers
+static const unsigned char aes_kat_key[2][SK_SIZE] = {
+	{0x2b,0x7e,0x15,0x16,0x28,0xae,0xd2,0xa6,0xab,0xf7,0x15,0x88,0x09,0xcf,0x4f,0x3c},
+	{0x00,0x01,0x02,0x03,0x04,0x05,0x06,0x07,0x08,0x09,0x0a,0x0b,0x0c,0x0d,0x0e,0x0f}
+};
+static const unsigned char aes_kat_in[2][LABEL_SIZE] = {
+	{0x32,0x43,0xf6,0xa8,0x88,0x5a,0x30,0x8d,0x31,0x31,0x98,0xa2,0xe0,0x37,0x07,0x34},
+	{0x00,0x11,0x22,0x33,0x44,0x55,0x66,0x77,0x88,0x99,0xaa,0xbb,0xcc,0xdd,0xee,0xff}
+};
+static const unsigned char aes_kat_out[2][NONCE_SIZE] = {
+	{0x39,0x25,0x84,0x1d,0x02,0xdc,0x09,0xfb,0xdc,0x11,0x85,0x97,0x19,0x6a,0x0b,0x32},
+	{0x69,0xc4,0xe0,0xd8,0x6a,0x7b,0x04,0x30,0xd8,0xcd,0xb7,0x80,0x70,0xb4,0xc5,0x5a}
+};
+
+// Keccak backend (KeccakPRG, capacity 254, key || label, 16 bytes) under
+// key 00..0f for labels 0, 1 and 1000, pinned from the baseline prf
+static const unsigned char keccak_kat_key[SK_SIZE] = {
+	0x00,0x01,0x02,0x03,0x04,0x05,0x06,0x07,0x08,0x09,0x0a,0x0b,0x0c,0x0d,0x0e,0x0f
+};
+static const int keccak_kat_label[3] = { 0, 1, 1000 };
+static const unsigned char keccak_kat_out[3][NONCE_SIZE] = {
+	{0x29,0xcc,0xcb,0xa5,0x08,0x3e,0x19,0x63,0x5c,0x27,0xbd,0x6b,0x01,0xe7,0x0d,0x81},
+	{0x6f,0xf6,0x64,0xc7,0x9b,0x12,0x7d,0xfe,0x4b,0x11,0x14,0x92,0xcc,0x09,0xdc,0xfe},
+	{0xb5,0xf6,0x90,0xf1,0x5f,0xcc,0xa5,0x90,0x2b,0x47,0x81,0x58,0x06,0xb7,0x49,0xa6}
+};
+
+static unsigned char batch_in[BATCH_NONCES*LABEL_SIZE], batch_out[BATCH_NONCES*NONCE_SIZE];
 
 int main(int argc, char* argv[])
 {
 	long long before, after;
 	FILE *fp;
-	int i;
+	int i, j, b;
 	unsigned char seed[SK_SIZE];
 	unsigned char label[LABEL_SIZE] = { 0 };
 	unsigned char nonces[NONCE_SIZE*TEST_NONCES];
+	unsigned char rseed[RNG_SEED_SIZE] = { 0 };
+	unsigned char out1[64], out2[64];
+	labhe_rng rng1, rng2, rng3;
+	mpz_t n, x[TEST_NONCES], xl;
 
 	fp = fopen("/dev/urandom", "r");
 	if (!fp) { exit(1); }
@@ -34,5 +70,94 @@ int main(int argc, char* argv[])
 	
 	PRINT_ARRAY("nonces: ", nonces,sizeof(nonces));
 
+	// Default (Keccak) backend: known answers, on the single and batch paths
+	if (prf_backend()!=PRF_BACKEND_KECCAK) { printf("Error.\n"); exit(1); }
+	for (i = 0; i < 3; i++) {
+		memset(label,0,sizeof(label));
+		label[0] = (unsigned char)(keccak_kat_label[i] & 0xff);
+		label[1] = (unsigned char)(keccak_kat_label[i] >> 8);
+		prf(nonces,label,keccak_kat_key);
+		if (memcmp(nonces,keccak_kat_out[i],NONCE_SIZE)!=0) { printf("Error.\n"); exit(1); }
+		prf_batch_list(batch_out,keccak_kat_label+i,1,keccak_kat_key);
+		if (memcmp(batch_out,keccak_kat_out[i],NONCE_SIZE)!=0) { printf("Error.\n"); exit(1); }
+	}
+	prf_batch_seq(batch_out,0,2,keccak_kat_key);
+	if (memcmp(batch_out,keccak_kat_out,2*NONCE_SIZE)!=0) { printf("Error.\n"); exit(1); }
+
+	// AES backend: known answers, on both the single and batch paths
+	for (i = 0; i < 2; i++) {
+		prf_aes(nonces,aes_kat_in[i],aes_kat_key[i]);
+		if (memcmp(nonces,aes_kat_out[i],NONCE_SIZE)!=0) { printf("Error.\n"); exit(1); }
+		for (j = 0; j < 9; j++) { memcpy(batch_in+j*LABEL_SIZE,aes_kat_in[i],LABEL_SIZE); }
+		prf_aes_batch(batch_out,batch_in,9,aes_kat_key[i]);
+		for (j = 0; j < 9; j++) {
+			if (memcmp(batch_out+j*NONCE_SIZE,aes_kat_out[i],NONCE_SIZE)!=0) { printf("Error.\n"); exit(1); }
+		}
+	}
+
+	// Batch and sequential-label entry points agree with prf for both backends
+	for (b = PRF_BACKEND_KECCAK; b <= PRF_BACKEND_AES; b++) {
+		if (prf_select(b)!=0 || prf_backend()!=b) { printf("Error.\n"); exit(1); }
+		memset(batch_in,0,sizeof(batch_in));
+		for (i = 0; i < BATCH_NONCES; i++) { *(int *)(batch_in+i*LABEL_SIZE) = 1000+i; }
+
+		before=cpucycles();
+		prf_batch_seq(batch_out,1000,BATCH_NONCES,seed);
+		after=cpucycles();
+
+		printf("%s%s ",b==PRF_BACKEND_AES?"AES":"Keccak",b==PRF_BACKEND_AES&&prf_aes_hw()?"-NI":"");
+		PRINT_TIME("PRF batch",after,before);
+
+		for (i = 0; i < BATCH_NONCES; i+=97) {
+			prf(nonces,batch_in+i*LABEL_SIZE,seed);
+			if (memcmp(nonces,batch_out+i*NONCE_SIZE,NONCE_SIZE)!=0) { printf("Error.\n"); exit(1); }
+		}
+		prf_batch(batch_out,batch_in,TEST_NONCES,seed);
+		prf_batch_seq(batch_out+TEST_NONCES*NONCE_SIZE,1000,TEST_NONCES,seed);
+		if (memcmp(batch_out,batch_out+TEST_NONCES*NONCE_SIZE,TEST_NONCES*NONCE_SIZE)!=0) { printf("Error.\n"); exit(1); }
+	}
+	if (prf_select(7)==0) { printf("Error.\n"); exit(1); }
+	prf_select(PRF_BACKEND_KECCAK);
+
+	// Counter-mode Keccak randomness: deterministic per (seed, stream, counter)
+	rng_init_seed(&rng1,rseed);
+	rng_init_seed(&rng2,rseed);
+	rng_fork(&rng3,&rng1,1);
+
+	rng_bytes(&rng1,out1,sizeof(out1));
+	rng_bytes(&rng2,out2,sizeof(out2));
+	if (memcmp(out1,out2,sizeof(out1))!=0) { printf("Error.\n"); exit(1); }
+	rng_bytes(&rng1,out2,sizeof(out2));
+	if (memcmp(out1,out2,sizeof(out1))==0) { printf("Error.\n"); exit(1); }
+	rng_bytes(&rng3,out2,sizeof(out2));
+	if (memcmp(out1,out2,sizeof(out1))==0) { printf("Error.\n"); exit(1); }
+
+	mpz_init_set_str(n,"C7F1D3A94B2E6F0815A7C3E9D2B4F6081A3C5E7092B4D6F8",16);
+	mpz_init(xl);
+	for (i = 0; i < TEST_NONCES; i++) { mpz_init(x[i]); }
+
+	if (rng_init(&rng1)!=0) { exit(1); }
+
+	before=cpucycles();
+	rng_urandomm_batch(x,TEST_NONCES,&rng1,n);
+	after=cpucycles();
+
+	PRINT_TIME("RNG batch",after,before);
+
+	for (i = 0; i < TEST_NONCES; i++) {
+		if (mpz_sgn(x[i])<0 || mpz_cmp(x[i],n)>=0) { printf("Error.\n"); exit(1); }
+		if (i > 0 && mpz_cmp(x[i],x[i-1])==0) { printf("Error.\n"); exit(1); }
+	}
+
+	rng_urandomm_label(x[0],&rng1,7,n);
+	rng_urandomm_label(xl,&rng1,7,n);
+	rng_urandomm_label(x[1],&rng1,8,n);
+	if (mpz_cmp(x[0],xl)!=0 || mpz_cmp(x[0],x[1])==0) { printf("Error.\n"); exit(1); }
+
+	for (i = 0; i < TEST_NONCES; i++) { mpz_clear(x[i]); }
+	mpz_clears(n,xl,NULL);
+
+	printf("OK!\n");
+
 	exit(0);
 }
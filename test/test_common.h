@@ -0,0 +1,36 @@
+#ifndef TEST_COMMON_HEADER
+#define TEST_COMMON_HEADER
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <gmp.h>
+
+#include "labhe.h"
+#include "labhe_gen.h"
+
+#define TEST_L 2048
+#define TEST_K 128
+
+static void check(const int ok)
+{
+	if (!ok) {
+		printf("Error.\n");
+		exit(1);
+	}
+}
+
+/*
+ * Test fixture: LabHE parameters for l = TEST_L, k = TEST_K and the keys
+ * of one or two encryptors (pk2 and sk2 are NULL for one)
+ */
+static inline void test_labhe_setup(mpz_t p, mpz_t n, mpz_t y, mpz_t D,
+	                                mpz_t _2k1, mpz_t _2k, mpz_t pm12k, mpz_t enc1,
+	                                mpz_t pk1, unsigned char *sk1, mpz_t pk2, unsigned char *sk2,
+	                                gmp_randstate_t state)
+{
+	if (labhe_setup(p,n,y,D,TEST_L,TEST_K,_2k1,_2k,pm12k,enc1,state)!=0) { exit(1); }
+	if (labhe_gen(pk1,sk1,n,y,TEST_K,_2k,state)!=0) { exit(1); }
+	if (pk2 && labhe_gen(pk2,sk2,n,y,TEST_K,_2k,state)!=0) { exit(1); }
+}
+
+#endif
@@ -0,0 +1,179 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <gmp.h>
+
+#include "bench.h"
+#include "bhjl.h"
+#include "labhe.h"
+#include "labhe_gen.h"
+#include "keystore.h"
+#include "tune.h"
+
+#define COUNT 16
+
+static void check(const int ok)
+{
+	if (!ok) {
+		printf("Error.\n");
+		exit(1);
+	}
+}
+
+static int same(const labhe_tune *a, const labhe_tune *b)
+{
+	int i;
+
+	if (a->k != b->k || a->nlimbs != b->nlimbs || a->plimbs != b->plimbs ||
+	    a->dec_digit != b->dec_digit || a->workers != b->workers) { return 0; }
+	for (i=0;i<TUNE_MULTI_CLASSES;i++) {
+		if (a->multi_window[i] != b->multi_window[i]) { return 0; }
+	}
+	for (i=1;i<=TUNE_MAX_WINDOW;i++) {
+		if (a->table_build[i] != b->table_build[i] || a->table_use[i] != b->table_use[i]) { return 0; }
+	}
+	for (i=0;i<TUNE_MONT_OPS;i++) {
+		if (a->mont[i] != b->mont[i]) { return 0; }
+	}
+	return 1;
+}
+
+int main(int argc, char* argv[])
+{
+	mpz_t p, n, y, D, seed, _2k, _2k1, pm12k, enc1, m, mp, c, Dpow[128];
+	mpz_t bm1[COUNT], c1[COUNT], bm2[COUNT], c2[COUNT], cres[COUNT], ms1[COUNT], ms2[COUNT];
+	long long before, after;
+	labhe_tune t, t2, base;
+	char pub[64], path[64];
+	keystore_pub kp;
+	int l, k, i, w, j;
+	FILE *fp;
+	unsigned char rand_buff[16];
+
+	mpz_inits(p, n, y, D, seed, _2k, _2k1, pm12k, enc1, m, mp, c, NULL);
+	for (i=0;i<COUNT;i++) { mpz_inits(bm1[i],c1[i],bm2[i],c2[i],cres[i],ms1[i],ms2[i],NULL); }
+
+	fp = fopen("/dev/urandom", "r");
+	if (!fp) { exit(1); }
+	if (fread(rand_buff, sizeof(rand_buff), 1, fp) != 1)  { exit(1); }
+	if (fclose(fp)) { exit(1); }
+
+	mpz_import(seed, sizeof(rand_buff), 1, sizeof(rand_buff[0]), 0, 0, rand_buff);
+
+	gmp_randstate_t gmpRandState;
+	gmp_randinit_default(gmpRandState);
+	gmp_randseed(gmpRandState, seed);
+
+	l = 2048;
+	k = 128;
+
+	if (labhe_setup(p,n,y,D,l,k,_2k1,_2k,pm12k,enc1,gmpRandState)!=0) { exit(1); }
+	for (j=0;j<k;j++) {
+		mpz_init(Dpow[j]);
+		mpz_powm_ui(Dpow[j],j ? Dpow[j-1] : D,j ? 2 : 1,p);
+	}
+
+	// Profile files live next to the key-store files
+	check(tune_path(path,sizeof(path),"/a/keys.pub")==0 && strcmp(path,"/a/keys.tune")==0);
+	check(tune_path(path,sizeof(path),"/a/keys.sec")==0 && strcmp(path,"/a/keys.tune")==0);
+	check(tune_path(path,sizeof(path),"/a/keys")==0 && strcmp(path,"/a/keys.tune")==0);
+	check(tune_path(path,8,"/a/keys.pub")!=0);
+
+	// Decryption with every digit width, on both kernels and both tables
+	memset(&base,0,sizeof(base));
+	base.k = k;
+	base.nlimbs = mpz_size(n);
+	base.plimbs = mpz_size(p);
+	base.workers = 1;
+	for (i=0;i<TUNE_MONT_OPS;i++) { base.mont[i] = 1; }
+	for (w=0;w<=TUNE_MAX_DIGIT;w++) {
+		t = base;
+		t.dec_digit = w ? w : 1;
+		t.mont[TUNE_MONT_DECRYPT] = (w != 0);
+		check(tune_set(&t)==0);
+		for (i=0;i<4;i++) {
+			mpz_urandomb(mp,gmpRandState,k);
+			if (i==0) { mpz_set_ui(mp,0); }
+			if (i==1) { mpz_sub_ui(mp,_2k,1); }
+			bhjl_encrypt(c,mp,n,y,k,_2k,gmpRandState);
+			bhjl_decrypt(m,c,p,D,k,_2k1,pm12k);
+			check(mpz_cmp(m,mp)==0);
+			bhjl_decrypt_tab(m,c,p,(const mpz_t *)Dpow,k,_2k1,pm12k);
+			check(mpz_cmp(m,mp)==0);
+		}
+		before=cpucycles();
+		bhjl_decrypt_tab(m,c,p,(const mpz_t *)Dpow,k,_2k1,pm12k);
+		after=cpucycles();
+		fprintf(stdout,"%s digit %d: decrypt cycles=%lld\n",w ? "Montgomery" : "GMP",t.dec_digit,after-before);
+	}
+	check(tune_set(NULL)==0 && tune_get()==NULL);
+
+	// Calibration, save and reload
+	before=cpucycles();
+	check(tune_calibrate(&t,n,p,k,2)==0);
+	after=cpucycles();
+	fprintf(stdout,"\nCalibration cycles=%lld: digit %d, workers %d, kernels %d%d%d%d, windows",
+	        after-before,t.dec_digit,t.workers,t.mont[0],t.mont[1],t.mont[2],t.mont[3]);
+	for (i=0;i<TUNE_MULTI_CLASSES;i++) { fprintf(stdout," %d",t.multi_window[i]); }
+	fprintf(stdout,"\n");
+	check(tune_get()==NULL);
+	check(t.k==k && t.nlimbs==(int)mpz_size(n) && t.plimbs==(int)mpz_size(p));
+	check(t.dec_digit>=1 && t.dec_digit<=TUNE_MAX_DIGIT && t.workers>=1 && t.workers<=2);
+	check(t.multi_window[0]>0 && t.table_use[1]>0 && t.table_build[TUNE_MAX_WINDOW]>0);
+
+	snprintf(pub,sizeof(pub),"/tmp/labhe-tune-test-%d.pub",(int)getpid());
+	check(tune_path(path,sizeof(path),pub)==0);
+	check(tune_save(path,&t)==0);
+	check(tune_load(&t2,path)==0 && same(&t,&t2));
+
+	// Loading the key store installs the profile
+	check(keystore_save_public(pub,n,y,k,_2k,enc1,4)==0);
+	check(keystore_load_public(&kp,pub)==0);
+	check(tune_get()!=NULL && same(tune_get(),&t));
+	keystore_close_public(&kp);
+
+	// Batches under the profile and with every kernel choice flipped
+	for (i=0;i<COUNT;i++) {
+		mpz_urandomb(ms1[i],gmpRandState,k);
+		mpz_urandomb(ms2[i],gmpRandState,k);
+		mpz_urandomb(bm1[i],gmpRandState,k);
+		mpz_urandomb(bm2[i],gmpRandState,k);
+		mpz_sub(mp,ms1[i],bm1[i]); mpz_mod(mp,mp,_2k);
+		bhjl_encrypt(c1[i],mp,n,y,k,_2k,gmpRandState);
+		mpz_sub(mp,ms2[i],bm2[i]); mpz_mod(mp,mp,_2k);
+		bhjl_encrypt(c2[i],mp,n,y,k,_2k,gmpRandState);
+	}
+	for (j=0;j<2;j++) {
+		t2 = t;
+		for (i=0;i<TUNE_MONT_OPS && j;i++) { t2.mont[i] = !t.mont[i]; }
+		check(tune_set(&t2)==0);
+		labhe_hommul_lev0_batch(cres,(const mpz_t *)bm1,(const mpz_t *)c1,(const mpz_t *)bm2,(const mpz_t *)c2,COUNT,n,k,enc1);
+		labhe_homadd_lev1_batch(c,(const mpz_t *)cres,COUNT,n);
+		bhjl_decrypt(mp,c,p,D,k,_2k1,pm12k);
+		mpz_neg(mp,mp);
+		for (i=0;i<COUNT;i++) {
+			// level-1 plaintext m1*m2 - b1*b2 with b = m - bm
+			mpz_addmul(mp,ms1[i],ms2[i]);
+			mpz_sub(c,ms1[i],bm1[i]);
+			mpz_sub(m,ms2[i],bm2[i]);
+			mpz_mul(c,c,m);
+			mpz_sub(mp,mp,c);
+		}
+		mpz_mod(mp,mp,_2k);
+		check(mpz_sgn(mp)==0);
+	}
+	tune_set(NULL);
+
+	unlink(pub);
+	unlink(path);
+
+	printf("OK!\n");
+
+	for (j=0;j<k;j++) { mpz_clear(Dpow[j]); }
+	for (i=0;i<COUNT;i++) { mpz_clears(bm1[i],c1[i],bm2[i],c2[i],cres[i],ms1[i],ms2[i],NULL); }
+	mpz_clears(p, n, y, D, seed, _2k, _2k1, pm12k, enc1, m, mp, c, NULL);
+	gmp_randclear(gmpRandState);
+
+	return 0;
+}